@@ -0,0 +1,31 @@
+#include "boot_times.h"
+
+#include <string.h>
+
+boot_times_t boot_times = {
+  BOOT_TIME_PENDING, BOOT_TIME_PENDING, BOOT_TIME_PENDING, BOOT_TIME_PENDING, BOOT_TIME_PENDING
+};
+
+uint32_t boot_time_now(void) {
+#if defined(PROTOCOL_CHIBIOS)
+  return TIME_I2MS(chVTGetSystemTimeX());
+#else
+  return timer_read32();
+#endif
+}
+
+void boot_time_record(uint32_t *step) {
+  if (*step == BOOT_TIME_PENDING) {
+    *step = boot_time_now();
+  }
+}
+
+void notify_usb_device_state_change_user(struct usb_device_state usb_device_state) {
+  if (usb_device_state.configure_state == USB_DEVICE_STATE_CONFIGURED) {
+    boot_time_record(&boot_times.usb_configured);
+  }
+}
+
+void remote_boot_times(remote_message_t *message) {
+  memcpy(&message->boot_times.init_start, &boot_times, sizeof(boot_times));
+}
@@ -0,0 +1,43 @@
+/*
+ * Boot times, shared by the keyboards
+ *
+ * The time of each boot step is kept so the host can ask for them once it is
+ * up (see tools/boot-times.c). Steps that did not happen yet are left as
+ * BOOT_TIME_PENDING, and later occurrences of a step are ignored.
+ *
+ * A keymap using it calls boot_time_record for init_start from
+ * keyboard_pre_init_user, init_end from keyboard_post_init_user, and
+ * first_scan and first_key from the hooks seeing them, and registers
+ * remote_boot_times for REMOTE_BOOT_TIMES. The USB step is recorded
+ * by notify_usb_device_state_change_user, defined here.
+ */
+
+#pragma once
+
+#include "quantum.h"
+#include "remote_hid.h"
+
+#define BOOT_TIME_PENDING UINT32_MAX
+
+typedef struct {
+  uint32_t init_start;     // keyboard_pre_init_user
+  uint32_t init_end;       // keyboard_post_init_user
+  uint32_t usb_configured; // the host configured the device
+  uint32_t first_scan;     // the first matrix scan was processed
+  uint32_t first_key;      // the first key event was processed
+} boot_times_t;
+
+REMOTE_STATIC_ASSERT(sizeof(boot_times_t) == sizeof(remote_boot_times_t) - 1, "BOOT_TIMES replies are laid out like boot_times_t");
+
+extern boot_times_t boot_times;
+
+// Milliseconds since reset. QMK only starts its timer at the end of the USB
+// setup, so use the system time when the platform has one.
+uint32_t boot_time_now(void);
+
+// Record a boot step the first time it happens
+void boot_time_record(uint32_t *step);
+
+// Reply to a BOOT_TIMES message with the time of each boot step (see
+// remote_boot_times_t, laid out like boot_times_t)
+void remote_boot_times(remote_message_t *message);
@@ -0,0 +1,141 @@
+#include "combos.h"
+
+_Static_assert(COMBO_TERM < TAPPING_TERM, "chords must be decided within the tapping term");
+
+// Room for the key events of the longest combo
+#define COMBO_BUFFER_SIZE 4
+
+keyrecord_t combo_buffer[COMBO_BUFFER_SIZE];
+uint8_t combo_buffered = 0;
+combo_mask_t combo_pressed = 0;  // The keys held back
+combo_mask_t combo_possible = 0; // The keys that can still join them
+combo_mask_t combo_held = 0;     // The keys of the last combo still down
+uint16_t combo_held_action = KC_NO;
+
+// The action of a mask of keys, KC_NO if they are not a combo
+static uint16_t combo_action(combo_mask_t mask) {
+  for (const combo_entry_t *combo = combo_list;; combo++) {
+    combo_mask_t combo_mask = pgm_read_word(&combo->mask);
+    if (combo_mask == 0) {
+      return KC_NO;
+    }
+    if (combo_mask == mask) {
+      return pgm_read_word(&combo->action);
+    }
+  }
+}
+
+// Replay the key events held back, in order
+static void combo_flush(void) {
+  for (uint8_t index = 0; index < combo_buffered; index++) {
+#ifndef NO_ACTION_TAPPING
+    action_tapping_process(combo_buffer[index]);
+#else
+    process_record(&combo_buffer[index]);
+#endif
+  }
+  combo_buffered = 0;
+  combo_pressed = combo_possible = 0;
+}
+
+static void combo_send(uint16_t action, bool pressed) {
+  if (IS_QK_MOMENTARY(action)) {
+    if (pressed) {
+      layer_on(QK_MOMENTARY_GET_LAYER(action));
+    } else {
+      layer_off(QK_MOMENTARY_GET_LAYER(action));
+    }
+  } else if (pressed) {
+    register_code16(action);
+  } else {
+    unregister_code16(action);
+  }
+}
+
+// Release the last combo, if it is still down
+static void combo_release(void) {
+  if (combo_held_action != KC_NO) {
+    combo_send(combo_held_action, false);
+    combo_held_action = KC_NO;
+  }
+}
+
+// Press the combo of the keys held back, which stays down until the first of
+// them goes up
+static void combo_fire(uint16_t action) {
+  combo_release();
+  combo_send(action, true);
+  combo_held = combo_pressed;
+  combo_held_action = action;
+  combo_buffered = 0;
+  combo_pressed = combo_possible = 0;
+}
+
+bool combo_process(uint16_t keycode, keyrecord_t *record, bool chords) {
+  int8_t key = combo_key(keycode);
+  combo_mask_t bit = key < 0 ? 0 : COMBO_BIT(key);
+
+  if (!record->event.pressed) {
+    // The first key of a combo to go up releases it, the rest are swallowed
+    if (combo_held & bit) {
+      combo_held &= ~bit;
+      combo_release();
+      return false;
+    }
+    // A key held back going up ends the chord, tapping its combo if any
+    if (combo_pressed & bit) {
+      uint16_t action = combo_action(combo_pressed);
+      if (action != KC_NO) {
+        combo_fire(action);
+        combo_held &= ~bit;
+        combo_release();
+        return false;
+      }
+    }
+    // Any other key going up ends it too, and must reach the host after the
+    // keys held back
+    combo_flush();
+    return true;
+  }
+
+  // Other keys go through right away, after those held back
+  combo_mask_t partners = key < 0 ? 0 : pgm_read_word(&combo_partners[key]);
+#ifdef AUDIO_ENABLE
+  // Chords would get in the way of playing notes
+  if (is_music_on()) {
+    partners = 0;
+  }
+#endif
+  if (partners == 0 || !chords) {
+    combo_flush();
+    return true;
+  }
+
+  // Start over when this key can't join the chord
+  combo_mask_t possible = combo_possible & partners;
+  bool joins = !(combo_pressed & bit) && ((combo_pressed | bit) & ~possible) == 0;
+  if (combo_buffered > 0 && (!joins || combo_buffered == COMBO_BUFFER_SIZE)) {
+    combo_flush();
+  }
+  combo_possible = combo_buffered > 0 ? possible : partners;
+  combo_pressed |= bit;
+  combo_buffer[combo_buffered++] = *record;
+
+  // Fire right away when no bigger combo can come
+  uint16_t action = combo_action(combo_pressed);
+  if (action != KC_NO && combo_possible == combo_pressed) {
+    combo_fire(action);
+  }
+  return false;
+}
+
+void combo_task(void) {
+  if (combo_buffered > 0 && timer_elapsed(combo_buffer[0].event.time) > COMBO_TERM) {
+    uint16_t action = combo_action(combo_pressed);
+    if (action != KC_NO) {
+      combo_fire(action);
+    } else {
+      combo_flush();
+    }
+  }
+}
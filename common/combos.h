@@ -0,0 +1,71 @@
+/*
+ * Combos, shared by the keyboards
+ *
+ * Chords are matched here instead of by QMK's combos, which go through every
+ * combo on every key event. Each key that takes part in a combo gets a bit, so
+ * a combo is just the mask of its keys, and the compiler turns the lists of
+ * the keymap into a list of (mask, action) pairs and into the mask of partners
+ * of every key, both in flash. A key that is not chorded costs a switch, and a
+ * chorded one a lookup of its partners, plus a pass over the combos once the
+ * chord could fire. Nothing grows with the number of keys, which keeps it
+ * small on the ErgoDox.
+ *
+ * Chorded keys are held back until the chord can't grow into a combo anymore,
+ * another key comes in, they go up or COMBO_TERM runs out, and are then
+ * replayed with their original times. The tap-hold logic counts its tapping
+ * term from those times, so waiting for a chord eats into the tapping term of
+ * the home row mods and thumb keys instead of adding to it.
+ *
+ * A keymap using them lists its keys and combos as X macros, builds the tables
+ * below out of them with COMBO_TABLES(), calls combo_process from
+ * pre_process_record_user and combo_task from housekeeping_task_user.
+ */
+
+#pragma once
+
+#include "quantum.h"
+
+typedef uint16_t combo_mask_t;
+#define COMBO_BIT(key) ((combo_mask_t)1 << (key))
+
+typedef struct {
+  combo_mask_t mask; // 0 ends the list
+  uint16_t action;
+} combo_entry_t;
+
+// Given COMBO_KEYS(X), listing the keys that can be chorded as X(name,
+// keycode), and COMBOS(X, arg), listing the combos as X(arg, mask, keycode),
+// COMBO_TABLES() defines the keys as enum combo_keys and the tables below
+#define COMBO_KEY_ENUM(name, keycode) name,
+#define COMBO_ENTRY(arg, mask, keycode) { mask, keycode },
+#define COMBO_PARTNER(key, mask, keycode) | ((mask) & COMBO_BIT(key) ? (mask) : 0)
+#define COMBO_KEY_PARTNERS(name, keycode) [name] = 0 COMBOS(COMBO_PARTNER, name),
+#define COMBO_KEY_CASE(name, keycode) case keycode: return name;
+
+#define COMBO_TABLES() \
+  enum combo_keys { COMBO_KEYS(COMBO_KEY_ENUM) COMBO_KEY_COUNT }; \
+  _Static_assert(COMBO_KEY_COUNT <= sizeof(combo_mask_t) * 8, "too many combo keys"); \
+  const combo_entry_t PROGMEM combo_list[] = { COMBOS(COMBO_ENTRY, 0) { 0, KC_NO } }; \
+  const combo_mask_t PROGMEM combo_partners[COMBO_KEY_COUNT] = { COMBO_KEYS(COMBO_KEY_PARTNERS) }; \
+  int8_t combo_key(uint16_t keycode) { \
+    switch (keycode) { \
+      COMBO_KEYS(COMBO_KEY_CASE) \
+    } \
+    return -1; \
+  }
+
+// The tables of the keymap:
+// * the combos, ended by a mask of 0
+// * the keys that share a combo with every key, itself included
+// * the key of a keycode, -1 if it is not chorded
+extern const combo_entry_t PROGMEM combo_list[];
+extern const combo_mask_t PROGMEM combo_partners[];
+int8_t combo_key(uint16_t keycode);
+
+// Hold back the chorded keys. Returns false if the event was held back or
+// swallowed. Presses go through right away when chords is false, for modes
+// they would get in the way of.
+bool combo_process(uint16_t keycode, keyrecord_t *record, bool chords);
+
+// Stop waiting for a chord after COMBO_TERM
+void combo_task(void);
@@ -0,0 +1,63 @@
+#include "idle.h"
+
+#if defined(__AVR__)
+#  include <avr/sleep.h>
+#endif
+
+bool idle_mode = false;
+uint32_t idle_activity = 0;
+
+static bool idle_keys_down(void) {
+  for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+    if (matrix_get_row(row) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Wait for the next scan, letting the CPU sleep
+static void idle_wait(void) {
+#if defined(__AVR__)
+  uint16_t start = timer_read();
+  while (timer_elapsed(start) < IDLE_SCAN_INTERVAL) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sleep_cpu();
+    sleep_disable();
+  }
+#else
+  wait_ms(IDLE_SCAN_INTERVAL);
+#endif
+}
+
+void idle_touch(void) {
+  idle_activity = timer_read32();
+  if (idle_mode) {
+    idle_mode = false;
+    idle_leds_on();
+  }
+}
+
+void idle_task(bool allowed) {
+  if (!allowed) {
+    idle_touch();
+    return;
+  }
+  if (!idle_mode) {
+    if (timer_elapsed32(idle_activity) <= IDLE_TIMEOUT) {
+      return;
+    }
+    // A key held that long sends no events, but is not idle either
+    if (idle_keys_down()) {
+      idle_activity = timer_read32();
+      return;
+    }
+    idle_mode = true;
+#ifdef AUDIO_ENABLE
+    stop_all_notes();
+#endif
+    idle_leds_off();
+  }
+  idle_wait();
+}
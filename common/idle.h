@@ -0,0 +1,47 @@
+/*
+ * Idle mode, shared by the keyboards
+ *
+ * After IDLE_TIMEOUT ms without key events or raw HID messages, and with no
+ * key held down, the keyboard goes idle: the notes still playing are stopped,
+ * the keymap turns its LEDs off, and the main loop sleeps IDLE_SCAN_INTERVAL
+ * ms between matrix scans instead of scanning as fast as it can. On ChibiOS
+ * the main thread sleeps, leaving the core to the interrupt handlers. On AVR
+ * the CPU sleeps until its millisecond timer ticks. USB keeps being served
+ * either way.
+ *
+ * The key that wakes the keyboard goes through like any other once the next
+ * scan sees it, so it is at most IDLE_SCAN_INTERVAL late, and the keymap puts
+ * its LEDs back.
+ *
+ * A keymap using it defines idle_leds_off and idle_leds_on, calls idle_touch
+ * from process_record_user and raw_hid_receive, and idle_task at the end of
+ * housekeeping_task_user.
+ */
+
+#pragma once
+
+#include "quantum.h"
+
+// How long the keyboard must be left alone before going idle
+#ifndef IDLE_TIMEOUT
+#  define IDLE_TIMEOUT 300000
+#endif
+
+// Milliseconds between matrix scans while idle
+#ifndef IDLE_SCAN_INTERVAL
+#  define IDLE_SCAN_INTERVAL 10
+#endif
+
+extern bool idle_mode;
+
+// Turn the LEDs off when going idle, and back on when waking up. Defined by
+// the keymap, which can leave alone LEDs driven by the host.
+void idle_leds_off(void);
+void idle_leds_on(void);
+
+// Note some activity, waking the keyboard up if it was idle
+void idle_touch(void);
+
+// Go idle after IDLE_TIMEOUT, then throttle the scan rate. Stays awake while
+// allowed is false, for modes that need every scan.
+void idle_task(bool allowed);
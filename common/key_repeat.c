@@ -0,0 +1,112 @@
+#include "key_repeat.h"
+
+const key_repeat_curve_t key_repeat_curves[] = {
+  [KEY_REPEAT_CURVE_ARROWS]  = { 250, { {0, 12}, {500, 20},  {1500, 50}, {3000, 100} } },
+  [KEY_REPEAT_CURVE_PRECISE] = { 400, { {0, 4},  {1000, 8},  {2000, 20}, {4000, 40} } },
+  [KEY_REPEAT_CURVE_PAGES]   = { 400, { {0, 3},  {1000, 5},  {2000, 10}, {4000, 20} } }
+};
+
+// Most taps owed at once, in case the task was not run for a while
+#define KEY_REPEAT_MAX_OWED 2
+
+uint16_t key_repeat_keycode = KC_NO; // The key being repeated, if any
+keypos_t key_repeat_key;             // Its position, which its release comes from
+const key_repeat_curve_t *key_repeat_curve = NULL;
+bool key_repeat_held = false;        // The key is still held
+bool key_repeat_down = false;        // A tap was pressed, and goes up next
+uint32_t key_repeat_timer = 0;       // When the key was pressed
+uint16_t key_repeat_step_timer = 0;  // When the last report was sent
+int32_t key_repeat_owed = 0;         // Taps owed, in 1/1000 taps (rate times ms)
+
+bool key_repeat_process(uint16_t keycode, keyrecord_t *record) {
+  if (key_repeat_held) {
+    // The key being repeated going up stops it, whatever the layers are now
+    if (!record->event.pressed && KEYEQ(record->event.key, key_repeat_key)) {
+      key_repeat_held = false;
+      key_repeat_owed = 0;
+      return false;
+    }
+    // Like the host autorepeat, pressing any other key stops it too
+    if (record->event.pressed) {
+      key_repeat_held = false;
+      key_repeat_owed = 0;
+    }
+  }
+
+  uint8_t group;
+  switch (keycode) {
+    case KC_UP:
+    case KC_DOWN:
+    case KC_LEFT:
+    case KC_RGHT:
+      group = KEY_REPEAT_ARROWS;
+      break;
+    case KC_PGUP:
+    case KC_PGDN:
+    case LCTL(KC_PGUP):
+    case LCTL(KC_PGDN):
+      group = KEY_REPEAT_PAGES;
+      break;
+    default:
+      return true;
+  }
+
+  // The layer the key was pressed on, which QMK keeps for its release
+  uint8_t layer = read_source_layers_cache(record->event.key);
+  uint8_t curve = layer < key_repeat_layer_count ? key_repeat_layers[layer][group] : KEY_REPEAT_CURVE_HOST;
+  if (curve == KEY_REPEAT_CURVE_HOST) {
+    return true;
+  }
+
+  // The press was taken over, and so is the release
+  if (!record->event.pressed) {
+    return false;
+  }
+
+  // The last tap of another key goes up first
+  if (key_repeat_down) {
+    unregister_code16(key_repeat_keycode);
+  }
+  key_repeat_keycode = keycode;
+  key_repeat_key = record->event.key;
+  key_repeat_curve = &key_repeat_curves[curve];
+  key_repeat_held = true;
+  key_repeat_timer = timer_read32();
+  key_repeat_owed = 0;
+  register_code16(keycode);
+  key_repeat_down = true;
+  key_repeat_step_timer = timer_read();
+  return false;
+}
+
+void key_repeat_task(void) {
+  uint16_t elapsed = timer_elapsed(key_repeat_step_timer);
+  if (key_repeat_keycode == KC_NO || elapsed < USB_POLLING_INTERVAL_MS) {
+    return;
+  }
+  key_repeat_step_timer = timer_read();
+
+  if (key_repeat_held) {
+    uint32_t held = timer_elapsed32(key_repeat_timer);
+    const key_repeat_curve_t *curve = key_repeat_curve;
+    if (held >= curve->delay) {
+      // The first repeat comes right at the delay, the next ones at the rate
+      if (held < (uint32_t)curve->delay + elapsed) {
+        key_repeat_owed += 1000;
+      }
+      key_repeat_owed += mouse_curve_speed(curve->rates, held - curve->delay) * elapsed;
+      key_repeat_owed = MIN(key_repeat_owed, KEY_REPEAT_MAX_OWED * 1000);
+    }
+  }
+
+  if (key_repeat_down) {
+    unregister_code16(key_repeat_keycode);
+    key_repeat_down = false;
+  } else if (key_repeat_owed >= 1000) {
+    register_code16(key_repeat_keycode);
+    key_repeat_down = true;
+    key_repeat_owed -= 1000;
+  } else if (!key_repeat_held) {
+    key_repeat_keycode = KC_NO;
+  }
+}
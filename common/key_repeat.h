@@ -0,0 +1,55 @@
+/*
+ * Key repeat, shared by the keyboards
+ *
+ * The navigation keys are repeated here instead of by the host, whose
+ * autorepeat has a single fixed rate for every key. Pressing one taps it right
+ * away, and holding it taps it again at a rate given by an acceleration curve
+ * for the time it has been held: slow at first for single steps, then faster
+ * for long jumps. Every tap is a press and a release in consecutive reports,
+ * one per USB poll, so the host never sees the key held long enough to start
+ * its own autorepeat. The layer a key is pressed on picks its curve, and like
+ * with the host autorepeat, pressing any other key stops the repeat.
+ * tools/key-repeat-sim.c runs the same engine and prints the taps per second.
+ *
+ * A keymap using it defines key_repeat_layers and key_repeat_layer_count,
+ * calls key_repeat_process early in process_record_user, so that it sees the
+ * presses of the other keys, and key_repeat_task from housekeeping_task_user,
+ * and sets USB_POLLING_INTERVAL_MS in its config.h.
+ */
+
+#pragma once
+
+#include "quantum.h"
+#include "mouse_keys.h"
+
+// A repeat curve, as the delay before the first repeat (in ms), and the rate
+// (in taps per second) at given times (in ms) after it
+typedef struct {
+  uint16_t delay;
+  mouse_curve_point_t rates[MOUSE_CURVE_POINTS];
+} key_repeat_curve_t;
+
+typedef enum {
+  KEY_REPEAT_CURVE_HOST, // Left to the host autorepeat
+  KEY_REPEAT_CURVE_ARROWS,
+  KEY_REPEAT_CURVE_PRECISE,
+  KEY_REPEAT_CURVE_PAGES
+} KEY_REPEAT_CURVE;
+
+typedef enum {
+  KEY_REPEAT_ARROWS,
+  KEY_REPEAT_PAGES,
+  KEY_REPEAT_GROUP_COUNT
+} KEY_REPEAT_GROUP;
+
+// The curves of the arrows and of the page keys on each layer, defined by the
+// keymap, the layers left out keeping the host autorepeat
+extern const uint8_t key_repeat_layers[][KEY_REPEAT_GROUP_COUNT];
+extern const uint8_t key_repeat_layer_count;
+
+// Take over the navigation keys on the layers with a repeat curve. Returns
+// false if the key was handled.
+bool key_repeat_process(uint16_t keycode, keyrecord_t *record);
+
+// Send the next report of the taps, at most once per USB poll
+void key_repeat_task(void);
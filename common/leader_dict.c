@@ -0,0 +1,195 @@
+#include "leader_dict.h"
+
+#include <string.h>
+
+#define LEADER_DICT_MAGIC 0x4C
+#define LEADER_DICT_VALUE 0x80
+#define LEADER_DICT_CHILDREN 0x3F
+#define LEADER_DICT_KEYS 5 // Like the leader sequences of QMK
+#define LEADER_DICT_CHUNK 27
+
+typedef struct {
+  uint8_t magic;
+  uint8_t reserved;
+  uint16_t version;
+  uint16_t length;
+  uint16_t crc;
+} leader_dict_header_t;
+
+_Static_assert(sizeof(leader_dict_header_t) + LEADER_DICT_SIZE <= LEADER_DICT_STORE_SIZE, "leader dictionary store too small");
+
+uint8_t leader_dict_buffers[2][LEADER_DICT_SIZE];
+uint8_t leader_dict_current = 0;    // The buffer in use, the other one stages uploads
+leader_dict_header_t leader_dict;   // The dictionary in use, no magic if none
+leader_dict_header_t leader_dict_upload;
+uint16_t leader_dict_received = 0;  // Bytes of the upload received so far
+bool leader_dict_uploading = false;
+bool leader_dict_loaded = false;    // Loaded from EEPROM yet
+
+// The keys of the current leader sequence
+uint8_t leader_dict_keys[LEADER_DICT_KEYS];
+uint8_t leader_dict_key_count = 0;
+
+void leader_dict_start(void) {
+  leader_dict_key_count = 0;
+}
+
+// CRC-16/CCITT-FALSE of some bytes
+static uint16_t leader_dict_crc(const uint8_t *bytes, uint16_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= bytes[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Load the saved dictionary the first time it is needed, so the EEPROM is not
+// read at boot
+static void leader_dict_load(void) {
+  if (leader_dict_loaded) {
+    return;
+  }
+  leader_dict_loaded = true;
+  leader_dict_header_t header;
+  eeconfig_read_user_datablock(&header, LEADER_DICT_STORE, sizeof(header));
+  if (header.magic != LEADER_DICT_MAGIC || header.length > LEADER_DICT_SIZE) {
+    return;
+  }
+  uint8_t *dict = leader_dict_buffers[leader_dict_current];
+  eeconfig_read_user_datablock(dict, LEADER_DICT_STORE + sizeof(header), header.length);
+  if (leader_dict_crc(dict, header.length) == header.crc) {
+    leader_dict = header;
+  }
+}
+
+const char *leader_dict_find(void) {
+  leader_dict_load();
+  if (leader_dict.magic != LEADER_DICT_MAGIC) {
+    return NULL;
+  }
+  const uint8_t *dict = leader_dict_buffers[leader_dict_current];
+  uint16_t length = leader_dict.length;
+  uint16_t node = 0;
+  uint16_t value = 0;
+  for (uint8_t index = 0; index <= leader_dict_key_count; index++) {
+    if (node >= length) {
+      return NULL;
+    }
+    uint8_t count = dict[node] & LEADER_DICT_CHILDREN;
+    value = node + 1 + 3 * count;
+    if (value > length) {
+      return NULL;
+    }
+    if (index == leader_dict_key_count) {
+      break;
+    }
+    uint16_t next = 0;
+    for (uint8_t child = 0; child < count; child++) {
+      const uint8_t *entry = &dict[node + 1 + 3 * child];
+      if (entry[0] == leader_dict_keys[index]) {
+        next = entry[1] | entry[2] << 8;
+        break;
+      }
+    }
+    if (next <= node) {
+      return NULL;
+    }
+    node = next;
+  }
+  if (!(dict[node] & LEADER_DICT_VALUE) || !memchr(&dict[value], 0, length - value)) {
+    return NULL;
+  }
+  return (const char *)&dict[value];
+}
+
+void leader_dict_record(uint16_t keycode, keyrecord_t *record) {
+  if (!record->event.pressed || !leader_sequence_active() || leader_sequence_timed_out()) {
+    return;
+  }
+#ifndef LEADER_KEY_STRICT_KEY_PROCESSING
+  if (IS_QK_MOD_TAP(keycode)) {
+    keycode = QK_MOD_TAP_GET_TAP_KEYCODE(keycode);
+  } else if (IS_QK_LAYER_TAP(keycode)) {
+    keycode = QK_LAYER_TAP_GET_TAP_KEYCODE(keycode);
+  }
+#endif
+  if (leader_dict_key_count < LEADER_DICT_KEYS) {
+    // Only basic keycodes can be uploaded
+    leader_dict_keys[leader_dict_key_count++] = keycode <= 0xFF ? keycode : KC_NO;
+  }
+}
+
+// Take a complete upload into use and save it
+static uint8_t leader_dict_commit(uint16_t crc) {
+  if (!leader_dict_uploading || leader_dict_received != leader_dict_upload.length) {
+    return LEADER_DICT_INCOMPLETE;
+  }
+  leader_dict_uploading = false;
+  uint8_t staging = !leader_dict_current;
+  if (leader_dict_crc(leader_dict_buffers[staging], leader_dict_upload.length) != crc) {
+    return LEADER_DICT_BAD_CRC;
+  }
+  leader_dict_upload.magic = LEADER_DICT_MAGIC;
+  leader_dict_upload.crc = crc;
+  leader_dict_current = staging;
+  leader_dict = leader_dict_upload;
+  leader_dict_loaded = true;
+  eeconfig_update_user_datablock(leader_dict_buffers[staging], LEADER_DICT_STORE + sizeof(leader_dict), leader_dict.length);
+  eeconfig_update_user_datablock(&leader_dict, LEADER_DICT_STORE, sizeof(leader_dict));
+  return LEADER_DICT_OK;
+}
+
+// Forget the uploaded dictionary
+static void leader_dict_clear(void) {
+  memset(&leader_dict, 0, sizeof(leader_dict));
+  leader_dict_loaded = true;
+  leader_dict_uploading = false;
+  eeconfig_update_user_datablock(&leader_dict, LEADER_DICT_STORE, sizeof(leader_dict));
+}
+
+void leader_dict_message(remote_message_t *message) {
+  remote_leader_dict_t *request = &message->leader_dict;
+  uint8_t status = LEADER_DICT_OK;
+  switch (request->operation) {
+    case LEADER_DICT_BEGIN:
+      if (request->begin.length > LEADER_DICT_SIZE) {
+        status = LEADER_DICT_TOO_LARGE;
+        break;
+      }
+      leader_dict_upload = (leader_dict_header_t){ .version = request->begin.version, .length = request->begin.length };
+      leader_dict_received = 0;
+      leader_dict_uploading = true;
+      break;
+    case LEADER_DICT_DATA: {
+      uint16_t offset = request->chunk.offset;
+      uint8_t count = request->chunk.count;
+      if (!leader_dict_uploading || offset != leader_dict_received || count > LEADER_DICT_CHUNK
+          || offset + count > leader_dict_upload.length) {
+        status = LEADER_DICT_OUT_OF_ORDER;
+        break;
+      }
+      memcpy(&leader_dict_buffers[!leader_dict_current][offset], request->chunk.bytes, count);
+      leader_dict_received += count;
+      break;
+    }
+    case LEADER_DICT_COMMIT:
+      status = leader_dict_commit(request->commit.crc);
+      break;
+    case LEADER_DICT_INFO:
+      leader_dict_load();
+      request->reply.version = leader_dict.version;
+      request->reply.length = leader_dict.length;
+      request->reply.crc = leader_dict.crc;
+      break;
+    case LEADER_DICT_CLEAR:
+      leader_dict_clear();
+      break;
+    default:
+      status = LEADER_DICT_UNKNOWN;
+      break;
+  }
+  request->reply.status = status;
+}
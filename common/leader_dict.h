@@ -0,0 +1,69 @@
+/*
+ * Leader dictionary, shared by the keyboards
+ *
+ * Besides the sequences compiled in, the host can upload a dictionary of
+ * sequences (see tools/leader-dict.c), packed into a trie of nodes made of:
+ * * a header byte, with the number of children in bits 0-5, and bit 7 set if a
+ *   sequence ends at the node
+ * * the children, as their keycode and the offset of their node (little
+ *   endian), which is always after the node itself
+ * * the string typed by the sequence ending at the node if any, as encoded by
+ *   SEND_STRING, NUL terminated
+ * The root is at offset 0, so finding a sequence reads a node per key.
+ *
+ * Uploads are staged in chunks in a second buffer, which only replaces the
+ * dictionary in use once complete and matching its CRC, so a key typed in the
+ * middle of an upload still finds the previous one. The dictionary is then
+ * saved to the user EEPROM block at LEADER_DICT_STORE, header last. A save
+ * cut short fails the CRC, leaving the compiled in sequences alone.
+ *
+ * A keymap using it sets LEADER_DICT_SIZE, LEADER_DICT_STORE and
+ * LEADER_DICT_STORE_SIZE in its config.h, calls leader_dict_start from
+ * leader_start_user, leader_dict_record from process_record_user and
+ * leader_dict_find when the compiled in sequences do not match, and registers
+ * leader_dict_message for REMOTE_LEADER_DICT.
+ */
+
+#pragma once
+
+#include "quantum.h"
+#include "remote_hid.h"
+
+// Operations of LEADER_DICT messages
+typedef enum {
+  LEADER_DICT_BEGIN = 0,
+  LEADER_DICT_DATA,
+  LEADER_DICT_COMMIT,
+  LEADER_DICT_INFO,
+  LEADER_DICT_CLEAR
+} LEADER_DICT_OPERATION;
+
+// Replies to LEADER_DICT messages
+typedef enum {
+  LEADER_DICT_OK = 0,
+  LEADER_DICT_TOO_LARGE,
+  LEADER_DICT_OUT_OF_ORDER,
+  LEADER_DICT_INCOMPLETE,
+  LEADER_DICT_BAD_CRC,
+  LEADER_DICT_UNKNOWN
+} LEADER_DICT_STATUS;
+
+// Forget the keys of the last leader sequence
+void leader_dict_start(void);
+
+// Follow the keys of the leader sequence the way QMK does
+void leader_dict_record(uint16_t keycode, keyrecord_t *record);
+
+// Find the string of the sequence typed, or NULL if it is not in the
+// dictionary. Offsets are checked, so a bogus dictionary cannot read past it.
+const char *leader_dict_find(void);
+
+// Handle a LEADER_DICT message (see remote_leader_dict_t), replying with the
+// status of the operation:
+// * BEGIN: start uploading a dictionary of the given length and version
+// * DATA: the next chunk, chunks must come in order
+// * COMMIT: check the CRC-16 of the whole dictionary and switch to it
+// * INFO: replied with the version, length and CRC of the dictionary in use,
+//   all zero if there is none
+// * CLEAR
+void leader_dict_message(remote_message_t *message);
@@ -0,0 +1,150 @@
+#include "mouse_keys.h"
+
+const mouse_curve_point_t mouse_curves[][MOUSE_CURVE_POINTS] = {
+  [MOUSE_CURVE_LINEAR]    = { {0, 200}, {400, 700},  {800, 1200},  {1200, 1700} },
+  [MOUSE_CURVE_QUADRATIC] = { {0, 60},  {400, 300},  {800, 900},   {1200, 1800} },
+  [MOUSE_CURVE_PRECISE]   = { {0, 30},  {1000, 120}, {1500, 400},  {2500, 1200} }
+};
+
+const mouse_curve_point_t mouse_wheel_curve[MOUSE_CURVE_POINTS] = {
+  {0, 6}, {500, 12}, {1000, 24}, {2000, 40}
+};
+
+// Below this speed (in units per second) a released axis stops right away
+#define MOUSE_STOP_SPEED 4
+
+// Longest step taken at once, in case the task was not run for a while
+#define MOUSE_MAX_STEP_MS 32
+
+typedef enum {
+  MOUSE_KEY_UP    = 1 << 0,
+  MOUSE_KEY_DOWN  = 1 << 1,
+  MOUSE_KEY_LEFT  = 1 << 2,
+  MOUSE_KEY_RIGHT = 1 << 3,
+  MOUSE_KEY_WHEEL_UP   = 1 << 4,
+  MOUSE_KEY_WHEEL_DOWN = 1 << 5
+} MOUSE_KEY;
+
+#define MOUSE_KEYS_POINTER (MOUSE_KEY_UP | MOUSE_KEY_DOWN | MOUSE_KEY_LEFT | MOUSE_KEY_RIGHT)
+#define MOUSE_KEYS_WHEEL (MOUSE_KEY_WHEEL_UP | MOUSE_KEY_WHEEL_DOWN)
+
+// The state of a single axis: its velocity in 1/256 units per second, and the
+// distance not reported yet in 1/256000 units (velocity times milliseconds)
+typedef struct {
+  int32_t velocity;
+  int32_t remainder;
+} mouse_axis_t;
+
+uint8_t mouse_keys_held = 0;
+uint32_t mouse_pointer_timer = 0;
+uint32_t mouse_wheel_timer = 0;
+uint16_t mouse_step_timer = 0;
+mouse_axis_t mouse_x, mouse_y, mouse_v;
+
+int32_t mouse_curve_speed(const mouse_curve_point_t *curve, uint32_t time) {
+  for (uint8_t i = 1; i < MOUSE_CURVE_POINTS; i++) {
+    if (time < curve[i].time) {
+      const mouse_curve_point_t *a = &curve[i - 1], *b = &curve[i];
+      if (time <= a->time) {
+        return a->speed;
+      }
+      return a->speed + ((int32_t)b->speed - a->speed) * (int32_t)(time - a->time) / (b->time - a->time);
+    }
+  }
+  return curve[MOUSE_CURVE_POINTS - 1].speed;
+}
+
+// Advance an axis by some milliseconds with the velocity easing towards a
+// target, and return the whole units to report (at most limit)
+static int32_t mouse_axis_step(mouse_axis_t *axis, int32_t target, uint16_t elapsed, int32_t limit) {
+  if (elapsed >= MOUSE_KEYS_INERTIA_MS) {
+    axis->velocity = target;
+  } else {
+    axis->velocity += (target - axis->velocity) * elapsed / MOUSE_KEYS_INERTIA_MS;
+  }
+  if (target == 0 && axis->velocity > -MOUSE_STOP_SPEED * 256 && axis->velocity < MOUSE_STOP_SPEED * 256) {
+    axis->velocity = 0;
+    axis->remainder = 0;
+    return 0;
+  }
+  axis->remainder += axis->velocity * elapsed;
+  int32_t units = axis->remainder / 256000;
+  units = units > limit ? limit : units < -limit ? -limit : units;
+  axis->remainder -= units * 256000;
+  return units;
+}
+
+bool mouse_keys_process(uint16_t keycode, keyrecord_t *record) {
+  uint8_t key;
+  switch (keycode) {
+    case MS_UP:   key = MOUSE_KEY_UP;         break;
+    case MS_DOWN: key = MOUSE_KEY_DOWN;       break;
+    case MS_LEFT: key = MOUSE_KEY_LEFT;       break;
+    case MS_RGHT: key = MOUSE_KEY_RIGHT;      break;
+    case MS_WHLU: key = MOUSE_KEY_WHEEL_UP;   break;
+    case MS_WHLD: key = MOUSE_KEY_WHEEL_DOWN; break;
+    default:
+      return true;
+  }
+  if (record->event.pressed) {
+    if ((key & MOUSE_KEYS_POINTER) && !(mouse_keys_held & MOUSE_KEYS_POINTER)) {
+      mouse_pointer_timer = timer_read32();
+    }
+    if ((key & MOUSE_KEYS_WHEEL) && !(mouse_keys_held & MOUSE_KEYS_WHEEL)) {
+      mouse_wheel_timer = timer_read32();
+    }
+    mouse_keys_held |= key;
+  } else {
+    mouse_keys_held &= ~key;
+  }
+  return false;
+}
+
+// Add the movement since the last report
+report_mouse_t pointing_device_task_user(report_mouse_t mouse_report) {
+  uint16_t elapsed = MIN(timer_elapsed(mouse_step_timer), MOUSE_MAX_STEP_MS);
+  mouse_step_timer = timer_read();
+  if (!mouse_keys_held && !mouse_x.velocity && !mouse_y.velocity && !mouse_v.velocity) {
+    return mouse_report;
+  }
+
+  // Pointer
+  int8_t dx = !!(mouse_keys_held & MOUSE_KEY_RIGHT) - !!(mouse_keys_held & MOUSE_KEY_LEFT);
+  int8_t dy = !!(mouse_keys_held & MOUSE_KEY_DOWN) - !!(mouse_keys_held & MOUSE_KEY_UP);
+  int32_t speed = mouse_curve_speed(mouse_curves[MOUSE_KEYS_CURVE], timer_elapsed32(mouse_pointer_timer)) * 256;
+  if (dx && dy) {
+    speed = speed * 181 / 256;
+  }
+  mouse_report.x = mouse_axis_step(&mouse_x, dx * speed, elapsed, 127);
+  mouse_report.y = mouse_axis_step(&mouse_y, dy * speed, elapsed, 127);
+
+  // Wheel, in fractions of a notch as set by the host
+  int8_t dv = !!(mouse_keys_held & MOUSE_KEY_WHEEL_UP) - !!(mouse_keys_held & MOUSE_KEY_WHEEL_DOWN);
+  int32_t wheel_speed = mouse_curve_speed(mouse_wheel_curve, timer_elapsed32(mouse_wheel_timer)) * 256;
+  wheel_speed *= pointing_device_get_hires_scroll_resolution();
+  mouse_report.v = mouse_axis_step(&mouse_v, dv * wheel_speed, elapsed, 127);
+
+  return mouse_report;
+}
+
+// There is no sensor, the keys above are the only source of movement
+bool mouse_keys_driver_init(void) {
+  return true;
+}
+
+report_mouse_t mouse_keys_driver_get_report(report_mouse_t mouse_report) {
+  return mouse_report;
+}
+
+uint16_t mouse_keys_driver_get_cpi(void) {
+  return 0;
+}
+
+void mouse_keys_driver_set_cpi(uint16_t cpi) {}
+
+const pointing_device_driver_t custom_pointing_device_driver = {
+  .init       = mouse_keys_driver_init,
+  .get_report = mouse_keys_driver_get_report,
+  .get_cpi    = mouse_keys_driver_get_cpi,
+  .set_cpi    = mouse_keys_driver_set_cpi
+};
@@ -0,0 +1,42 @@
+/*
+ * Mouse keys, shared by the keyboards
+ *
+ * The mouse movement and wheel keys are handled here instead of by QMK's
+ * mousekey feature, which is left with the buttons. On every pointing device
+ * task (once per USB poll) the velocity eases towards the speed given by an
+ * acceleration curve for the time the keys have been held. The position then
+ * advances in 1/256 steps and only whole units are reported, keeping the rest
+ * for the next report. Diagonals are scaled by 1/sqrt(2), so they are not
+ * faster than straight lines. The wheel reports fractions of a notch when the
+ * host enables high resolution scrolling.
+ *
+ * A keymap using them sets POINTING_DEVICE_DRIVER = custom, calls
+ * mouse_keys_process from process_record_user, and picks the curve
+ * (MOUSE_KEYS_CURVE) and the easing time (MOUSE_KEYS_INERTIA_MS) in its
+ * config.h. This file provides pointing_device_task_user.
+ */
+
+#pragma once
+
+#include "quantum.h"
+
+// An acceleration curve, as the speed (in pixels or notches per second) at
+// given times (in ms) since the keys were pressed, linearly interpolated
+typedef struct {
+  uint16_t time;
+  uint16_t speed;
+} mouse_curve_point_t;
+
+#define MOUSE_CURVE_POINTS 4
+
+typedef enum {
+  MOUSE_CURVE_LINEAR,
+  MOUSE_CURVE_QUADRATIC,
+  MOUSE_CURVE_PRECISE
+} MOUSE_CURVE;
+
+// The speed of a curve a given time after the keys were pressed
+int32_t mouse_curve_speed(const mouse_curve_point_t *curve, uint32_t time);
+
+// Take over the movement and wheel keys. Returns false if the key was handled.
+bool mouse_keys_process(uint16_t keycode, keyrecord_t *record);
@@ -0,0 +1,193 @@
+#include "packed_string.h"
+
+#include <string.h>
+
+uint8_t packed_mods = 0;     // Modifiers of the report being planned
+uint8_t packed_explicit = 0; // Modifiers held down by SS_DOWN
+uint8_t packed_taps[KEYBOARD_REPORT_KEYS];      // Taps of the report being planned
+uint8_t packed_tap_count = 0;
+uint8_t packed_sent[KEYBOARD_REPORT_KEYS];      // Taps of the last report sent
+uint8_t packed_sent_count = 0;
+uint8_t packed_held[KEYBOARD_REPORT_KEYS];      // Keys held down by SS_DOWN
+uint8_t packed_held_count = 0;
+bool packed_pending = false; // Something changed since the last report
+
+static bool packed_contains(const uint8_t *keys, uint8_t count, uint8_t key) {
+  for (uint8_t index = 0; index < count; index++) {
+    if (keys[index] == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Send the planned report. The taps of the last one go up, unless tapped again.
+static void packed_send(void) {
+  for (uint8_t index = 0; index < packed_sent_count; index++) {
+    del_key(packed_sent[index]);
+  }
+  for (uint8_t index = 0; index < packed_held_count; index++) {
+    add_key(packed_held[index]);
+  }
+  for (uint8_t index = 0; index < packed_tap_count; index++) {
+    add_key(packed_taps[index]);
+  }
+  set_weak_mods(packed_mods);
+  send_keyboard_report();
+  memcpy(packed_sent, packed_taps, packed_tap_count);
+  packed_sent_count = packed_tap_count;
+  packed_tap_count = 0;
+  packed_pending = false;
+}
+
+// Send the planned report if there is anything in it
+static void packed_flush(void) {
+  if (packed_pending || packed_tap_count > 0) {
+    packed_send();
+  }
+}
+
+// Tap a key with some modifiers
+static void packed_tap(uint8_t key, uint8_t mods) {
+  // A modifier tapped on its own (like the compose key) gets a report, and
+  // goes up with whatever comes next
+  if (IS_MODIFIER_KEYCODE(key)) {
+    packed_flush();
+    packed_mods = mods | MOD_BIT(key);
+    packed_send();
+    packed_mods = mods;
+    packed_pending = true;
+    return;
+  }
+
+  // System, media and mouse keys go in reports of their own
+  if (key > KC_EXSEL) {
+    packed_flush();
+    tap_code(key);
+    return;
+  }
+
+  bool full = packed_held_count + packed_tap_count >= KEYBOARD_REPORT_KEYS;
+  if (packed_tap_count > 0 && (mods != packed_mods || key <= packed_taps[packed_tap_count - 1] || full)) {
+    packed_send();
+  }
+  // A key still down from the last report has to go up first
+  if (packed_contains(packed_sent, packed_sent_count, key)) {
+    packed_send();
+  }
+  packed_mods = mods;
+  packed_taps[packed_tap_count++] = key;
+}
+
+// Hold a key down until packed_up
+static void packed_down(uint8_t key) {
+  if (IS_MODIFIER_KEYCODE(key)) {
+    packed_explicit |= MOD_BIT(key);
+    return;
+  }
+  packed_flush();
+  if (key > KC_EXSEL) {
+    register_code(key);
+    return;
+  }
+  if (packed_held_count < KEYBOARD_REPORT_KEYS && !packed_contains(packed_held, packed_held_count, key)) {
+    packed_held[packed_held_count++] = key;
+    packed_pending = true;
+    packed_send();
+  }
+}
+
+// Let go of a key held with packed_down. The keys pressed with it must reach
+// the host first.
+static void packed_up(uint8_t key) {
+  if (packed_tap_count > 0) {
+    packed_send();
+  }
+  if (IS_MODIFIER_KEYCODE(key)) {
+    packed_explicit &= ~MOD_BIT(key);
+    packed_mods = packed_explicit;
+    packed_pending = true;
+    return;
+  }
+  if (key > KC_EXSEL) {
+    unregister_code(key);
+    return;
+  }
+  for (uint8_t index = 0; index < packed_held_count; index++) {
+    if (packed_held[index] == key) {
+      del_key(key);
+      packed_held[index] = packed_held[--packed_held_count];
+      packed_pending = true;
+      return;
+    }
+  }
+}
+
+// Read the next byte of a string, from PROGMEM or RAM
+static char packed_read(const char **string, bool progmem) {
+  char c = progmem ? pgm_read_byte(*string) : **string;
+  (*string)++;
+  return c;
+}
+
+// Type a string built with the SEND_STRING macros. Strings uploaded by the host
+// may be cut short anywhere, so a NUL always ends them.
+static void send_string_packed_with(const char *string, bool progmem) {
+  char c;
+  while ((c = packed_read(&string, progmem))) {
+    if (c == SS_TAP_CODE || c == SS_DOWN_CODE || c == SS_UP_CODE) {
+      uint8_t key = packed_read(&string, progmem);
+      if (key == KC_NO) {
+        break;
+      }
+      if (c == SS_TAP_CODE) {
+        packed_tap(key, packed_explicit);
+      } else if (c == SS_DOWN_CODE) {
+        packed_down(key);
+      } else {
+        packed_up(key);
+      }
+    } else if (c == SS_DELAY_CODE) {
+      packed_flush();
+      uint16_t ms = 0;
+      while ((c = packed_read(&string, progmem)) >= '0' && c <= '9') {
+        ms = ms * 10 + c - '0';
+      }
+      wait_ms(ms);
+      if (c != '|') {
+        break;
+      }
+    } else if ((uint8_t)c < 128) {
+      uint8_t mods = packed_explicit;
+      if (PGM_LOADBIT(ascii_to_shift_lut, (uint8_t)c)) {
+        mods |= MOD_BIT(KC_LEFT_SHIFT);
+      }
+      if (PGM_LOADBIT(ascii_to_altgr_lut, (uint8_t)c)) {
+        mods |= MOD_BIT(KC_RIGHT_ALT);
+      }
+      uint8_t key = pgm_read_byte(&ascii_to_keycode_lut[(uint8_t)c]);
+      if (key != KC_NO) {
+        packed_tap(key, mods);
+      }
+    }
+  }
+
+  // Let go of everything, with any change still pending
+  if (packed_tap_count > 0) {
+    packed_send();
+  }
+  for (uint8_t index = 0; index < packed_held_count; index++) {
+    del_key(packed_held[index]);
+  }
+  packed_held_count = 0;
+  packed_explicit = packed_mods = 0;
+  packed_send();
+}
+
+void send_string_packed_P(const char *string) {
+  send_string_packed_with(string, true);
+}
+
+void send_string_packed(const char *string) {
+  send_string_packed_with(string, false);
+}
@@ -0,0 +1,27 @@
+/*
+ * Packed strings, shared by the keyboards
+ *
+ * SEND_STRING sends a report for every key and modifier going down or up.
+ * send_string_packed types the same strings with far fewer reports:
+ * * modifiers stay down for as long as the next characters need them
+ * * a key goes up in the report that presses the next one
+ * * taps go in the same report while their usages are ascending and need the
+ *   same modifiers, as hosts process new keys in usage order with NKRO and in
+ *   slot order otherwise, and a report's modifiers before its keys
+ * A report only waits for another one when a key is typed twice in a row.
+ * tools/send-string-sim.c runs it on the host, and checks that the host sees
+ * the same keys as with SEND_STRING.
+ */
+
+#pragma once
+
+#include "quantum.h"
+
+// Type a string built with the SEND_STRING macros, stored in PROGMEM
+void send_string_packed_P(const char *string);
+
+// Type a string built with the SEND_STRING macros, stored in RAM. Strings
+// uploaded by the host may be cut short anywhere, so a NUL always ends them.
+void send_string_packed(const char *string);
+
+#define SEND_STRING_PACKED(string) send_string_packed_P(PSTR(string))
@@ -0,0 +1,131 @@
+#include "remote_hid.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "progmem.h"
+#include "raw_hid.h"
+
+#define REMOTE_REPLY 0x01   // The message is sent back once handled
+#define REMOTE_TO_HOST 0x02 // Only sent by the keyboard
+
+// What the dispatch checks for each kind, before calling its handler
+typedef struct {
+  uint8_t flags;
+  uint8_t count_offset; // The byte giving the number of payload items, if any
+  uint8_t count_max;    // Items the payload can hold, 0 if not counted
+} remote_layout_t;
+
+#define REMOTE_COUNTED(view, count, items)           \
+  .count_offset = offsetof(view, count),             \
+  .count_max = sizeof(((view *)0)->items) / sizeof(((view *)0)->items[0])
+
+// In flash, not to take RAM on the AVR boards
+static const remote_layout_t PROGMEM remote_layouts[REMOTE_KIND_COUNT] = {
+  [REMOTE_RGB_SET_COLOR] = { REMOTE_COUNTED(remote_rgb_set_color_t, count, cells) },
+  [REMOTE_RGB_LOAD_EFFECT] = { REMOTE_COUNTED(remote_rgb_load_effect_t, count, program) },
+  [REMOTE_RGB_ANIM_GROUP] = { REMOTE_COUNTED(remote_rgb_anim_group_t, count, cells) },
+  [REMOTE_RGB_ANIM_KEYFRAMES] = { REMOTE_COUNTED(remote_rgb_anim_keyframes_t, count, keyframes) },
+  [REMOTE_RGB_SET_LEDS] = { REMOTE_COUNTED(remote_rgb_set_leds_t, count, colors) },
+  [REMOTE_EVENTS_REPORT] = { .flags = REMOTE_TO_HOST },
+  [REMOTE_PING] = { .flags = REMOTE_REPLY },
+  [REMOTE_PROBE_SYNC] = { .flags = REMOTE_REPLY },
+  [REMOTE_PROBE_EVENTS] = { .flags = REMOTE_TO_HOST },
+  [REMOTE_BOOT_TIMES] = { .flags = REMOTE_REPLY },
+  [REMOTE_LEADER_DICT] = { .flags = REMOTE_REPLY },
+  [REMOTE_STACK_USAGE] = { .flags = REMOTE_REPLY },
+  [REMOTE_VERSION] = { .flags = REMOTE_REPLY },
+  [REMOTE_ERROR] = { .flags = REMOTE_TO_HOST },
+};
+
+uint32_t remote_messages_received = 0;
+
+// Set when the last VERSION came from a host with another protocol version
+bool remote_version_mismatch = false;
+
+// The reply queue, as a ring of reports
+remote_message_t remote_queue[REMOTE_QUEUE_SIZE];
+uint8_t remote_queue_first = 0;
+uint8_t remote_queue_count = 0;
+
+remote_message_t *remote_queue_push(uint8_t kind) {
+  if (remote_queue_count == REMOTE_QUEUE_SIZE) {
+    remote_flush();
+  }
+  remote_message_t *message = &remote_queue[(remote_queue_first + remote_queue_count) % REMOTE_QUEUE_SIZE];
+  remote_queue_count++;
+  memset(message, 0, sizeof(*message));
+  message->kind = kind;
+  return message;
+}
+
+void remote_flush(void) {
+  while (remote_queue_count > 0) {
+    raw_hid_send(remote_queue[remote_queue_first].data, REMOTE_REPORT_SIZE);
+    remote_queue_first = (remote_queue_first + 1) % REMOTE_QUEUE_SIZE;
+    remote_queue_count--;
+  }
+}
+
+static void remote_reject(uint8_t kind, uint8_t reason) {
+  remote_message_t *reply = remote_queue_push(REMOTE_ERROR);
+  reply->error.rejected_kind = kind;
+  reply->error.reason = reason;
+  reply->error.version = REMOTE_PROTOCOL_VERSION;
+}
+
+// Reply to a VERSION message, handled the same way by every keyboard
+static void remote_version(remote_message_t *message) {
+  message->version.version = REMOTE_PROTOCOL_VERSION;
+  message->version.kinds = 1UL << REMOTE_VERSION;
+  for (uint8_t kind = 0; kind < REMOTE_KIND_COUNT; kind++) {
+    if (pgm_read_ptr(&remote_handlers[kind])) {
+      message->version.kinds |= 1UL << kind;
+    }
+  }
+  message->version.queue_size = REMOTE_QUEUE_SIZE;
+}
+
+void remote_dispatch(uint8_t *data, uint8_t length) {
+  remote_messages_received++;
+  uint8_t kind = data[0];
+  if (kind >= REMOTE_KIND_COUNT) {
+    return;
+  }
+  remote_handler_t handle = kind == REMOTE_VERSION ? remote_version : (remote_handler_t)pgm_read_ptr(&remote_handlers[kind]);
+  const remote_layout_t *layout = &remote_layouts[kind];
+  uint8_t flags = pgm_read_byte(&layout->flags);
+  if (flags & REMOTE_TO_HOST) {
+    remote_reject(kind, REMOTE_ERROR_TO_HOST);
+    return;
+  }
+  if (!handle) {
+    return; // Not handled by this keyboard, the host can tell from VERSION
+  }
+  if (length < REMOTE_REPORT_SIZE) {
+    remote_reject(kind, REMOTE_ERROR_TOO_SHORT);
+    return;
+  }
+  if (kind == REMOTE_VERSION) {
+    uint8_t version = ((remote_message_t *)data)->version.version;
+    remote_version_mismatch = version != 0 && version != REMOTE_PROTOCOL_VERSION;
+  }
+  if (remote_version_mismatch) {
+    remote_reject(kind, REMOTE_ERROR_VERSION);
+    return;
+  }
+  uint8_t count_max = pgm_read_byte(&layout->count_max);
+  if (count_max && data[pgm_read_byte(&layout->count_offset)] > count_max) {
+    remote_reject(kind, REMOTE_ERROR_TOO_MANY);
+    return;
+  }
+
+  // Replies are handled in the queue, where they are built in place. Their
+  // handlers must not queue anything else.
+  remote_message_t *message = (remote_message_t *)data;
+  if (flags & REMOTE_REPLY) {
+    message = remote_queue_push(kind);
+    memcpy(message->data, data, REMOTE_REPORT_SIZE);
+  }
+  handle(message);
+}
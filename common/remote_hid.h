@@ -0,0 +1,353 @@
+/*
+ * Raw HID messages, shared by the keyboards
+ *
+ * Every message is a 32 byte report, whose first byte is its kind. The
+ * keyboards hand each report they receive to remote_dispatch, which checks it
+ * against the layout of its kind and calls the handler the keymap registered
+ * for that kind, with a typed view of the report (no copy). Replies and the
+ * reports the keyboards push on their own go through a small queue, sent once
+ * per loop by remote_flush.
+ *
+ * The layouts below are the protocol: REMOTE_PROTOCOL_VERSION changes with
+ * them, and the host can ask for it (and for the kinds the keyboard handles)
+ * with a VERSION message. A host giving its own version in that message gets
+ * an ERROR back if it is not the keyboard's, and every message after it is
+ * rejected until a VERSION that matches. Numbers are little endian, like the
+ * MCUs.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REMOTE_REPORT_SIZE 32
+#define REMOTE_PROTOCOL_VERSION 1
+
+// Replies waiting for the next remote_flush
+#ifndef REMOTE_QUEUE_SIZE
+#  define REMOTE_QUEUE_SIZE 4
+#endif
+
+// The kind of each message is given by its first byte. Kinds are never
+// reused, a keyboard ignores the ones it does not handle.
+typedef enum {
+  REMOTE_RGB_START = 0,
+  REMOTE_RGB_STOP,
+  REMOTE_RGB_SET_COLOR,
+  REMOTE_RGB_LOAD_EFFECT,
+  REMOTE_RGB_SELECT_EFFECT,
+  REMOTE_RGB_ANIM_GROUP,
+  REMOTE_RGB_ANIM_KEYFRAMES,
+  REMOTE_RGB_ANIM_PLAY,
+  REMOTE_RGB_ANIM_STOP,
+  REMOTE_EVENTS_SUBSCRIBE,
+  REMOTE_EVENTS_REPORT,
+  REMOTE_RGB_SET_LEDS,
+  REMOTE_PING,
+  REMOTE_PROBE_START,
+  REMOTE_PROBE_STOP,
+  REMOTE_PROBE_SYNC,
+  REMOTE_PROBE_EVENTS,
+  REMOTE_BOOT_TIMES,
+  REMOTE_MIDI_PROBE,
+  REMOTE_LEADER_DICT,
+  REMOTE_STACK_USAGE,
+  REMOTE_VERSION,
+  REMOTE_ERROR,
+  REMOTE_KIND_COUNT
+} REMOTE_MESSAGE_KIND;
+
+// Why a message was rejected, in the ERROR reply
+typedef enum {
+  REMOTE_ERROR_TOO_SHORT = 1, // The report is shorter than REMOTE_REPORT_SIZE
+  REMOTE_ERROR_TOO_MANY,      // Its count is over what its payload can hold
+  REMOTE_ERROR_TO_HOST,       // The kind only goes from the keyboard to the host
+  REMOTE_ERROR_VERSION        // The host speaks another protocol version
+} REMOTE_ERROR_REASON;
+
+// The events pushed to the host in EVENTS_REPORT
+typedef enum {
+  REMOTE_EVENT_LAYER = 0,     // arg1: highest active layer, arg2: low byte of the layer state
+  REMOTE_EVENT_STICKY,        // arg1: sticky layer
+  REMOTE_EVENT_LEADER_START,
+  REMOTE_EVENT_LEADER_END,    // arg1: 1 if the sequence matched, 0 otherwise
+  REMOTE_EVENT_REMOTE_RGB,    // arg1: 1 if remote RGB mode is on, 0 otherwise
+  REMOTE_EVENT_KEY            // arg1: row, arg2: column (bit 7 set when pressed)
+} REMOTE_EVENT_KIND;
+
+/*
+ * Message layouts
+ */
+
+#define REMOTE_PACKED __attribute__((packed))
+
+// The layouts are also used by the host tools, some of them in C++
+#ifdef __cplusplus
+#  define REMOTE_STATIC_ASSERT static_assert
+#else
+#  define REMOTE_STATIC_ASSERT _Static_assert
+#endif
+
+// SET_COLOR and ANIM_GROUP address keys by matrix position
+typedef struct REMOTE_PACKED {
+  uint8_t row;
+  uint8_t col;
+} remote_cell_t;
+
+typedef struct REMOTE_PACKED {
+  uint8_t r, g, b;
+} remote_color_t;
+
+// SET_COLOR: set keys to a color
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  remote_color_t color;
+  uint8_t count;
+  uint8_t unused[3];
+  remote_cell_t cells[12];
+} remote_rgb_set_color_t;
+
+// LOAD_EFFECT: a chunk of an effect program. Chunks come in order, an offset
+// of 0 starting a new program and a chunk shorter than program (empty if need
+// be) ending it.
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t offset;
+  uint8_t count;
+  uint8_t program[29];
+} remote_rgb_load_effect_t;
+
+// SELECT_EFFECT: switch to an effect (RGB_EFFECT_UPLOADED for the uploaded one)
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t index;
+} remote_rgb_select_effect_t;
+
+// ANIM_GROUP: the keys of an animation group, added to it or replacing it
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t group;
+  uint8_t replace;
+  uint8_t unused;
+  uint8_t count;
+  uint8_t unused2[3];
+  remote_cell_t cells[12];
+} remote_rgb_anim_group_t;
+
+typedef struct REMOTE_PACKED {
+  remote_color_t color;
+  uint16_t duration; // In ms, to go from the previous keyframe to this one
+  uint8_t easing;    // REMOTE_RGB_EASING
+} remote_rgb_keyframe_view_t;
+
+// ANIM_KEYFRAMES: keyframes of an animation group, from index first
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t group;
+  uint8_t first;
+  uint8_t count;
+  remote_rgb_keyframe_view_t keyframes[4];
+} remote_rgb_anim_keyframes_t;
+
+// ANIM_PLAY: start the animation, repeating it until stopped if loop is set
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t loop;
+} remote_rgb_anim_play_t;
+
+// SET_LEDS: set LEDs by index, from first
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t first;
+  uint8_t count;
+  remote_color_t colors[9];
+} remote_rgb_set_leds_t;
+
+// EVENTS_SUBSCRIBE: the events pushed to the host (one bit per
+// REMOTE_EVENT_KIND, 0 to unsubscribe)
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t mask;
+} remote_events_subscribe_t;
+
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t arg1;
+  uint8_t arg2;
+} remote_event_view_t;
+
+// EVENTS_REPORT, to the host: bit 7 of count is set if events were dropped
+// since the last report
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t count;
+  remote_event_view_t events[10];
+} remote_events_report_t;
+
+// PING, replied with the device time and the number of messages received so
+// far. Everything else is echoed back (e.g. a sequence number).
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t echo[7];
+  uint32_t time_ms;
+  uint32_t received;
+} remote_ping_t;
+
+// PROBE_SYNC, replied with the device time
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t echo[7];
+  uint32_t time_us;
+} remote_probe_sync_t;
+
+typedef struct REMOTE_PACKED {
+  uint8_t row;
+  uint8_t col;
+  uint8_t pressed;
+  uint32_t time_us;
+} remote_probe_event_t;
+
+// PROBE_EVENTS, to the host: key changes timestamped right after the scan
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t count;
+  remote_probe_event_t events[4];
+} remote_probe_events_t;
+
+// BOOT_TIMES, replied with the time of each boot step in ms since reset
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint32_t init_start;
+  uint32_t init_end;
+  uint32_t usb_configured;
+  uint32_t first_scan;
+  uint32_t first_key;
+} remote_boot_times_t;
+
+// MIDI_PROBE: play a short note on the next flush
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t note;
+} remote_midi_probe_t;
+
+// LEADER_DICT, replied with the status of the operation in place of its
+// first argument
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t operation; // LEADER_DICT_OPERATION
+  union REMOTE_PACKED {
+    struct REMOTE_PACKED {
+      uint16_t length;
+      uint16_t version;
+    } begin;
+    struct REMOTE_PACKED {
+      uint16_t offset;
+      uint8_t count;
+      uint8_t bytes[27];
+    } chunk;
+    struct REMOTE_PACKED {
+      uint16_t crc; // CRC-16 of the whole dictionary
+    } commit;
+    struct REMOTE_PACKED {
+      uint8_t status;
+      uint16_t version; // INFO only, all zero if there is no dictionary
+      uint16_t length;
+      uint16_t crc;
+    } reply;
+  };
+} remote_leader_dict_t;
+
+// STACK_USAGE, replied with the deepest use of each stack in bytes. A
+// start_over of 1 paints the stacks again after replying.
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t start_over;
+  uint16_t process_size;
+  uint16_t process_used;
+  uint16_t main_size;
+  uint16_t main_used;
+  uint32_t free_ram;
+  uint8_t deepest;
+  uint16_t context_peaks[4];
+} remote_stack_usage_t;
+
+// VERSION, sent with the protocol version of the host (0 if it does not
+// check), replied with the one of the keyboard and the kinds it handles (one
+// bit per REMOTE_MESSAGE_KIND)
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t version;
+  uint32_t kinds;
+  uint8_t queue_size;
+} remote_version_t;
+
+// ERROR, to the host: a message was rejected without being handled
+typedef struct REMOTE_PACKED {
+  uint8_t kind;
+  uint8_t rejected_kind;
+  uint8_t reason; // REMOTE_ERROR_REASON
+  uint8_t version; // The protocol version of the keyboard
+} remote_error_t;
+
+// A report, seen through the layout of its kind
+typedef union {
+  uint8_t data[REMOTE_REPORT_SIZE];
+  uint8_t kind;
+  remote_rgb_set_color_t set_color;
+  remote_rgb_load_effect_t load_effect;
+  remote_rgb_select_effect_t select_effect;
+  remote_rgb_anim_group_t anim_group;
+  remote_rgb_anim_keyframes_t anim_keyframes;
+  remote_rgb_anim_play_t anim_play;
+  remote_rgb_set_leds_t set_leds;
+  remote_events_subscribe_t events_subscribe;
+  remote_events_report_t events_report;
+  remote_ping_t ping;
+  remote_probe_sync_t probe_sync;
+  remote_probe_events_t probe_events;
+  remote_boot_times_t boot_times;
+  remote_midi_probe_t midi_probe;
+  remote_leader_dict_t leader_dict;
+  remote_stack_usage_t stack_usage;
+  remote_version_t version;
+  remote_error_t error;
+} remote_message_t;
+
+// The views are packed, so a report can be used in place wherever it is
+REMOTE_STATIC_ASSERT(sizeof(remote_message_t) == REMOTE_REPORT_SIZE, "a layout is over 32 bytes");
+REMOTE_STATIC_ASSERT(__alignof__(remote_message_t) == 1, "views must not need alignment");
+
+/*
+ * Dispatch
+ */
+
+// Handle a message of the kind it is registered for. Messages replied to
+// (PING, BOOT_TIMES...) are already in the queue: the handler fills in its
+// reply in place.
+typedef void (*remote_handler_t)(remote_message_t *message);
+
+// The handlers of a keyboard, indexed by message kind (NULL when not handled),
+// defined PROGMEM
+extern const remote_handler_t remote_handlers[REMOTE_KIND_COUNT];
+
+// Number of raw HID messages received so far, used by the host to detect loss
+extern uint32_t remote_messages_received;
+
+// Check a report and hand it to its handler, or reply with an ERROR
+void remote_dispatch(uint8_t *data, uint8_t length);
+
+// A zeroed report of the given kind in the queue, to be filled in before the
+// next remote_flush. The queue is flushed right away when full.
+remote_message_t *remote_queue_push(uint8_t kind);
+
+// Send the queued reports, once per loop
+void remote_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,88 @@
+#include "stack_usage.h"
+
+#include <string.h>
+
+uint16_t stack_context_peaks[STACK_CONTEXT_COUNT];
+uint32_t *stack_watermark = NULL;
+
+#if defined(PROTOCOL_CHIBIOS)
+extern uint32_t STACK_MAIN_BASE[], STACK_MAIN_END[];
+extern uint32_t STACK_PROCESS_BASE[], STACK_PROCESS_END[];
+
+// The first word that lost the pattern, going up from the bottom of a stack
+static uint32_t *stack_scan(uint32_t *base, uint32_t *end) {
+  uint32_t *word = base;
+  while (word < end && *word == STACK_PATTERN) {
+    word++;
+  }
+  return word;
+}
+
+// Paint a stack, only below the current frame if it is the one in use.
+// Returns the end of the painted words.
+static uint32_t *stack_paint_range(uint32_t *base, uint32_t *end, uint32_t *top) {
+  if (top >= base && top < end) {
+    end = top;
+  }
+  for (uint32_t *word = base; word < end; word++) {
+    *word = STACK_PATTERN;
+  }
+  return end;
+}
+
+void stack_paint(void) {
+  memset(stack_context_peaks, 0, sizeof(stack_context_peaks));
+  uint32_t here;
+  uint32_t *top = &here - STACK_PAINT_MARGIN;
+  chSysLock();
+  stack_watermark = stack_paint_range(STACK_PROCESS_BASE, STACK_PROCESS_END, top);
+  stack_paint_range(STACK_MAIN_BASE, STACK_MAIN_END, top);
+  chSysUnlock();
+}
+
+void stack_check(uint8_t context) {
+  uint32_t *mark = stack_watermark;
+  if (mark == NULL) {
+    return;
+  }
+  while (mark > STACK_PROCESS_BASE && mark[-1] != STACK_PATTERN) {
+    mark--;
+  }
+  if (mark < stack_watermark) {
+    stack_watermark = mark;
+    uint16_t used = (STACK_PROCESS_END - mark) * sizeof(uint32_t);
+    stack_context_peaks[context] = MAX(stack_context_peaks[context], used);
+  }
+}
+#else
+void stack_paint(void) {}
+void stack_check(uint8_t context) {}
+#endif
+
+void remote_stack_usage(remote_message_t *message) {
+  remote_stack_usage_t *reply = &message->stack_usage;
+  bool start_over = reply->start_over == 1;
+  memset(&message->data[2], 0, sizeof(message->data) - 2);
+#if defined(PROTOCOL_CHIBIOS)
+  uint32_t *process_mark = stack_scan(STACK_PROCESS_BASE, STACK_PROCESS_END);
+  uint32_t *main_mark = stack_scan(STACK_MAIN_BASE, STACK_MAIN_END);
+  reply->process_size = (STACK_PROCESS_END - STACK_PROCESS_BASE) * sizeof(uint32_t);
+  reply->process_used = (STACK_PROCESS_END - process_mark) * sizeof(uint32_t);
+  reply->main_size = (STACK_MAIN_END - STACK_MAIN_BASE) * sizeof(uint32_t);
+  reply->main_used = (STACK_MAIN_END - main_mark) * sizeof(uint32_t);
+#  if CH_CFG_USE_MEMCORE == TRUE
+  reply->free_ram = chCoreGetStatusX();
+#  endif
+#endif
+  reply->deepest = STACK_CONTEXT_MAIN_LOOP;
+  for (uint8_t context = 0; context < STACK_CONTEXT_COUNT; context++) {
+    if (stack_context_peaks[context] > stack_context_peaks[reply->deepest]) {
+      reply->deepest = context;
+    }
+  }
+  memcpy(reply->context_peaks, stack_context_peaks, sizeof(stack_context_peaks));
+
+  if (start_over) {
+    stack_paint();
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * Stack usage, shared by the keyboards
+ *
+ * The stacks are painted with a pattern, so the host can ask how deep they
+ * ever got: up to the first word from the bottom that lost the pattern. The
+ * main loop runs on the process stack, and the interrupt handlers (USB, audio,
+ * timers) on the main one. Both are painted at init (the process stack below
+ * the current frame), whatever the ChibiOS startup code was built with.
+ *
+ * The process stack is also checked at the end of a few hooks. When it grew
+ * since the last check, the hook that just ran gets the blame, which tells
+ * what runs the deepest. A check only looks at the words right below the
+ * deepest use so far, so it costs next to nothing unless the stack grew.
+ *
+ * A keymap using it calls stack_paint from keyboard_pre_init_user and
+ * stack_check at the end of the hooks it wants to blame, and registers
+ * remote_stack_usage for REMOTE_STACK_USAGE. The stacks are found through the
+ * symbols of the ChibiOS linker scripts, which a board linked differently can
+ * rename in its config.h. On other platforms, nothing is painted and the
+ * replies are all zero.
+ */
+
+#pragma once
+
+#include "quantum.h"
+#include "remote_hid.h"
+
+#define STACK_PATTERN 0x55555555 // Like CRT0_STACKS_FILL_PATTERN in ChibiOS
+#define STACK_PAINT_MARGIN 16    // Words left alone below the current frame
+
+// The first and past the last words of each stack
+#ifndef STACK_PROCESS_BASE
+#  define STACK_PROCESS_BASE __process_stack_base__
+#endif
+#ifndef STACK_PROCESS_END
+#  define STACK_PROCESS_END __process_stack_end__
+#endif
+#ifndef STACK_MAIN_BASE
+#  define STACK_MAIN_BASE __main_stack_base__
+#endif
+#ifndef STACK_MAIN_END
+#  define STACK_MAIN_END __main_stack_end__
+#endif
+
+typedef enum {
+  STACK_CONTEXT_MAIN_LOOP = 0, // Everything else in the main loop, like the keys
+  STACK_CONTEXT_RAW_HID,       // raw_hid_receive
+  STACK_CONTEXT_RGB,           // Rendering the LEDs
+  STACK_CONTEXT_LEADER,        // leader_end_user
+  STACK_CONTEXT_COUNT
+} STACK_CONTEXT;
+
+REMOTE_STATIC_ASSERT(STACK_CONTEXT_COUNT == sizeof(((remote_stack_usage_t *)0)->context_peaks) / sizeof(uint16_t),
+                     "STACK_USAGE replies have a peak per context");
+
+// The deepest use of the process stack blamed on each context, in bytes
+extern uint16_t stack_context_peaks[STACK_CONTEXT_COUNT];
+
+// The lowest word of the process stack known to be used, NULL until painted
+extern uint32_t *stack_watermark;
+
+// Paint both stacks, while no interrupt handler can be using the main one
+void stack_paint(void);
+
+// Blame a context if the process stack grew since the last check
+void stack_check(uint8_t context);
+
+// Reply to a STACK_USAGE message with the deepest use of each stack, in bytes
+// (see remote_stack_usage_t). The start_over flag is left as is in the reply,
+// the numbers are all zero if the platform is not ChibiOS, and deepest is the
+// STACK_CONTEXT using the process stack the most.
+void remote_stack_usage(remote_message_t *message);
@@ -0,0 +1,97 @@
+#include "user_store.h"
+
+#include <string.h>
+
+_Static_assert(USER_STORE_SLOTS >= 2, "user store too small for its log");
+
+bool user_store_restored = false;
+user_state_t user_store_saved;
+user_state_t user_store_latest;
+uint16_t user_store_seq = 0;
+uint8_t user_store_slot = 0;
+uint32_t user_store_activity = 0;
+uint32_t user_store_timer = 0;
+
+// CRC-8 of a slot, tweaked so that erased slots (all 0x00 or all 0xFF) never
+// pass the check
+static uint8_t user_store_check(const user_store_slot_t *slot) {
+  const uint8_t *bytes = (const uint8_t *)slot;
+  uint8_t crc = 0xFF;
+  for (uint8_t i = 0; i < offsetof(user_store_slot_t, check); i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc ^ 0x5A;
+}
+
+// Take the current state of the keymap
+static void user_store_take(user_state_t *state) {
+  memset(state, 0, sizeof(*state));
+  user_store_collect(state);
+}
+
+bool user_store_restore(void) {
+  bool found = false;
+  user_store_seq = 0;
+  user_store_slot = 0;
+  for (uint8_t index = 0; index < USER_STORE_SLOTS; index++) {
+    user_store_slot_t slot;
+    eeconfig_read_user_datablock(&slot, index * sizeof(slot), sizeof(slot));
+    if (slot.commit != USER_STORE_COMMITTED || slot.check != user_store_check(&slot)) {
+      continue;
+    }
+    if (!found || (int16_t)(slot.seq - user_store_seq) > 0) {
+      found = true;
+      user_store_seq = slot.seq;
+      user_store_slot = index;
+      user_store_saved = slot.state;
+    }
+  }
+  if (found) {
+    user_store_apply(&user_store_saved);
+  }
+  user_store_take(&user_store_saved);
+  user_store_latest = user_store_saved;
+  return found;
+}
+
+void user_store_save(const user_state_t *state) {
+  user_store_slot_t slot = { .seq = user_store_seq + 1, .state = *state, .commit = USER_STORE_COMMITTED };
+  slot.check = user_store_check(&slot);
+  user_store_slot = (user_store_slot + 1) % USER_STORE_SLOTS;
+  uint16_t offset = user_store_slot * sizeof(slot);
+  uint8_t uncommitted = 0;
+  eeconfig_update_user_datablock(&uncommitted, offset + offsetof(user_store_slot_t, commit), 1);
+  eeconfig_update_user_datablock(&slot, offset, offsetof(user_store_slot_t, commit));
+  eeconfig_update_user_datablock(&slot.commit, offset + offsetof(user_store_slot_t, commit), 1);
+  user_store_seq = slot.seq;
+  user_store_saved = *state;
+  user_store_timer = timer_read32();
+}
+
+void user_store_touch(void) {
+  user_store_activity = timer_read32();
+}
+
+void user_store_task(void) {
+  if (!user_store_restored) {
+    user_store_restore();
+    user_store_restored = true;
+    return;
+  }
+
+  user_state_t state;
+  user_store_take(&state);
+  if (memcmp(&state, &user_store_latest, sizeof(state)) != 0) {
+    user_store_latest = state;
+    user_store_touch();
+  }
+
+  if (memcmp(&state, &user_store_saved, sizeof(state)) != 0
+      && timer_elapsed32(user_store_activity) > USER_STORE_IDLE_MS
+      && timer_elapsed32(user_store_timer) > USER_STORE_INTERVAL_MS) {
+    user_store_save(&state);
+  }
+}
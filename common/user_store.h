@@ -0,0 +1,75 @@
+/*
+ * Persistent state, shared by the keyboards
+ *
+ * The state kept across reboots is saved as a small log in the user EEPROM
+ * block. Every save goes to the next slot, which spreads the writes over the
+ * whole block. A slot is marked uncommitted before it is overwritten, and
+ * committed once it is complete, so a save cut short by a power loss anywhere
+ * leaves the previous slot as the latest valid one, whatever the bytes left
+ * behind happen to match (see tools/user-store-sim.c). Saves wait for the
+ * keyboard to be idle, so they never delay a key press.
+ *
+ * The state is a few bytes the keymap gives a meaning to. A keymap using it
+ * sets USER_STORE_SIZE in its config.h (the log being at the start of the
+ * user EEPROM block), defines user_store_collect and user_store_apply, calls
+ * user_store_touch from process_record_user and user_store_task from
+ * housekeeping_task_user.
+ */
+
+#pragma once
+
+#include "quantum.h"
+
+// Bytes of state, zero when unused so that more can be added later
+#ifndef USER_STATE_SIZE
+#  define USER_STATE_SIZE 4
+#endif
+
+typedef struct {
+  uint8_t values[USER_STATE_SIZE];
+} user_state_t;
+
+typedef struct {
+  uint16_t seq;
+  user_state_t state;
+  uint8_t check;
+  uint8_t commit; // USER_STORE_COMMITTED once the rest is written
+} user_store_slot_t;
+
+#define USER_STORE_COMMITTED 0xA5
+
+#define USER_STORE_SLOTS (USER_STORE_SIZE / sizeof(user_store_slot_t))
+
+// How long the state and keys must be left alone before saving, and the
+// minimum time between saves, so a chatty host cannot wear the flash down
+#ifndef USER_STORE_IDLE_MS
+#  define USER_STORE_IDLE_MS 5000
+#endif
+#ifndef USER_STORE_INTERVAL_MS
+#  define USER_STORE_INTERVAL_MS 30000
+#endif
+
+// The sequence number of the latest save, and its slot
+extern uint16_t user_store_seq;
+extern uint8_t user_store_slot;
+
+// Take the current state, from a zeroed one. Defined by the keymap.
+void user_store_collect(user_state_t *state);
+
+// Bring a saved state back, without the songs and events of the keycodes.
+// Defined by the keymap.
+void user_store_apply(const user_state_t *state);
+
+// Find the latest valid slot and bring its state back, returning false if
+// there is none
+bool user_store_restore(void);
+
+// Append a state to the log
+void user_store_save(const user_state_t *state);
+
+// Postpone saving while the keyboard is in use
+void user_store_touch(void);
+
+// Restore the state on the first run, then save it whenever it changed and
+// the keyboard has been idle for a while
+void user_store_task(void);
@@ -23,19 +23,162 @@
         # Read all the keyboard definitions from the `keyboards` directory
         keyboardsDir = "keyboards";
 
-        keyboards = lib.mapAttrs (name: _: import ./${keyboardsDir}/${name}) (
+        keyboards = lib.mapAttrs (name: _: withCommon name (import ./${keyboardsDir}/${name})) (
           lib.filterAttrs (_: type: type == "directory") (builtins.readDir ./${keyboardsDir})
         );
 
+        # Copy the sources shared by the keyboards (`common`) next to each keymap,
+        # so their rules.mk can build them like their own
+        withCommon =
+          name: keyboard:
+          keyboard
+          // {
+            src = pkgs.runCommand "${name}-src" { } ''
+              cp -r ${keyboard.src} $out
+              chmod -R u+w $out
+              cp ${./common}/* $out/
+            '';
+          };
+
         # Map a function over all the keyboard definitions
         forEachKeyboard = f: builtins.mapAttrs (_: pkg: f pkg) keyboards;
+
+        # Map a function over all the keyboard definitions and their names, to
+        # `<keyboard>-size` outputs
+        forEachKeyboardSize =
+          f: lib.mapAttrs' (name: pkg: lib.nameValuePair "${name}-size" (f name pkg)) keyboards;
+
+        # Map a function over the keyboards with a benchmark scenario in
+        # `keyboards/<keyboard>/bench-scenario` and their names, to
+        # `<keyboard>-bench` outputs
+        forEachKeyboardBench =
+          f:
+          lib.mapAttrs' (name: pkg: lib.nameValuePair "${name}-bench" (f name pkg)) (
+            lib.filterAttrs (
+              name: _: builtins.pathExists ./${keyboardsDir}/${name}/bench-scenario
+            ) keyboards
+          );
+
+        tools = pkgs.callPackage ./tools { common = ./common; };
+
+        # Build a firmware again with call graphs (see SIZE_REPORT in the rules.mk
+        # files), keeping its ELF file and call graphs in a `size` output
+        mkSizeInputs =
+          keyboard:
+          (nixcaps.mkQmkFirmware keyboard).overrideAttrs (old: {
+            SIZE_REPORT = "yes";
+            outputs = (old.outputs or [ "out" ]) ++ [ "size" ];
+            postPhases = (old.postPhases or [ ]) ++ [ "keepSizeInputsPhase" ];
+            keepSizeInputsPhase = ''
+              mkdir -p $size
+              find "$NIX_BUILD_TOP" -name '*.elf' -exec cp {} $size/firmware.elf \;
+              find "$NIX_BUILD_TOP" -name '*.ci' -exec cat {} + > $size/callgraph.ci
+            '';
+          });
+
+        # Report the flash, RAM and stack used by a firmware, failing when over the
+        # budget in `keyboards/<keyboard>/size-budget` if there is one
+        mkSizeReport =
+          name: keyboard:
+          let
+            size = (mkSizeInputs keyboard).size;
+            budget = ./${keyboardsDir}/${name}/size-budget;
+            budgetFlag = lib.optionalString (builtins.pathExists budget) "-b ${budget}";
+          in
+          pkgs.runCommand "${name}-size" { } ''
+            set -o pipefail
+            mkdir -p $out
+            ${tools}/bin/size-report ${budgetFlag} -o $out/report.txt \
+              ${size}/firmware.elf ${size}/callgraph.ci | tee $out/summary.txt
+          '';
+
+        sizeReports = forEachKeyboardSize mkSizeReport;
+
+        # Print a size report and what changed since the last run, which is kept
+        # in `.size/<keyboard>.txt`
+        mkSizeDiff = name: _: {
+          type = "app";
+          program = toString (
+            pkgs.writeShellScript "${name}-size" ''
+              set -e
+              report=${sizeReports."${name}-size"}
+              cat $report/summary.txt
+              mkdir -p .size
+              if [ -f .size/${name}.txt ]; then
+                echo
+                echo "Changes since the last run:"
+                ${tools}/bin/size-report -c .size/${name}.txt $report/report.txt
+              fi
+              install -m 644 $report/report.txt .size/${name}.txt
+            ''
+          );
+        };
+
+        # Build a firmware again without LTO (see BENCH in the rules.mk files),
+        # keeping its ELF file in a `bench` output
+        mkBenchInputs =
+          keyboard:
+          (nixcaps.mkQmkFirmware keyboard).overrideAttrs (old: {
+            BENCH = "yes";
+            outputs = (old.outputs or [ "out" ]) ++ [ "bench" ];
+            postPhases = (old.postPhases or [ ]) ++ [ "keepBenchInputsPhase" ];
+            keepBenchInputsPhase = ''
+              mkdir -p $bench
+              find "$NIX_BUILD_TOP" -name '*.elf' -exec cp {} $bench/firmware.elf \;
+            '';
+          });
+
+        # Count the cycles a firmware spends in its callbacks through the
+        # scenario in `keyboards/<keyboard>/bench-scenario`, under emulation
+        mkBenchReport =
+          name: keyboard:
+          let
+            bench = (mkBenchInputs keyboard).bench;
+          in
+          pkgs.runCommand "${name}-bench" { } ''
+            set -o pipefail
+            mkdir -p $out
+            ${tools}/bin/cortex-bench -o $out/report.txt \
+              ${bench}/firmware.elf ${./${keyboardsDir}/${name}/bench-scenario} | tee $out/summary.txt
+          '';
+
+        benchReports = forEachKeyboardBench mkBenchReport;
+
+        # Print a benchmark report and what changed since the last run, which is
+        # kept in `.bench/<keyboard>.txt`
+        mkBenchDiff = name: _: {
+          type = "app";
+          program = toString (
+            pkgs.writeShellScript "${name}-bench" ''
+              set -e
+              report=${benchReports."${name}-bench"}
+              cat $report/summary.txt
+              mkdir -p .bench
+              if [ -f .bench/${name}.txt ]; then
+                echo
+                echo "Changes since the last run:"
+                ${tools}/bin/cortex-bench -c .bench/${name}.txt $report/report.txt
+              fi
+              install -m 644 $report/report.txt .bench/${name}.txt
+            ''
+          );
+        };
       in
       {
-        # Build firmware with `nix build .#<keyboard>`
-        packages = forEachKeyboard nixcaps.mkQmkFirmware;
+        # Build firmware with `nix build .#<keyboard>`, its size report with
+        # `nix build .#<keyboard>-size`, its cycle counts with
+        # `nix build .#<keyboard>-bench`, and the host tools with `nix build .#tools`
+        packages = forEachKeyboard nixcaps.mkQmkFirmware // sizeReports // benchReports // {
+          inherit tools;
+        };
 
-        # Flash firmwares with `nix run .#<keyboard>`
-        apps = forEachKeyboard nixcaps.flashQmkFirmware;
+        # Flash firmwares with `nix run .#<keyboard>`, and compare their size and
+        # cycle counts with the last run with `nix run .#<keyboard>-size` and
+        # `nix run .#<keyboard>-bench`
+        apps =
+          forEachKeyboard nixcaps.flashQmkFirmware
+          // forEachKeyboardSize mkSizeDiff
+          // forEachKeyboardBench mkBenchDiff;
 
         # Default shell with prebuilt compile_commands.json for all keyboards
         devShells.default = pkgs.mkShell {
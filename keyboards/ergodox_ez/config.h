@@ -38,4 +38,27 @@
  * Hold-tap timeout
  */
 
-#define TAPPING_TERM 250
\ No newline at end of file
+#define TAPPING_TERM 250
+
+/*
+ * Mouse keys
+ */
+
+#define MOUSE_KEYS_CURVE MOUSE_CURVE_QUADRATIC
+#define MOUSE_KEYS_INERTIA_MS 40
+#define POINTING_DEVICE_TASK_THROTTLE_MS 1
+#define POINTING_DEVICE_HIRES_SCROLL_ENABLE
+#define WHEEL_EXTENDED_REPORT
+
+/*
+ * Key repeat
+ */
+
+// The repeated keys send one report per poll
+#define USB_POLLING_INTERVAL_MS 1
+
+/*
+ * Combos
+ */
+
+#define COMBO_TERM 40
\ No newline at end of file
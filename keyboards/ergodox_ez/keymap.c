@@ -19,6 +19,11 @@
 
 #include QMK_KEYBOARD_H
 #include "version.h"
+#include "mouse_keys.h"
+#include "key_repeat.h"
+#include "combos.h"
+#include "packed_string.h"
+#include "idle.h"
 
 /*
  * Layers
@@ -157,11 +162,11 @@ bool leader_mode = false;
 
 // Macros for registering key sequences
 #define ONE_KEY_SEQUENCE(kc1, str) \
-  if (leader_sequence_one_key(kc1)) { SEND_STRING(str); return true; }
+  if (leader_sequence_one_key(kc1)) { SEND_STRING_PACKED(str); return true; }
 #define TWO_KEYS_SEQUENCE(kc1, kc2, str) \
-  if (leader_sequence_two_keys(kc1, kc2)) { SEND_STRING(str); return true; }
+  if (leader_sequence_two_keys(kc1, kc2)) { SEND_STRING_PACKED(str); return true; }
 #define THREE_KEYS_SEQUENCE(kc1, kc2, kc3, str) \
-  if (leader_sequence_three_keys(kc1, kc2, kc3)) { SEND_STRING(str); return true; }
+  if (leader_sequence_three_keys(kc1, kc2, kc3)) { SEND_STRING_PACKED(str); return true; }
 
 // The dictionary of sequences
 bool process_leader_sequence(void) {
@@ -235,11 +240,67 @@ void set_or_revert_default_layer(uint16_t layer) {
   }
 }
 
+/*
+ * Key repeat
+ */
+
+// The curves of the arrows and of the page keys on each layer (see
+// common/key_repeat.c), the layers left out keeping the host autorepeat
+const uint8_t key_repeat_layers[][KEY_REPEAT_GROUP_COUNT] = {
+  [RAISE_LAYER] = { KEY_REPEAT_CURVE_ARROWS, KEY_REPEAT_CURVE_PAGES }
+};
+
+const uint8_t key_repeat_layer_count = ARRAY_SIZE(key_repeat_layers);
+
+
+/*
+ * Combos
+ */
+
+// Chords are matched by common/combos.c, out of the lists below
+
+// The keys that can be chorded, as their name and keycode
+#define COMBO_KEYS(X) \
+  X(CHORD_J, HR_J) \
+  X(CHORD_K, HR_K) \
+  X(CHORD_LOWER, LT_LOWER(KC_SPC)) \
+  X(CHORD_RAISE, LT_RAISE(KC_ENT))
+
+// The combos, as the mask of their keys and the keycode they send. MO()
+// keycodes switch layers while the chord is held.
+#define COMBOS(X, arg) \
+  X(arg, COMBO_BIT(CHORD_J) | COMBO_BIT(CHORD_K), KC_ESC) \
+  X(arg, COMBO_BIT(CHORD_LOWER) | COMBO_BIT(CHORD_RAISE), MO(HYPER_LAYER))
+
+COMBO_TABLES()
+
+bool pre_process_record_user(uint16_t keycode, keyrecord_t *record) {
+  return combo_process(keycode, record, true);
+}
+
+void housekeeping_task_user(void) {
+  combo_task();
+  key_repeat_task();
+  idle_task(true);
+}
+
+
 /*
  * Process custom keycodes
  */
 
 bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+  idle_touch();
+
+  // Before the mouse keys, so that their presses stop a key repeat
+  if (!key_repeat_process(keycode, record)) {
+    return false;
+  }
+
+  if (!mouse_keys_process(keycode, record)) {
+    return false;
+  }
+
   switch (keycode) {
     // Sticky mode keycodes
     case LOWER:
@@ -292,6 +353,18 @@ layer_state_t layer_state_set_user(layer_state_t state) {
   return state;
 }
 
+/*
+ * Idle mode
+ */
+
+void idle_leds_off(void) {
+  ergodox_led_all_off();
+}
+
+void idle_leds_on(void) {
+  layer_state_set_user(layer_state);
+}
+
 /*
  * Keymaps
  */
@@ -354,7 +427,7 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
                              LT_HYPER(KC_SPC), _______, RAISE,
 
   // Right hand
-  _______, _______, _______, _______, _______, _______, _______,
+  _______, _______, MS_WHLU, _______, MS_WHLD, _______, _______,
   _______, _______, CTL_PUP, KC_UP,   CTL_PDN, _______, _______,
            _______, KC_LEFT, KC_DOWN, KC_RGHT, _______, _______,
   _______, _______, _______, _______, _______, _______, _______,
@@ -1,2 +1,14 @@
 LEADER_ENABLE = yes
-CONSOLE_ENABLE = yes
\ No newline at end of file
+CONSOLE_ENABLE = yes
+POINTING_DEVICE_ENABLE = yes
+POINTING_DEVICE_DRIVER = custom
+
+# Code shared by the keyboards (common/, copied next to the keymap by
+# flake.nix)
+SRC += mouse_keys.c key_repeat.c combos.c packed_string.c idle.c
+
+# Call graphs for the size reports (see flake.nix). LTO builds only generate
+# code when linking, so the objects keep theirs too.
+ifeq ($(SIZE_REPORT), yes)
+  EXTRAFLAGS += -fcallgraph-info=su -ffat-lto-objects
+endif
\ No newline at end of file
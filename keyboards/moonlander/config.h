@@ -79,4 +79,59 @@
 #undef ENABLE_RGB_MATRIX_SPLASH
 #undef ENABLE_RGB_MATRIX_MULTISPLASH
 #undef ENABLE_RGB_MATRIX_SOLID_SPLASH
-#undef ENABLE_RGB_MATRIX_SOLID_MULTISPLASH
\ No newline at end of file
+#undef ENABLE_RGB_MATRIX_SOLID_MULTISPLASH
+
+/*
+ * Persistent state
+ */
+
+#define USER_STORE_SIZE 128
+#define EECONFIG_USER_DATA_SIZE (USER_STORE_SIZE + MACRO_STORE_SIZE + LEADER_DICT_STORE_SIZE)
+
+/*
+ * Sleep
+ */
+
+// The keyboard goes idle after 5 minutes without keys or host messages (see
+// common/idle.h), and the LEDs go dark while the host sleeps
+#define IDLE_TIMEOUT 300000
+#define RGB_MATRIX_SLEEP
+
+/*
+ * Mouse keys
+ */
+
+#define MOUSE_KEYS_CURVE MOUSE_CURVE_QUADRATIC
+#define MOUSE_KEYS_INERTIA_MS 40
+#define POINTING_DEVICE_TASK_THROTTLE_MS 1
+#define POINTING_DEVICE_HIRES_SCROLL_ENABLE
+#define WHEEL_EXTENDED_REPORT
+
+/*
+ * Key repeat
+ */
+
+// The repeated keys send one report per poll
+#define USB_POLLING_INTERVAL_MS 1
+
+/*
+ * Dynamic macros
+ */
+
+#define MACRO_ARENA_SIZE 4096
+#define MACRO_STORE_SIZE 1024
+
+/*
+ * Leader dictionary
+ */
+
+#define LEADER_DICT_SIZE 512
+#define LEADER_DICT_STORE_SIZE (LEADER_DICT_SIZE + 8)
+// Saved after the dynamic macros
+#define LEADER_DICT_STORE (USER_STORE_SIZE + MACRO_STORE_SIZE)
+
+/*
+ * Combos
+ */
+
+#define COMBO_TERM 40
\ No newline at end of file
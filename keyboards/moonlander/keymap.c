@@ -20,6 +20,16 @@
 #include QMK_KEYBOARD_H
 #include "version.h"
 #include "raw_hid.h"
+#include "remote_hid.h"
+#include "mouse_keys.h"
+#include "key_repeat.h"
+#include "combos.h"
+#include "packed_string.h"
+#include "leader_dict.h"
+#include "user_store.h"
+#include "stack_usage.h"
+#include "boot_times.h"
+#include "idle.h"
 
 /*
  * Layers
@@ -54,7 +64,17 @@ enum keyboard_keycodes {
   RAISE,                // Set the default layer to RAISE_LAYER
   HYPER,                // Set the default layer to HYPER_LAYER
   GAME,                 // Set the default later to GAME_LAYER
-  REM_RGB               // Toggle remote RGB mode
+  REM_RGB,              // Toggle remote RGB mode
+  NXT_FX,               // Cycle through the custom RGB effects
+  MIDI_MD,              // Toggle MIDI mode
+  REC_M1,               // Start or stop recording dynamic macro 1
+  REC_M2,               // Start or stop recording dynamic macro 2
+  REC_M3,               // Start or stop recording dynamic macro 3
+  REC_M4,               // Start or stop recording dynamic macro 4
+  PLY_M1,               // Play dynamic macro 1
+  PLY_M2,               // Play dynamic macro 2
+  PLY_M3,               // Play dynamic macro 3
+  PLY_M4                // Play dynamic macro 4
 };
 
 /*
@@ -112,62 +132,828 @@ static float leader_on_song[][2] = SONG(E__NOTE(_A5), E__NOTE(_A5),);
 static float leader_ok_song[][2] = SONG(E__NOTE(_A5), E__NOTE(_E6),);
 static float leader_ko_song[][2] = SONG(E__NOTE(_A5), HD_NOTE(_E4),);
 
+static float macro_record_on_song[][2]  = SONG(E__NOTE(_C5), E__NOTE(_G5),);
+static float macro_record_off_song[][2] = SONG(E__NOTE(_G5), E__NOTE(_C5),);
+
+/*
+ * Key hits
+ */
+
+// Time since each LED's key was last hit, in 4ms ticks (saturates at ~1s)
+uint8_t rgb_hit_age[RGB_MATRIX_LED_COUNT];
+uint16_t rgb_hit_timer = 0;
+
+// Record a key hit at a given matrix position
+void rgb_hit_record(keypos_t key) {
+  if (key.row < MATRIX_ROWS && key.col < MATRIX_COLS) {
+    uint8_t index = g_led_config.matrix_co[key.row][key.col];
+    if (index != NO_LED) {
+      rgb_hit_age[index] = 0;
+    }
+  }
+}
+
+// Age every key hit by the time elapsed since the last call
+void rgb_hit_tick(void) {
+  uint16_t ticks = timer_elapsed(rgb_hit_timer) / 4;
+  if (ticks == 0) {
+    return;
+  }
+  rgb_hit_timer += ticks * 4;
+  uint8_t delta = MIN(ticks, UINT8_MAX);
+  for (uint8_t index = 0; index < RGB_MATRIX_LED_COUNT; index++) {
+    rgb_hit_age[index] = qadd8(rgb_hit_age[index], delta);
+  }
+}
+
 /*
  * Initialization code
  */
 
+void keyboard_pre_init_user(void) {
+  boot_time_record(&boot_times.init_start);
+  stack_paint();
+}
+
+// Only set up RAM state here, the first frame is rendered by the RGB matrix task
 void keyboard_post_init_user(void) {
-  rgb_matrix_mode_noeeprom(RGB_MATRIX_SOLID_COLOR);
-  rgb_matrix_set_color_all(BASE_RGB);
+  memset(rgb_hit_age, UINT8_MAX, sizeof(rgb_hit_age));
+  rgb_matrix_mode_noeeprom(RGB_MATRIX_CUSTOM_LAYER_COLORS);
+  boot_time_record(&boot_times.init_end);
 }
 
 /*
- * RGB helpers
+ * RGB frame
  */
 
-// Change a single key in the RGB matrix to the color of a given layer
-void rgb_matrix_set_color_by_layer(uint8_t index, uint8_t layer) {
+// The colors last pushed to the LED driver, and the set of LEDs whose driver
+// registers are out of date. The LAYER_COLORS effect (see rgb_matrix_user.inc)
+// only writes the LEDs in this change set, so the driver buffers stay clean and
+// nothing is flushed over I2C unless some color actually changed.
+RGB rgb_frame[RGB_MATRIX_LED_COUNT];
+uint8_t rgb_frame_changes[(RGB_MATRIX_LED_COUNT + 7) / 8];
+
+// Set whenever the layer, leader or remote RGB state changes
+bool rgb_frame_dirty = true;
+
+// Request the whole frame to be recomputed on the next render
+void rgb_frame_invalidate(void) {
+  rgb_frame_dirty = true;
+}
+
+// Set the color of a single LED, adding it to the change set if it differs
+void rgb_frame_set_color(uint8_t index, uint8_t r, uint8_t g, uint8_t b) {
+  RGB *led = &rgb_frame[index];
+  if (led->r != r || led->g != g || led->b != b) {
+    led->r = r; led->g = g; led->b = b;
+    rgb_frame_changes[index / 8] |= 1 << (index % 8);
+  }
+}
+
+// Set the color of every LED in the frame
+void rgb_frame_set_color_all(uint8_t r, uint8_t g, uint8_t b) {
+  for (uint8_t index = 0; index < RGB_MATRIX_LED_COUNT; index++) {
+    rgb_frame_set_color(index, r, g, b);
+  }
+}
+
+// Change a single key in the frame to the color of a given layer
+void rgb_frame_set_color_by_layer(uint8_t index, uint8_t layer) {
   switch(layer) {
     case BASE_LAYER:
-      rgb_matrix_set_color(index, BASE_RGB);
+      rgb_frame_set_color(index, BASE_RGB);
       break;
     case LOWER_LAYER:
-      rgb_matrix_set_color(index, LOWER_RGB);
+      rgb_frame_set_color(index, LOWER_RGB);
       break;
     case RAISE_LAYER:
-      rgb_matrix_set_color(index, RAISE_RGB);
+      rgb_frame_set_color(index, RAISE_RGB);
       break;
     case HYPER_LAYER:
-      rgb_matrix_set_color(index, HYPER_RGB);
+      rgb_frame_set_color(index, HYPER_RGB);
       break;
     case GAME_LAYER:
-      rgb_matrix_set_color(index, GAME_RGB);
+      rgb_frame_set_color(index, GAME_RGB);
       break;
   }
 }
 
+/*
+ * RGB effects
+ */
+
+// Custom effects are small stack machine programs, evaluated once per LED on
+// every frame. A program must leave the hue, saturation and value of the LED on
+// top of the stack, in that order. All values are 8-bit fixed point numbers, so
+// a handful of effects fit in a fraction of the flash of a built-in one.
+typedef enum {
+  RGB_OP_END = 0,   // Stop and use the top three values as h,s,v
+  RGB_OP_PUSH,      // Push the next program byte
+  RGB_OP_TIME,      // Push the effect time, scaled by the RGB matrix speed
+  RGB_OP_X,         // Push the x coordinate of the LED (0-224)
+  RGB_OP_Y,         // Push the y coordinate of the LED (0-64)
+  RGB_OP_DIST,      // Push the distance from the LED to the center
+  RGB_OP_ANGLE,     // Push the angle of the LED around the center
+  RGB_OP_AGE,       // Push the time since the LED's key was last hit
+  RGB_OP_LAYER,     // Push the current layer
+  RGB_OP_HUE,       // Push the configured hue
+  RGB_OP_SAT,       // Push the configured saturation
+  RGB_OP_VAL,       // Push the configured value
+  RGB_OP_DUP,       // a -> a a
+  RGB_OP_SWAP,      // a b -> b a
+  RGB_OP_DROP,      // a ->
+  RGB_OP_ADD,       // a b -> a+b (wrapping)
+  RGB_OP_SUB,       // a b -> a-b (wrapping)
+  RGB_OP_QADD,      // a b -> a+b (saturating)
+  RGB_OP_QSUB,      // a b -> a-b (saturating)
+  RGB_OP_MUL,       // a b -> a*b/256
+  RGB_OP_MIN,       // a b -> min(a,b)
+  RGB_OP_MAX,       // a b -> max(a,b)
+  RGB_OP_INV,       // a -> 255-a
+  RGB_OP_SIN,       // a -> sin8(a)
+  RGB_OP_SHL,       // a -> a<<n, where n is the next program byte
+  RGB_OP_SHR        // a -> a>>n, where n is the next program byte
+} RGB_EFFECT_OPCODE;
+
+#define RGB_EFFECT_MAX_SIZE 64
+#define RGB_EFFECT_STACK_SIZE 8
+#define RGB_EFFECT_UPLOADED UINT8_MAX
+
+// Light up keys as they are hit and fade them out
+const uint8_t rgb_effect_reactive[] = {
+  RGB_OP_HUE, RGB_OP_SAT, RGB_OP_AGE, RGB_OP_INV, RGB_OP_VAL, RGB_OP_MUL, RGB_OP_END
+};
+
+// Same, but shifting the hue as keys fade out
+const uint8_t rgb_effect_reactive_hue[] = {
+  RGB_OP_HUE, RGB_OP_AGE, RGB_OP_ADD, RGB_OP_SAT, RGB_OP_AGE, RGB_OP_INV, RGB_OP_VAL, RGB_OP_MUL, RGB_OP_END
+};
+
+// Dimly tint the keyboard with a hue per layer, brightening keys as they are hit
+const uint8_t rgb_effect_layer_typing[] = {
+  RGB_OP_LAYER, RGB_OP_SHL, 6, RGB_OP_HUE, RGB_OP_ADD, RGB_OP_SAT,
+  RGB_OP_AGE, RGB_OP_INV, RGB_OP_PUSH, 48, RGB_OP_QADD, RGB_OP_VAL, RGB_OP_MUL, RGB_OP_END
+};
+
+// Rainbow moving from left to right
+const uint8_t rgb_effect_rainbow[] = {
+  RGB_OP_X, RGB_OP_TIME, RGB_OP_ADD, RGB_OP_SAT, RGB_OP_VAL, RGB_OP_END
+};
+
+// Waves of light moving out from the center
+const uint8_t rgb_effect_ripple[] = {
+  RGB_OP_HUE, RGB_OP_SAT, RGB_OP_DIST, RGB_OP_SHL, 2, RGB_OP_TIME, RGB_OP_SUB, RGB_OP_SIN, RGB_OP_VAL, RGB_OP_MUL, RGB_OP_END
+};
+
+// Rainbow spinning around the center
+const uint8_t rgb_effect_spiral[] = {
+  RGB_OP_ANGLE, RGB_OP_TIME, RGB_OP_ADD, RGB_OP_SAT, RGB_OP_VAL, RGB_OP_END
+};
+
+const uint8_t *const rgb_effects[] = {
+  rgb_effect_reactive,
+  rgb_effect_reactive_hue,
+  rgb_effect_layer_typing,
+  rgb_effect_rainbow,
+  rgb_effect_ripple,
+  rgb_effect_spiral
+};
+
+#define RGB_EFFECT_COUNT ARRAY_SIZE(rgb_effects)
+
+// The program uploaded by the host. The extra byte is always RGB_OP_END, so
+// evaluation stops within bounds no matter what was uploaded.
+uint8_t rgb_effect_uploaded[RGB_EFFECT_MAX_SIZE + 1];
+bool rgb_effect_uploaded_ready = false;
+
+// The program being uploaded, until its last chunk comes in
+uint8_t rgb_effect_staged[RGB_EFFECT_MAX_SIZE];
+uint8_t rgb_effect_staged_size = 0;
+bool rgb_effect_staging = false;
+
+// The currently selected effect
+uint8_t rgb_effect_index = 0;
+const uint8_t *rgb_effect_program = rgb_effect_reactive;
+
+// Per-frame inputs shared by all the LEDs
+uint8_t rgb_effect_time = 0;
+uint8_t rgb_effect_layer = 0;
+
+// Evaluate a program for a single LED. Returns false if the program is malformed.
+bool rgb_effect_eval(const uint8_t *program, uint8_t index, HSV *hsv) {
+  uint8_t stack[RGB_EFFECT_STACK_SIZE];
+  uint8_t sp = 0;
+  led_point_t point = g_led_config.point[index];
+  int16_t dx = point.x - k_rgb_matrix_center.x;
+  int16_t dy = point.y - k_rgb_matrix_center.y;
+
+  #define RGB_EFFECT_NEED(n) if (sp < (n)) { return false; }
+  #define RGB_EFFECT_PUSH(v) if (sp == RGB_EFFECT_STACK_SIZE) { return false; } stack[sp++] = (v)
+  #define A stack[sp - 2]
+  #define B stack[sp - 1]
+
+  for (uint8_t pc = 0; pc < RGB_EFFECT_MAX_SIZE; pc++) {
+    switch (program[pc]) {
+      case RGB_OP_END:
+        RGB_EFFECT_NEED(3);
+        hsv->h = stack[sp - 3]; hsv->s = stack[sp - 2]; hsv->v = stack[sp - 1];
+        return true;
+      case RGB_OP_PUSH:  RGB_EFFECT_PUSH(program[++pc]); break;
+      case RGB_OP_TIME:  RGB_EFFECT_PUSH(rgb_effect_time); break;
+      case RGB_OP_X:     RGB_EFFECT_PUSH(point.x); break;
+      case RGB_OP_Y:     RGB_EFFECT_PUSH(point.y); break;
+      case RGB_OP_DIST:  RGB_EFFECT_PUSH(sqrt16(dx * dx + dy * dy)); break;
+      case RGB_OP_ANGLE: RGB_EFFECT_PUSH(atan2_8(dy, dx)); break;
+      case RGB_OP_AGE:   RGB_EFFECT_PUSH(rgb_hit_age[index]); break;
+      case RGB_OP_LAYER: RGB_EFFECT_PUSH(rgb_effect_layer); break;
+      case RGB_OP_HUE:   RGB_EFFECT_PUSH(rgb_matrix_config.hsv.h); break;
+      case RGB_OP_SAT:   RGB_EFFECT_PUSH(rgb_matrix_config.hsv.s); break;
+      case RGB_OP_VAL:   RGB_EFFECT_PUSH(rgb_matrix_config.hsv.v); break;
+      case RGB_OP_DUP:   RGB_EFFECT_NEED(1); { uint8_t t = B; RGB_EFFECT_PUSH(t); } break;
+      case RGB_OP_SWAP:  RGB_EFFECT_NEED(2); { uint8_t t = A; A = B; B = t; } break;
+      case RGB_OP_DROP:  RGB_EFFECT_NEED(1); sp--; break;
+      case RGB_OP_ADD:   RGB_EFFECT_NEED(2); A = A + B; sp--; break;
+      case RGB_OP_SUB:   RGB_EFFECT_NEED(2); A = A - B; sp--; break;
+      case RGB_OP_QADD:  RGB_EFFECT_NEED(2); A = qadd8(A, B); sp--; break;
+      case RGB_OP_QSUB:  RGB_EFFECT_NEED(2); A = qsub8(A, B); sp--; break;
+      case RGB_OP_MUL:   RGB_EFFECT_NEED(2); A = scale8(A, B); sp--; break;
+      case RGB_OP_MIN:   RGB_EFFECT_NEED(2); A = MIN(A, B); sp--; break;
+      case RGB_OP_MAX:   RGB_EFFECT_NEED(2); A = MAX(A, B); sp--; break;
+      case RGB_OP_INV:   RGB_EFFECT_NEED(1); B = UINT8_MAX - B; break;
+      case RGB_OP_SIN:   RGB_EFFECT_NEED(1); B = sin8(B); break;
+      case RGB_OP_SHL:   RGB_EFFECT_NEED(1); B = B << (program[++pc] & 7); break;
+      case RGB_OP_SHR:   RGB_EFFECT_NEED(1); B = B >> (program[++pc] & 7); break;
+      default:
+        return false;
+    }
+  }
+
+  #undef RGB_EFFECT_NEED
+  #undef RGB_EFFECT_PUSH
+  #undef A
+  #undef B
+
+  return false;
+}
+
+// Render the BYTECODE effect
+bool rgb_effect_render(effect_params_t *params) {
+  RGB_MATRIX_USE_LIMITS(led_min, led_max);
+
+  // Update the inputs shared by all LEDs once per frame
+  if (params->iter == 0) {
+    rgb_hit_tick();
+    rgb_effect_time = scale16by8(g_rgb_timer, qadd8(rgb_matrix_config.speed / 4, 1));
+    rgb_effect_layer = get_highest_layer(layer_state | default_layer_state);
+  }
+
+  // Evaluate the program for each LED, turning off the ones it fails on
+  for (uint8_t index = led_min; index < led_max; index++) {
+    HSV hsv = { 0, 0, 0 };
+    rgb_effect_eval(rgb_effect_program, index, &hsv);
+    RGB rgb = rgb_matrix_hsv_to_rgb(hsv);
+    rgb_matrix_set_color(index, rgb.r, rgb.g, rgb.b);
+  }
+
+  stack_check(STACK_CONTEXT_RGB);
+  return rgb_matrix_check_finished_leds(led_max);
+}
+
+// Select a built-in effect, or the one uploaded by the host
+void rgb_effect_select(uint8_t index) {
+  if (index == RGB_EFFECT_UPLOADED) {
+    rgb_effect_program = rgb_effect_uploaded;
+  } else if (index < RGB_EFFECT_COUNT) {
+    rgb_effect_program = rgb_effects[index];
+  } else {
+    return;
+  }
+  rgb_effect_index = index;
+  rgb_matrix_mode_noeeprom(RGB_MATRIX_CUSTOM_BYTECODE);
+}
+
+// Cycle through the built-in effects, the uploaded one (if any), and back to
+// the layer colors
+void rgb_effect_next(void) {
+  if (rgb_matrix_get_mode() != RGB_MATRIX_CUSTOM_BYTECODE) {
+    rgb_effect_select(0);
+  } else if (rgb_effect_index + 1 < RGB_EFFECT_COUNT) {
+    rgb_effect_select(rgb_effect_index + 1);
+  } else if (rgb_effect_index != RGB_EFFECT_UPLOADED && rgb_effect_uploaded_ready) {
+    rgb_effect_select(RGB_EFFECT_UPLOADED);
+  } else {
+    rgb_matrix_mode_noeeprom(RGB_MATRIX_CUSTOM_LAYER_COLORS);
+  }
+}
+
+// Check that a program always leaves a color on the stack, without running
+// past its end or over the stack, before it is used
+bool rgb_effect_validate(const uint8_t *program, uint8_t size) {
+  uint8_t sp = 0;
+  for (uint8_t pc = 0; pc < size; pc++) {
+    uint8_t pops = 0, pushes = 1;
+    bool operand = false;
+    switch (program[pc]) {
+      case RGB_OP_END:
+        return sp >= 3;
+      case RGB_OP_PUSH:
+        operand = true;
+        break;
+      case RGB_OP_TIME: case RGB_OP_X: case RGB_OP_Y: case RGB_OP_DIST: case RGB_OP_ANGLE:
+      case RGB_OP_AGE: case RGB_OP_LAYER: case RGB_OP_HUE: case RGB_OP_SAT: case RGB_OP_VAL:
+        break;
+      case RGB_OP_DUP:  pops = 1; pushes = 2; break;
+      case RGB_OP_SWAP: pops = 2; pushes = 2; break;
+      case RGB_OP_DROP: pops = 1; pushes = 0; break;
+      case RGB_OP_ADD: case RGB_OP_SUB: case RGB_OP_QADD: case RGB_OP_QSUB:
+      case RGB_OP_MUL: case RGB_OP_MIN: case RGB_OP_MAX:
+        pops = 2;
+        break;
+      case RGB_OP_INV: case RGB_OP_SIN:
+        pops = 1;
+        break;
+      case RGB_OP_SHL: case RGB_OP_SHR:
+        pops = 1;
+        operand = true;
+        break;
+      default:
+        return false;
+    }
+    if (sp < pops || sp - pops + pushes > RGB_EFFECT_STACK_SIZE) {
+      return false;
+    }
+    sp = sp - pops + pushes;
+    if (operand && ++pc == size) {
+      return false;
+    }
+  }
+  return false; // No RGB_OP_END
+}
+
+// Parse a LOAD_EFFECT message and stage a chunk of the program uploaded by the
+// host (see remote_rgb_load_effect_t). The program only replaces the uploaded
+// one once its last chunk is in and it is valid, so the effect on show never
+// runs half a program.
+void rgb_effect_load(remote_message_t *message) {
+  remote_rgb_load_effect_t *chunk = &message->load_effect;
+  if (chunk->offset == 0) {
+    rgb_effect_staging = true;
+    rgb_effect_staged_size = 0;
+  }
+  // Chunks must follow each other, anything else drops the upload
+  if (!rgb_effect_staging || chunk->offset != rgb_effect_staged_size
+      || chunk->offset + chunk->count > RGB_EFFECT_MAX_SIZE) {
+    rgb_effect_staging = false;
+    return;
+  }
+  memcpy(&rgb_effect_staged[chunk->offset], chunk->program, chunk->count);
+  rgb_effect_staged_size += chunk->count;
+  if (chunk->count == sizeof(chunk->program)) {
+    return; // More to come
+  }
+
+  rgb_effect_staging = false;
+  if (!rgb_effect_validate(rgb_effect_staged, rgb_effect_staged_size)) {
+    return;
+  }
+  memset(rgb_effect_uploaded, RGB_OP_END, sizeof(rgb_effect_uploaded));
+  memcpy(rgb_effect_uploaded, rgb_effect_staged, rgb_effect_staged_size);
+  rgb_effect_uploaded_ready = true;
+}
+
+/*
+ * MIDI mode
+ */
+
+// In MIDI mode, the keys in music_map send USB MIDI notes instead of playing
+// on the speaker. The velocity comes from the time since the previous note, so
+// fast runs play louder. The notes from one scan are sent together once it has
+// been processed, back to back in the MIDI endpoint queue, so they go out in
+// the same USB transfer. The LEDs are frozen while playing, skipping the
+// layer colors pass.
+
+#define MIDI_CHANNEL 0
+#define MIDI_BASE_NOTE 48 // C3, played by the 1 in music_map
+#define MIDI_NOTE_COUNT 36
+
+// Notes closer than MIDI_FAST_MS play at full velocity, and notes further
+// apart than MIDI_SLOW_MS at MIDI_MIN_VELOCITY
+#define MIDI_FAST_MS 50
+#define MIDI_SLOW_MS 800
+#define MIDI_MIN_VELOCITY 40
+
+#define MIDI_MAX_EVENTS 16
+
+extern MidiDevice midi_device;
+
+// Defined along with the keymaps, below
+extern const uint8_t music_map[MATRIX_ROWS][MATRIX_COLS];
+
+bool midi_mode = false;
+uint8_t midi_rgb_mode = RGB_MATRIX_CUSTOM_LAYER_COLORS;
+uint32_t midi_last_note = 0;
+uint8_t midi_notes_held[(MIDI_NOTE_COUNT + 7) / 8];
+
+// Note events waiting for the end of the scan
+typedef struct {
+  uint8_t note;
+  uint8_t velocity;
+  bool on;
+} midi_event_t;
+
+midi_event_t midi_events[MIDI_MAX_EVENTS];
+uint8_t midi_events_count = 0;
+
+void midi_event_push(uint8_t note, uint8_t velocity, bool on) {
+  if (midi_events_count < MIDI_MAX_EVENTS) {
+    midi_events[midi_events_count++] = (midi_event_t){ note, velocity, on };
+  }
+}
+
+// Send the notes of the last scan
+void midi_events_flush(void) {
+  for (uint8_t i = 0; i < midi_events_count; i++) {
+    midi_event_t *event = &midi_events[i];
+    if (event->on) {
+      midi_send_noteon(&midi_device, MIDI_CHANNEL, event->note, event->velocity);
+    } else {
+      midi_send_noteoff(&midi_device, MIDI_CHANNEL, event->note, event->velocity);
+    }
+  }
+  midi_events_count = 0;
+}
+
+// The velocity of a note played now
+uint8_t midi_velocity(void) {
+  uint32_t interval = timer_elapsed32(midi_last_note);
+  midi_last_note = timer_read32();
+  if (interval <= MIDI_FAST_MS) {
+    return 127;
+  }
+  if (interval >= MIDI_SLOW_MS) {
+    return MIDI_MIN_VELOCITY;
+  }
+  return 127 - (127 - MIDI_MIN_VELOCITY) * (interval - MIDI_FAST_MS) / (MIDI_SLOW_MS - MIDI_FAST_MS);
+}
+
+// Play the note of a key. Returns false if the key was a note.
+bool midi_process(keyrecord_t *record) {
+  uint8_t index = music_map[record->event.key.row][record->event.key.col];
+  if (index == 0 || index > MIDI_NOTE_COUNT) {
+    return true;
+  }
+  index--;
+  uint8_t mask = 1 << (index % 8);
+  if (record->event.pressed) {
+    midi_notes_held[index / 8] |= mask;
+    midi_event_push(MIDI_BASE_NOTE + index, midi_velocity(), true);
+  } else if (midi_notes_held[index / 8] & mask) {
+    midi_notes_held[index / 8] &= ~mask;
+    midi_event_push(MIDI_BASE_NOTE + index, 0, false);
+  }
+  return false;
+}
+
+void midi_start(void) {
+  if (is_music_on()) {
+    music_off();
+  }
+  // Only the layer colors effect can be frozen
+  midi_rgb_mode = rgb_matrix_get_mode();
+  rgb_matrix_mode_noeeprom(RGB_MATRIX_CUSTOM_LAYER_COLORS);
+  midi_mode = true;
+}
+
+// Release the notes still held, and bring the LEDs back
+void midi_stop(void) {
+  for (uint8_t index = 0; index < MIDI_NOTE_COUNT; index++) {
+    if (midi_notes_held[index / 8] & (1 << (index % 8))) {
+      midi_event_push(MIDI_BASE_NOTE + index, 0, false);
+    }
+  }
+  memset(midi_notes_held, 0, sizeof(midi_notes_held));
+  midi_mode = false;
+  rgb_matrix_mode_noeeprom(midi_rgb_mode);
+  rgb_frame_invalidate();
+}
+
+void midi_toggle(void) {
+  if (!midi_mode) {
+    midi_start();
+  } else {
+    midi_stop();
+  }
+}
+
+// Reply to a MIDI_PROBE message by playing a short note on the next flush, so
+// the host can time its way through the MIDI stack
+void midi_probe(remote_message_t *message) {
+  uint8_t note = message->midi_probe.note & 0x7F;
+  midi_event_push(note, 127, true);
+  midi_event_push(note, 0, false);
+}
+
+/*
+ * Remote ping
+ */
+
+// Reply to a PING message, adding the device time and message count (see
+// remote_ping_t)
+void remote_ping(remote_message_t *message) {
+  message->ping.time_ms = timer_read32();
+  message->ping.received = remote_messages_received;
+}
+
+/*
+ * Remote events
+ */
+
+// Events are pushed to the host over raw HID, packed into reports of up to
+// REMOTE_EVENTS_MAX events. Pending events are sent at most once per USB frame
+// (1ms), so bursts of changes end up in a single report. Events that describe
+// a state (layer, sticky layer, remote RGB mode) replace any pending event of
+// the same kind, so the host only sees the latest value.
+
+#define REMOTE_EVENTS_MAX 10
+#define REMOTE_EVENTS_DEFAULT_MASK ((1 << REMOTE_EVENT_KEY) - 1)
+
+// Events the host has subscribed to, one bit per REMOTE_EVENT_KIND
+uint8_t remote_events_mask = 0;
+
+uint8_t remote_events[REMOTE_EVENTS_MAX][3];
+uint8_t remote_events_count = 0;
+bool remote_events_dropped = false;
+bool remote_events_snapshot = false;
+uint16_t remote_events_timer = 0;
+
+// Queue an event for the host, if it subscribed to it
+void remote_event_push(uint8_t kind, uint8_t arg1, uint8_t arg2) {
+  if (!(remote_events_mask & (1 << kind))) {
+    return;
+  }
+
+  // Coalesce state events with a pending one of the same kind
+  if (kind == REMOTE_EVENT_LAYER || kind == REMOTE_EVENT_STICKY || kind == REMOTE_EVENT_REMOTE_RGB) {
+    for (uint8_t i = 0; i < remote_events_count; i++) {
+      if (remote_events[i][0] == kind) {
+        remote_events[i][1] = arg1;
+        remote_events[i][2] = arg2;
+        return;
+      }
+    }
+  }
+
+  if (remote_events_count == REMOTE_EVENTS_MAX) {
+    remote_events_dropped = true;
+    return;
+  }
+
+  remote_events[remote_events_count][0] = kind;
+  remote_events[remote_events_count][1] = arg1;
+  remote_events[remote_events_count][2] = arg2;
+  remote_events_count++;
+}
+
+// Queue the pending events in a single EVENTS_REPORT message (see
+// remote_events_report_t)
+void remote_events_flush(void) {
+  if (remote_events_count == 0 || timer_read() == remote_events_timer) {
+    return;
+  }
+
+  remote_events_report_t *report = &remote_queue_push(REMOTE_EVENTS_REPORT)->events_report;
+  report->count = remote_events_count;
+  if (remote_events_dropped) {
+    report->count |= 0x80;
+  }
+  memcpy(report->events, remote_events, remote_events_count * sizeof(report->events[0]));
+
+  remote_events_count = 0;
+  remote_events_dropped = false;
+  remote_events_timer = timer_read();
+}
+
+// Parse an EVENTS_SUBSCRIBE message and set the events pushed to the host. The
+// current state is pushed right after subscribing.
+void remote_events_subscribe(remote_message_t *message) {
+  remote_events_mask = message->events_subscribe.mask;
+  remote_events_count = 0;
+  remote_events_dropped = false;
+  remote_events_snapshot = remote_events_mask != 0;
+}
+
 /*
  * Remote RGB mode
  */
 
 bool remote_rgb_mode = false;
 
+// The colors set by the host, kept so the frame can be recomputed at any time
+RGB remote_rgb_buffer[RGB_MATRIX_LED_COUNT];
+
+// Animations uploaded by the host are played locally at the RGB render rate.
+// Each group of LEDs cycles through its own keyframes, where every keyframe
+// fades into the next one over its duration using a given easing curve.
 typedef enum {
-  REMOTE_RGB_START = 0,
-  REMOTE_RGB_STOP,
-  REMOTE_RGB_SET_COLOR
-} REMOTE_RGB_MESSAGE_KIND;
+  REMOTE_RGB_EASE_LINEAR = 0,
+  REMOTE_RGB_EASE_IN,
+  REMOTE_RGB_EASE_OUT,
+  REMOTE_RGB_EASE_IN_OUT,
+  REMOTE_RGB_EASE_STEP
+} REMOTE_RGB_EASING;
+
+#define REMOTE_RGB_ANIM_MAX_GROUPS 8
+#define REMOTE_RGB_ANIM_MAX_KEYFRAMES 8
+
+typedef struct {
+  RGB color;
+  uint16_t duration;
+  uint8_t easing;
+} remote_rgb_keyframe_t;
+
+typedef struct {
+  uint8_t leds[(RGB_MATRIX_LED_COUNT + 7) / 8];
+  uint8_t count;
+  remote_rgb_keyframe_t keyframes[REMOTE_RGB_ANIM_MAX_KEYFRAMES];
+} remote_rgb_group_t;
+
+remote_rgb_group_t remote_rgb_groups[REMOTE_RGB_ANIM_MAX_GROUPS];
+
+bool remote_rgb_anim_playing = false;
+bool remote_rgb_anim_loop = false;
+uint32_t remote_rgb_anim_timer = 0;
+
+// Clear every group and stop the animation
+void remote_rgb_anim_reset(void) {
+  memset(remote_rgb_groups, 0, sizeof(remote_rgb_groups));
+  remote_rgb_anim_playing = false;
+}
+
+// Apply an easing curve to a 0-255 fraction
+uint8_t remote_rgb_ease(uint8_t easing, uint8_t f) {
+  switch (easing) {
+    case REMOTE_RGB_EASE_IN:
+      return scale8(f, f);
+    case REMOTE_RGB_EASE_OUT:
+      return UINT8_MAX - scale8(UINT8_MAX - f, UINT8_MAX - f);
+    case REMOTE_RGB_EASE_IN_OUT:
+      return ease8InOutQuad(f);
+    case REMOTE_RGB_EASE_STEP:
+      return 0;
+    default:
+      return f;
+  }
+}
+
+// Blend two color channels by a 0-255 fraction
+uint8_t remote_rgb_lerp(uint8_t a, uint8_t b, uint8_t f) {
+  return a + ((int16_t)(b - a) * f) / UINT8_MAX;
+}
+
+// Compute the color of a group at a given time since the animation started.
+// Returns false once a non-looping animation has reached its last keyframe.
+bool remote_rgb_anim_sample(remote_rgb_group_t *group, uint32_t elapsed, RGB *color) {
+  uint32_t total = 0;
+  for (uint8_t k = 0; k < group->count; k++) {
+    total += group->keyframes[k].duration;
+  }
+
+  // Hold the last keyframe once the animation is over
+  if (total == 0 || (!remote_rgb_anim_loop && elapsed >= total)) {
+    *color = group->keyframes[group->count - 1].color;
+    return false;
+  }
+
+  if (remote_rgb_anim_loop) {
+    elapsed %= total;
+  }
+
+  // Find the keyframe we are in and blend it with the next one
+  for (uint8_t k = 0; k < group->count; k++) {
+    remote_rgb_keyframe_t *from = &group->keyframes[k];
+    if (elapsed < from->duration) {
+      uint8_t next = k + 1 < group->count ? k + 1 : (remote_rgb_anim_loop ? 0 : k);
+      remote_rgb_keyframe_t *to = &group->keyframes[next];
+      uint8_t f = remote_rgb_ease(from->easing, elapsed * UINT8_MAX / from->duration);
+      color->r = remote_rgb_lerp(from->color.r, to->color.r, f);
+      color->g = remote_rgb_lerp(from->color.g, to->color.g, f);
+      color->b = remote_rgb_lerp(from->color.b, to->color.b, f);
+      return true;
+    }
+    elapsed -= from->duration;
+  }
+
+  return false;
+}
+
+// Advance the animation, updating the LEDs of every group. Called once per frame.
+void remote_rgb_anim_tick(void) {
+  if (!remote_rgb_mode || !remote_rgb_anim_playing) {
+    return;
+  }
+
+  uint32_t elapsed = timer_elapsed32(remote_rgb_anim_timer);
+  bool running = false;
+
+  for (uint8_t g = 0; g < REMOTE_RGB_ANIM_MAX_GROUPS; g++) {
+    remote_rgb_group_t *group = &remote_rgb_groups[g];
+    if (group->count == 0) {
+      continue;
+    }
+
+    RGB color;
+    running |= remote_rgb_anim_sample(group, elapsed, &color);
+
+    for (uint8_t index = 0; index < RGB_MATRIX_LED_COUNT; index++) {
+      if (group->leds[index / 8] & (1 << (index % 8))) {
+        remote_rgb_buffer[index] = color;
+        rgb_frame_set_color(index, color.r, color.g, color.b);
+      }
+    }
+  }
+
+  remote_rgb_anim_playing = running;
+}
+
+// Parse an ANIM_GROUP message and add LEDs to an animation group, clearing it
+// first if replace is set
+void remote_rgb_anim_group(remote_message_t *message) {
+  remote_rgb_anim_group_t *request = &message->anim_group;
+  uint8_t group = request->group;
+  if (group >= REMOTE_RGB_ANIM_MAX_GROUPS) {
+    return;
+  }
+  uint8_t *leds = remote_rgb_groups[group].leds;
+  if (request->replace) {
+    memset(leds, 0, sizeof(remote_rgb_groups[group].leds));
+  }
+  for (int i = 0; i < request->count; i++) {
+    uint8_t row = request->cells[i].row, col = request->cells[i].col;
+    if (row >= MATRIX_ROWS || col >= MATRIX_COLS) {
+      continue;
+    }
+    uint8_t index = g_led_config.matrix_co[row][col];
+    if (index == NO_LED) {
+      continue;
+    }
+    leds[index / 8] |= 1 << (index % 8);
+  }
+}
+
+// Parse an ANIM_KEYFRAMES message and set the keyframes of an animation group.
+// The group ends up with exactly first+count keyframes, so uploading from
+// index 0 replaces its animation.
+void remote_rgb_anim_keyframes(remote_message_t *message) {
+  remote_rgb_anim_keyframes_t *request = &message->anim_keyframes;
+  uint8_t group = request->group, first = request->first, count = request->count;
+  if (group >= REMOTE_RGB_ANIM_MAX_GROUPS || first + count > REMOTE_RGB_ANIM_MAX_KEYFRAMES) {
+    return;
+  }
+  if (first > remote_rgb_groups[group].count) {
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    remote_rgb_keyframe_view_t *view = &request->keyframes[i];
+    remote_rgb_keyframe_t *keyframe = &remote_rgb_groups[group].keyframes[first + i];
+    keyframe->color = (RGB){ .r = view->color.r, .g = view->color.g, .b = view->color.b };
+    keyframe->duration = view->duration;
+    keyframe->easing = view->easing;
+  }
+  remote_rgb_groups[group].count = first + count;
+}
+
+// Parse an ANIM_PLAY message and (re)start the animation from the beginning
+void remote_rgb_anim_play(remote_message_t *message) {
+  if (!remote_rgb_mode) {
+    return;
+  }
+  remote_rgb_anim_loop = message->anim_play.loop;
+  remote_rgb_anim_timer = timer_read32();
+  remote_rgb_anim_playing = true;
+}
+
+// Stop the animation, leaving the LEDs as they are
+void remote_rgb_anim_stop(void) {
+  remote_rgb_anim_playing = false;
+}
 
 // Toggle the remote RGB mode on and off
 void remote_rgb_start(void) {
-  rgb_matrix_set_color_all(RGB_BLACK);
+  memset(remote_rgb_buffer, 0, sizeof(remote_rgb_buffer));
+  remote_rgb_anim_reset();
+  rgb_matrix_mode_noeeprom(RGB_MATRIX_CUSTOM_LAYER_COLORS);
   PLAY_SONG(remote_rgb_on_song);
   remote_rgb_mode = true;
+  remote_event_push(REMOTE_EVENT_REMOTE_RGB, true, 0);
+  rgb_frame_invalidate();
 }
 
 void remote_rgb_stop(void) {
+  remote_rgb_anim_stop();
   PLAY_SONG(remote_rgb_off_song);
   remote_rgb_mode = false;
+  remote_event_push(REMOTE_EVENT_REMOTE_RGB, false, 0);
+  rgb_frame_invalidate();
 }
 
 void remote_rgb_toggle(void) {
@@ -178,39 +964,514 @@ void remote_rgb_toggle(void) {
   }
 }
 
-// Parse a SET_COLOR message and set the RGB matrix accordingly:
-// * data[0]: message_kind
-// * data[1-3]: r,g,b values
-// * data[4]: count
-// * data[5-7]: unused
-// * data[8-31]: payload (up to 12 sequential pairs of row/column indices)
-void remote_rgb_set_color(uint8_t *data) {
-  uint8_t r = data[1], g = data[2], b = data[3];
-  uint8_t count = data[4];
-  uint8_t *payload = &data[8];
-  for (int i = 0; i < count; i++) {
-    uint8_t row = payload[2*i], col = payload[2*i+1];
+// Parse a SET_COLOR message and set the RGB matrix accordingly
+void remote_rgb_set_color(remote_message_t *message) {
+  remote_rgb_set_color_t *request = &message->set_color;
+  if (!remote_rgb_mode) {
+    return;
+  }
+  uint8_t r = request->color.r, g = request->color.g, b = request->color.b;
+  for (int i = 0; i < request->count; i++) {
+    uint8_t row = request->cells[i].row, col = request->cells[i].col;
+    if (row >= MATRIX_ROWS || col >= MATRIX_COLS) {
+      continue;
+    }
     uint8_t index = g_led_config.matrix_co[row][col];
-    rgb_matrix_set_color(index, r, g, b);
+    if (index == NO_LED) {
+      continue;
+    }
+    remote_rgb_buffer[index] = (RGB){ .r = r, .g = g, .b = b };
+    rgb_frame_set_color(index, r, g, b);
+  }
+}
+
+// Parse a SET_LEDS message and set a range of LEDs by index
+void remote_rgb_set_leds(remote_message_t *message) {
+  remote_rgb_set_leds_t *request = &message->set_leds;
+  if (!remote_rgb_mode) {
+    return;
+  }
+  uint8_t first = request->first;
+  for (uint8_t i = 0; i < request->count && first + i < RGB_MATRIX_LED_COUNT; i++) {
+    uint8_t r = request->colors[i].r, g = request->colors[i].g, b = request->colors[i].b;
+    remote_rgb_buffer[first + i] = (RGB){ .r = r, .g = g, .b = b };
+    rgb_frame_set_color(first + i, r, g, b);
+  }
+}
+
+/*
+ * Idle mode
+ */
+
+// The LEDs stop rendering while idle, unless the host drives them
+void idle_leds_off(void) {
+  if (!remote_rgb_mode) {
+    rgb_matrix_set_suspend_state(true);
+  }
+}
+
+void idle_leds_on(void) {
+  if (!remote_rgb_mode) {
+    rgb_matrix_set_suspend_state(false);
+    rgb_frame_invalidate();
   }
 }
 
-// Dispatch incoming HID messages
+/*
+ * Raw HID messages
+ */
+
+// The messages and their layouts are shared with the other keyboards (see
+// common/remote_hid.h), the keymap only registers its handlers
+
+void remote_rgb_start_message(remote_message_t *message) {
+  remote_rgb_start();
+}
+
+void remote_rgb_stop_message(remote_message_t *message) {
+  remote_rgb_stop();
+}
+
+void remote_rgb_select_effect(remote_message_t *message) {
+  rgb_effect_select(message->select_effect.index);
+}
+
+void remote_rgb_anim_stop_message(remote_message_t *message) {
+  remote_rgb_anim_stop();
+}
+
+const remote_handler_t PROGMEM remote_handlers[REMOTE_KIND_COUNT] = {
+  [REMOTE_RGB_START] = remote_rgb_start_message,
+  [REMOTE_RGB_STOP] = remote_rgb_stop_message,
+  [REMOTE_RGB_SET_COLOR] = remote_rgb_set_color,
+  [REMOTE_RGB_LOAD_EFFECT] = rgb_effect_load,
+  [REMOTE_RGB_SELECT_EFFECT] = remote_rgb_select_effect,
+  [REMOTE_RGB_ANIM_GROUP] = remote_rgb_anim_group,
+  [REMOTE_RGB_ANIM_KEYFRAMES] = remote_rgb_anim_keyframes,
+  [REMOTE_RGB_ANIM_PLAY] = remote_rgb_anim_play,
+  [REMOTE_RGB_ANIM_STOP] = remote_rgb_anim_stop_message,
+  [REMOTE_EVENTS_SUBSCRIBE] = remote_events_subscribe,
+  [REMOTE_RGB_SET_LEDS] = remote_rgb_set_leds,
+  [REMOTE_PING] = remote_ping,
+  [REMOTE_BOOT_TIMES] = remote_boot_times,
+  [REMOTE_MIDI_PROBE] = midi_probe,
+  [REMOTE_LEADER_DICT] = leader_dict_message,
+  [REMOTE_STACK_USAGE] = remote_stack_usage,
+};
+
 void raw_hid_receive(uint8_t *data, uint8_t length) {
-  switch (data[0]) {
-    case REMOTE_RGB_START:
-      remote_rgb_start();
-      break;
-    case REMOTE_RGB_STOP:
-      remote_rgb_stop();
-      break;
-    case REMOTE_RGB_SET_COLOR:
-      if (remote_rgb_mode) {
-        remote_rgb_set_color(data);
+  idle_touch();
+  remote_dispatch(data, length);
+  stack_check(STACK_CONTEXT_RAW_HID);
+}
+
+/*
+ * Dynamic macros
+ */
+
+// Macros are recorded as the HID usages the keys send (a MEH_F1 becomes
+// Ctrl, Shift and Alt down, F1 down, F1 up and the modifiers up), so they
+// play back the same on any layer. All slots share one RAM arena, using one
+// byte per tap and two per press or release:
+// * MACRO_OP_PRESS, usage: the key goes down and stays down
+// * MACRO_OP_RELEASE, usage: the key goes up
+// * usage: the key is tapped (down and up)
+// Usages are never below KC_A, so the ops can't be mistaken for them, and a
+// press followed by its release is folded into a tap as the release comes
+// in, which keeps regular typing at one byte per key.
+
+#define MACRO_SLOTS 4
+#define MACRO_OP_PRESS 0x01
+#define MACRO_OP_RELEASE 0x02
+
+// How many ops back a release looks for its press to fold it into a tap
+#define MACRO_FOLD_LOOKBACK 16
+
+typedef struct {
+  uint16_t start;
+  uint16_t length;
+} macro_slot_t;
+
+uint8_t macro_arena[MACRO_ARENA_SIZE];
+uint16_t macro_arena_used = 0;
+macro_slot_t macro_slots[MACRO_SLOTS];
+
+bool macro_recording = false;
+uint8_t macro_recording_slot = 0;
+
+bool macro_playing = false;
+uint16_t macro_play_pos = 0;
+uint16_t macro_play_end = 0;
+uint8_t macro_taps[KEYBOARD_REPORT_KEYS]; // Tapped in the last report
+uint8_t macro_tap_count = 0;
+uint8_t macro_held[KEYBOARD_REPORT_KEYS]; // Pressed and not released yet
+uint8_t macro_held_count = 0;
+uint8_t macro_mods = 0;
+
+bool macro_restored = false;
+
+// Free a slot, moving the macros after it down the arena
+void macro_clear(uint8_t slot) {
+  macro_slot_t *cleared = &macro_slots[slot];
+  if (cleared->length == 0) {
+    return;
+  }
+  uint16_t end = cleared->start + cleared->length;
+  memmove(&macro_arena[cleared->start], &macro_arena[end], macro_arena_used - end);
+  for (uint8_t index = 0; index < MACRO_SLOTS; index++) {
+    if (macro_slots[index].start >= end && index != slot) {
+      macro_slots[index].start -= cleared->length;
+    }
+  }
+  macro_arena_used -= cleared->length;
+  cleared->start = macro_arena_used;
+  cleared->length = 0;
+}
+
+/*
+ * Dynamic macros: recording
+ */
+
+// Start recording into a slot, replacing what it had
+void macro_record_start(uint8_t slot) {
+  macro_clear(slot);
+  macro_slots[slot].start = macro_arena_used;
+  macro_recording_slot = slot;
+  macro_recording = true;
+  PLAY_SONG(macro_record_on_song);
+}
+
+void macro_record_stop(void) {
+  macro_recording = false;
+  PLAY_SONG(macro_record_off_song);
+}
+
+// Append the ops for a key going down or up
+void macro_record_usage(uint8_t usage, bool pressed) {
+  if (!macro_recording) {
+    return;
+  }
+  macro_slot_t *slot = &macro_slots[macro_recording_slot];
+
+  // Look for the press of a released key among the last ops. Only taps and
+  // presses of other regular keys may come after it: those don't depend on
+  // the key being held, unlike modifiers, so releasing it earlier is fine.
+  if (!pressed && !IS_MODIFIER_KEYCODE(usage)) {
+    uint16_t end = macro_arena_used;
+    for (uint8_t ops = 0; ops < MACRO_FOLD_LOOKBACK && end > slot->start; ops++) {
+      // Ops can be walked back from their end, as usages are never ops
+      bool two_bytes = end - slot->start >= 2 && macro_arena[end - 2] <= MACRO_OP_RELEASE;
+      uint16_t op = two_bytes ? end - 2 : end - 1;
+      if (!two_bytes) {
+        end = op;
+        continue;
       }
-      break;
-    default:
-      break;
+      if (macro_arena[op] == MACRO_OP_RELEASE || IS_MODIFIER_KEYCODE(macro_arena[op + 1])) {
+        break;
+      }
+      if (macro_arena[op + 1] == usage) {
+        macro_arena[op] = usage;
+        memmove(&macro_arena[op + 1], &macro_arena[op + 2], macro_arena_used - op - 2);
+        macro_arena_used--;
+        slot->length--;
+        return;
+      }
+      end = op;
+    }
+  }
+
+  if (macro_arena_used + 2 > MACRO_ARENA_SIZE) {
+    macro_record_stop();
+    return;
+  }
+  macro_arena[macro_arena_used++] = pressed ? MACRO_OP_PRESS : MACRO_OP_RELEASE;
+  macro_arena[macro_arena_used++] = usage;
+  slot->length += 2;
+}
+
+// Record every modifier of a 5-bit mod mask
+void macro_record_mods(uint8_t mods, bool pressed) {
+  for (uint8_t index = 0; index < 4; index++) {
+    if (mods & (1 << index)) {
+      macro_record_usage(KC_LEFT_CTRL + index + (mods & 0x10 ? 4 : 0), pressed); // 0x10 is the right hand
+    }
+  }
+}
+
+// Record the usages a key event sends, if any. Layer switches, leader
+// sequences and custom keycodes are left out.
+void macro_record(uint16_t keycode, keyrecord_t *record) {
+  uint8_t mods = 0;
+  uint16_t usage = KC_NO;
+  if (IS_QK_BASIC(keycode)) {
+    usage = keycode;
+  } else if (IS_QK_MODS(keycode)) {
+    mods = QK_MODS_GET_MODS(keycode);
+    usage = QK_MODS_GET_BASIC_KEYCODE(keycode);
+  } else if (IS_QK_MOD_TAP(keycode)) {
+    if (record->tap.count) {
+      usage = QK_MOD_TAP_GET_TAP_KEYCODE(keycode);
+    } else {
+      mods = QK_MOD_TAP_GET_MODS(keycode);
+    }
+  } else if (IS_QK_LAYER_TAP(keycode) && record->tap.count) {
+    usage = QK_LAYER_TAP_GET_TAP_KEYCODE(keycode);
+  }
+  // Only keyboard usages, not the system, media and mouse keys
+  if (usage != KC_NO && (usage < KC_A || (usage > KC_EXSEL && !IS_MODIFIER_KEYCODE(usage)))) {
+    usage = KC_NO;
+  }
+
+  bool pressed = record->event.pressed;
+  if (pressed) {
+    macro_record_mods(mods, true);
+  }
+  if (usage != KC_NO) {
+    macro_record_usage(usage, pressed);
+  }
+  if (!pressed) {
+    macro_record_mods(mods, false);
+  }
+}
+
+/*
+ * Dynamic macros: playback
+ */
+
+// Macros are played from housekeeping, one report per call, with as many taps
+// in each report as it has room for. Keys pressed in the same report reach
+// the host in usage order with NKRO and in slot order otherwise, so a report
+// only takes taps in ascending usage order, which is right for both. Presses
+// and releases of modifiers go in the report of the taps that follow them,
+// those of regular keys get a report of their own.
+
+void macro_hold(uint8_t usage) {
+  if (IS_MODIFIER_KEYCODE(usage)) {
+    add_mods(MOD_BIT(usage));
+    macro_mods |= MOD_BIT(usage);
+  } else if (macro_held_count < KEYBOARD_REPORT_KEYS) {
+    add_key(usage);
+    macro_held[macro_held_count++] = usage;
+  }
+}
+
+void macro_unhold(uint8_t usage) {
+  if (IS_MODIFIER_KEYCODE(usage)) {
+    del_mods(MOD_BIT(usage));
+    macro_mods &= ~MOD_BIT(usage);
+    return;
+  }
+  for (uint8_t index = 0; index < macro_held_count; index++) {
+    if (macro_held[index] == usage) {
+      del_key(usage);
+      macro_held[index] = macro_held[--macro_held_count];
+      return;
+    }
+  }
+}
+
+// Start playing a slot. Returns false if there is nothing to play.
+bool macro_play(uint8_t slot) {
+  if (macro_recording || macro_playing || macro_slots[slot].length == 0) {
+    return false;
+  }
+  macro_play_pos = macro_slots[slot].start;
+  macro_play_end = macro_play_pos + macro_slots[slot].length;
+  macro_playing = true;
+  return true;
+}
+
+// Stop playing, releasing whatever the macro left down
+void macro_play_stop(void) {
+  for (uint8_t index = 0; index < macro_tap_count; index++) {
+    del_key(macro_taps[index]);
+  }
+  for (uint8_t index = 0; index < macro_held_count; index++) {
+    del_key(macro_held[index]);
+  }
+  del_mods(macro_mods);
+  macro_tap_count = macro_held_count = macro_mods = 0;
+  send_keyboard_report();
+  macro_playing = false;
+}
+
+// Send the next report of the macro being played
+void macro_play_task(void) {
+  // The taps of the last report go up before anything else happens
+  if (macro_tap_count > 0) {
+    for (uint8_t index = 0; index < macro_tap_count; index++) {
+      del_key(macro_taps[index]);
+    }
+    macro_tap_count = 0;
+    send_keyboard_report();
+    return;
+  }
+  if (macro_play_pos >= macro_play_end) {
+    macro_play_stop();
+    return;
+  }
+
+  while (macro_play_pos < macro_play_end) {
+    uint8_t op = macro_arena[macro_play_pos];
+    if (op == MACRO_OP_PRESS || op == MACRO_OP_RELEASE) {
+      if (macro_tap_count > 0) {
+        break;
+      }
+      uint8_t usage = macro_arena[macro_play_pos + 1];
+      if (op == MACRO_OP_PRESS) {
+        macro_hold(usage);
+      } else {
+        macro_unhold(usage);
+      }
+      macro_play_pos += 2;
+      if (!IS_MODIFIER_KEYCODE(usage)) {
+        break;
+      }
+    } else {
+      bool ascending = macro_tap_count == 0 || op > macro_taps[macro_tap_count - 1];
+      if (!ascending || macro_held_count + macro_tap_count >= KEYBOARD_REPORT_KEYS) {
+        break;
+      }
+      add_key(op);
+      macro_taps[macro_tap_count++] = op;
+      macro_play_pos++;
+    }
+  }
+  send_keyboard_report();
+}
+
+/*
+ * Dynamic macros: persistence
+ */
+
+// Macros are only saved when asked to (see the leader sequences), to the user
+// EEPROM block right after the persistent state: a header with the length of
+// each slot, then their ops one after another. The header goes last, and its
+// check covers everything, so a save cut short reads back as no macros.
+
+#define MACRO_STORE_MAGIC 0x4D
+
+typedef struct {
+  uint8_t magic;
+  uint8_t check;
+  uint16_t lengths[MACRO_SLOTS];
+} macro_store_header_t;
+
+#define MACRO_STORE_DATA (USER_STORE_SIZE + sizeof(macro_store_header_t))
+#define MACRO_STORE_CAPACITY (MACRO_STORE_SIZE - sizeof(macro_store_header_t))
+
+// CRC-8 (polynomial 0x31) of some bytes, chained from a previous one
+uint8_t macro_store_crc(uint8_t crc, const uint8_t *bytes, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Save every slot that fits. Returns false if some did not.
+bool macro_save(void) {
+  if (macro_recording) {
+    return false;
+  }
+  macro_store_header_t header = { .magic = MACRO_STORE_MAGIC };
+  uint16_t offset = 0;
+  uint8_t crc = 0xFF;
+  bool saved_all = true;
+  for (uint8_t index = 0; index < MACRO_SLOTS; index++) {
+    macro_slot_t *slot = &macro_slots[index];
+    if (offset + slot->length > MACRO_STORE_CAPACITY) {
+      saved_all = false;
+      continue;
+    }
+    eeconfig_update_user_datablock(&macro_arena[slot->start], MACRO_STORE_DATA + offset, slot->length);
+    crc = macro_store_crc(crc, &macro_arena[slot->start], slot->length);
+    header.lengths[index] = slot->length;
+    offset += slot->length;
+  }
+  header.check = macro_store_crc(crc, (const uint8_t *)header.lengths, sizeof(header.lengths));
+  eeconfig_update_user_datablock(&header, USER_STORE_SIZE, sizeof(header));
+  return saved_all;
+}
+
+// Load the saved macros, if any, straight into the arena, unless something
+// was recorded already
+void macro_restore(void) {
+  if (macro_arena_used > 0) {
+    return;
+  }
+  macro_store_header_t header;
+  eeconfig_read_user_datablock(&header, USER_STORE_SIZE, sizeof(header));
+  if (header.magic != MACRO_STORE_MAGIC) {
+    return;
+  }
+  uint16_t total = 0;
+  for (uint8_t index = 0; index < MACRO_SLOTS; index++) {
+    total += header.lengths[index];
+  }
+  if (total > MACRO_STORE_CAPACITY) {
+    return;
+  }
+  eeconfig_read_user_datablock(macro_arena, MACRO_STORE_DATA, total);
+  uint8_t crc = macro_store_crc(0xFF, macro_arena, total);
+  if (macro_store_crc(crc, (const uint8_t *)header.lengths, sizeof(header.lengths)) != header.check) {
+    return;
+  }
+  for (uint8_t index = 0; index < MACRO_SLOTS; index++) {
+    macro_slots[index].start = macro_arena_used;
+    macro_slots[index].length = header.lengths[index];
+    macro_arena_used += header.lengths[index];
+  }
+}
+
+/*
+ * Dynamic macros: keys
+ */
+
+// Handle the macro keycodes and record the other keys. Any key pressed while a
+// macro plays stops it.
+bool macro_process(uint16_t keycode, keyrecord_t *record) {
+  if (macro_playing && record->event.pressed) {
+    macro_play_stop();
+  }
+
+  if (keycode >= REC_M1 && keycode <= REC_M4) {
+    if (record->event.pressed) {
+      uint8_t slot = keycode - REC_M1;
+      bool same = macro_recording && macro_recording_slot == slot;
+      if (macro_recording) {
+        macro_record_stop();
+      }
+      if (!same) {
+        macro_record_start(slot);
+      }
+    }
+    return false;
+  }
+  if (keycode >= PLY_M1 && keycode <= PLY_M4) {
+    if (record->event.pressed) {
+      macro_play(keycode - PLY_M1);
+    }
+    return false;
+  }
+
+  if (macro_recording && !leader_sequence_active()) {
+    macro_record(keycode, record);
+  }
+  return true;
+}
+
+// Load the saved macros on the first run, then play
+void macro_task(void) {
+  if (!macro_restored) {
+    macro_restore();
+    macro_restored = true;
+    return;
+  }
+  if (macro_playing) {
+    macro_play_task();
   }
 }
 
@@ -229,14 +1490,23 @@ bool leader_mode = false;
 
 // Macros for registering key sequences
 #define ONE_KEY_SEQUENCE(kc1, str) \
-  if (leader_sequence_one_key(kc1)) { SEND_STRING(str); return true; }
+  if (leader_sequence_one_key(kc1)) { SEND_STRING_PACKED(str); return true; }
 #define TWO_KEYS_SEQUENCE(kc1, kc2, str) \
-  if (leader_sequence_two_keys(kc1, kc2)) { SEND_STRING(str); return true; }
+  if (leader_sequence_two_keys(kc1, kc2)) { SEND_STRING_PACKED(str); return true; }
 #define THREE_KEYS_SEQUENCE(kc1, kc2, kc3, str) \
-  if (leader_sequence_three_keys(kc1, kc2, kc3)) { SEND_STRING(str); return true; }
+  if (leader_sequence_three_keys(kc1, kc2, kc3)) { SEND_STRING_PACKED(str); return true; }
+#define MACRO_SEQUENCE(kc1, kc2, slot) \
+  if (leader_sequence_two_keys(kc1, kc2)) { return macro_play(slot); }
 
 // The dictionary of sequences
 bool process_leader_sequence(void) {
+  // Uploaded sequences come first, so they can replace the ones below
+  const char *uploaded = leader_dict_find();
+  if (uploaded) {
+    send_string_packed(uploaded);
+    return true;
+  }
+
   // Lowercase acutes
   // E.g. leader + a ==> Right Alt+'+a ==> á
   ONE_KEY_SEQUENCE(KC_A, COMPOSE_KEY LOWER_ACUTE(X_A));
@@ -261,17 +1531,26 @@ bool process_leader_sequence(void) {
   THREE_KEYS_SEQUENCE(KC_LSFT, KC_A, KC_E, COMPOSE_KEY UPPER_UMLAUT(X_A));
   THREE_KEYS_SEQUENCE(KC_LSFT, KC_O, KC_E, COMPOSE_KEY UPPER_UMLAUT(X_O));
   THREE_KEYS_SEQUENCE(KC_LSFT, KC_O, KC_A, COMPOSE_KEY SS_TAP(X_O) SS_LSFT(SS_TAP(X_A)));
+  // Dynamic macros
+  // E.g. leader + m + 1 ==> play dynamic macro 1, leader + m + s ==> save them
+  MACRO_SEQUENCE(KC_M, KC_1, 0);
+  MACRO_SEQUENCE(KC_M, KC_2, 1);
+  MACRO_SEQUENCE(KC_M, KC_3, 2);
+  MACRO_SEQUENCE(KC_M, KC_4, 3);
+  if (leader_sequence_two_keys(KC_M, KC_S)) {
+    return macro_save();
+  }
 
   return false;
 }
 
 // Start leader mode hook
 void leader_start_user(void) {
-  if (!remote_rgb_mode) {
-    rgb_matrix_set_color_all(LEADER_RGB);
-  }
+  leader_dict_start();
   PLAY_SONG(leader_on_song);
   leader_mode = true;
+  remote_event_push(REMOTE_EVENT_LEADER_START, 0, 0);
+  rgb_frame_invalidate();
 }
 
 // End leader mode hook
@@ -283,6 +1562,9 @@ void leader_end_user(void) {
     PLAY_SONG(leader_ko_song);
   }
   leader_mode = false;
+  remote_event_push(REMOTE_EVENT_LEADER_END, success, 0);
+  rgb_frame_invalidate();
+  stack_check(STACK_CONTEXT_LEADER);
 }
 
 /*
@@ -302,13 +1584,117 @@ void set_or_revert_default_layer(uint16_t layer) {
     set_single_default_layer(layer);
     PLAY_SONG(sticky_on_song);
   }
+  remote_event_push(REMOTE_EVENT_STICKY, sticky_layer, 0);
 }
 
+/*
+ * Persistent state
+ */
+
+// Saved across reboots by the log of common/user_store.c
+enum user_state_values {
+  USER_STATE_STICKY_LAYER,
+  USER_STATE_REMOTE_RGB_MODE,
+  USER_STATE_RGB_EFFECT, // RGB_EFFECT_UPLOADED when showing the layer colors
+};
+
+void user_store_collect(user_state_t *state) {
+  state->values[USER_STATE_STICKY_LAYER] = sticky_layer;
+  state->values[USER_STATE_REMOTE_RGB_MODE] = remote_rgb_mode;
+  // The uploaded effect only lives in RAM, so it is not worth saving
+  bool builtin = rgb_matrix_get_mode() == RGB_MATRIX_CUSTOM_BYTECODE && rgb_effect_index < RGB_EFFECT_COUNT;
+  state->values[USER_STATE_RGB_EFFECT] = builtin ? rgb_effect_index : RGB_EFFECT_UPLOADED;
+}
+
+void user_store_apply(const user_state_t *state) {
+  if (state->values[USER_STATE_STICKY_LAYER] <= GAME_LAYER) {
+    sticky_layer = state->values[USER_STATE_STICKY_LAYER];
+    set_single_default_layer(sticky_layer);
+  }
+  if (state->values[USER_STATE_REMOTE_RGB_MODE]) {
+    memset(remote_rgb_buffer, 0, sizeof(remote_rgb_buffer));
+    remote_rgb_mode = true;
+  } else if (state->values[USER_STATE_RGB_EFFECT] < RGB_EFFECT_COUNT) {
+    rgb_effect_select(state->values[USER_STATE_RGB_EFFECT]);
+  }
+  rgb_frame_invalidate();
+}
+
+
+/*
+ * Key repeat
+ */
+
+// The curves of the arrows and of the page keys on each layer (see
+// common/key_repeat.c), the layers left out keeping the host autorepeat
+const uint8_t key_repeat_layers[][KEY_REPEAT_GROUP_COUNT] = {
+  [RAISE_LAYER] = { KEY_REPEAT_CURVE_ARROWS, KEY_REPEAT_CURVE_PAGES }
+};
+
+const uint8_t key_repeat_layer_count = ARRAY_SIZE(key_repeat_layers);
+
+
+/*
+ * Combos
+ */
+
+// Chords are matched by common/combos.c, out of the lists below
+
+// The keys that can be chorded, as their name and keycode
+#define COMBO_KEYS(X) \
+  X(CHORD_J, HR_J) \
+  X(CHORD_K, HR_K) \
+  X(CHORD_LOWER, LT_LOWER(KC_SPC)) \
+  X(CHORD_RAISE, LT_RAISE(KC_ENT))
+
+// The combos, as the mask of their keys and the keycode they send. MO()
+// keycodes switch layers while the chord is held.
+#define COMBOS(X, arg) \
+  X(arg, COMBO_BIT(CHORD_J) | COMBO_BIT(CHORD_K), KC_ESC) \
+  X(arg, COMBO_BIT(CHORD_LOWER) | COMBO_BIT(CHORD_RAISE), MO(HYPER_LAYER))
+
+COMBO_TABLES()
+
+bool pre_process_record_user(uint16_t keycode, keyrecord_t *record) {
+  // Chords would get in the way of playing MIDI notes
+  return combo_process(keycode, record, !midi_mode);
+}
+
+
 /*
  * Process custom keycodes
  */
 
 bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+  boot_time_record(&boot_times.first_key);
+  user_store_touch();
+  idle_touch();
+  leader_dict_record(keycode, record);
+
+  if (midi_mode && keycode != MIDI_MD && !midi_process(record)) {
+    return false;
+  }
+
+  if (record->event.pressed) {
+    rgb_hit_record(record->event.key);
+  }
+
+  uint8_t event_col = record->event.key.col | (record->event.pressed ? 0x80 : 0);
+  remote_event_push(REMOTE_EVENT_KEY, record->event.key.row, event_col);
+
+  if (!macro_process(keycode, record)) {
+    return false;
+  }
+
+  // Before the mouse keys, so that their presses stop a key repeat
+  if (!key_repeat_process(keycode, record)) {
+    return false;
+  }
+
+  if (!mouse_keys_process(keycode, record)) {
+    return false;
+  }
+
   switch (keycode) {
     // Sticky mode keycodes
     case LOWER:
@@ -337,6 +1723,18 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
         remote_rgb_toggle();
       }
       return false;
+    // Custom RGB effects
+    case NXT_FX:
+      if (record->event.pressed) {
+        rgb_effect_next();
+      }
+      return false;
+    // MIDI mode
+    case MIDI_MD:
+      if (record->event.pressed) {
+        midi_toggle();
+      }
+      return false;
   }
 
   return true;
@@ -346,11 +1744,22 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
  * Change specific key colors depending on layer
  */
 
-bool rgb_matrix_indicators_advanced_user(uint8_t led_min, uint8_t led_max) {
+// Recompute the whole frame from the current layer, leader and remote RGB state
+void rgb_frame_update(void) {
 
-  // Do not repaint if we are in a mode that overrides the default layer color
-  if (leader_mode || remote_rgb_mode) {
-    return false;
+  // The host colors take precedence over everything else
+  if (remote_rgb_mode) {
+    for (uint8_t index = 0; index < RGB_MATRIX_LED_COUNT; index++) {
+      RGB color = remote_rgb_buffer[index];
+      rgb_frame_set_color(index, color.r, color.g, color.b);
+    }
+    return;
+  }
+
+  // Leader mode paints the whole keyboard
+  if (leader_mode) {
+    rgb_frame_set_color_all(LEADER_RGB);
+    return;
   }
 
   // Get the current layer
@@ -364,27 +1773,105 @@ bool rgb_matrix_indicators_advanced_user(uint8_t led_min, uint8_t led_max) {
       uint8_t index = g_led_config.matrix_co[row][col];
       uint16_t keycode = keymap_key_to_keycode(layer, (keypos_t){col, row});
 
-      // Only paint keys that are within bounds and have LEDs
-      if (index >= led_min && index < led_max && index != NO_LED) {
+      // Only paint keys that have LEDs
+      if (index != NO_LED) {
 
         // Paint only keys that have something mapped to them using the current
         // layer color or the base layer color if they are transparent.
         switch(keycode) {
           case KC_NO:
-            rgb_matrix_set_color(index, RGB_BLACK);
+            rgb_frame_set_color(index, RGB_BLACK);
             break;
           case KC_TRNS:
-            rgb_matrix_set_color_by_layer(index, BASE_LAYER);
+            rgb_frame_set_color_by_layer(index, BASE_LAYER);
             break;
           default:
-            rgb_matrix_set_color_by_layer(index, layer);
+            rgb_frame_set_color_by_layer(index, layer);
             break;
         }
       }
     }
   }
+}
+
+// Render the LAYER_COLORS effect, pushing only the LEDs in the change set.
+// Returns right away when nothing changed since the last frame.
+bool rgb_frame_render(effect_params_t *params) {
+  RGB_MATRIX_USE_LIMITS(led_min, led_max);
+
+  // Leave the LEDs as they are while playing MIDI
+  if (midi_mode) {
+    return rgb_matrix_check_finished_leds(led_max);
+  }
 
-  return false;
+  // The driver buffers may hold anything after a mode change, push every LED
+  if (params->init) {
+    memset(rgb_frame_changes, 0xFF, sizeof(rgb_frame_changes));
+  }
+
+  // Advance the host animation and recompute the frame (if needed) once, at
+  // the start of the first render iteration
+  if (params->iter == 0) {
+    remote_rgb_anim_tick();
+    if (rgb_frame_dirty) {
+      rgb_frame_dirty = false;
+      rgb_frame_update();
+    }
+  }
+
+  // Push the changed LEDs within this iteration's range
+  for (uint8_t index = led_min; index < led_max; index++) {
+    uint8_t mask = 1 << (index % 8);
+    if (rgb_frame_changes[index / 8] & mask) {
+      rgb_frame_changes[index / 8] &= ~mask;
+      rgb_matrix_set_color(index, rgb_frame[index].r, rgb_frame[index].g, rgb_frame[index].b);
+    }
+  }
+
+  stack_check(STACK_CONTEXT_RGB);
+  return rgb_matrix_check_finished_leds(led_max);
+}
+
+// Repaint when either the active or the default layers change
+layer_state_t layer_state_set_user(layer_state_t state) {
+  rgb_frame_invalidate();
+  remote_event_push(REMOTE_EVENT_LAYER, get_highest_layer(state | default_layer_state), state);
+  return state;
+}
+
+layer_state_t default_layer_state_set_user(layer_state_t state) {
+  rgb_frame_invalidate();
+  remote_event_push(REMOTE_EVENT_LAYER, get_highest_layer(layer_state | state), layer_state);
+  return state;
+}
+
+/*
+ * Push pending events to the host
+ */
+
+void housekeeping_task_user(void) {
+  boot_time_record(&boot_times.first_scan);
+  combo_task();
+  key_repeat_task();
+  midi_events_flush();
+
+  // Push the current state right after the host subscribes
+  if (remote_events_snapshot) {
+    remote_events_snapshot = false;
+    remote_event_push(REMOTE_EVENT_LAYER, get_highest_layer(layer_state | default_layer_state), layer_state);
+    remote_event_push(REMOTE_EVENT_STICKY, sticky_layer, 0);
+    remote_event_push(REMOTE_EVENT_REMOTE_RGB, remote_rgb_mode, 0);
+    if (leader_mode) {
+      remote_event_push(REMOTE_EVENT_LEADER_START, 0, 0);
+    }
+  }
+
+  remote_events_flush();
+  remote_flush();
+  user_store_task();
+  macro_task();
+  stack_check(STACK_CONTEXT_MAIN_LOOP);
+  idle_task(true);
 }
 
 /*
@@ -434,7 +1921,7 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
 ),
 
 [RAISE_LAYER] = LAYOUT_moonlander(
-  _______, _______, _______, _______, _______, _______, _______,           _______, _______, _______, _______, _______, _______, _______,
+  _______, _______, _______, _______, _______, _______, _______,           _______, _______, MS_WHLU, _______, MS_WHLD, _______, _______,
   MEH_TAB, _______, MS_BTN2, MS_UP,   MS_BTN1, _______, _______,           _______, _______, CTL_PUP, KC_UP,   CTL_PDN, _______, _______,
   _______, _______, MS_LEFT, MS_DOWN, MS_RGHT, _______, _______,           _______, _______, KC_LEFT, KC_DOWN, KC_RGHT, _______, _______,
   _______, _______, _______, _______, _______, _______,                             _______, _______, _______, _______, _______, _______,
@@ -443,11 +1930,11 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
 ),
 
 [HYPER_LAYER] = LAYOUT_moonlander(
-  _______, _______, _______, _______, _______, _______, _______,           GAME,    _______, KC_7,    KC_8,    KC_9,    _______, QK_BOOT,
-  _______, KC_F13,  KC_F14,  KC_F15,  KC_F16,  _______, _______,           _______, _______, KC_4,    KC_5,    KC_6,    _______, REM_RGB,
-  _______, KC_F17,  KC_F18,  KC_F19,  KC_F20,  _______, _______,           _______, _______, KC_1,    KC_2,    KC_3,    _______, MU_TOGG,
+  _______, REC_M1,  REC_M2,  REC_M3,  REC_M4,  _______, _______,           GAME,    _______, KC_7,    KC_8,    KC_9,    _______, QK_BOOT,
+  _______, KC_F13,  KC_F14,  KC_F15,  KC_F16,  _______, _______,           _______, _______, KC_4,    KC_5,    KC_6,    NXT_FX,  REM_RGB,
+  _______, KC_F17,  KC_F18,  KC_F19,  KC_F20,  _______, _______,           _______, _______, KC_1,    KC_2,    KC_3,    MIDI_MD, MU_TOGG,
   _______, KC_F21,  KC_F22,  KC_F23,  KC_F24,  _______,                             _______, KC_0,    KC_COMM, KC_DOT,  _______, AU_TOGG,
-  _______, _______, _______, _______, KC_LABK,          _______,           _______,          KC_RABK, _______, _______, _______, _______,
+  PLY_M1,  PLY_M2,  PLY_M3,  PLY_M4,  KC_LABK,          _______,           _______,          KC_RABK, _______, _______, _______, _______,
                                       _______, _______, HYPER,             HYPER,   _______, _______
 ),
 
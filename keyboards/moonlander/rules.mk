@@ -1,4 +1,24 @@
 LEADER_ENABLE = yes
 CONSOLE_ENABLE = yes
 RAW_ENABLE = yes
-RGB_MATRIX_ENABLE = yes
\ No newline at end of file
+RGB_MATRIX_ENABLE = yes
+RGB_MATRIX_CUSTOM_USER = yes
+POINTING_DEVICE_ENABLE = yes
+POINTING_DEVICE_DRIVER = custom
+MIDI_ENABLE = yes
+
+# Code shared by the keyboards (common/, copied next to the keymap by
+# flake.nix)
+SRC += remote_hid.c mouse_keys.c key_repeat.c combos.c packed_string.c leader_dict.c user_store.c stack_usage.c boot_times.c idle.c
+
+# Call graphs for the size reports (see flake.nix). LTO builds only generate
+# code when linking, so the objects keep theirs too.
+ifeq ($(SIZE_REPORT), yes)
+  EXTRAFLAGS += -fcallgraph-info=su -ffat-lto-objects
+endif
+
+# Benchmark builds (see flake.nix). Without LTO, the callbacks keep their own
+# functions to count the cycles spent in.
+ifeq ($(BENCH), yes)
+  LTO_ENABLE = no
+endif
\ No newline at end of file
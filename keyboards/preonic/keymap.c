@@ -20,6 +20,16 @@
 #include QMK_KEYBOARD_H
 #include "version.h"
 #include "raw_hid.h"
+#include "remote_hid.h"
+#include "mouse_keys.h"
+#include "key_repeat.h"
+#include "combos.h"
+#include "packed_string.h"
+#include "leader_dict.h"
+#include "user_store.h"
+#include "stack_usage.h"
+#include "boot_times.h"
+#include "idle.h"
 
 
 /*
@@ -112,9 +122,22 @@ static float leader_ko_song[][2] = SONG(E__NOTE(_A5), HD_NOTE(_E4),);
  * Initialization code
  */
 
-void keyboard_post_init_user(void) {
+void keyboard_pre_init_user(void) {
+  boot_time_record(&boot_times.init_start);
+  stack_paint();
+}
+
+// Set up the underglow once the keyboard is already scanning, in the color of
+// the sticky layer restored at boot (if any)
+uint32_t deferred_init_user(uint32_t trigger_time, void *cb_arg) {
   rgblight_mode_noeeprom(RGBLIGHT_MODE_STATIC_LIGHT);
-  rgblight_setrgb(BASE_RGB);
+  layer_state_set_user(layer_state);
+  return 0;
+}
+
+void keyboard_post_init_user(void) {
+  defer_exec(1, deferred_init_user, NULL);
+  boot_time_record(&boot_times.init_end);
 }
 
 /*
@@ -140,29 +163,175 @@ void rgblight_restore_color(void) {
 
 bool remote_rgb_mode = false;
 
+// The colors set by the host. They are written to the underglow at most once
+// per frame, instead of refreshing the whole strip on every message.
+RGB remote_rgb_buffer[RGBLIGHT_LED_COUNT];
+bool remote_rgb_dirty = false;
+uint16_t remote_rgb_timer = 0;
+
+#define REMOTE_RGB_FRAME_MS 16
+
+// Request the buffer to be written to the underglow on the next frame
+void remote_rgb_invalidate(void) {
+  remote_rgb_dirty = true;
+}
+
+// Write the buffer to the underglow if it changed, at most once per frame
+void remote_rgb_flush(void) {
+  if (!remote_rgb_mode || !remote_rgb_dirty) {
+    return;
+  }
+  if (timer_elapsed(remote_rgb_timer) < REMOTE_RGB_FRAME_MS) {
+    return;
+  }
+  for (uint8_t index = 0; index < RGBLIGHT_LED_COUNT; index++) {
+    led[index].r = remote_rgb_buffer[index].r;
+    led[index].g = remote_rgb_buffer[index].g;
+    led[index].b = remote_rgb_buffer[index].b;
+  }
+  rgblight_set();
+  remote_rgb_dirty = false;
+  remote_rgb_timer = timer_read();
+}
+
 // Toggle the remote RGB mode on and off
+void remote_rgb_start(void) {
+  memset(remote_rgb_buffer, 0, sizeof(remote_rgb_buffer));
+  PLAY_SONG(remote_rgb_on_song);
+  remote_rgb_mode = true;
+  remote_rgb_invalidate();
+}
+
+void remote_rgb_stop(void) {
+  PLAY_SONG(remote_rgb_off_song);
+  remote_rgb_mode = false;
+  layer_state_set_user(layer_state);
+}
+
 void remote_rgb_toggle(void) {
   if(!remote_rgb_mode) {
-    rgblight_save_color(RGB_YELLOW);
-    rgblight_setrgb(RGB_YELLOW);
-    PLAY_SONG(remote_rgb_on_song);
-    remote_rgb_mode = true;
+    remote_rgb_start();
+    // Show the mode is on until the host sends some colors
+    for (uint8_t index = 0; index < RGBLIGHT_LED_COUNT; index++) {
+      remote_rgb_buffer[index] = (RGB){ RGB_YELLOW };
+    }
   } else {
-    PLAY_SONG(remote_rgb_off_song);
-    remote_rgb_mode = false;
+    remote_rgb_stop();
   }
 }
 
-// Handle incoming HID messages
-void raw_hid_receive(uint8_t *data, uint8_t length) {
+// Parse a SET_LEDS message and set a range of underglow LEDs
+void remote_rgb_set_leds(remote_message_t *message) {
+  remote_rgb_set_leds_t *request = &message->set_leds;
+  if (!remote_rgb_mode) {
+    return;
+  }
+  uint8_t first = request->first;
+  for (uint8_t i = 0; i < request->count && first + i < RGBLIGHT_LED_COUNT; i++) {
+    remote_color_t *color = &request->colors[i];
+    remote_rgb_buffer[first + i] = (RGB){ .r = color->r, .g = color->g, .b = color->b };
+  }
+  remote_rgb_invalidate();
+}
+
+// The underglow has no LED per key, so SET_COLOR lights the LED under the
+// column of each key, the columns being spread over the strip. The right half
+// of the matrix is in its lower rows.
+#define REMOTE_RGB_COLUMNS (MATRIX_COLS * 2)
+
+// Parse a SET_COLOR message and set the LEDs under its keys
+void remote_rgb_set_color(remote_message_t *message) {
+  remote_rgb_set_color_t *request = &message->set_color;
+  if (!remote_rgb_mode) {
+    return;
+  }
+  RGB color = { .r = request->color.r, .g = request->color.g, .b = request->color.b };
+  for (uint8_t i = 0; i < request->count; i++) {
+    uint8_t row = request->cells[i].row, col = request->cells[i].col;
+    if (row >= MATRIX_ROWS || col >= MATRIX_COLS) {
+      continue;
+    }
+    uint8_t column = row < MATRIX_ROWS / 2 ? col : MATRIX_COLS + col;
+    remote_rgb_buffer[column * RGBLIGHT_LED_COUNT / REMOTE_RGB_COLUMNS] = color;
+  }
+  remote_rgb_invalidate();
+}
+
+/*
+ * Sleep
+ */
+
+// The underglow goes dark while the host sleeps (RGBLIGHT_SLEEP), and comes
+// back with the colors of rgblight's own state: put ours back
+void suspend_wakeup_init_user(void) {
   if (remote_rgb_mode) {
-    raw_hid_send(data, length);
-    uint8_t r = data[0], g = data[1], b = data[2];
-    rgblight_save_color(r, g, b);
-    rgblight_setrgb(r, g, b);
+    remote_rgb_invalidate();
+  } else {
+    rgblight_restore_color();
+  }
+}
+
+// The underglow goes dark while idle too, unless the host drives it
+void idle_leds_off(void) {
+  if (!remote_rgb_mode) {
+    rgblight_setrgb(RGB_BLACK);
+  }
+}
+
+void idle_leds_on(void) {
+  if (!remote_rgb_mode) {
+    rgblight_restore_color();
   }
 }
 
+/*
+ * Remote ping
+ */
+
+// Reply to a PING message, adding the device time and message count (see
+// remote_ping_t)
+void remote_ping(remote_message_t *message) {
+  message->ping.time_ms = timer_read32();
+  message->ping.received = remote_messages_received;
+}
+
+/*
+ * Raw HID messages
+ */
+
+// The messages and their layouts are shared with the other keyboards (see
+// common/remote_hid.h), so the same host code drives both. The Preonic only
+// handles those below.
+
+void remote_rgb_start_message(remote_message_t *message) {
+  if (!remote_rgb_mode) {
+    remote_rgb_start();
+  }
+}
+
+void remote_rgb_stop_message(remote_message_t *message) {
+  if (remote_rgb_mode) {
+    remote_rgb_stop();
+  }
+}
+
+const remote_handler_t PROGMEM remote_handlers[REMOTE_KIND_COUNT] = {
+  [REMOTE_RGB_START] = remote_rgb_start_message,
+  [REMOTE_RGB_STOP] = remote_rgb_stop_message,
+  [REMOTE_RGB_SET_COLOR] = remote_rgb_set_color,
+  [REMOTE_RGB_SET_LEDS] = remote_rgb_set_leds,
+  [REMOTE_PING] = remote_ping,
+  [REMOTE_BOOT_TIMES] = remote_boot_times,
+  [REMOTE_LEADER_DICT] = leader_dict_message,
+  [REMOTE_STACK_USAGE] = remote_stack_usage,
+};
+
+void raw_hid_receive(uint8_t *data, uint8_t length) {
+  idle_touch();
+  remote_dispatch(data, length);
+  stack_check(STACK_CONTEXT_RAW_HID);
+}
+
 /*
  * Leader mode
  */
@@ -178,14 +347,21 @@ bool leader_mode = false;
 
 // Macros for registering key sequences
 #define ONE_KEY_SEQUENCE(kc1, str) \
-  if (leader_sequence_one_key(kc1)) { SEND_STRING(str); return true; }
+  if (leader_sequence_one_key(kc1)) { SEND_STRING_PACKED(str); return true; }
 #define TWO_KEYS_SEQUENCE(kc1, kc2, str) \
-  if (leader_sequence_two_keys(kc1, kc2)) { SEND_STRING(str); return true; }
+  if (leader_sequence_two_keys(kc1, kc2)) { SEND_STRING_PACKED(str); return true; }
 #define THREE_KEYS_SEQUENCE(kc1, kc2, kc3, str) \
-  if (leader_sequence_three_keys(kc1, kc2, kc3)) { SEND_STRING(str); return true; }
+  if (leader_sequence_three_keys(kc1, kc2, kc3)) { SEND_STRING_PACKED(str); return true; }
 
 // The dictionary of sequences
 bool process_leader_sequence(void) {
+  // Uploaded sequences come first, so they can replace the ones below
+  const char *uploaded = leader_dict_find();
+  if (uploaded) {
+    send_string_packed(uploaded);
+    return true;
+  }
+
   // leader + t ==> Ctrl+Shift+t
   ONE_KEY_SEQUENCE(KC_T, SS_LCTL(SS_LSFT(SS_TAP(X_T))));
   // leader + q ==> Alt+F4
@@ -222,6 +398,7 @@ bool process_leader_sequence(void) {
 
 // Start leader mode hook
 void leader_start_user(void) {
+  leader_dict_start();
   rgblight_setrgb(RGB_WHITE);
   PLAY_SONG(leader_on_song);
   leader_mode = true;
@@ -230,13 +407,18 @@ void leader_start_user(void) {
 // End leader mode hook
 void leader_end_user(void) {
   bool success = process_leader_sequence();
-  rgblight_restore_color();
+  if (remote_rgb_mode) {
+    remote_rgb_invalidate();
+  } else {
+    rgblight_restore_color();
+  }
   if (success) {
     PLAY_SONG(leader_ok_song);
   } else {
     PLAY_SONG(leader_ko_song);
   }
   leader_mode = false;
+  stack_check(STACK_CONTEXT_LEADER);
 }
 
 /*
@@ -258,11 +440,94 @@ void set_or_revert_default_layer(uint16_t layer) {
   }
 }
 
+/*
+ * Persistent state
+ */
+
+// Saved across reboots by the log of common/user_store.c
+enum user_state_values {
+  USER_STATE_STICKY_LAYER,
+  USER_STATE_REMOTE_RGB_MODE,
+};
+
+void user_store_collect(user_state_t *state) {
+  state->values[USER_STATE_STICKY_LAYER] = sticky_layer;
+  state->values[USER_STATE_REMOTE_RGB_MODE] = remote_rgb_mode;
+}
+
+void user_store_apply(const user_state_t *state) {
+  if (state->values[USER_STATE_STICKY_LAYER] <= HYPER_LAYER) {
+    sticky_layer = state->values[USER_STATE_STICKY_LAYER];
+    set_single_default_layer(sticky_layer);
+  }
+  if (state->values[USER_STATE_REMOTE_RGB_MODE]) {
+    memset(remote_rgb_buffer, 0, sizeof(remote_rgb_buffer));
+    remote_rgb_mode = true;
+    remote_rgb_invalidate();
+  } else {
+    layer_state_set_user(layer_state);
+  }
+}
+
+
+/*
+ * Key repeat
+ */
+
+// The curves of the arrows and of the page keys on each layer (see
+// common/key_repeat.c), the layers left out keeping the host autorepeat
+const uint8_t key_repeat_layers[][KEY_REPEAT_GROUP_COUNT] = {
+  [RAISE_LAYER] = { KEY_REPEAT_CURVE_ARROWS, KEY_REPEAT_CURVE_PAGES }
+};
+
+const uint8_t key_repeat_layer_count = ARRAY_SIZE(key_repeat_layers);
+
+
+/*
+ * Combos
+ */
+
+// Chords are matched by common/combos.c, out of the lists below
+
+// The keys that can be chorded, as their name and keycode
+#define COMBO_KEYS(X) \
+  X(CHORD_J, HR_J) \
+  X(CHORD_K, HR_K) \
+  X(CHORD_LOWER, LT_LOWER(KC_SPC)) \
+  X(CHORD_RAISE, LT_RAISE(KC_ENT))
+
+// The combos, as the mask of their keys and the keycode they send. MO()
+// keycodes switch layers while the chord is held.
+#define COMBOS(X, arg) \
+  X(arg, COMBO_BIT(CHORD_J) | COMBO_BIT(CHORD_K), KC_ESC) \
+  X(arg, COMBO_BIT(CHORD_LOWER) | COMBO_BIT(CHORD_RAISE), MO(HYPER_LAYER))
+
+COMBO_TABLES()
+
+bool pre_process_record_user(uint16_t keycode, keyrecord_t *record) {
+  return combo_process(keycode, record, true);
+}
+
+
 /*
  * Process custom keycodes
  */
 
 bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+  boot_time_record(&boot_times.first_key);
+  user_store_touch();
+  idle_touch();
+  leader_dict_record(keycode, record);
+
+  // Before the mouse keys, so that their presses stop a key repeat
+  if (!key_repeat_process(keycode, record)) {
+    return false;
+  }
+
+  if (!mouse_keys_process(keycode, record)) {
+    return false;
+  }
+
   switch (keycode) {
     // Sticky mode keycodes
     case LOWER:
@@ -328,6 +593,24 @@ layer_state_t layer_state_set_user(layer_state_t state) {
   return state;
 }
 
+/*
+ * Write the remote RGB colors once per frame
+ */
+
+void housekeeping_task_user(void) {
+  boot_time_record(&boot_times.first_scan);
+  combo_task();
+  key_repeat_task();
+  if (!leader_mode) {
+    remote_rgb_flush();
+    stack_check(STACK_CONTEXT_RGB);
+  }
+  remote_flush();
+  user_store_task();
+  stack_check(STACK_CONTEXT_MAIN_LOOP);
+  idle_task(true);
+}
+
 /*
  * Keymaps
  */
@@ -17,4 +17,7 @@
 #define PRODUCT_ID 0x5678
 
 #define RAW_USAGE_PAGE 0xFF60
-#define RAW_USAGE_ID 0x61
\ No newline at end of file
+#define RAW_USAGE_ID 0x61
+
+// At most a probe report and a reply go out per loop, keep the RAM for the rest
+#define REMOTE_QUEUE_SIZE 2
\ No newline at end of file
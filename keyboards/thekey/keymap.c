@@ -15,19 +15,218 @@
  */
 
 #include QMK_KEYBOARD_H
+#include "raw_hid.h"
+#include "remote_hid.h"
+#include "boot_times.h"
+#include "idle.h"
+
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#endif
 
 // LED intensity
 #define LED_HUE 63
 #define LED_INTENSITY 63
 
-// Runs just one time when the keyboard initializes
-void matrix_init_user(void) {
-  rgblight_mode(RGBLIGHT_MODE_STATIC_LIGHT);
+// Layers
+enum keyboard_layers {
+  BASE_LAYER,
+  PROBE_LAYER
+};
+
+// Custom keycodes
+enum custom_keycodes {
+  PROBE_OFF = SAFE_RANGE // Leave probe mode, in place of QK_BOOT while probing
+};
+
+/*
+ * Initialization code
+ */
+
+void keyboard_pre_init_user(void) {
+  boot_time_record(&boot_times.init_start);
+}
+
+// Set up the LEDs once the keyboard is already scanning, without touching the
+// EEPROM
+uint32_t deferred_init_user(uint32_t trigger_time, void *cb_arg) {
+  rgblight_mode_noeeprom(RGBLIGHT_MODE_STATIC_LIGHT);
   rgblight_sethsv_noeeprom(LED_HUE, 255, LED_INTENSITY);
+  return 0;
+}
+
+void keyboard_post_init_user(void) {
+  defer_exec(1, deferred_init_user, NULL);
+  boot_time_record(&boot_times.init_end);
+}
+
+/*
+ * Idle mode
+ */
+
+void idle_leds_off(void) {
+  rgblight_disable_noeeprom();
+}
+
+void idle_leds_on(void) {
+  rgblight_enable_noeeprom();
+}
+
+/*
+ * Latency probe mode
+ */
+
+// In probe mode, the keys send harmless keycodes and every key change is
+// timestamped right after the matrix scan, then pushed to the host over raw
+// HID. The host compares these timestamps with the time the key events reach
+// its input stack, which gives the USB and host side share of the latency.
+
+#define PROBE_MAX_EVENTS 4
+
+bool probe_mode = false;
+
+// Current time in microseconds, as precise as the platform allows
+uint32_t probe_timer_us(void) {
+#if defined(__AVR__)
+  // Timer 0 counts up in steps of 64 clock cycles and is reset every ms
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t ms = timer_read32();
+  uint8_t ticks = TCNT0;
+  if (TIFR0 & _BV(OCF0A)) { // The millisecond interrupt is pending
+    ms++;
+    ticks = TCNT0;
+  }
+  SREG = sreg;
+  return ms * 1000 + (uint32_t)ticks * 64 / (F_CPU / 1000000);
+#elif defined(PROTOCOL_CHIBIOS)
+  return TIME_I2US(chVTGetSystemTimeX());
+#else
+  return timer_read32() * 1000;
+#endif
+}
+
+// Key changes waiting to be sent, and the matrix state they were taken from
+remote_probe_event_t probe_events[PROBE_MAX_EVENTS];
+uint8_t probe_events_count = 0;
+matrix_row_t probe_matrix[MATRIX_ROWS];
+
+// Queue a key change for the host
+void probe_push(uint8_t row, uint8_t col, bool pressed, uint32_t time) {
+  if (probe_events_count == PROBE_MAX_EVENTS) {
+    return;
+  }
+  probe_events[probe_events_count++] = (remote_probe_event_t){
+    .row = row, .col = col, .pressed = pressed, .time_us = time
+  };
+}
+
+// Queue the pending key changes in a single PROBE_EVENTS message (see
+// remote_probe_events_t)
+void probe_flush(void) {
+  if (probe_events_count == 0) {
+    return;
+  }
+  remote_probe_events_t *report = &remote_queue_push(REMOTE_PROBE_EVENTS)->probe_events;
+  report->count = probe_events_count;
+  memcpy(report->events, probe_events, probe_events_count * sizeof(probe_events[0]));
+  probe_events_count = 0;
+}
+
+void probe_start(void) {
+  for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+    probe_matrix[row] = matrix_get_row(row);
+  }
+  probe_events_count = 0;
+  probe_mode = true;
+  layer_on(PROBE_LAYER);
+}
+
+void probe_stop(void) {
+  probe_mode = false;
+  layer_off(PROBE_LAYER);
+}
+
+// Reply to a PROBE_SYNC message with the device time, so the host can map it
+// to its own clock (see remote_probe_sync_t)
+void probe_sync(remote_message_t *message) {
+  message->probe_sync.time_us = probe_timer_us();
+}
+
+// Timestamp key changes as soon as the matrix has been scanned
+void matrix_scan_user(void) {
+  if (!probe_mode) {
+    return;
+  }
+  uint32_t time = probe_timer_us();
+  for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+    matrix_row_t current = matrix_get_row(row);
+    matrix_row_t changed = current ^ probe_matrix[row];
+    for (uint8_t col = 0; changed && col < MATRIX_COLS; col++) {
+      matrix_row_t mask = (matrix_row_t)1 << col;
+      if (changed & mask) {
+        probe_push(row, col, current & mask, time);
+        changed &= ~mask;
+      }
+    }
+    probe_matrix[row] = current;
+  }
+}
+
+// Send the key changes once the regular keyboard report is out
+void housekeeping_task_user(void) {
+  boot_time_record(&boot_times.first_scan);
+  if (probe_mode) {
+    probe_flush();
+  }
+  remote_flush();
+  // Probing needs every scan
+  idle_task(!probe_mode);
+}
+
+/*
+ * Raw HID messages
+ */
+
+// The messages and their layouts are shared with the other keyboards (see
+// common/remote_hid.h). TheKey only handles the probe and the boot times.
+
+void probe_start_message(remote_message_t *message) {
+  probe_start();
+}
+
+void probe_stop_message(remote_message_t *message) {
+  probe_stop();
+}
+
+const remote_handler_t PROGMEM remote_handlers[REMOTE_KIND_COUNT] = {
+  [REMOTE_PROBE_START] = probe_start_message,
+  [REMOTE_PROBE_STOP] = probe_stop_message,
+  [REMOTE_PROBE_SYNC] = probe_sync,
+  [REMOTE_BOOT_TIMES] = remote_boot_times,
+};
+
+void raw_hid_receive(uint8_t *data, uint8_t length) {
+  idle_touch();
+  remote_dispatch(data, length);
+}
+
+// Record the first key event for the boot times
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+  boot_time_record(&boot_times.first_key);
+  idle_touch();
+  if (keycode == PROBE_OFF) {
+    if (record->event.pressed) {
+      probe_stop();
+    }
+    return false;
+  }
+  return true;
 }
 
 // The keymap
 const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
-  [0] = LAYOUT(KC_PWR, KC_PWR, QK_BOOT)
+  [BASE_LAYER] = LAYOUT(KC_PWR, KC_PWR, QK_BOOT),
+  [PROBE_LAYER] = LAYOUT(KC_F23, KC_F24, PROBE_OFF)
 };
-
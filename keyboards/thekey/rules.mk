@@ -0,0 +1,12 @@
+RAW_ENABLE = yes
+DEFERRED_EXEC_ENABLE = yes
+
+# Code shared by the keyboards (common/, copied next to the keymap by
+# flake.nix)
+SRC += remote_hid.c boot_times.c idle.c
+
+# Call graphs for the size reports (see flake.nix). LTO builds only generate
+# code when linking, so the objects keep theirs too.
+ifeq ($(SIZE_REPORT), yes)
+  EXTRAFLAGS += -fcallgraph-info=su -ffat-lto-objects
+endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+ * Print how long a keyboard took to boot and accept input
+ *
+ * Usage: boot-times [-w] [device]
+ *
+ *   -w      Wait for the raw HID interface to show up first (e.g. right after
+ *           plugging the keyboard or switching a KVM to this host), and also
+ *           print how long that took from the host side
+ *   device  The hidraw device to use (found automatically by default)
+ *
+ * The keyboard records the time of each boot step since reset, and replies
+ * with them to a BOOT_TIMES message. Steps that did not happen yet (e.g. no
+ * key was pressed since boot) are shown as pending.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BOOT_TIME_PENDING 0xFFFFFFFF
+#define REPLY_TIMEOUT_MS 1000
+#define WAIT_PERIOD_US 10000
+
+static const char *steps[] = {
+  "init start", "init end", "USB configured", "first scan", "first key"
+};
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+int main(int argc, char **argv) {
+  bool wait = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "w")) != -1) {
+    switch (opt) {
+      case 'w':
+        wait = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-w] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  char path[64];
+  if (optind < argc) {
+    snprintf(path, sizeof(path), "%s", argv[optind]);
+    if (wait) {
+      uint64_t start = now_us();
+      while (access(path, R_OK | W_OK) != 0) {
+        usleep(WAIT_PERIOD_US);
+      }
+      printf("%-16s %8.1f ms (host side)\n", "device found", (now_us() - start) / 1000.0);
+    }
+  } else if (wait) {
+    uint64_t start = now_us();
+    while (!hidraw_find(path, sizeof(path))) {
+      usleep(WAIT_PERIOD_US);
+    }
+    printf("%-16s %8.1f ms (host side)\n", "device found", (now_us() - start) / 1000.0);
+  } else if (!hidraw_find(path, sizeof(path))) {
+    fprintf(stderr, "no raw HID device found\n");
+    return 1;
+  }
+
+  int device = hidraw_open(path);
+  if (device < 0) {
+    perror(path);
+    return 1;
+  }
+
+  uint8_t request[HIDRAW_REPORT_SIZE] = { REMOTE_BOOT_TIMES };
+  if (hidraw_send(device, request, sizeof(request)) < 0) {
+    perror("send");
+    return 1;
+  }
+
+  // Skip any event report pushed by the keyboard in the meantime
+  uint8_t reply[HIDRAW_REPORT_SIZE];
+  uint64_t deadline = now_us() + REPLY_TIMEOUT_MS * 1000;
+  for (;;) {
+    int64_t left_ms = ((int64_t)deadline - (int64_t)now_us()) / 1000;
+    int n = left_ms > 0 ? hidraw_recv(device, reply, left_ms) : 0;
+    if (n < 0) {
+      perror("recv");
+      return 1;
+    }
+    if (n == 0) {
+      fprintf(stderr, "no reply, is the firmware up to date?\n");
+      return 1;
+    }
+    if (reply[0] == REMOTE_BOOT_TIMES) {
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    uint32_t time = read_u32(&reply[1 + 4 * i]);
+    if (time == BOOT_TIME_PENDING) {
+      printf("%-16s %8s\n", steps[i], "pending");
+    } else {
+      printf("%-16s %8u ms\n", steps[i], time);
+    }
+  }
+
+  close(device);
+  return 0;
+}
@@ -0,0 +1,1104 @@
+/*
+ * Count the CPU cycles a Cortex-M4 firmware spends in its callbacks, running
+ * it under emulation with the peripherals stubbed out
+ *
+ * Usage: cortex-bench [-v] [-o report] [-f hz] [-w wait-states] [-k hz]
+ *                     [-l limit] [-s symbol]... [-t symbol]...
+ *                     firmware.elf scenario
+ *        cortex-bench -c previous-report report
+ *
+ *   -v          Print the cycles of every step of the scenario
+ *   -o report   Save the report, to compare it with a later one
+ *   -f hz       CPU clock (72 MHz by default, like the STM32F303)
+ *   -w states   Flash wait states (2 by default, for 72 MHz)
+ *   -k hz       ChibiOS system tick (CH_CFG_ST_FREQUENCY, 10 kHz by default),
+ *               only used to turn the sleeps into time
+ *   -l limit    Give up on a call after this many instructions (50 million by
+ *               default), printing where it got stuck
+ *   -s symbol   Also stub out this function, returning 0 right away
+ *   -t symbol   Also count the cycles spent in this function
+ *   -c          Compare two reports, printing what changed
+ *
+ * The firmware is loaded like the startup code would (variables initialized
+ * from flash), then keyboard_setup() and keyboard_init() run, and the scenario
+ * drives keyboard_task() like the main loop would, one line per step:
+ *
+ *   matrix 12 7      the size of the matrix (must come first)
+ *   scan 100         run keyboard_task() 100 times
+ *   press 2 1        press the key at row 2, column 1, then scan
+ *   release 2 1      release it, then scan
+ *   tap 2 1          press and release it, scanning after each
+ *   idle 250         scan until 250 ms went by, like holding a key
+ *   wait 250         let 250 ms go by without scanning
+ *   hid 0c 01 ff     call raw_hid_receive() with these bytes (zero padded to
+ *                    a 32 byte report)
+ *   call fn 1 2      call any function with up to 4 integer arguments
+ *   count fn         also count the cycles spent in this function, like -t
+ *
+ * Keys are pressed by writing the `matrix` array of QMK and stubbing
+ * matrix_scan(), so everything after the matrix runs for real: the action and
+ * tapping code, the keymap callbacks, the RGB matrix effects and so on. What
+ * talks to the outside is stubbed out (USB reports, I2C, sleeps), the EEPROM
+ * is emulated in memory and QMK timers follow the cycles counted. Interrupt
+ * handlers never run, so e.g. the audio callbacks only run when called.
+ *
+ * Unicorn does not count cycles, so they are estimated from a simple model of
+ * the Cortex-M4: one cycle per instruction, one more per memory access, two
+ * more per taken branch for the pipeline refill, the flash wait states on
+ * every jump to and read from flash (there is no data cache, and the prefetch
+ * buffer is assumed to hide them on sequential code), and the average time of
+ * the divisions. This is not exact but deterministic, so what matters is the
+ * change from one build to the next.
+ */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unicorn/unicorn.h>
+#include <unistd.h>
+
+#define FLASH_BASE 0x08000000
+#define FLASH_SIZE 0x100000
+#define CCM_BASE 0x10000000
+#define CCM_SIZE 0x10000
+#define SRAM_BASE 0x20000000
+#define SRAM_SIZE 0x40000
+#define PERIPH_BASE 0x40000000
+#define PERIPH_SIZE 0x20000000
+#define SYSTEM_BASE 0xE0000000
+#define SYSTEM_SIZE 0x100000
+#define DWT_CYCCNT 0xE0001004
+
+// Calls return to a `b .` in the system memory, where the emulation stops
+#define RETURN_BASE 0x1FFF0000
+#define RETURN_SIZE 0x1000
+
+#define BRANCH_REFILL 2
+#define DIVIDE_CYCLES 6   // 2 to 12 depending on the operands
+#define VFP_DIVIDE_CYCLES 13
+#define HID_REPORT_SIZE 32
+#define MAX_FRAMES 64
+#define MAX_TRACKED 32
+
+typedef struct {
+  char kind[8]; // "cycles", "calls" or "max"
+  char *name;
+  long value;
+} entry_t;
+
+typedef struct {
+  entry_t *entries;
+  int count;
+  int capacity;
+} report_t;
+
+static void add_entry(report_t *report, const char *kind, const char *name, long value) {
+  if (report->count == report->capacity) {
+    report->capacity = report->capacity ? report->capacity * 2 : 64;
+    report->entries = realloc(report->entries, report->capacity * sizeof(entry_t));
+  }
+  entry_t *entry = &report->entries[report->count++];
+  snprintf(entry->kind, sizeof(entry->kind), "%s", kind);
+  entry->name = strdup(name);
+  entry->value = value;
+}
+
+static long find_entry(const report_t *report, const char *kind, const char *name) {
+  for (int i = 0; i < report->count; i++) {
+    if (strcmp(report->entries[i].kind, kind) == 0 && strcmp(report->entries[i].name, name) == 0) {
+      return report->entries[i].value;
+    }
+  }
+  return -1;
+}
+
+static void *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *data = malloc(*size + 1);
+  if (fread(data, 1, *size, file) != *size) {
+    perror(path);
+    fclose(file);
+    free(data);
+    return NULL;
+  }
+  data[*size] = 0;
+  fclose(file);
+  return data;
+}
+
+/*
+ * Firmware
+ */
+
+typedef struct {
+  char *name;
+  uint32_t address; // Without the Thumb bit
+  uint32_t size;
+  bool function;
+  bool global;
+} symbol_t;
+
+static symbol_t *symbols = NULL;
+static int symbol_count = 0;
+
+static uc_engine *uc;
+
+// Find a symbol by name, preferring the global one
+static const symbol_t *find_symbol(const char *name) {
+  const symbol_t *found = NULL;
+  for (int i = 0; i < symbol_count; i++) {
+    if (strcmp(symbols[i].name, name) == 0 && (!found || symbols[i].global)) {
+      found = &symbols[i];
+    }
+  }
+  return found;
+}
+
+// Find the function an address is in, for the error messages
+static const char *function_at(uint32_t address, uint32_t *offset) {
+  for (int i = 0; i < symbol_count; i++) {
+    const symbol_t *symbol = &symbols[i];
+    if (symbol->function && address >= symbol->address && address < symbol->address + symbol->size) {
+      *offset = address - symbol->address;
+      return symbol->name;
+    }
+  }
+  *offset = address;
+  return "?";
+}
+
+static bool map(uint32_t base, uint32_t size) {
+  uc_err err = uc_mem_map(uc, base, size, UC_PROT_ALL);
+  if (err != UC_ERR_OK) {
+    fprintf(stderr, "cannot map 0x%08x: %s\n", base, uc_strerror(err));
+    return false;
+  }
+  return true;
+}
+
+// Load the segments of an ARM ELF file, and its symbols
+static bool load_elf(const char *path) {
+  size_t size;
+  uint8_t *data = read_file(path, &size);
+  if (!data) {
+    return false;
+  }
+  Elf32_Ehdr *header = (Elf32_Ehdr *)data;
+  if (size < sizeof(*header) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+      || header->e_ident[EI_CLASS] != ELFCLASS32 || header->e_machine != EM_ARM
+      || header->e_phoff + (size_t)header->e_phnum * sizeof(Elf32_Phdr) > size
+      || header->e_shoff + (size_t)header->e_shnum * sizeof(Elf32_Shdr) > size) {
+    fprintf(stderr, "%s: not an ARM ELF file\n", path);
+    return false;
+  }
+
+  // Load addresses are in flash, and differ from the run addresses for the
+  // initialized variables, which the startup code would copy to RAM
+  Elf32_Phdr *segments = (Elf32_Phdr *)(data + header->e_phoff);
+  for (int i = 0; i < header->e_phnum; i++) {
+    Elf32_Phdr *segment = &segments[i];
+    if (segment->p_type != PT_LOAD || segment->p_filesz == 0) {
+      continue;
+    }
+    if (segment->p_offset + segment->p_filesz > size
+        || uc_mem_write(uc, segment->p_paddr, data + segment->p_offset, segment->p_filesz) != UC_ERR_OK
+        || uc_mem_write(uc, segment->p_vaddr, data + segment->p_offset, segment->p_filesz) != UC_ERR_OK) {
+      fprintf(stderr, "%s: segment at 0x%08x is outside the memory of a STM32F3/F4\n", path, segment->p_vaddr);
+      return false;
+    }
+  }
+
+  Elf32_Shdr *sections = (Elf32_Shdr *)(data + header->e_shoff);
+  for (int i = 0; i < header->e_shnum; i++) {
+    if (sections[i].sh_type != SHT_SYMTAB) {
+      continue;
+    }
+    const char *names = (const char *)data + sections[sections[i].sh_link].sh_offset;
+    Elf32_Sym *table = (Elf32_Sym *)(data + sections[i].sh_offset);
+    size_t count = sections[i].sh_size / sizeof(Elf32_Sym);
+    symbols = calloc(count, sizeof(symbol_t));
+    for (size_t j = 0; j < count; j++) {
+      int type = ELF32_ST_TYPE(table[j].st_info);
+      if ((type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE) || table[j].st_name == 0
+          || table[j].st_shndx == SHN_UNDEF) {
+        continue;
+      }
+      symbols[symbol_count++] = (symbol_t){
+        .name = strdup(names + table[j].st_name),
+        .address = type == STT_FUNC ? table[j].st_value & ~1u : table[j].st_value,
+        .size = table[j].st_size,
+        .function = type == STT_FUNC,
+        .global = ELF32_ST_BIND(table[j].st_info) != STB_LOCAL,
+      };
+    }
+  }
+  free(data);
+  if (symbol_count == 0) {
+    fprintf(stderr, "%s: no symbols, cannot find the functions to call\n", path);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Cycles
+ */
+
+static uint64_t cycles = 0;
+static uint32_t next_pc = 0;
+static uint32_t cpu_hz = 72000000;
+static uint32_t tick_hz = 10000;
+static int wait_states = 2;
+static uint64_t clock_offset_us = 0; // Time that went by without cycles (sleeps, waits)
+
+// Extra cycles of each halfword of flash, plus one (0 when not decoded yet)
+static uint8_t flash_costs[FLASH_SIZE / 2];
+
+// Marks the halfwords of flash where a stub or a counted function starts
+static uint8_t flash_marks[FLASH_SIZE / 16];
+
+static bool in_flash(uint32_t address) {
+  return address - FLASH_BASE < FLASH_SIZE;
+}
+
+static uint64_t now_us(void) {
+  return clock_offset_us + cycles * 1000000 / cpu_hz;
+}
+
+// Extra cycles of the 32 bit instructions taking more than one
+static uint8_t instruction_cost(uint32_t address) {
+  uint16_t halfwords[2];
+  if (uc_mem_read(uc, address, halfwords, sizeof(halfwords)) != UC_ERR_OK) {
+    return 0;
+  }
+  if ((halfwords[0] & 0xFFD0) == 0xFB90 && (halfwords[1] & 0x00F0) == 0x00F0) {
+    return DIVIDE_CYCLES; // SDIV, UDIV
+  }
+  if ((halfwords[0] & 0xFFB0) == 0xEE80 && (halfwords[1] & 0x0F50) == 0x0A00) {
+    return VFP_DIVIDE_CYCLES; // VDIV.F32
+  }
+  if ((halfwords[0] & 0xFFBF) == 0xEEB1 && (halfwords[1] & 0x0FD0) == 0x0AC0) {
+    return VFP_DIVIDE_CYCLES; // VSQRT.F32
+  }
+  return 0;
+}
+
+static void mark(uint32_t address) {
+  if (in_flash(address)) {
+    uint32_t index = (address - FLASH_BASE) / 2;
+    flash_marks[index / 8] |= 1 << (index % 8);
+  }
+}
+
+static bool marked(uint32_t address) {
+  uint32_t index = (address - FLASH_BASE) / 2;
+  return flash_marks[index / 8] & (1 << (index % 8));
+}
+
+/*
+ * Stubs
+ */
+
+typedef uint32_t (*native_t)(const uint32_t *args);
+
+typedef struct {
+  uint32_t address;
+  const char *name;
+  native_t native;
+} stub_t;
+
+static stub_t *stubs = NULL;
+static int stub_count = 0;
+static bool halted = false;
+static bool matrix_changed = false;
+
+static uint8_t eeprom[8192];
+
+static uint32_t native_zero(const uint32_t *args) {
+  (void)args;
+  return 0;
+}
+
+// Report a change of the matrix written by the scenario
+static uint32_t native_matrix_scan(const uint32_t *args) {
+  (void)args;
+  bool changed = matrix_changed;
+  matrix_changed = false;
+  return changed;
+}
+
+static uint32_t native_timer_read(const uint32_t *args) {
+  (void)args;
+  return (now_us() / 1000) & 0xFFFF;
+}
+
+static uint32_t native_timer_read32(const uint32_t *args) {
+  (void)args;
+  return now_us() / 1000;
+}
+
+static uint32_t native_timer_elapsed(const uint32_t *args) {
+  return (now_us() / 1000 - args[0]) & 0xFFFF;
+}
+
+static uint32_t native_timer_elapsed32(const uint32_t *args) {
+  return (uint32_t)(now_us() / 1000) - args[0];
+}
+
+// The sleeps of wait_ms() and friends, which have no thread to switch to
+static uint32_t native_sleep(const uint32_t *args) {
+  clock_offset_us += (uint64_t)args[0] * 1000000 / tick_hz;
+  return 0;
+}
+
+static uint32_t native_halt(const uint32_t *args) {
+  char reason[64] = "?";
+  if (args[0]) {
+    uc_mem_read(uc, args[0], reason, sizeof(reason) - 1);
+  }
+  fprintf(stderr, "the firmware halted: %s\n", reason);
+  halted = true;
+  uc_emu_stop(uc);
+  return 0;
+}
+
+// The EEPROM functions of QMK, on an erased EEPROM in memory
+static bool eeprom_range(uint32_t address, uint32_t length) {
+  return address < sizeof(eeprom) && length <= sizeof(eeprom) - address;
+}
+
+static uint32_t eeprom_read(uint32_t address, uint32_t length) {
+  uint32_t value = 0;
+  if (eeprom_range(address, length)) {
+    memcpy(&value, &eeprom[address], length);
+  }
+  return value;
+}
+
+static void eeprom_write(uint32_t address, uint32_t value, uint32_t length) {
+  if (eeprom_range(address, length)) {
+    memcpy(&eeprom[address], &value, length);
+  }
+}
+
+static uint32_t native_eeprom_read_byte(const uint32_t *args) {
+  return eeprom_read(args[0], 1);
+}
+
+static uint32_t native_eeprom_read_word(const uint32_t *args) {
+  return eeprom_read(args[0], 2);
+}
+
+static uint32_t native_eeprom_read_dword(const uint32_t *args) {
+  return eeprom_read(args[0], 4);
+}
+
+static uint32_t native_eeprom_read_block(const uint32_t *args) {
+  if (eeprom_range(args[1], args[2])) {
+    uc_mem_write(uc, args[0], &eeprom[args[1]], args[2]);
+  }
+  return 0;
+}
+
+static uint32_t native_eeprom_write_byte(const uint32_t *args) {
+  eeprom_write(args[0], args[1], 1);
+  return 0;
+}
+
+static uint32_t native_eeprom_write_word(const uint32_t *args) {
+  eeprom_write(args[0], args[1], 2);
+  return 0;
+}
+
+static uint32_t native_eeprom_write_dword(const uint32_t *args) {
+  eeprom_write(args[0], args[1], 4);
+  return 0;
+}
+
+static uint32_t native_eeprom_write_block(const uint32_t *args) {
+  if (eeprom_range(args[1], args[2])) {
+    uc_mem_read(uc, args[0], &eeprom[args[1]], args[2]);
+  }
+  return 0;
+}
+
+// Functions replaced whenever the firmware has them
+static const struct {
+  const char *name;
+  native_t native;
+} default_stubs[] = {
+  // The matrix is written by the scenario
+  { "matrix_scan", native_matrix_scan },
+  { "matrix_init", native_zero },
+  // Time follows the cycles counted
+  { "timer_read", native_timer_read },
+  { "timer_read32", native_timer_read32 },
+  { "timer_elapsed", native_timer_elapsed },
+  { "timer_elapsed32", native_timer_elapsed32 },
+  { "chThdSleep", native_sleep },
+  { "chSysHalt", native_halt },
+  // The EEPROM is emulated
+  { "eeprom_driver_init", native_zero },
+  { "eeprom_driver_erase", native_zero },
+  { "eeprom_read_byte", native_eeprom_read_byte },
+  { "eeprom_read_word", native_eeprom_read_word },
+  { "eeprom_read_dword", native_eeprom_read_dword },
+  { "eeprom_read_block", native_eeprom_read_block },
+  { "eeprom_write_byte", native_eeprom_write_byte },
+  { "eeprom_write_word", native_eeprom_write_word },
+  { "eeprom_write_dword", native_eeprom_write_dword },
+  { "eeprom_write_block", native_eeprom_write_block },
+  { "eeprom_update_byte", native_eeprom_write_byte },
+  { "eeprom_update_word", native_eeprom_write_word },
+  { "eeprom_update_dword", native_eeprom_write_dword },
+  { "eeprom_update_block", native_eeprom_write_block },
+  // Nothing is on the other end of the I2C bus, USB or the speaker
+  { "i2c_init", native_zero },
+  { "i2c_transmit", native_zero },
+  { "i2c_receive", native_zero },
+  { "i2c_transmit_and_receive", native_zero },
+  { "i2c_write_register", native_zero },
+  { "i2c_write_register16", native_zero },
+  { "i2c_read_register", native_zero },
+  { "i2c_read_register16", native_zero },
+  { "i2c_ping_address", native_zero },
+  { "host_keyboard_send", native_zero },
+  { "host_nkro_send", native_zero },
+  { "host_mouse_send", native_zero },
+  { "host_system_send", native_zero },
+  { "host_consumer_send", native_zero },
+  { "raw_hid_send", native_zero },
+  { "send_midi_packet", native_zero },
+  { "sendchar", native_zero },
+  { "audio_driver_initialize", native_zero },
+  { "audio_driver_start", native_zero },
+  { "audio_driver_stop", native_zero },
+};
+
+static bool add_stub(const char *name, native_t native, bool required) {
+  const symbol_t *symbol = find_symbol(name);
+  if (!symbol || !symbol->function) {
+    if (required) {
+      fprintf(stderr, "no function %s to stub out\n", name);
+    }
+    return !required;
+  }
+  stubs = realloc(stubs, (stub_count + 1) * sizeof(stub_t));
+  stubs[stub_count++] = (stub_t){ .address = symbol->address, .name = symbol->name, .native = native };
+  mark(symbol->address);
+  return true;
+}
+
+static const stub_t *find_stub(uint32_t address) {
+  for (int i = 0; i < stub_count; i++) {
+    if (stubs[i].address == address) {
+      return &stubs[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Counted functions
+ */
+
+typedef struct {
+  const char *name;
+  uint32_t address;
+  long calls;
+  uint64_t total;
+  uint64_t max;
+} tracked_t;
+
+typedef struct {
+  int tracked;
+  uint64_t start;
+  uint32_t return_address;
+  uint32_t sp;
+} frame_t;
+
+static tracked_t tracked[MAX_TRACKED];
+static int tracked_count = 0;
+static frame_t frames[MAX_FRAMES];
+static int frame_count = 0;
+
+static const char *default_tracked[] = {
+  "keyboard_task", "process_record_user", "rgb_matrix_indicators_advanced_user",
+  "raw_hid_receive", "housekeeping_task_user",
+};
+
+static bool add_tracked(const char *name, bool required) {
+  const symbol_t *symbol = find_symbol(name);
+  if (!symbol || !symbol->function) {
+    // Without LTO, the callbacks keep their own functions (see BENCH in the
+    // keymap rules.mk files)
+    fprintf(stderr, "%s: no such function%s\n", name, required ? "" : ", maybe inlined");
+    return !required;
+  }
+  if (tracked_count == MAX_TRACKED) {
+    fprintf(stderr, "too many functions to count\n");
+    return false;
+  }
+  tracked[tracked_count++] = (tracked_t){ .name = symbol->name, .address = symbol->address };
+  mark(symbol->address);
+  return true;
+}
+
+static uint32_t read_register(int reg) {
+  uint32_t value = 0;
+  uc_reg_read(uc, reg, &value);
+  return value;
+}
+
+static void write_register(int reg, uint32_t value) {
+  uc_reg_write(uc, reg, &value);
+}
+
+// Close the frames of the counted functions returning to an address. A
+// function tail calling another returns with it, so there can be several.
+static void close_frames(uint32_t address) {
+  uint32_t sp = read_register(UC_ARM_REG_SP);
+  while (frame_count > 0 && frames[frame_count - 1].return_address == address
+         && frames[frame_count - 1].sp == sp) {
+    frame_t *frame = &frames[--frame_count];
+    tracked_t *function = &tracked[frame->tracked];
+    uint64_t spent = cycles - frame->start;
+    function->calls++;
+    function->total += spent;
+    if (spent > function->max) {
+      function->max = spent;
+    }
+  }
+}
+
+// Run a stub, or open the frame of a counted function
+static void enter_function(uint32_t address) {
+  const stub_t *stub = find_stub(address);
+  if (stub) {
+    uint32_t args[4] = {
+      read_register(UC_ARM_REG_R0), read_register(UC_ARM_REG_R1),
+      read_register(UC_ARM_REG_R2), read_register(UC_ARM_REG_R3),
+    };
+    write_register(UC_ARM_REG_R0, stub->native(args));
+    write_register(UC_ARM_REG_PC, read_register(UC_ARM_REG_LR));
+    return;
+  }
+  for (int i = 0; i < tracked_count; i++) {
+    if (tracked[i].address == address && frame_count < MAX_FRAMES) {
+      frames[frame_count++] = (frame_t){
+        .tracked = i,
+        .start = cycles,
+        .return_address = read_register(UC_ARM_REG_LR) & ~1u,
+        .sp = read_register(UC_ARM_REG_SP),
+      };
+    }
+  }
+}
+
+static void on_code(uc_engine *engine, uint64_t address, uint32_t size, void *user_data) {
+  (void)engine;
+  (void)user_data;
+  uint32_t pc = address;
+  cycles++;
+  if (pc != next_pc) {
+    cycles += BRANCH_REFILL + (in_flash(pc) ? wait_states : 0);
+  }
+  next_pc = pc + size;
+  if (frame_count > 0 && frames[frame_count - 1].return_address == pc) {
+    close_frames(pc);
+  }
+  if (!in_flash(pc)) {
+    if (size == 4) {
+      cycles += instruction_cost(pc);
+    }
+    return;
+  }
+  uint8_t *cost = &flash_costs[(pc - FLASH_BASE) / 2];
+  if (*cost == 0) {
+    *cost = (size == 4 ? instruction_cost(pc) : 0) + 1;
+  }
+  cycles += *cost - 1;
+  if (marked(pc)) {
+    enter_function(pc);
+  }
+}
+
+static void on_memory(uc_engine *engine, uc_mem_type type, uint64_t address, int size, int64_t value,
+                      void *user_data) {
+  (void)engine;
+  (void)size;
+  (void)value;
+  (void)user_data;
+  cycles++;
+  if (type == UC_MEM_READ && in_flash(address)) {
+    cycles += wait_states;
+  }
+}
+
+static bool on_unmapped(uc_engine *engine, uc_mem_type type, uint64_t address, int size, int64_t value,
+                        void *user_data) {
+  (void)engine;
+  (void)size;
+  (void)value;
+  (void)user_data;
+  uint32_t offset;
+  const char *function = function_at(read_register(UC_ARM_REG_PC), &offset);
+  fprintf(stderr, "%s of unmapped memory at 0x%08x in %s+0x%x\n",
+          type == UC_MEM_WRITE_UNMAPPED ? "write" : type == UC_MEM_FETCH_UNMAPPED ? "fetch" : "read",
+          (uint32_t)address, function, offset);
+  return false;
+}
+
+// The peripherals read as zero and ignore writes, except the cycle counter
+// that busy waits poll
+static uint64_t on_periph_read(uc_engine *engine, uint64_t offset, unsigned size, void *user_data) {
+  (void)engine;
+  (void)size;
+  uint32_t base = (uint32_t)(uintptr_t)user_data;
+  if (base + offset == DWT_CYCCNT) {
+    return (uint32_t)cycles;
+  }
+  return 0;
+}
+
+static void on_periph_write(uc_engine *engine, uint64_t offset, unsigned size, uint64_t value,
+                            void *user_data) {
+  (void)engine;
+  (void)offset;
+  (void)size;
+  (void)value;
+  (void)user_data;
+}
+
+/*
+ * Calls
+ */
+
+static uint32_t stack_top;
+static uint64_t instruction_limit = 50000000;
+
+// Call a function with its arguments in registers, and up to `scratch_size`
+// bytes copied onto the stack first (passed as the first argument)
+static bool call(const char *name, uint32_t *args, int count, const void *scratch, uint32_t scratch_size) {
+  const symbol_t *symbol = find_symbol(name);
+  if (!symbol || !symbol->function) {
+    fprintf(stderr, "no function %s to call\n", name);
+    return false;
+  }
+  uint32_t sp = stack_top;
+  if (scratch) {
+    sp -= (scratch_size + 7) & ~7u;
+    uc_mem_write(uc, sp, scratch, scratch_size);
+    args[0] = sp;
+  }
+  static const int registers[] = { UC_ARM_REG_R0, UC_ARM_REG_R1, UC_ARM_REG_R2, UC_ARM_REG_R3 };
+  for (int i = 0; i < count && i < 4; i++) {
+    write_register(registers[i], args[i]);
+  }
+  write_register(UC_ARM_REG_SP, sp);
+  write_register(UC_ARM_REG_LR, RETURN_BASE | 1);
+  frame_count = 0;
+  halted = false;
+
+  uc_err err = uc_emu_start(uc, symbol->address | 1, RETURN_BASE, 0, instruction_limit);
+  uint32_t pc = read_register(UC_ARM_REG_PC);
+  if (err != UC_ERR_OK || halted || pc != RETURN_BASE) {
+    uint32_t offset;
+    const char *function = function_at(pc, &offset);
+    if (err != UC_ERR_OK) {
+      fprintf(stderr, "%s: %s in %s+0x%x\n", name, uc_strerror(err), function, offset);
+    } else if (!halted) {
+      fprintf(stderr, "%s: still running after %llu instructions, in %s+0x%x (stub it out with -s?)\n",
+              name, (unsigned long long)instruction_limit, function, offset);
+    }
+    return false;
+  }
+  // The emulation stops before running the return address
+  close_frames(RETURN_BASE);
+  return true;
+}
+
+static bool call_void(const char *name) {
+  uint32_t args[4] = { 0 };
+  return call(name, args, 0, NULL, 0);
+}
+
+/*
+ * Scenario
+ */
+
+static int matrix_rows = 0, matrix_cols = 0;
+static uint32_t matrix_address, matrix_row_size;
+static bool verbose = false;
+
+// Set or clear a key in the matrix, reporting the keycode of the base layer
+static bool set_key(int row, int col, bool pressed) {
+  if (matrix_rows == 0) {
+    fprintf(stderr, "the scenario must start with the size of the matrix\n");
+    return false;
+  }
+  if (row < 0 || row >= matrix_rows || col < 0 || col >= matrix_cols) {
+    fprintf(stderr, "no key at row %d, column %d\n", row, col);
+    return false;
+  }
+  uint32_t bits = 0;
+  uint32_t address = matrix_address + row * matrix_row_size;
+  uc_mem_read(uc, address, &bits, matrix_row_size);
+  bits = pressed ? bits | 1u << col : bits & ~(1u << col);
+  uc_mem_write(uc, address, &bits, matrix_row_size);
+  matrix_changed = true;
+
+  const symbol_t *keymaps = find_symbol("keymaps");
+  if (verbose && keymaps) {
+    uint16_t keycode = 0;
+    uc_mem_read(uc, keymaps->address + 2 * (row * matrix_cols + col), &keycode, sizeof(keycode));
+    printf("  %s key %d,%d (0x%04x)\n", pressed ? "press" : "release", row, col, keycode);
+  }
+  return true;
+}
+
+static bool scan(int count) {
+  for (int i = 0; i < count; i++) {
+    if (!call_void("keyboard_task")) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool run_step(char **words, int count) {
+  const char *command = words[0];
+  if (strcmp(command, "matrix") == 0 && count == 3) {
+    const symbol_t *matrix = find_symbol("matrix");
+    matrix_rows = atoi(words[1]);
+    matrix_cols = atoi(words[2]);
+    if (!matrix || matrix_rows <= 0 || matrix_cols <= 0 || matrix_cols > 32) {
+      fprintf(stderr, "no matrix of this size in the firmware\n");
+      return false;
+    }
+    matrix_address = matrix->address;
+    matrix_row_size = matrix_cols <= 8 ? 1 : matrix_cols <= 16 ? 2 : 4;
+    return true;
+  }
+  if (strcmp(command, "scan") == 0 && count <= 2) {
+    return scan(count == 2 ? atoi(words[1]) : 1);
+  }
+  if ((strcmp(command, "press") == 0 || strcmp(command, "release") == 0) && count == 3) {
+    return set_key(atoi(words[1]), atoi(words[2]), command[0] == 'p') && scan(1);
+  }
+  if (strcmp(command, "tap") == 0 && count == 3) {
+    int row = atoi(words[1]), col = atoi(words[2]);
+    return set_key(row, col, true) && scan(1) && set_key(row, col, false) && scan(1);
+  }
+  if (strcmp(command, "idle") == 0 && count == 2) {
+    uint64_t until = now_us() + strtoull(words[1], NULL, 10) * 1000;
+    while (now_us() < until) {
+      if (!scan(1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (strcmp(command, "wait") == 0 && count == 2) {
+    clock_offset_us += strtoull(words[1], NULL, 10) * 1000;
+    return true;
+  }
+  if (strcmp(command, "hid") == 0 && count >= 2 && count <= HID_REPORT_SIZE + 1) {
+    uint8_t report[HID_REPORT_SIZE] = { 0 };
+    for (int i = 1; i < count; i++) {
+      report[i - 1] = strtoul(words[i], NULL, 16);
+    }
+    uint32_t args[4] = { 0, HID_REPORT_SIZE };
+    return call("raw_hid_receive", args, 2, report, sizeof(report));
+  }
+  if (strcmp(command, "call") == 0 && count >= 2 && count <= 6) {
+    uint32_t args[4] = { 0 };
+    for (int i = 2; i < count; i++) {
+      args[i - 2] = strtoul(words[i], NULL, 0);
+    }
+    return call(words[1], args, count - 2, NULL, 0);
+  }
+  if (strcmp(command, "count") == 0 && count == 2) {
+    return add_tracked(words[1], true);
+  }
+  fprintf(stderr, "unknown step: %s\n", command);
+  return false;
+}
+
+static bool run_scenario(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[512];
+  int number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = 0;
+    }
+    char *words[HID_REPORT_SIZE + 2];
+    int count = 0;
+    for (char *word = strtok(line, " \t\n"); word && count < HID_REPORT_SIZE + 2; word = strtok(NULL, " \t\n")) {
+      words[count++] = word;
+    }
+    if (count == 0) {
+      continue;
+    }
+    uint64_t start = cycles;
+    if (!run_step(words, count)) {
+      fprintf(stderr, "%s:%d: step failed\n", path, number);
+      fclose(file);
+      return false;
+    }
+    if (verbose) {
+      printf("%s:%d: %s, %llu cycles\n", path, number, words[0], (unsigned long long)(cycles - start));
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/*
+ * Reports
+ */
+
+static bool save_report(const report_t *report, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  for (int i = 0; i < report->count; i++) {
+    const entry_t *entry = &report->entries[i];
+    fprintf(file, "%s %ld %s\n", entry->kind, entry->value, entry->name);
+  }
+  return fclose(file) == 0;
+}
+
+static bool load_report(report_t *report, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[1024], kind[8], name[512];
+  long value;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%7s %ld %511[^\n]", kind, &value, name) == 3) {
+      add_entry(report, kind, name, value);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// Print the cycles that changed between two reports
+static void compare(const report_t *previous, const report_t *current) {
+  bool changed = false;
+  for (int i = 0; i < current->count; i++) {
+    const entry_t *entry = &current->entries[i];
+    long before = find_entry(previous, entry->kind, entry->name);
+    if (strcmp(entry->kind, "calls") == 0 || before == entry->value) {
+      continue;
+    }
+    changed = true;
+    if (before < 0) {
+      printf("%-6s %10ld  %s (new)\n", entry->kind, entry->value, entry->name);
+    } else if (before == 0) {
+      printf("%-6s %+10ld  %s (0 -> %ld)\n", entry->kind, entry->value, entry->name, entry->value);
+    } else {
+      printf("%-6s %+10ld  %s (%ld -> %ld, %+.1f%%)\n", entry->kind, entry->value - before, entry->name,
+             before, entry->value, 100.0 * (entry->value - before) / before);
+    }
+  }
+  for (int i = 0; i < previous->count; i++) {
+    const entry_t *entry = &previous->entries[i];
+    if (strcmp(entry->kind, "calls") != 0 && find_entry(current, entry->kind, entry->name) < 0) {
+      changed = true;
+      printf("%-6s %10s  %s (removed)\n", entry->kind, "", entry->name);
+    }
+  }
+  if (!changed) {
+    printf("no changes\n");
+  }
+}
+
+static bool setup(const char *firmware) {
+  uc_err err = uc_open(UC_ARCH_ARM, UC_MODE_THUMB | UC_MODE_MCLASS, &uc);
+  if (err == UC_ERR_OK) {
+    err = uc_ctl_set_cpu_model(uc, UC_CPU_ARM_CORTEX_M4);
+  }
+  if (err != UC_ERR_OK) {
+    fprintf(stderr, "cannot emulate a Cortex-M4: %s\n", uc_strerror(err));
+    return false;
+  }
+  if (!map(FLASH_BASE, FLASH_SIZE) || !map(CCM_BASE, CCM_SIZE) || !map(SRAM_BASE, SRAM_SIZE)
+      || !map(RETURN_BASE, RETURN_SIZE)) {
+    return false;
+  }
+  static const uint16_t loop = 0xE7FE; // b .
+  uc_mem_write(uc, RETURN_BASE, &loop, sizeof(loop));
+  static const uint32_t regions[][2] = { { PERIPH_BASE, PERIPH_SIZE }, { SYSTEM_BASE, SYSTEM_SIZE } };
+  for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+    void *base = (void *)(uintptr_t)regions[i][0];
+    err = uc_mmio_map(uc, regions[i][0], regions[i][1], on_periph_read, base, on_periph_write, base);
+    if (err != UC_ERR_OK) {
+      fprintf(stderr, "cannot stub the peripherals at 0x%08x: %s\n", regions[i][0], uc_strerror(err));
+      return false;
+    }
+  }
+  if (!load_elf(firmware)) {
+    return false;
+  }
+  memset(eeprom, 0xFF, sizeof(eeprom));
+
+  // The main thread of ChibiOS runs on the process stack
+  const symbol_t *stack_end = find_symbol("__process_stack_end__");
+  stack_top = stack_end ? stack_end->address : SRAM_BASE + SRAM_SIZE;
+
+  uc_hook hook;
+  uc_hook_add(uc, &hook, UC_HOOK_CODE, on_code, NULL, 1, 0);
+  uc_hook_add(uc, &hook, UC_HOOK_MEM_READ | UC_HOOK_MEM_WRITE, on_memory, NULL, 1, 0);
+  uc_hook_add(uc, &hook, UC_HOOK_MEM_UNMAPPED, on_unmapped, NULL, 1, 0);
+  for (size_t i = 0; i < sizeof(default_stubs) / sizeof(default_stubs[0]); i++) {
+    add_stub(default_stubs[i].name, default_stubs[i].native, false);
+  }
+  for (size_t i = 0; i < sizeof(default_tracked) / sizeof(default_tracked[0]); i++) {
+    add_tracked(default_tracked[i], false);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL;
+  bool compare_reports = false;
+  const char *extra_stubs[64], *extra_tracked[MAX_TRACKED];
+  int extra_stub_count = 0, extra_tracked_count = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "vo:f:w:k:l:s:t:c")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = true;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        cpu_hz = strtoul(optarg, NULL, 10);
+        break;
+      case 'w':
+        wait_states = atoi(optarg);
+        break;
+      case 'k':
+        tick_hz = strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        instruction_limit = strtoull(optarg, NULL, 10);
+        break;
+      case 's':
+        if (extra_stub_count < 64) {
+          extra_stubs[extra_stub_count++] = optarg;
+        }
+        break;
+      case 't':
+        if (extra_tracked_count < MAX_TRACKED) {
+          extra_tracked[extra_tracked_count++] = optarg;
+        }
+        break;
+      case 'c':
+        compare_reports = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-v] [-o report] [-f hz] [-w wait-states] [-k hz] [-l limit]\n"
+                        "       %*s [-s symbol]... [-t symbol]... firmware.elf scenario\n"
+                        "       %s -c previous-report report\n",
+                argv[0], (int)strlen(argv[0]), "", argv[0]);
+        return 2;
+    }
+  }
+
+  if (compare_reports) {
+    if (argc - optind != 2) {
+      fprintf(stderr, "-c takes two reports\n");
+      return 2;
+    }
+    report_t previous = { 0 }, current = { 0 };
+    if (!load_report(&previous, argv[optind]) || !load_report(&current, argv[optind + 1])) {
+      return 1;
+    }
+    compare(&previous, &current);
+    return 0;
+  }
+
+  if (argc - optind != 2) {
+    fprintf(stderr, "a firmware and a scenario are needed\n");
+    return 2;
+  }
+  if (cpu_hz == 0 || tick_hz == 0) {
+    fprintf(stderr, "clocks cannot be zero\n");
+    return 2;
+  }
+  if (!setup(argv[optind])) {
+    return 1;
+  }
+  for (int i = 0; i < extra_stub_count; i++) {
+    if (!add_stub(extra_stubs[i], native_zero, true)) {
+      return 1;
+    }
+  }
+  for (int i = 0; i < extra_tracked_count; i++) {
+    if (!add_tracked(extra_tracked[i], true)) {
+      return 1;
+    }
+  }
+
+  report_t report = { 0 };
+  if (!call_void("keyboard_setup") || !call_void("keyboard_init")) {
+    return 1;
+  }
+  add_entry(&report, "cycles", "init", cycles);
+  uint64_t start = cycles;
+  for (int i = 0; i < tracked_count; i++) {
+    tracked[i].calls = tracked[i].total = tracked[i].max = 0;
+  }
+  if (!run_scenario(argv[optind + 1])) {
+    return 1;
+  }
+  add_entry(&report, "cycles", "scenario", cycles - start);
+
+  printf("%u MHz, %d flash wait states (estimated cycles, see cortex-bench.c)\n", cpu_hz / 1000000, wait_states);
+  printf("%-9s %12llu cycles\n", "init", (unsigned long long)start);
+  printf("%-9s %12llu cycles (%.1f ms)\n\n", "scenario", (unsigned long long)(cycles - start),
+         (cycles - start) * 1000.0 / cpu_hz);
+  printf("%-40s %8s %12s %10s %10s\n", "function", "calls", "total", "average", "max");
+  for (int i = 0; i < tracked_count; i++) {
+    const tracked_t *function = &tracked[i];
+    printf("%-40s %8ld %12llu %10llu %10llu\n", function->name, function->calls,
+           (unsigned long long)function->total,
+           (unsigned long long)(function->calls ? function->total / function->calls : 0),
+           (unsigned long long)function->max);
+    add_entry(&report, "calls", function->name, function->calls);
+    add_entry(&report, "cycles", function->name, function->total);
+    add_entry(&report, "max", function->name, function->max);
+  }
+
+  if (output && !save_report(&report, output)) {
+    return 1;
+  }
+  uc_close(uc);
+  return 0;
+}
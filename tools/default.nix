@@ -0,0 +1,18 @@
+{
+  stdenv,
+  pkg-config,
+  unicorn,
+  common,
+}:
+
+stdenv.mkDerivation {
+  pname = "qmk-playground-tools";
+  version = "0.1.0";
+  src = ./.;
+  nativeBuildInputs = [ pkg-config ];
+  buildInputs = [ unicorn ];
+  makeFlags = [
+    "PREFIX=$(out)"
+    "COMMON=${common}"
+  ];
+}
@@ -0,0 +1,464 @@
+/*
+ * A fake keyboard for testing the host tools without hardware
+ *
+ * Usage: fake-keyboard [-q] [-p]
+ *
+ *   -q  Do not print every message received from the host
+ *   -p  Be a Preonic instead of a Moonlander
+ *
+ * Creates a virtual USB device through /dev/uhid (usually requires root)
+ * exposing the same raw HID interface as the keyboards, and implements their
+ * raw HID protocol: remote RGB mode, SET_COLOR and SET_LEDS messages, event
+ * subscriptions, pings, boot times, leader dictionary uploads and VERSION. The
+ * host tools find it just like a real keyboard.
+ *
+ * As a Preonic, it only handles the messages the Preonic does (no events), and
+ * has its 9 underglow LEDs, SET_COLOR lighting the LED under the column of
+ * each key like the Preonic firmware.
+ *
+ * Sending SIGUSR1 toggles the remote RGB mode, like pressing REM_RGB, and
+ * SIGUSR2 prints the current LED colors.
+ */
+
+#include "remote_hid.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPORT_SIZE 32
+
+// The LEDs of the biggest board, one per key of the Moonlander
+#define MAX_LEDS 84
+
+// The kinds both keyboards handle below
+#define FAKE_KINDS                                                                      \
+  (1UL << REMOTE_RGB_START | 1UL << REMOTE_RGB_STOP | 1UL << REMOTE_RGB_SET_COLOR       \
+   | 1UL << REMOTE_RGB_SET_LEDS | 1UL << REMOTE_PING | 1UL << REMOTE_BOOT_TIMES         \
+   | 1UL << REMOTE_LEADER_DICT | 1UL << REMOTE_VERSION)
+
+typedef struct {
+  const char *name;
+  uint16_t vendor_id, product_id;
+  uint8_t rows, cols;
+  uint8_t leds;    // One per key, or the underglow
+  bool underglow;  // SET_COLOR lights the LED under the column of each key
+  uint32_t kinds;  // The kinds handled, for VERSION replies
+} board_t;
+
+static const board_t moonlander = {
+  .name = "moonlander",
+  .vendor_id = 0x3297,
+  .product_id = 0x1969,
+  .rows = 12,
+  .cols = 7,
+  .leds = 84,
+  .underglow = false,
+  .kinds = FAKE_KINDS | 1UL << REMOTE_EVENTS_SUBSCRIBE,
+};
+
+// The right half of the Preonic's matrix is in its lower rows
+static const board_t preonic = {
+  .name = "preonic",
+  .vendor_id = 0x03A8,
+  .product_id = 0xA649,
+  .rows = 10,
+  .cols = 6,
+  .leds = 9,
+  .underglow = true,
+  .kinds = FAKE_KINDS,
+};
+
+enum {
+  LEADER_DICT_BEGIN = 0,
+  LEADER_DICT_DATA,
+  LEADER_DICT_COMMIT,
+  LEADER_DICT_INFO,
+  LEADER_DICT_CLEAR
+};
+
+#define LEADER_DICT_SIZE 512
+#define LEADER_DICT_CHUNK 27
+
+// QMK's raw HID report descriptor
+static const uint8_t raw_hid_descriptor[] = {
+  0x06, 0x60, 0xFF, // Usage Page (0xFF60)
+  0x09, 0x61,       // Usage (0x61)
+  0xA1, 0x01,       // Collection (Application)
+  0x09, 0x62,       //   Usage (0x62)
+  0x15, 0x00,       //   Logical Minimum (0)
+  0x26, 0xFF, 0x00, //   Logical Maximum (255)
+  0x95, REPORT_SIZE,//   Report Count
+  0x75, 0x08,       //   Report Size (8)
+  0x81, 0x02,       //   Input (Data, Variable, Absolute)
+  0x09, 0x63,       //   Usage (0x63)
+  0x15, 0x00,       //   Logical Minimum (0)
+  0x26, 0xFF, 0x00, //   Logical Maximum (255)
+  0x95, REPORT_SIZE,//   Report Count
+  0x75, 0x08,       //   Report Size (8)
+  0x91, 0x02,       //   Output (Data, Variable, Absolute)
+  0xC0              // End Collection
+};
+
+static int uhid = -1;
+static bool verbose = true;
+static const board_t *board = &moonlander;
+
+static bool remote_rgb_mode = false;
+static uint8_t remote_rgb_buffer[MAX_LEDS][3];
+static uint8_t remote_events_mask = 0;
+static uint32_t messages_received = 0;
+static bool remote_version_mismatch = false;
+
+// Init start, init end, USB configured, first scan and first key, in ms since
+// the fake keyboard started. There are no keys, so the last one stays pending.
+static uint32_t boot_start = 0;
+static uint32_t boot_times[5] = { 0, UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+
+// The leader dictionary in use (version, length and CRC) and the upload staged
+static uint16_t leader_dict[3] = { 0 };
+static uint16_t leader_dict_upload[3] = { 0 };
+static uint8_t leader_dict_staging[LEADER_DICT_SIZE];
+static int leader_dict_received = -1;
+
+static volatile sig_atomic_t toggle_requested = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+static void on_signal(int signal) {
+  if (signal == SIGUSR1) {
+    toggle_requested = 1;
+  } else {
+    dump_requested = 1;
+  }
+}
+
+static int uhid_write(const struct uhid_event *ev) {
+  ssize_t ret = write(uhid, ev, sizeof(*ev));
+  return ret == sizeof(*ev) ? 0 : -1;
+}
+
+// Send a report to the host
+static void send_report(const uint8_t *data) {
+  struct uhid_event ev = { .type = UHID_INPUT2 };
+  ev.u.input2.size = REPORT_SIZE;
+  memcpy(ev.u.input2.data, data, REPORT_SIZE);
+  uhid_write(&ev);
+}
+
+// Push a single event to the host, if it subscribed to it
+static void push_event(uint8_t kind, uint8_t arg1, uint8_t arg2) {
+  if (!(remote_events_mask & (1 << kind))) {
+    return;
+  }
+  uint8_t report[REPORT_SIZE] = { REMOTE_EVENTS_REPORT, 1, kind, arg1, arg2 };
+  send_report(report);
+}
+
+static void remote_rgb_set(bool on) {
+  if (on) {
+    memset(remote_rgb_buffer, 0, sizeof(remote_rgb_buffer));
+  }
+  remote_rgb_mode = on;
+  push_event(REMOTE_EVENT_REMOTE_RGB, on, 0);
+  printf("remote_rgb %s\n", on ? "on" : "off");
+}
+
+// The LED of a key (-1 if it has none): its own, or the one under its column
+static int key_led(uint8_t row, uint8_t col) {
+  if (row >= board->rows || col >= board->cols) {
+    return -1;
+  }
+  if (board->underglow) {
+    int column = row < board->rows / 2 ? col : board->cols + col;
+    return column * board->leds / (2 * board->cols);
+  }
+  return row * board->cols + col;
+}
+
+// The LEDs, a line per matrix row (or a single line for the underglow)
+static void dump_leds(void) {
+  int width = board->underglow ? board->leds : board->cols;
+  for (int index = 0; index < board->leds; index++) {
+    uint8_t *c = remote_rgb_buffer[index];
+    printf("%02x%02x%02x%c", c[0], c[1], c[2], (index + 1) % width ? ' ' : '\n');
+  }
+}
+
+// The device time in milliseconds, like timer_read32 in the firmware
+static uint32_t timer_read32(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// CRC-16/CCITT-FALSE, like the firmware
+static uint16_t crc16(const uint8_t *bytes, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= bytes[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Handle a LEADER_DICT message like the firmware, without using the dictionary
+static void leader_dict_message(uint8_t *data) {
+  uint16_t arg1 = data[2] | data[3] << 8;
+  uint16_t arg2 = data[4] | data[5] << 8;
+  uint8_t status = 0;
+  switch (data[1]) {
+    case LEADER_DICT_BEGIN:
+      if (arg1 > LEADER_DICT_SIZE) {
+        status = 1;
+        break;
+      }
+      leader_dict_upload[0] = arg2;
+      leader_dict_upload[1] = arg1;
+      leader_dict_received = 0;
+      break;
+    case LEADER_DICT_DATA:
+      if (leader_dict_received != arg1 || data[4] > LEADER_DICT_CHUNK || arg1 + data[4] > leader_dict_upload[1]) {
+        status = 2;
+        break;
+      }
+      memcpy(&leader_dict_staging[arg1], &data[5], data[4]);
+      leader_dict_received += data[4];
+      break;
+    case LEADER_DICT_COMMIT:
+      if (leader_dict_received != leader_dict_upload[1]) {
+        status = 3;
+      } else if (crc16(leader_dict_staging, leader_dict_upload[1]) != arg1) {
+        status = 4;
+      } else {
+        leader_dict_upload[2] = arg1;
+        memcpy(leader_dict, leader_dict_upload, sizeof(leader_dict));
+        printf("leader dictionary: version %u, %u bytes\n", leader_dict[0], leader_dict[1]);
+      }
+      leader_dict_received = -1;
+      break;
+    case LEADER_DICT_INFO:
+      memcpy(&data[3], leader_dict, sizeof(leader_dict));
+      break;
+    case LEADER_DICT_CLEAR:
+      memset(leader_dict, 0, sizeof(leader_dict));
+      leader_dict_received = -1;
+      printf("leader dictionary: cleared\n");
+      break;
+    default:
+      status = 5;
+      break;
+  }
+  data[2] = status;
+  send_report(data);
+}
+
+// Handle a report sent by the host, like raw_hid_receive in the firmware
+static void handle_report(uint8_t *data) {
+  messages_received++;
+
+  if (verbose) {
+    printf("recv");
+    for (int i = 0; i < REPORT_SIZE; i++) {
+      printf(" %02x", data[i]);
+    }
+    printf("\n");
+  }
+
+  // Like remote_dispatch, ignore the kinds not handled, and reject everything
+  // after a VERSION from a host with another protocol version
+  if (data[0] >= REMOTE_KIND_COUNT || !(board->kinds & 1UL << data[0])) {
+    return;
+  }
+  if (data[0] == REMOTE_VERSION) {
+    remote_version_mismatch = data[1] != 0 && data[1] != REMOTE_PROTOCOL_VERSION;
+  }
+  if (remote_version_mismatch) {
+    uint8_t error[REPORT_SIZE] = { REMOTE_ERROR, data[0], REMOTE_ERROR_VERSION, REMOTE_PROTOCOL_VERSION };
+    send_report(error);
+    fflush(stdout);
+    return;
+  }
+
+  switch (data[0]) {
+    case REMOTE_RGB_START:
+      remote_rgb_set(true);
+      break;
+    case REMOTE_RGB_STOP:
+      remote_rgb_set(false);
+      break;
+    case REMOTE_RGB_SET_COLOR:
+      if (data[4] > 12) {
+        uint8_t error[REPORT_SIZE] = { REMOTE_ERROR, REMOTE_RGB_SET_COLOR, REMOTE_ERROR_TOO_MANY, REMOTE_PROTOCOL_VERSION };
+        send_report(error);
+      } else if (remote_rgb_mode) {
+        for (int i = 0; i < data[4]; i++) {
+          int led = key_led(data[8 + 2*i], data[9 + 2*i]);
+          if (led >= 0) {
+            memcpy(remote_rgb_buffer[led], &data[1], 3);
+          }
+        }
+      }
+      break;
+    case REMOTE_RGB_SET_LEDS:
+      if (data[2] > 9) {
+        uint8_t error[REPORT_SIZE] = { REMOTE_ERROR, REMOTE_RGB_SET_LEDS, REMOTE_ERROR_TOO_MANY, REMOTE_PROTOCOL_VERSION };
+        send_report(error);
+      } else if (remote_rgb_mode) {
+        for (int i = 0; i < data[2] && data[1] + i < board->leds; i++) {
+          memcpy(remote_rgb_buffer[data[1] + i], &data[3 + 3*i], 3);
+        }
+      }
+      break;
+    case REMOTE_EVENTS_SUBSCRIBE:
+      remote_events_mask = data[1];
+      push_event(REMOTE_EVENT_LAYER, 0, 0);
+      push_event(REMOTE_EVENT_STICKY, 0, 0);
+      push_event(REMOTE_EVENT_REMOTE_RGB, remote_rgb_mode, 0);
+      break;
+    case REMOTE_PING: {
+      uint32_t time = timer_read32();
+      memcpy(&data[8], &time, sizeof(time));
+      memcpy(&data[12], &messages_received, sizeof(messages_received));
+      send_report(data);
+      break;
+    }
+    case REMOTE_BOOT_TIMES:
+      memcpy(&data[1], boot_times, sizeof(boot_times));
+      send_report(data);
+      break;
+    case REMOTE_LEADER_DICT:
+      leader_dict_message(data);
+      break;
+    case REMOTE_VERSION: {
+      uint32_t kinds = board->kinds;
+      memset(&data[1], 0, REPORT_SIZE - 1);
+      data[1] = REMOTE_PROTOCOL_VERSION;
+      memcpy(&data[2], &kinds, sizeof(kinds));
+      data[6] = 4;
+      send_report(data);
+      break;
+    }
+    default:
+      break;
+  }
+  fflush(stdout);
+}
+
+static void handle_uhid_event(void) {
+  struct uhid_event ev;
+  ssize_t ret = read(uhid, &ev, sizeof(ev));
+  if (ret <= 0) {
+    return;
+  }
+
+  if (ev.type == UHID_START && boot_times[2] == UINT32_MAX) {
+    boot_times[2] = timer_read32() - boot_start;
+  } else if (ev.type == UHID_OUTPUT) {
+    // Unnumbered reports may come prefixed by a zero report id
+    uint8_t *data = ev.u.output.data;
+    size_t size = ev.u.output.size;
+    if (size == REPORT_SIZE + 1) {
+      data++;
+      size--;
+    }
+    uint8_t report[REPORT_SIZE] = { 0 };
+    memcpy(report, data, size < REPORT_SIZE ? size : REPORT_SIZE);
+    handle_report(report);
+  } else if (ev.type == UHID_GET_REPORT) {
+    struct uhid_event reply = { .type = UHID_GET_REPORT_REPLY };
+    reply.u.get_report_reply.id = ev.u.get_report.id;
+    reply.u.get_report_reply.err = EIO;
+    uhid_write(&reply);
+  } else if (ev.type == UHID_SET_REPORT) {
+    struct uhid_event reply = { .type = UHID_SET_REPORT_REPLY };
+    reply.u.set_report_reply.id = ev.u.set_report.id;
+    uhid_write(&reply);
+  }
+}
+
+int main(int argc, char **argv) {
+  boot_start = timer_read32();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "qp")) != -1) {
+    switch (opt) {
+      case 'q':
+        verbose = false;
+        break;
+      case 'p':
+        board = &preonic;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-q] [-p]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  uhid = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+  if (uhid < 0) {
+    perror("/dev/uhid");
+    return 1;
+  }
+
+  struct uhid_event create = { .type = UHID_CREATE2 };
+  snprintf((char *)create.u.create2.name, sizeof(create.u.create2.name), "qmk-playground fake %s", board->name);
+  memcpy(create.u.create2.rd_data, raw_hid_descriptor, sizeof(raw_hid_descriptor));
+  create.u.create2.rd_size = sizeof(raw_hid_descriptor);
+  create.u.create2.bus = BUS_USB;
+  create.u.create2.vendor = board->vendor_id;
+  create.u.create2.product = board->product_id;
+  if (uhid_write(&create) < 0) {
+    perror("UHID_CREATE2");
+    return 1;
+  }
+
+  struct sigaction sa = { .sa_handler = on_signal };
+  sigaction(SIGUSR1, &sa, NULL);
+  sigaction(SIGUSR2, &sa, NULL);
+
+  boot_times[1] = timer_read32() - boot_start;
+
+  printf("ready\n");
+  fflush(stdout);
+
+  struct pollfd pfd = { .fd = uhid, .events = POLLIN };
+  for (;;) {
+    if (toggle_requested) {
+      toggle_requested = 0;
+      remote_rgb_set(!remote_rgb_mode);
+      fflush(stdout);
+    }
+    if (dump_requested) {
+      dump_requested = 0;
+      dump_leds();
+      fflush(stdout);
+    }
+
+    if (boot_times[3] == UINT32_MAX) {
+      boot_times[3] = timer_read32() - boot_start;
+    }
+
+    int ready = poll(&pfd, 1, -1);
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+    if (ready > 0) {
+      handle_uhid_event();
+    }
+  }
+
+  struct uhid_event destroy = { .type = UHID_DESTROY };
+  uhid_write(&destroy);
+  close(uhid);
+  return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * Measure how fast a keyboard can take raw HID traffic
+ *
+ * Usage: hid-bench [-n count] [-w window] [-k kinds] [device]
+ *
+ *   -n count   The number of messages sent by each test (1000 by default)
+ *   -w window  The maximum number of pings in flight when measuring the
+ *              ping throughput (8 by default)
+ *   -k kinds   A comma separated list of the message kinds to benchmark,
+ *              among ping, set_color and set_leds (all by default)
+ *   device     The hidraw device to use (found automatically by default)
+ *
+ * First measures the round-trip latency of sequential PING messages, then
+ * the sustained rate at which the keyboard takes each message kind. PING
+ * replies carry the number of messages received by the keyboard, which is
+ * used to count the messages lost under load.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long to wait for a reply before considering a ping lost
+#define PING_TIMEOUT_MS 1000
+
+typedef struct {
+  uint32_t seq;
+  uint32_t device_time;
+  uint32_t device_received;
+} pong_t;
+
+static int device = -1;
+static uint32_t next_seq = 0;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void write_u32(uint8_t *data, uint32_t value) {
+  data[0] = value; data[1] = value >> 8; data[2] = value >> 16; data[3] = value >> 24;
+}
+
+static int send_ping(uint32_t seq) {
+  uint8_t report[HIDRAW_REPORT_SIZE] = { REMOTE_PING };
+  write_u32(&report[1], seq);
+  return hidraw_send(device, report, sizeof(report));
+}
+
+// Wait for the next ping reply. Returns 1 if one arrived, 0 on timeout and -1
+// on error. Any other report is skipped.
+static int recv_pong(pong_t *pong, int timeout_ms) {
+  uint64_t deadline = now_us() + (uint64_t)timeout_ms * 1000;
+  for (;;) {
+    uint64_t now = now_us();
+    if (now >= deadline) {
+      return 0;
+    }
+    uint8_t report[HIDRAW_REPORT_SIZE];
+    int length = hidraw_recv(device, report, (deadline - now + 999) / 1000);
+    if (length <= 0) {
+      return length;
+    }
+    if (length >= 16 && report[0] == REMOTE_PING) {
+      pong->seq = read_u32(&report[1]);
+      pong->device_time = read_u32(&report[8]);
+      pong->device_received = read_u32(&report[12]);
+      return 1;
+    }
+  }
+}
+
+// Send a ping and wait for its reply, discarding stale replies
+static int ping(pong_t *pong) {
+  uint32_t seq = next_seq++;
+  if (send_ping(seq) < 0) {
+    return -1;
+  }
+  int ret;
+  while ((ret = recv_pong(pong, PING_TIMEOUT_MS)) == 1 && pong->seq != seq) {
+  }
+  return ret;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t *sorted, int count, double p) {
+  int index = (int)(p / 100.0 * (count - 1) + 0.5);
+  return sorted[index] / 1000.0;
+}
+
+/*
+ * Tests
+ */
+
+// Round-trip latency of sequential pings
+static int bench_latency(int count) {
+  uint64_t *rtts = malloc(count * sizeof(uint64_t));
+  int received = 0, lost = 0;
+  uint32_t first_device_time = 0, last_device_time = 0;
+  uint64_t first_host_time = 0, last_host_time = 0;
+
+  for (int i = 0; i < count; i++) {
+    pong_t pong;
+    uint64_t start = now_us();
+    int ret = ping(&pong);
+    uint64_t end = now_us();
+    if (ret < 0) {
+      free(rtts);
+      return -1;
+    }
+    if (ret == 0) {
+      lost++;
+      continue;
+    }
+    if (received == 0) {
+      first_device_time = pong.device_time;
+      first_host_time = end;
+    }
+    last_device_time = pong.device_time;
+    last_host_time = end;
+    rtts[received++] = end - start;
+  }
+
+  printf("latency: %d pings, %d lost\n", count, lost);
+  if (received > 0) {
+    qsort(rtts, received, sizeof(uint64_t), compare_u64);
+    printf("  rtt ms: min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           percentile(rtts, received, 0), percentile(rtts, received, 50),
+           percentile(rtts, received, 90), percentile(rtts, received, 99),
+           percentile(rtts, received, 100));
+    printf("  elapsed ms: host %.1f  device %u\n",
+           (last_host_time - first_host_time) / 1000.0, last_device_time - first_device_time);
+  }
+
+  free(rtts);
+  return 0;
+}
+
+// Sustained ping rate, with up to window pings in flight
+static int bench_ping_throughput(int count, int window) {
+  int sent = 0, received = 0, in_flight = 0;
+  uint64_t start = now_us();
+
+  while (sent < count || in_flight > 0) {
+    while (in_flight < window && sent < count) {
+      if (send_ping(next_seq++) < 0) {
+        return -1;
+      }
+      sent++;
+      in_flight++;
+    }
+    pong_t pong;
+    int ret = recv_pong(&pong, PING_TIMEOUT_MS);
+    if (ret < 0) {
+      return -1;
+    }
+    if (ret == 0) {
+      // Whatever is still in flight is lost
+      in_flight = 0;
+      continue;
+    }
+    received++;
+    in_flight--;
+  }
+
+  double elapsed = (now_us() - start) / 1e6;
+  printf("ping: %d sent, %d lost, %.0f msgs/s (window %d)\n",
+         sent, sent - received, received / elapsed, window);
+  return 0;
+}
+
+// Sustained rate of one-way messages, bracketed by pings to count the
+// messages that actually reached the keyboard
+static int bench_one_way(const char *name, uint8_t kind, int count) {
+  uint8_t report[HIDRAW_REPORT_SIZE] = { kind };
+  if (kind == REMOTE_RGB_SET_COLOR) {
+    // A full message: 12 keys, cycling through the first rows of the matrix
+    report[4] = 12;
+    for (int i = 0; i < 12; i++) {
+      report[8 + 2 * i] = 1 + i / 6;
+      report[9 + 2 * i] = i % 6;
+    }
+  } else if (kind == REMOTE_RGB_SET_LEDS) {
+    // A full message: 9 LEDs from the first one
+    report[2] = 9;
+  }
+
+  uint8_t start_report[HIDRAW_REPORT_SIZE] = { REMOTE_RGB_START };
+  uint8_t stop_report[HIDRAW_REPORT_SIZE] = { REMOTE_RGB_STOP };
+  if (hidraw_send(device, start_report, sizeof(start_report)) < 0) {
+    return -1;
+  }
+
+  pong_t before, after;
+  if (ping(&before) != 1) {
+    fprintf(stderr, "%s: no reply to the initial ping\n", name);
+    return -1;
+  }
+
+  uint64_t start = now_us();
+  for (int i = 0; i < count; i++) {
+    // Change the color every message, so the keyboard has real work to do
+    if (kind == REMOTE_RGB_SET_COLOR) {
+      report[1] = i; report[2] = i >> 8; report[3] = ~i;
+    } else {
+      for (int b = 3; b < 3 + 27; b++) {
+        report[b] = i + b;
+      }
+    }
+    if (hidraw_send(device, report, sizeof(report)) < 0) {
+      return -1;
+    }
+  }
+  int ret = ping(&after);
+  double elapsed = (now_us() - start) / 1e6;
+
+  hidraw_send(device, stop_report, sizeof(stop_report));
+
+  if (ret != 1) {
+    fprintf(stderr, "%s: no reply to the final ping\n", name);
+    return -1;
+  }
+
+  // The final ping is counted by the keyboard as well
+  long delivered = (long)(after.device_received - before.device_received) - 1;
+  printf("%s: %d sent, %ld lost, %.0f msgs/s\n", name, count, count - delivered, count / elapsed);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int count = 1000;
+  int window = 8;
+  const char *kinds = "ping,set_color,set_leds";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:w:k:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      case 'k':
+        kinds = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n count] [-w window] [-k kinds] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (count <= 0 || window <= 0) {
+    fprintf(stderr, "invalid count or window\n");
+    return 2;
+  }
+
+  device = hidraw_open(optind < argc ? argv[optind] : NULL);
+  if (device < 0) {
+    perror("hidraw_open");
+    return 1;
+  }
+
+  if (bench_latency(count) < 0) {
+    perror("latency");
+    return 1;
+  }
+
+  char *list = strdup(kinds);
+  for (char *kind = strtok(list, ","); kind; kind = strtok(NULL, ",")) {
+    int ret;
+    if (strcmp(kind, "ping") == 0) {
+      ret = bench_ping_throughput(count, window);
+    } else if (strcmp(kind, "set_color") == 0) {
+      ret = bench_one_way(kind, REMOTE_RGB_SET_COLOR, count);
+    } else if (strcmp(kind, "set_leds") == 0) {
+      ret = bench_one_way(kind, REMOTE_RGB_SET_LEDS, count);
+    } else {
+      fprintf(stderr, "unknown message kind: %s\n", kind);
+      return 2;
+    }
+    if (ret < 0) {
+      perror(kind);
+      return 1;
+    }
+  }
+
+  free(list);
+  close(device);
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Listen to the events pushed by the Moonlander over raw HID
+ *
+ * Usage: hid-events [-k] [-m mask] [device]
+ *
+ *   -k       Also subscribe to key events
+ *   -m mask  Subscribe to an explicit event mask (see REMOTE_EVENT_KIND)
+ *   device   The hidraw device to use (found automatically by default)
+ *
+ * Each event is printed on its own line, prefixed by the host time in
+ * seconds. The keyboard unsubscribes when the listener exits.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MASK ((1 << REMOTE_EVENT_KEY) - 1)
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  (void)signal;
+  running = 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_event(double time, const uint8_t *event) {
+  printf("%.6f ", time);
+  switch (event[0]) {
+    case REMOTE_EVENT_LAYER:
+      printf("layer %u (state 0x%02x)\n", event[1], event[2]);
+      break;
+    case REMOTE_EVENT_STICKY:
+      printf("sticky %u\n", event[1]);
+      break;
+    case REMOTE_EVENT_LEADER_START:
+      printf("leader start\n");
+      break;
+    case REMOTE_EVENT_LEADER_END:
+      printf("leader end %s\n", event[1] ? "ok" : "ko");
+      break;
+    case REMOTE_EVENT_REMOTE_RGB:
+      printf("remote_rgb %s\n", event[1] ? "on" : "off");
+      break;
+    case REMOTE_EVENT_KEY:
+      printf("key %u,%u %s\n", event[1], event[2] & 0x7F, event[2] & 0x80 ? "down" : "up");
+      break;
+    default:
+      printf("unknown %u %u %u\n", event[0], event[1], event[2]);
+      break;
+  }
+}
+
+int main(int argc, char **argv) {
+  uint8_t mask = DEFAULT_MASK;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "km:")) != -1) {
+    switch (opt) {
+      case 'k':
+        mask |= 1 << REMOTE_EVENT_KEY;
+        break;
+      case 'm':
+        mask = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-k] [-m mask] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  int fd = hidraw_open(optind < argc ? argv[optind] : NULL);
+  if (fd < 0) {
+    perror("hidraw_open");
+    return 1;
+  }
+
+  uint8_t subscribe[] = { REMOTE_EVENTS_SUBSCRIBE, mask };
+  if (hidraw_send(fd, subscribe, sizeof(subscribe)) < 0) {
+    perror("hidraw_send");
+    return 1;
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  uint8_t report[HIDRAW_REPORT_SIZE];
+  while (running) {
+    int length = hidraw_recv(fd, report, 100);
+    if (length < 0) {
+      break;
+    }
+    if (length < 2 || report[0] != REMOTE_EVENTS_REPORT) {
+      continue;
+    }
+
+    double time = now();
+    uint8_t count = report[1] & 0x7F;
+    if (report[1] & 0x80) {
+      printf("%.6f dropped events\n", time);
+    }
+    for (uint8_t i = 0; i < count && 2 + 3 * i + 2 < length; i++) {
+      print_event(time, &report[2 + 3 * i]);
+    }
+    fflush(stdout);
+  }
+
+  uint8_t unsubscribe[] = { REMOTE_EVENTS_SUBSCRIBE, 0 };
+  hidraw_send(fd, unsubscribe, sizeof(unsubscribe));
+  close(fd);
+  return 0;
+}
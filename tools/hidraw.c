@@ -0,0 +1,121 @@
+/*
+ * Raw HID access to the keyboards in this repo through Linux hidraw devices
+ */
+
+#include "hidraw.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Check whether a HID report descriptor declares the QMK raw HID usage
+static bool hidraw_descriptor_matches(const uint8_t *desc, size_t size) {
+  uint32_t usage_page = 0;
+  size_t i = 0;
+  while (i < size) {
+    uint8_t prefix = desc[i++];
+
+    // Long items carry their own size and are never usages
+    if (prefix == 0xFE) {
+      if (i + 1 >= size) {
+        return false;
+      }
+      i += 2 + desc[i];
+      continue;
+    }
+
+    size_t length = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+    if (i + length > size) {
+      return false;
+    }
+    uint32_t value = 0;
+    for (size_t b = 0; b < length; b++) {
+      value |= (uint32_t)desc[i + b] << (8 * b);
+    }
+    i += length;
+
+    switch (prefix & 0xFC) {
+      case 0x04: // Usage page (global)
+        usage_page = value;
+        break;
+      case 0x08: // Usage (local)
+        if (length == 4) {
+          if (value == ((uint32_t)HIDRAW_USAGE_PAGE << 16 | HIDRAW_USAGE_ID)) {
+            return true;
+          }
+        } else if (usage_page == HIDRAW_USAGE_PAGE && value == HIDRAW_USAGE_ID) {
+          return true;
+        }
+        break;
+    }
+  }
+  return false;
+}
+
+bool hidraw_find(char *path, size_t size) {
+  DIR *dir = opendir("/sys/class/hidraw");
+  if (!dir) {
+    return false;
+  }
+
+  bool found = false;
+  struct dirent *entry;
+  while (!found && (entry = readdir(dir))) {
+    if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+      continue;
+    }
+
+    char desc_path[512];
+    snprintf(desc_path, sizeof(desc_path), "/sys/class/hidraw/%s/device/report_descriptor", entry->d_name);
+    FILE *file = fopen(desc_path, "rb");
+    if (!file) {
+      continue;
+    }
+    uint8_t desc[4096];
+    size_t length = fread(desc, 1, sizeof(desc), file);
+    fclose(file);
+
+    if (hidraw_descriptor_matches(desc, length)) {
+      snprintf(path, size, "/dev/%s", entry->d_name);
+      found = true;
+    }
+  }
+
+  closedir(dir);
+  return found;
+}
+
+int hidraw_open(const char *path) {
+  char found[64];
+  if (!path) {
+    if (!hidraw_find(found, sizeof(found))) {
+      errno = ENODEV;
+      return -1;
+    }
+    path = found;
+  }
+  return open(path, O_RDWR | O_CLOEXEC);
+}
+
+int hidraw_send(int fd, const uint8_t *data, size_t length) {
+  // The first byte is the report id, always 0 for the raw HID interface
+  uint8_t report[HIDRAW_REPORT_SIZE + 1] = { 0 };
+  if (length > HIDRAW_REPORT_SIZE) {
+    length = HIDRAW_REPORT_SIZE;
+  }
+  memcpy(&report[1], data, length);
+  return write(fd, report, sizeof(report)) == sizeof(report) ? 0 : -1;
+}
+
+int hidraw_recv(int fd, uint8_t *data, int timeout_ms) {
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  int ready = poll(&pfd, 1, timeout_ms);
+  if (ready <= 0) {
+    return ready;
+  }
+  return read(fd, data, HIDRAW_REPORT_SIZE);
+}
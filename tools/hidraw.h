@@ -0,0 +1,31 @@
+/*
+ * Raw HID access to the keyboards in this repo through Linux hidraw devices
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The size of a raw HID report (RAW_EPSIZE in QMK)
+#define HIDRAW_REPORT_SIZE 32
+
+// QMK's default raw HID usage page and usage id
+#define HIDRAW_USAGE_PAGE 0xFF60
+#define HIDRAW_USAGE_ID   0x61
+
+// Find the first hidraw device exposing the QMK raw HID interface. Returns
+// false if none was found.
+bool hidraw_find(char *path, size_t size);
+
+// Open a hidraw device, or the first raw HID interface found if path is NULL.
+// Returns a file descriptor, or -1 on error.
+int hidraw_open(const char *path);
+
+// Send a single report, padding it with zeroes up to HIDRAW_REPORT_SIZE
+int hidraw_send(int fd, const uint8_t *data, size_t length);
+
+// Wait up to timeout_ms (-1 to wait forever) for a report. Returns the number
+// of bytes read, 0 on timeout or -1 on error.
+int hidraw_recv(int fd, uint8_t *data, int timeout_ms);
@@ -0,0 +1,262 @@
+/*
+ * Simulate the key repeat of the keymaps and plot the taps per second
+ *
+ * Usage: key-repeat-sim [-i interval] [-w window] [-s svg-file]
+ *
+ *   -i interval  The USB polling interval in ms (1 by default)
+ *   -w window    The window the rate is measured over, in ms (250 by default)
+ *   -s svg-file  Also plot the taps per second over time of every curve while
+ *                holding a key to an SVG file
+ *
+ * Runs a few key press scenarios (holding a key for a long jump, holding it
+ * briefly and tapping it) through every repeat curve of common/key_repeat.c,
+ * built as is, and through a typical host autorepeat (600 ms delay, 25 taps
+ * per second) for comparison. Prints
+ * the taps sent so far and the rate over the last window after each report,
+ * as CSV lines of curve,scenario,time,taps,rate.
+ */
+
+#include "key_repeat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char *curve_names[] = { "host", "arrows", "precise", "pages" };
+
+#define CURVE_COUNT (KEY_REPEAT_CURVE_PAGES + 1)
+
+// A typical host autorepeat
+#define HOST_DELAY_MS 600
+#define HOST_RATE 25
+
+// A layer per curve, the curve of a layer being the one after it
+const uint8_t key_repeat_layers[][KEY_REPEAT_GROUP_COUNT] = {
+  { KEY_REPEAT_CURVE_ARROWS, KEY_REPEAT_CURVE_ARROWS },
+  { KEY_REPEAT_CURVE_PRECISE, KEY_REPEAT_CURVE_PRECISE },
+  { KEY_REPEAT_CURVE_PAGES, KEY_REPEAT_CURVE_PAGES }
+};
+const uint8_t key_repeat_layer_count = sizeof(key_repeat_layers) / sizeof(key_repeat_layers[0]);
+
+uint16_t key_repeat_sim_interval = 1;
+
+// The time of the simulation in ms, the layer keys are pressed on, and the
+// taps sent so far
+static uint32_t now = 0;
+static uint8_t layer = 0;
+static long taps_sent = 0;
+
+uint32_t timer_read32(void) {
+  return now;
+}
+
+uint32_t timer_elapsed32(uint32_t last) {
+  return now - last;
+}
+
+uint16_t timer_read(void) {
+  return now;
+}
+
+uint16_t timer_elapsed(uint16_t last) {
+  return (uint16_t)now - last;
+}
+
+uint8_t read_source_layers_cache(keypos_t key) {
+  return layer;
+}
+
+void register_code16(uint16_t keycode) {
+  taps_sent++;
+}
+
+void unregister_code16(uint16_t keycode) {}
+
+// Not used, mouse_keys.c is only built for its curves
+uint16_t pointing_device_get_hires_scroll_resolution(void) {
+  return 1;
+}
+
+// Press or release the down arrow
+static void key(bool pressed) {
+  keyrecord_t record = { .event = { .pressed = pressed, .time = now } };
+  if (key_repeat_process(KC_DOWN, &record)) {
+    taps_sent += pressed; // Left to the host
+  }
+}
+
+// The taps of the host autorepeat after holding a key for some time
+static long host_taps(uint32_t held) {
+  return 1 + (held >= HOST_DELAY_MS ? 1 + (held - HOST_DELAY_MS) * HOST_RATE / 1000 : 0);
+}
+
+// Whether the key is held at a given time of a scenario
+typedef struct {
+  const char *name;
+  uint32_t duration;
+  bool (*held)(uint32_t time);
+} scenario_t;
+
+// Holding for a long jump through a file
+static bool hold_long(uint32_t time) {
+  return time < 4000;
+}
+
+// Holding for a few lines
+static bool hold_short(uint32_t time) {
+  return time < 800;
+}
+
+// Five taps, as used to move a few steps
+static bool taps(uint32_t time) {
+  return time < 1000 && time % 200 < 80;
+}
+
+static const scenario_t scenarios[] = {
+  { "long", 5000, hold_long },
+  { "short", 1500, hold_short },
+  { "taps", 1500, taps }
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct {
+  uint32_t time;
+  long taps;
+  double rate;
+} sample_t;
+
+// Run a scenario through a curve, one report every interval ms, measuring
+// the rate over the last window ms
+static size_t simulate(uint8_t curve, const scenario_t *scenario, uint16_t interval, uint32_t window, sample_t *samples) {
+  key_repeat_sim_interval = interval;
+  layer = curve - 1;
+
+  // Let the repeat of the run before end
+  for (int i = 0; i < 100; i++) {
+    now += interval;
+    key_repeat_task();
+  }
+  uint32_t start = now + interval;
+
+  bool held = false;
+  uint32_t pressed_at = 0;
+  long host_before = 0;
+  taps_sent = 0;
+  size_t count = 0;
+  for (uint32_t time = 0; time <= scenario->duration; time += interval) {
+    now = start + time;
+    bool pressed = scenario->held(time);
+    if (curve == KEY_REPEAT_CURVE_HOST) {
+      if (pressed && !held) {
+        pressed_at = time;
+        host_before = taps_sent;
+      }
+      if (pressed) {
+        taps_sent = host_before + host_taps(time - pressed_at);
+      }
+    } else {
+      if (pressed != held) {
+        key(pressed);
+      }
+      key_repeat_task();
+    }
+    held = pressed;
+
+    // Taps since the sample one window ago
+    size_t reports = window / interval;
+    long before = count >= reports ? samples[count - reports].taps : 0;
+    samples[count] = (sample_t){ time, taps_sent, (taps_sent - before) * 1000.0 / (reports * interval) };
+    count++;
+  }
+  return count;
+}
+
+static const char *colors[] = { "#7f7f7f", "#1f77b4", "#d62728", "#2ca02c" };
+
+// Plot the taps per second over time while holding a key, one line per curve
+static int write_svg(const char *path, uint16_t interval, uint32_t window) {
+  FILE *svg = fopen(path, "w");
+  if (!svg) {
+    perror(path);
+    return -1;
+  }
+
+  const scenario_t *scenario = &scenarios[0];
+  const int width = 800, height = 500, margin = 50;
+  const double max_time = scenario->duration, max_rate = 120;
+  fprintf(svg, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"sans-serif\" font-size=\"12\">\n", width, height);
+  fprintf(svg, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+  fprintf(svg, "<path d=\"M%d %d V%d H%d\" stroke=\"black\" fill=\"none\"/>\n", margin, margin, height - margin, width - margin);
+  fprintf(svg, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">time held (ms, up to %.0f)</text>\n", width / 2, height - 15, max_time);
+  fprintf(svg, "<text x=\"15\" y=\"%d\" transform=\"rotate(-90 15 %d)\" text-anchor=\"middle\">taps per second (up to %.0f)</text>\n", height / 2, height / 2, max_rate);
+
+  sample_t *samples = malloc(sizeof(sample_t) * (scenario->duration / interval + 2));
+  for (size_t c = 0; c < CURVE_COUNT; c++) {
+    size_t count = simulate(c, scenario, interval, window, samples);
+    fprintf(svg, "<polyline fill=\"none\" stroke=\"%s\" points=\"", colors[c]);
+    for (size_t i = 0; i < count; i++) {
+      double px = margin + samples[i].time / max_time * (width - 2 * margin);
+      double py = height - margin - samples[i].rate / max_rate * (height - 2 * margin);
+      fprintf(svg, "%.1f,%.1f ", px, py < margin ? margin : py);
+    }
+    fprintf(svg, "\"/>\n");
+  }
+  free(samples);
+
+  // Legend
+  for (size_t c = 0; c < CURVE_COUNT; c++) {
+    int y = margin + 20 * c;
+    fprintf(svg, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"%s\"/>\n", margin + 20, y, margin + 50, y, colors[c]);
+    fprintf(svg, "<text x=\"%d\" y=\"%d\">%s</text>\n", margin + 55, y + 4, curve_names[c]);
+  }
+
+  fprintf(svg, "</svg>\n");
+  fclose(svg);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint16_t interval = 1;
+  int window = 250;
+  const char *svg_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:w:s:")) != -1) {
+    switch (opt) {
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      case 's':
+        svg_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-i interval] [-w window] [-s svg-file]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (interval < 1 || window < interval) {
+    fprintf(stderr, "the interval must be positive, and the window at least as long\n");
+    return 2;
+  }
+
+  printf("curve,scenario,time,taps,rate\n");
+  sample_t *samples = malloc(sizeof(sample_t) * (5000 / interval + 2));
+  for (size_t c = 0; c < CURVE_COUNT; c++) {
+    for (size_t s = 0; s < SCENARIO_COUNT; s++) {
+      size_t count = simulate(c, &scenarios[s], interval, window, samples);
+      for (size_t i = 0; i < count; i++) {
+        printf("%s,%s,%u,%ld,%.1f\n", curve_names[c], scenarios[s].name, samples[i].time, samples[i].taps, samples[i].rate);
+      }
+    }
+  }
+  free(samples);
+
+  if (svg_path && write_svg(svg_path, interval, window) < 0) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * The configuration of common/key_repeat.c in key-repeat-sim, included before
+ * it like the config.h of a keymap, with the USB polling interval chosen at
+ * run time. common/mouse_keys.c is only built for its curves.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+extern uint16_t key_repeat_sim_interval;
+
+#define USB_POLLING_INTERVAL_MS key_repeat_sim_interval
+#define MOUSE_KEYS_CURVE MOUSE_CURVE_LINEAR
+#define MOUSE_KEYS_INERTIA_MS 40
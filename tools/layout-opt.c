@@ -0,0 +1,818 @@
+/*
+ * Search better places for the symbols of the keymaps, from usage data
+ *
+ * Usage: layout-opt [-i iterations] [-j threads] [-s seed] [-t text]...
+ *                   [-e events]... keymap.c...
+ *
+ *   -i iterations  Swaps tried by each thread (2000000 by default)
+ *   -j threads     Annealing runs at once (one per core by default)
+ *   -s seed        Seed of the first run, so searches can be repeated
+ *   -t text        A text corpus, like code or prose typed on the keyboards
+ *   -e events      Key events, in the format of tapping-sweep (e.g. recorded
+ *                  from the keyboards)
+ *   keymap.c       The keymaps to improve (the Moonlander, Preonic and ErgoDox
+ *                  EZ ones, found by their LAYOUT macro)
+ *
+ * The symbols of the main blocks of LOWER and RAISE can move to any free key
+ * (or to the key of another symbol) of the main blocks of LOWER, RAISE and
+ * HYPER. Letters, numbers and everything else stay put. Each placement costs:
+ * - the effort of every key press: its finger, row and how far the finger
+ *   reaches out, plus holding the thumbs for its layer
+ * - same finger bigrams: two keys in a row on the same finger, more so the
+ *   more rows apart
+ * - going straight from LOWER to RAISE (or HYPER), switching thumbs
+ *
+ * Several simulated annealing runs search at once from different seeds, and
+ * the best placement found is printed as the LAYOUT blocks of the layers, to
+ * paste into the keymap.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ITEMS 256
+#define MAX_ARGS 96
+#define MAX_SLOTS 192
+#define MAX_MOVABLE 64
+#define MAX_THREADS 256
+
+#define SHIFT_EFFORT 0.5
+#define SFB_PENALTY 2.0
+#define LAYER_SWITCH_PENALTY 1.0
+#define START_TEMPERATURE 0.05
+#define END_TEMPERATURE 0.00001
+
+/*
+ * Usage
+ */
+
+static char item_names[MAX_ITEMS][16];
+static int item_count = 0;
+static double unigrams[MAX_ITEMS];
+static double bigrams[MAX_ITEMS][MAX_ITEMS];
+static double total_presses = 0, skipped_presses = 0;
+
+// The id of a keycode name without KC_
+static int item_id(const char *name) {
+  for (int i = 0; i < item_count; i++) {
+    if (strcmp(item_names[i], name) == 0) {
+      return i;
+    }
+  }
+  if (item_count == MAX_ITEMS || strlen(name) >= sizeof(item_names[0])) {
+    return -1;
+  }
+  snprintf(item_names[item_count], sizeof(item_names[0]), "%s", name);
+  return item_count++;
+}
+
+// The keycodes of the characters, and of the shifted keys of a US layout
+static const char *symbol_names[128] = {
+  ['!'] = "EXLM", ['@'] = "AT",   ['#'] = "HASH", ['$'] = "DLR",  ['%'] = "PERC",
+  ['^'] = "CIRC", ['&'] = "AMPR", ['*'] = "ASTR", ['('] = "LPRN", [')'] = "RPRN",
+  ['_'] = "UNDS", ['+'] = "PLUS", ['-'] = "MINS", ['='] = "EQL",  ['|'] = "PIPE",
+  [':'] = "COLN", ['"'] = "DQUO", ['<'] = "LABK", ['>'] = "RABK", ['?'] = "QUES",
+  ['['] = "LBRC", [']'] = "RBRC", ['{'] = "LCBR", ['}'] = "RCBR", ['~'] = "TILD",
+  ['`'] = "GRV",  [';'] = "SCLN", ['\''] = "QUOT", [','] = "COMM", ['.'] = "DOT",
+  ['/'] = "SLSH", ['\\'] = "BSLS", [' '] = "SPC", ['\n'] = "ENT", ['\t'] = "TAB",
+};
+
+static const char *shifted_keys[][2] = {
+  { "1", "EXLM" }, { "2", "AT" },    { "3", "HASH" },  { "4", "DLR" },   { "5", "PERC" },
+  { "6", "CIRC" }, { "7", "AMPR" },  { "8", "ASTR" },  { "9", "LPRN" },  { "0", "RPRN" },
+  { "MINS", "UNDS" }, { "EQL", "PLUS" }, { "LBRC", "LCBR" }, { "RBRC", "RCBR" },
+  { "BSLS", "PIPE" }, { "SCLN", "COLN" }, { "QUOT", "DQUO" }, { "COMM", "LABK" },
+  { "DOT", "RABK" }, { "SLSH", "QUES" }, { "GRV", "TILD" },
+};
+
+static bool is_symbol(const char *name) {
+  for (int c = 0; c < 128; c++) {
+    if (symbol_names[c] && strcmp(symbol_names[c], name) == 0) {
+      return c != ' ' && c != '\n' && c != '\t';
+    }
+  }
+  return false;
+}
+
+static int previous_item = -1;
+
+// Count a key press, or break the bigrams with -1. Shifted letters are
+// counted as the letters: the shift costs the same wherever the symbols go.
+static void count_press(int item) {
+  if (item < 0) {
+    previous_item = -1;
+    return;
+  }
+  unigrams[item]++;
+  total_presses++;
+  if (previous_item >= 0) {
+    bigrams[previous_item][item]++;
+  }
+  previous_item = item;
+}
+
+static bool read_text(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    char name[2] = { 0 };
+    if (c >= 'a' && c <= 'z') {
+      name[0] = c - 'a' + 'A';
+      count_press(item_id(name));
+    } else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+      name[0] = c;
+      count_press(item_id(name));
+    } else if (c < 128 && symbol_names[c]) {
+      count_press(item_id(symbol_names[c]));
+    } else if (c != '\r') {
+      skipped_presses++;
+      count_press(-1);
+    }
+  }
+  fclose(file);
+  previous_item = -1;
+  return true;
+}
+
+// Read key events, turning the shifted keys into the symbols they type
+static bool read_events(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[256], name[32], state[8];
+  double time;
+  int shifts = 0, number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    if (sscanf(line, "%lf %31s %7s", &time, name, state) != 3) {
+      fprintf(stderr, "%s:%d: expected a time, a key and down or up\n", path, number);
+      fclose(file);
+      return false;
+    }
+    const char *key = strncmp(name, "KC_", 3) == 0 ? name + 3 : name;
+    bool down = strcmp(state, "down") == 0;
+    if (strcmp(key, "LSFT") == 0 || strcmp(key, "RSFT") == 0) {
+      shifts += down ? 1 : -1;
+      continue;
+    }
+    if (!down) {
+      continue;
+    }
+    // Only count the keys that type something, not the modifiers or F keys
+    if (strlen(key) != 1 && !is_symbol(key) && strcmp(key, "SPC") != 0 && strcmp(key, "ENT") != 0
+        && strcmp(key, "TAB") != 0) {
+      count_press(-1);
+      continue;
+    }
+    if (shifts > 0) {
+      for (size_t i = 0; i < sizeof(shifted_keys) / sizeof(shifted_keys[0]); i++) {
+        if (strcmp(key, shifted_keys[i][0]) == 0) {
+          key = shifted_keys[i][1];
+          break;
+        }
+      }
+    }
+    count_press(item_id(key));
+  }
+  fclose(file);
+  previous_item = -1;
+  return true;
+}
+
+/*
+ * Keymaps
+ */
+
+enum { FINGER_PINKY = 0, FINGER_RING, FINGER_MIDDLE, FINGER_INDEX, FINGER_THUMB };
+
+static const double finger_efforts[] = { 1.6, 1.3, 1.0, 1.0, 1.0 };
+static const double row_efforts[] = { 1.0, 0.3, 0.0, 0.4, 0.6, 0.0 };
+
+enum { LAYER_BASE = 0, LAYER_LOWER, LAYER_RAISE, LAYER_HYPER, LAYER_COUNT };
+
+static const char *layer_names[] = { "BASE_LAYER", "LOWER_LAYER", "RAISE_LAYER", "HYPER_LAYER" };
+static const double layer_efforts[] = { 0.0, 0.6, 0.6, 1.6 };
+
+// Where a key of a LAYOUT macro is
+typedef struct {
+  int8_t row;    // 0 for the number row, 4 and more below the main block
+  int8_t col;    // From the left, -1 for the thumb clusters
+} geometry_t;
+
+typedef struct {
+  const char *macro;
+  int columns;   // Half of them on each hand
+  int arg_count;
+  geometry_t args[MAX_ARGS];
+} board_t;
+
+static board_t boards[3];
+
+static void add_row(board_t *board, int row, int from, int to) {
+  for (int col = from; col <= to; col++) {
+    board->args[board->arg_count++] = (geometry_t){ .row = row, .col = col };
+  }
+}
+
+static void init_boards(void) {
+  board_t *moonlander = &boards[0];
+  *moonlander = (board_t){ .macro = "LAYOUT_moonlander", .columns = 14 };
+  for (int row = 0; row < 3; row++) {
+    add_row(moonlander, row, 0, 13);
+  }
+  add_row(moonlander, 3, 0, 5);
+  add_row(moonlander, 3, 8, 13);
+  add_row(moonlander, 4, 0, 4);
+  add_row(moonlander, 4, 6, 7);
+  add_row(moonlander, 4, 9, 13);
+  add_row(moonlander, 5, -1, -1);
+  add_row(moonlander, 5, -1, -1);
+  add_row(moonlander, 5, -1, -1);
+  add_row(moonlander, 5, -1, -1);
+  add_row(moonlander, 5, -1, -1);
+  add_row(moonlander, 5, -1, -1);
+
+  board_t *preonic = &boards[1];
+  *preonic = (board_t){ .macro = "LAYOUT_preonic_2x2u", .columns = 12 };
+  for (int row = 0; row < 4; row++) {
+    add_row(preonic, row, 0, 11);
+  }
+  for (int i = 0; i < 10; i++) {
+    add_row(preonic, 4, -1, -1);
+  }
+
+  board_t *ergodox = &boards[2];
+  *ergodox = (board_t){ .macro = "LAYOUT_ergodox", .columns = 14 };
+  add_row(ergodox, 0, 0, 6);
+  add_row(ergodox, 1, 0, 6);
+  add_row(ergodox, 2, 0, 5);
+  add_row(ergodox, 3, 0, 6);
+  add_row(ergodox, 4, 0, 4);
+  for (int i = 0; i < 6; i++) {
+    add_row(ergodox, 5, -1, -1);
+  }
+  add_row(ergodox, 0, 7, 13);
+  add_row(ergodox, 1, 7, 13);
+  add_row(ergodox, 2, 8, 13);
+  add_row(ergodox, 3, 7, 13);
+  add_row(ergodox, 4, 9, 13);
+  for (int i = 0; i < 6; i++) {
+    add_row(ergodox, 5, -1, -1);
+  }
+}
+
+// A key of a layer, as written in the keymap
+typedef struct {
+  int layer;
+  int arg;
+  char name[24];  // Keycode without KC_, or the whole macro
+  long start;     // Offsets of the keycode in the keymap file
+  long end;
+} layout_key_t;
+
+// A key press on a board, for the costs
+typedef struct {
+  int hand;       // 0 left, 1 right, -1 thumbs
+  int finger;
+  int row;
+  int layer;
+  double effort;
+} position_t;
+
+typedef struct {
+  const char *path;
+  char *text;
+  const board_t *board;
+  long layer_starts[LAYER_COUNT], layer_ends[LAYER_COUNT];
+  layout_key_t keys[LAYER_COUNT][MAX_ARGS];
+  int key_counts[LAYER_COUNT];
+  // The search
+  int slot_count;
+  layout_key_t *slots[MAX_SLOTS];        // Free keys and keys of movable symbols
+  position_t slot_positions[MAX_SLOTS];
+  int movable_count;
+  int movable_items[MAX_MOVABLE];
+  int initial_slots[MAX_MOVABLE];
+  position_t fixed[MAX_ITEMS];    // Where the other items are typed
+  bool typed[MAX_ITEMS];
+  bool movable[MAX_ITEMS];
+} keymap_t;
+
+static position_t key_position(const keymap_t *keymap, int layer, int arg) {
+  const geometry_t *geometry = &keymap->board->args[arg];
+  int columns = keymap->board->columns;
+  position_t position = { .hand = -1, .finger = FINGER_THUMB, .row = geometry->row, .layer = layer };
+  if (geometry->col >= 0) {
+    int half = columns / 2;
+    position.hand = geometry->col >= half;
+    // Distance from the outer edge, the last one or two columns being the
+    // inner reach of the index finger
+    int from_edge = position.hand ? columns - 1 - geometry->col : geometry->col;
+    static const int fingers[] = { FINGER_PINKY, FINGER_PINKY, FINGER_RING, FINGER_MIDDLE,
+                                   FINGER_INDEX, FINGER_INDEX, FINGER_INDEX };
+    position.finger = fingers[from_edge];
+    double reach = from_edge == 0 ? 0.8 : from_edge == 5 ? 0.4 : from_edge == 6 ? 0.8 : 0;
+    position.effort = finger_efforts[position.finger] * (1 + row_efforts[geometry->row]) + reach;
+  } else {
+    position.effort = finger_efforts[FINGER_THUMB];
+  }
+  position.effort += layer_efforts[layer];
+  return position;
+}
+
+// Parse the LAYOUT arguments of a layer, from just after its opening paren
+static bool parse_layer(keymap_t *keymap, int layer, long start) {
+  const char *text = keymap->text;
+  long i = start;
+  int depth = 1, count = 0;
+  long arg_start = -1, arg_end = -1;
+  while (text[i] && depth > 0) {
+    if (text[i] == '/' && text[i + 1] == '/') {
+      while (text[i] && text[i] != '\n') {
+        i++;
+      }
+      continue;
+    }
+    char c = text[i];
+    if (c == '(') {
+      depth++;
+    } else if (c == ')') {
+      depth--;
+    }
+    if ((c == ',' && depth == 1) || depth == 0) {
+      if (arg_start >= 0) {
+        if (count == MAX_ARGS) {
+          return false;
+        }
+        layout_key_t *key = &keymap->keys[layer][count];
+        const char *name = text + arg_start;
+        int length = arg_end - arg_start;
+        if (length > 3 && strncmp(name, "KC_", 3) == 0) {
+          name += 3;
+          length -= 3;
+        }
+        snprintf(key->name, sizeof(key->name), "%.*s", length, name);
+        key->layer = layer;
+        key->arg = count++;
+        key->start = arg_start;
+        key->end = arg_end;
+      }
+      arg_start = -1;
+    } else if (c != ' ' && c != '\n' && c != '\t') {
+      if (arg_start < 0) {
+        arg_start = i;
+      }
+      arg_end = i + 1;
+    }
+    i++;
+  }
+  keymap->key_counts[layer] = count;
+  keymap->layer_ends[layer] = i;
+  return count == keymap->board->arg_count;
+}
+
+static bool read_keymap(keymap_t *keymap, const char *path) {
+  size_t size;
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  keymap->text = malloc(size + 1);
+  if (fread(keymap->text, 1, size, file) != size) {
+    perror(path);
+    fclose(file);
+    return false;
+  }
+  keymap->text[size] = 0;
+  fclose(file);
+  keymap->path = path;
+
+  for (int layer = 0; layer < LAYER_COUNT; layer++) {
+    char header[32];
+    snprintf(header, sizeof(header), "[%s] = LAYOUT", layer_names[layer]);
+    const char *found = strstr(keymap->text, header);
+    if (!found) {
+      fprintf(stderr, "%s: no %s\n", path, layer_names[layer]);
+      return false;
+    }
+    const char *macro = found + strlen(header) - strlen("LAYOUT");
+    for (size_t i = 0; i < sizeof(boards) / sizeof(boards[0]); i++) {
+      size_t length = strlen(boards[i].macro);
+      if (strncmp(macro, boards[i].macro, length) == 0 && macro[length] == '(') {
+        keymap->board = &boards[i];
+      }
+    }
+    if (!keymap->board) {
+      fprintf(stderr, "%s: unknown layout %.24s\n", path, macro);
+      return false;
+    }
+    keymap->layer_starts[layer] = found - keymap->text;
+    if (!parse_layer(keymap, layer, strchr(macro, '(') + 1 - keymap->text)) {
+      fprintf(stderr, "%s: %s does not have the %d keys of %s\n", path, layer_names[layer],
+              keymap->board->arg_count, keymap->board->macro);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool main_block(const keymap_t *keymap, int arg) {
+  const geometry_t *geometry = &keymap->board->args[arg];
+  return geometry->col >= 0 && geometry->row <= 3;
+}
+
+// Find the slots, the movable symbols and where everything else is typed
+static void prepare(keymap_t *keymap) {
+  for (int item = 0; item < item_count; item++) {
+    keymap->fixed[item].effort = INFINITY;
+  }
+  for (int layer = 0; layer < LAYER_COUNT; layer++) {
+    for (int arg = 0; arg < keymap->key_counts[layer]; arg++) {
+      layout_key_t *key = &keymap->keys[layer][arg];
+      position_t position = key_position(keymap, layer, arg);
+      bool movable = (layer == LAYER_LOWER || layer == LAYER_RAISE) && main_block(keymap, arg)
+                  && is_symbol(key->name);
+      bool free = layer != LAYER_BASE && main_block(keymap, arg) && strcmp(key->name, "_______") == 0;
+      if ((movable || free) && keymap->slot_count < MAX_SLOTS) {
+        int slot = keymap->slot_count++;
+        keymap->slots[slot] = key;
+        keymap->slot_positions[slot] = position;
+        int item = movable ? item_id(key->name) : -1;
+        if (item >= 0 && !keymap->movable[item] && keymap->movable_count < MAX_MOVABLE) {
+          keymap->movable[item] = true;
+          keymap->initial_slots[keymap->movable_count] = slot;
+          keymap->movable_items[keymap->movable_count++] = item;
+        }
+        continue;
+      }
+      // Layer taps type their tap keycode
+      const char *name = key->name;
+      const char *paren = strchr(name, '(');
+      char tap[24];
+      if (paren) {
+        snprintf(tap, sizeof(tap), "%s", paren + 1 + (strncmp(paren + 1, "KC_", 3) == 0 ? 3 : 0));
+        tap[strcspn(tap, ")")] = 0;
+        name = tap;
+      }
+      // HR_ home row mods type their letter
+      if (strncmp(name, "HR_", 3) == 0) {
+        name += 3;
+      }
+      int item = item_id(name);
+      if (item >= 0 && position.effort < keymap->fixed[item].effort) {
+        keymap->fixed[item] = position;
+      }
+    }
+  }
+  // Shifted symbols not on any layer are typed with shift
+  for (size_t i = 0; i < sizeof(shifted_keys) / sizeof(shifted_keys[0]); i++) {
+    int item = item_id(shifted_keys[i][1]), base = item_id(shifted_keys[i][0]);
+    if (item >= 0 && base >= 0 && !keymap->movable[item] && isinf(keymap->fixed[item].effort)
+        && !isinf(keymap->fixed[base].effort)) {
+      keymap->fixed[item] = keymap->fixed[base];
+      keymap->fixed[item].effort += SHIFT_EFFORT;
+    }
+  }
+  for (int item = 0; item < item_count; item++) {
+    keymap->typed[item] = keymap->movable[item] || !isinf(keymap->fixed[item].effort);
+  }
+}
+
+/*
+ * Costs
+ */
+
+static double pair_penalty(const position_t *a, const position_t *b) {
+  double penalty = 0;
+  if (a->hand >= 0 && a->hand == b->hand && a->finger == b->finger
+      && (a->row != b->row || a->layer != b->layer || a->effort != b->effort)) {
+    penalty += SFB_PENALTY * (1 + abs(a->row - b->row));
+  }
+  if (a->layer != b->layer && a->layer != LAYER_BASE && b->layer != LAYER_BASE) {
+    penalty += LAYER_SWITCH_PENALTY;
+  }
+  return penalty;
+}
+
+typedef struct {
+  int slot_of[MAX_MOVABLE];    // The slot of each movable symbol
+  int symbol_in[MAX_SLOTS];    // The movable symbol in each slot, -1 if free
+  double cost;
+} placement_t;
+
+static const position_t *item_position(const keymap_t *keymap, const placement_t *placement, int item,
+                                       const int *movable_index) {
+  if (keymap->movable[item]) {
+    return &keymap->slot_positions[placement->slot_of[movable_index[item]]];
+  }
+  return &keymap->fixed[item];
+}
+
+static int movable_index[MAX_ITEMS];
+
+// The whole cost, per key press
+static double total_cost(const keymap_t *keymap, const placement_t *placement, double *sfb) {
+  double cost = 0, same_finger = 0;
+  for (int a = 0; a < item_count; a++) {
+    if (!keymap->typed[a]) {
+      continue;
+    }
+    const position_t *pa = item_position(keymap, placement, a, movable_index);
+    cost += unigrams[a] * pa->effort;
+    for (int b = 0; b < item_count; b++) {
+      if (!keymap->typed[b] || bigrams[a][b] == 0) {
+        continue;
+      }
+      const position_t *pb = item_position(keymap, placement, b, movable_index);
+      double penalty = pair_penalty(pa, pb);
+      cost += bigrams[a][b] * penalty;
+      if (a != b && pa->hand >= 0 && pa->hand == pb->hand && pa->finger == pb->finger) {
+        same_finger += bigrams[a][b];
+      }
+    }
+  }
+  if (sfb) {
+    *sfb = total_presses ? same_finger / total_presses : 0;
+  }
+  return total_presses ? cost / total_presses : 0;
+}
+
+// The cost depending on where a movable symbol is, leaving out its pair with
+// `other` (another movable symbol, or -1)
+static double symbol_cost(const keymap_t *keymap, const placement_t *placement, int m, int other) {
+  int a = keymap->movable_items[m];
+  const position_t *pa = &keymap->slot_positions[placement->slot_of[m]];
+  double cost = unigrams[a] * pa->effort + bigrams[a][a] * pair_penalty(pa, pa);
+  for (int b = 0; b < item_count; b++) {
+    if (b == a || !keymap->typed[b] || (other >= 0 && b == keymap->movable_items[other])) {
+      continue;
+    }
+    double weight = bigrams[a][b] + bigrams[b][a];
+    if (weight > 0) {
+      cost += weight * pair_penalty(pa, item_position(keymap, placement, b, movable_index));
+    }
+  }
+  return cost;
+}
+
+static double swap_cost(const keymap_t *keymap, const placement_t *placement, int m1, int m2) {
+  double cost = 0;
+  if (m1 >= 0) {
+    cost += symbol_cost(keymap, placement, m1, m2);
+  }
+  if (m2 >= 0) {
+    cost += symbol_cost(keymap, placement, m2, m1);
+  }
+  if (m1 >= 0 && m2 >= 0) {
+    int a = keymap->movable_items[m1], b = keymap->movable_items[m2];
+    cost += (bigrams[a][b] + bigrams[b][a])
+          * pair_penalty(&keymap->slot_positions[placement->slot_of[m1]],
+                         &keymap->slot_positions[placement->slot_of[m2]]);
+  }
+  return cost;
+}
+
+static void swap_slots(placement_t *placement, int s1, int s2) {
+  int m1 = placement->symbol_in[s1], m2 = placement->symbol_in[s2];
+  placement->symbol_in[s1] = m2;
+  placement->symbol_in[s2] = m1;
+  if (m1 >= 0) {
+    placement->slot_of[m1] = s2;
+  }
+  if (m2 >= 0) {
+    placement->slot_of[m2] = s1;
+  }
+}
+
+/*
+ * Search
+ */
+
+typedef struct {
+  const keymap_t *keymap;
+  uint64_t seed;
+  long iterations;
+  placement_t best;
+} run_t;
+
+static uint64_t next_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void initial_placement(const keymap_t *keymap, placement_t *placement) {
+  for (int slot = 0; slot < keymap->slot_count; slot++) {
+    placement->symbol_in[slot] = -1;
+  }
+  for (int m = 0; m < keymap->movable_count; m++) {
+    placement->slot_of[m] = keymap->initial_slots[m];
+    placement->symbol_in[keymap->initial_slots[m]] = m;
+  }
+  placement->cost = total_cost(keymap, placement, NULL) * total_presses;
+}
+
+static void *anneal(void *arg) {
+  run_t *run = arg;
+  const keymap_t *keymap = run->keymap;
+  uint64_t state = run->seed * 0x9E3779B97F4A7C15ull + 1;
+  placement_t current;
+  initial_placement(keymap, &current);
+  run->best = current;
+  // Costs are per key press, so the temperatures work for any corpus size
+  double scale = total_presses;
+  double cooling = pow(END_TEMPERATURE / START_TEMPERATURE, 1.0 / run->iterations);
+  double temperature = START_TEMPERATURE;
+  for (long i = 0; i < run->iterations; i++, temperature *= cooling) {
+    int s1 = next_random(&state) % keymap->slot_count;
+    int s2 = next_random(&state) % keymap->slot_count;
+    int m1 = current.symbol_in[s1], m2 = current.symbol_in[s2];
+    if (s1 == s2 || (m1 < 0 && m2 < 0)) {
+      continue;
+    }
+    double before = swap_cost(keymap, &current, m1, m2);
+    swap_slots(&current, s1, s2);
+    double delta = (swap_cost(keymap, &current, m1, m2) - before) / scale;
+    double chance = (next_random(&state) >> 11) * (1.0 / 9007199254740992.0);
+    if (delta <= 0 || chance < exp(-delta / temperature)) {
+      current.cost += delta * scale;
+      if (current.cost < run->best.cost - 1e-9) {
+        run->best = current;
+      }
+    } else {
+      swap_slots(&current, s1, s2);
+    }
+  }
+  return NULL;
+}
+
+// Print the layers with the symbols in their new places, aligned like the
+// keymap as far as the names allow
+static void print_layers(const keymap_t *keymap, const placement_t *placement) {
+  const char *names[LAYER_COUNT][MAX_ARGS] = { { NULL } };
+  for (int slot = 0; slot < keymap->slot_count; slot++) {
+    const layout_key_t *key = keymap->slots[slot];
+    int m = placement->symbol_in[slot];
+    names[key->layer][key->arg] = m >= 0 ? item_names[keymap->movable_items[m]] : "_______";
+  }
+  for (int layer = LAYER_LOWER; layer < LAYER_COUNT; layer++) {
+    const char *text = keymap->text;
+    long at = keymap->layer_starts[layer];
+    int owed = 0; // Columns taken by names longer than the original ones
+    for (int arg = 0; arg < keymap->key_counts[layer]; arg++) {
+      const layout_key_t *key = &keymap->keys[layer][arg];
+      fwrite(text + at, 1, key->start - at, stdout);
+      const char *name = names[layer][arg];
+      int width;
+      if (name && strcmp(name, "_______") != 0) {
+        width = printf("KC_%s", name);
+      } else if (name) {
+        width = printf("%s", name);
+      } else {
+        width = fwrite(text + key->start, 1, key->end - key->start, stdout);
+      }
+      owed += width - (key->end - key->start);
+      // Take back the columns owed from the spaces after the comma
+      at = key->end;
+      if (text[at] == ',') {
+        putchar(',');
+        at++;
+      }
+      while (owed > 0 && text[at] == ' ' && text[at + 1] == ' ') {
+        at++;
+        owed--;
+      }
+      while (owed < 0 && text[at] == ' ') {
+        putchar(' ');
+        owed++;
+      }
+      if (text[at] == '\n' || text[at] == '\0') {
+        owed = 0;
+      }
+    }
+    fwrite(text + at, 1, keymap->layer_ends[layer] - at, stdout);
+    printf(",\n\n");
+  }
+}
+
+int main(int argc, char **argv) {
+  long iterations = 2000000;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t seed = 1;
+  bool have_usage = false;
+  init_boards();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:j:s:t:e:")) != -1) {
+    switch (opt) {
+      case 'i':
+        iterations = strtol(optarg, NULL, 10);
+        break;
+      case 'j':
+        threads = strtol(optarg, NULL, 10);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 't':
+        if (!read_text(optarg)) {
+          return 1;
+        }
+        have_usage = true;
+        break;
+      case 'e':
+        if (!read_events(optarg)) {
+          return 1;
+        }
+        have_usage = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-i iterations] [-j threads] [-s seed] [-t text]...\n"
+                        "       %*s [-e events]... keymap.c...\n",
+                argv[0], (int)strlen(argv[0]), "");
+        return 2;
+    }
+  }
+  if (!have_usage || optind == argc) {
+    fprintf(stderr, "a corpus (-t or -e) and a keymap are needed\n");
+    return 2;
+  }
+  if (threads < 1 || threads > MAX_THREADS) {
+    threads = threads < 1 ? 1 : MAX_THREADS;
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  for (int k = optind; k < argc; k++) {
+    keymap_t *keymap = calloc(1, sizeof(keymap_t));
+    if (!read_keymap(keymap, argv[k])) {
+      return 1;
+    }
+    prepare(keymap);
+    for (int m = 0; m < keymap->movable_count; m++) {
+      movable_index[keymap->movable_items[m]] = m;
+    }
+    if (keymap->movable_count == 0) {
+      fprintf(stderr, "%s: no symbols to move\n", argv[k]);
+      continue;
+    }
+
+    run_t *runs = calloc(threads, sizeof(run_t));
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (long i = 0; i < threads; i++) {
+      runs[i] = (run_t){ .keymap = keymap, .seed = seed + i, .iterations = iterations };
+      pthread_create(&workers[i], NULL, anneal, &runs[i]);
+    }
+    int best = 0;
+    for (long i = 0; i < threads; i++) {
+      pthread_join(workers[i], NULL);
+      if (runs[i].best.cost < runs[best].best.cost) {
+        best = i;
+      }
+    }
+
+    placement_t initial;
+    initial_placement(keymap, &initial);
+    double sfb_before, sfb_after;
+    double before = total_cost(keymap, &initial, &sfb_before);
+    double after = total_cost(keymap, &runs[best].best, &sfb_after);
+    double untyped = 0;
+    for (int item = 0; item < item_count; item++) {
+      if (!keymap->typed[item]) {
+        untyped += unigrams[item];
+      }
+    }
+    printf("// %s (%s): %d symbols over %d keys, %.0f key presses (%.0f not on the keymap)\n",
+           keymap->path, keymap->board->macro, keymap->movable_count, keymap->slot_count,
+           total_presses, untyped + skipped_presses);
+    printf("// Effort per key press %.4f -> %.4f (%+.2f%%), same finger bigrams %.3f%% -> %.3f%%\n",
+           before, after, before ? 100 * (after - before) / before : 0, 100 * sfb_before, 100 * sfb_after);
+    printf("// Best of %ld runs of %ld swaps, from seed %llu\n\n", threads, iterations,
+           (unsigned long long)runs[best].seed);
+    print_layers(keymap, &runs[best].best);
+    free(runs);
+    free(workers);
+  }
+  return 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * Upload a dictionary of leader sequences to the keyboard
+ *
+ * Usage: leader-dict [-v version] [-o file] dictionary [device]
+ *        leader-dict -i [device]
+ *        leader-dict -c [device]
+ *
+ *   -v version  The version of the dictionary (one more than the version on
+ *               the keyboard by default)
+ *   -o file     Write the compiled dictionary to a file instead of uploading it
+ *   -i          Print the version, size and CRC of the dictionary on the keyboard
+ *   -c          Remove the dictionary from the keyboard
+ *   dictionary  The dictionary to upload, - for the standard input
+ *   device      The hidraw device to use (found automatically by default)
+ *
+ * The dictionary has a sequence per line, as the names of its keys (the QMK
+ * keycodes without KC_, like A, 1, SCLN or LSFT) separated by spaces, then a
+ * tab and the text to type. The text can use \n, \t, \\ and \xHH escapes, the
+ * latter for the SEND_STRING codes (like \x01\xe6 to tap Right Alt). Empty
+ * lines and lines starting with # are skipped:
+ *
+ *   # leader + s + i ==> signature
+ *   S I	Kind regards,\n
+ *   LSFT A E	\x01\xe6"A
+ *
+ * The sequences are compiled into a trie, and uploaded in chunks with LEADER_DICT
+ * messages. The keyboard only takes the new dictionary into use, and saves it,
+ * once all of it arrived and matches its CRC. Its sequences come before the ones
+ * compiled into the firmware.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The operations and dictionary format of common/leader_dict.h
+enum {
+  LEADER_DICT_BEGIN = 0,
+  LEADER_DICT_DATA,
+  LEADER_DICT_COMMIT,
+  LEADER_DICT_INFO,
+  LEADER_DICT_CLEAR
+};
+
+static const char *statuses[] = {
+  "ok", "too large", "chunk out of order", "incomplete", "bad CRC", "unknown operation"
+};
+
+#define LEADER_DICT_SIZE 512
+#define LEADER_DICT_VALUE 0x80
+#define LEADER_DICT_CHILDREN 0x3F
+#define LEADER_DICT_KEYS 5
+#define LEADER_DICT_CHUNK 27
+
+#define SS_TAP_CODE 1
+#define SS_UP_CODE 3
+#define SS_DELAY_CODE 4
+
+#define REPLY_TIMEOUT_MS 1000
+
+static const struct {
+  const char *name;
+  uint8_t keycode;
+} keys[] = {
+  { "ENT", 0x28 }, { "ESC", 0x29 }, { "BSPC", 0x2A }, { "TAB", 0x2B },
+  { "SPC", 0x2C }, { "MINS", 0x2D }, { "EQL", 0x2E }, { "LBRC", 0x2F },
+  { "RBRC", 0x30 }, { "BSLS", 0x31 }, { "SCLN", 0x33 }, { "QUOT", 0x34 },
+  { "GRV", 0x35 }, { "COMM", 0x36 }, { "DOT", 0x37 }, { "SLSH", 0x38 },
+  { "LCTL", 0xE0 }, { "LSFT", 0xE1 }, { "LALT", 0xE2 }, { "LGUI", 0xE3 },
+  { "RCTL", 0xE4 }, { "RSFT", 0xE5 }, { "RALT", 0xE6 }, { "RGUI", 0xE7 },
+};
+
+/*
+ * Parsing
+ */
+
+typedef struct node {
+  uint8_t keycode;
+  char *value; // NULL if no sequence ends here
+  size_t value_length;
+  struct node *children[LEADER_DICT_CHILDREN];
+  int child_count;
+  size_t offset;
+} node_t;
+
+static int sequences = 0;
+
+// The keycode of a key name, or 0 if unknown
+static uint8_t parse_key(const char *name) {
+  if (name[0] && !name[1]) {
+    if (name[0] >= 'A' && name[0] <= 'Z') {
+      return 0x04 + name[0] - 'A';
+    }
+    if (name[0] >= '1' && name[0] <= '9') {
+      return 0x1E + name[0] - '1';
+    }
+    if (name[0] == '0') {
+      return 0x27;
+    }
+  }
+  if (name[0] == 'F' && name[1]) {
+    char *end;
+    long number = strtol(name + 1, &end, 10);
+    if (!*end && number >= 1 && number <= 12) {
+      return 0x3A + number - 1;
+    }
+  }
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    if (strcmp(name, keys[i].name) == 0) {
+      return keys[i].keycode;
+    }
+  }
+  return 0;
+}
+
+// Unescape the text of a sequence in place. Returns its length, or -1 if an
+// escape is invalid.
+static int parse_text(char *text) {
+  char *out = text;
+  for (char *in = text; *in; in++) {
+    if (*in != '\\') {
+      *out++ = *in;
+      continue;
+    }
+    in++;
+    if (*in == 'n') {
+      *out++ = '\n';
+    } else if (*in == 't') {
+      *out++ = '\t';
+    } else if (*in == '\\') {
+      *out++ = '\\';
+    } else if (*in == 'x' && in[1] && in[2]) {
+      char hex[3] = { in[1], in[2], 0 };
+      char *end;
+      long byte = strtol(hex, &end, 16);
+      if (*end || byte == 0) {
+        return -1;
+      }
+      *out++ = byte;
+      in += 2;
+    } else {
+      return -1;
+    }
+  }
+  *out = 0;
+  return out - text;
+}
+
+// Check that the firmware reads the SEND_STRING codes of a text as intended
+static bool check_codes(const uint8_t *text, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] >= SS_TAP_CODE && text[i] <= SS_UP_CODE) {
+      if (++i == length) {
+        return false;
+      }
+    } else if (text[i] == SS_DELAY_CODE) {
+      do {
+        i++;
+      } while (i < length && text[i] >= '0' && text[i] <= '9');
+      if (i == length || text[i] != '|') {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static node_t *new_node(uint8_t keycode) {
+  node_t *node = calloc(1, sizeof(node_t));
+  node->keycode = keycode;
+  return node;
+}
+
+// Add a line of the dictionary to the trie. Returns false if it is invalid.
+static bool add_line(node_t *root, char *line, int number) {
+  char *tab = strchr(line, '\t');
+  if (!tab) {
+    fprintf(stderr, "line %d: no tab between the keys and the text\n", number);
+    return false;
+  }
+  *tab = 0;
+  char *text = tab + 1;
+  int length = parse_text(text);
+  if (length < 0 || !check_codes((const uint8_t *)text, length)) {
+    fprintf(stderr, "line %d: invalid text\n", number);
+    return false;
+  }
+
+  node_t *node = root;
+  int depth = 0;
+  for (char *name = strtok(line, " "); name; name = strtok(NULL, " ")) {
+    uint8_t keycode = parse_key(name);
+    if (!keycode) {
+      fprintf(stderr, "line %d: unknown key %s\n", number, name);
+      return false;
+    }
+    if (++depth > LEADER_DICT_KEYS) {
+      fprintf(stderr, "line %d: more than %d keys\n", number, LEADER_DICT_KEYS);
+      return false;
+    }
+    node_t *child = NULL;
+    for (int i = 0; i < node->child_count; i++) {
+      if (node->children[i]->keycode == keycode) {
+        child = node->children[i];
+      }
+    }
+    if (!child) {
+      if (node->child_count == LEADER_DICT_CHILDREN) {
+        fprintf(stderr, "line %d: too many sequences after the same keys\n", number);
+        return false;
+      }
+      child = new_node(keycode);
+      node->children[node->child_count++] = child;
+    }
+    node = child;
+  }
+  if (depth == 0) {
+    fprintf(stderr, "line %d: no keys\n", number);
+    return false;
+  }
+  if (node->value) {
+    fprintf(stderr, "line %d: duplicate sequence\n", number);
+    return false;
+  }
+  node->value = strdup(text);
+  node->value_length = length;
+  sequences++;
+  return true;
+}
+
+/*
+ * Compiling
+ */
+
+static size_t node_size(const node_t *node) {
+  return 1 + 3 * node->child_count + (node->value ? node->value_length + 1 : 0);
+}
+
+// Lay the nodes out depth first, so children always come after their parent
+static size_t place(node_t *node, size_t offset) {
+  node->offset = offset;
+  offset += node_size(node);
+  for (int i = 0; i < node->child_count; i++) {
+    offset = place(node->children[i], offset);
+  }
+  return offset;
+}
+
+static void emit(const node_t *node, uint8_t *dict) {
+  uint8_t *out = &dict[node->offset];
+  *out++ = node->child_count | (node->value ? LEADER_DICT_VALUE : 0);
+  for (int i = 0; i < node->child_count; i++) {
+    const node_t *child = node->children[i];
+    *out++ = child->keycode;
+    *out++ = child->offset & 0xFF;
+    *out++ = child->offset >> 8;
+  }
+  if (node->value) {
+    memcpy(out, node->value, node->value_length + 1);
+  }
+  for (int i = 0; i < node->child_count; i++) {
+    emit(node->children[i], dict);
+  }
+}
+
+// CRC-16/CCITT-FALSE, like the firmware
+static uint16_t crc16(const uint8_t *bytes, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= bytes[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/*
+ * Raw HID
+ */
+
+static int device = -1;
+
+// Send a LEADER_DICT message and wait for its reply. Returns its status, or -1
+// on error.
+static int request(uint8_t *report) {
+  uint8_t operation = report[1];
+  if (hidraw_send(device, report, HIDRAW_REPORT_SIZE) < 0) {
+    perror("send");
+    return -1;
+  }
+  for (;;) {
+    int length = hidraw_recv(device, report, REPLY_TIMEOUT_MS);
+    if (length < 0) {
+      perror("recv");
+      return -1;
+    }
+    if (length == 0) {
+      fprintf(stderr, "no reply to LEADER_DICT, is the firmware up to date?\n");
+      return -1;
+    }
+    if (report[0] == REMOTE_LEADER_DICT && report[1] == operation) {
+      return report[2];
+    }
+  }
+}
+
+static bool check_status(int status, const char *operation) {
+  if (status > 0) {
+    fprintf(stderr, "%s: %s\n", operation,
+            status < (int)(sizeof(statuses) / sizeof(statuses[0])) ? statuses[status] : "error");
+  }
+  return status == 0;
+}
+
+// The version, length and CRC of the dictionary on the keyboard
+static bool info(uint16_t *version, uint16_t *length, uint16_t *crc) {
+  uint8_t report[HIDRAW_REPORT_SIZE] = { REMOTE_LEADER_DICT, LEADER_DICT_INFO };
+  if (!check_status(request(report), "info")) {
+    return false;
+  }
+  *version = report[3] | report[4] << 8;
+  *length = report[5] | report[6] << 8;
+  *crc = report[7] | report[8] << 8;
+  return true;
+}
+
+static bool upload(const uint8_t *dict, uint16_t length, uint16_t version) {
+  uint8_t report[HIDRAW_REPORT_SIZE] = {
+    REMOTE_LEADER_DICT, LEADER_DICT_BEGIN, length & 0xFF, length >> 8, version & 0xFF, version >> 8
+  };
+  if (!check_status(request(report), "begin")) {
+    return false;
+  }
+  for (uint16_t offset = 0; offset < length; offset += LEADER_DICT_CHUNK) {
+    uint8_t count = length - offset < LEADER_DICT_CHUNK ? length - offset : LEADER_DICT_CHUNK;
+    memset(report, 0, sizeof(report));
+    report[0] = REMOTE_LEADER_DICT;
+    report[1] = LEADER_DICT_DATA;
+    report[2] = offset & 0xFF;
+    report[3] = offset >> 8;
+    report[4] = count;
+    memcpy(&report[5], &dict[offset], count);
+    if (!check_status(request(report), "data")) {
+      return false;
+    }
+  }
+  uint16_t crc = crc16(dict, length);
+  memset(report, 0, sizeof(report));
+  report[0] = REMOTE_LEADER_DICT;
+  report[1] = LEADER_DICT_COMMIT;
+  report[2] = crc & 0xFF;
+  report[3] = crc >> 8;
+  return check_status(request(report), "commit");
+}
+
+static int open_device(const char *path) {
+  device = hidraw_open(path);
+  if (device < 0) {
+    perror(path ? path : "raw HID device");
+  }
+  return device;
+}
+
+int main(int argc, char **argv) {
+  long version = -1;
+  const char *output = NULL;
+  bool print_info = false, clear = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "v:o:ic")) != -1) {
+    switch (opt) {
+      case 'v':
+        version = strtol(optarg, NULL, 0);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'i':
+        print_info = true;
+        break;
+      case 'c':
+        clear = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-v version] [-o file] dictionary [device]\n"
+                        "       %s -i [device]\n       %s -c [device]\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+  }
+  if (version > 0xFFFF) {
+    fprintf(stderr, "the version must be less than 65536\n");
+    return 2;
+  }
+
+  if (print_info || clear) {
+    if (open_device(optind < argc ? argv[optind] : NULL) < 0) {
+      return 1;
+    }
+    if (clear) {
+      uint8_t report[HIDRAW_REPORT_SIZE] = { REMOTE_LEADER_DICT, LEADER_DICT_CLEAR };
+      return check_status(request(report), "clear") ? 0 : 1;
+    }
+    uint16_t length, crc, current;
+    if (!info(&current, &length, &crc)) {
+      return 1;
+    }
+    if (length == 0 && crc == 0) {
+      printf("no dictionary\n");
+    } else {
+      printf("version %u, %u bytes, CRC %04x\n", current, length, crc);
+    }
+    return 0;
+  }
+
+  if (optind == argc) {
+    fprintf(stderr, "no dictionary given\n");
+    return 2;
+  }
+  const char *path = argv[optind++];
+  FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return 1;
+  }
+  node_t *root = new_node(0);
+  char line[1024];
+  int number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    line[strcspn(line, "\r\n")] = 0;
+    if (line[0] == 0 || line[0] == '#') {
+      continue;
+    }
+    if (!add_line(root, line, number)) {
+      return 1;
+    }
+  }
+
+  size_t length = place(root, 0);
+  if (length > LEADER_DICT_SIZE) {
+    fprintf(stderr, "the dictionary takes %zu bytes, more than the %d bytes of the keyboard\n",
+            length, LEADER_DICT_SIZE);
+    return 1;
+  }
+  uint8_t dict[LEADER_DICT_SIZE];
+  emit(root, dict);
+
+  if (output) {
+    FILE *out = fopen(output, "wb");
+    if (!out || fwrite(dict, 1, length, out) != length || fclose(out) != 0) {
+      perror(output);
+      return 1;
+    }
+    printf("%d sequences, %zu bytes, CRC %04x\n", sequences, length, crc16(dict, length));
+    return 0;
+  }
+
+  if (open_device(optind < argc ? argv[optind] : NULL) < 0) {
+    return 1;
+  }
+  if (version < 0) {
+    uint16_t current, current_length, crc;
+    if (!info(&current, &current_length, &crc)) {
+      return 1;
+    }
+    version = (uint16_t)(current + 1);
+  }
+  if (!upload(dict, length, version)) {
+    return 1;
+  }
+  printf("uploaded %d sequences, %zu bytes, version %ld, CRC %04x\n", sequences, length, version,
+         crc16(dict, length));
+  close(device);
+  return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Measure the latency of the Moonlander MIDI mode through ALSA
+ *
+ * Usage: midi-latency [-n count] [-m midi-device] [device]
+ *
+ *   -n count        The number of notes to time (200 by default)
+ *   -m midi-device  The ALSA raw MIDI device of the keyboard, like
+ *                   /dev/snd/midiC1D0 (found automatically by default, by
+ *                   looking for the one on the same USB device as the raw HID
+ *                   interface)
+ *   device          The hidraw device to use (found automatically by default)
+ *
+ * Asks the keyboard to play notes with MIDI_PROBE messages, which go through
+ * the same queue as the notes played from the keys, and times how long each
+ * note takes to show up on the ALSA raw MIDI device. The raw HID leg of that
+ * round trip is estimated as half the PING round trip, and subtracted to get
+ * the latency from the keyboard to ALSA.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PING_SAMPLES 64
+#define NOTE_TIMEOUT_MS 1000
+#define PROBE_NOTE 60
+
+static int device = -1;
+static int midi = -1;
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_summary(const char *name, int64_t *samples, int count) {
+  qsort(samples, count, sizeof(int64_t), compare_i64);
+  printf("%-12s ms: min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", name,
+         samples[0] / 1000.0, samples[(count - 1) / 2] / 1000.0,
+         samples[(int)((count - 1) * 0.9)] / 1000.0, samples[(int)((count - 1) * 0.99)] / 1000.0,
+         samples[count - 1] / 1000.0);
+}
+
+/*
+ * MIDI devices
+ */
+
+// Find the raw MIDI device on the same USB device as the raw HID interface
+static int find_midi(const char *hidraw_path, char *path, size_t size) {
+  char hidraw_link[PATH_MAX], hidraw_device[PATH_MAX];
+  const char *name = strrchr(hidraw_path, '/');
+  snprintf(hidraw_link, sizeof(hidraw_link), "/sys/class/hidraw/%s/device/../..", name ? name + 1 : hidraw_path);
+  if (!realpath(hidraw_link, hidraw_device)) {
+    return -1;
+  }
+
+  DIR *dir = opendir("/sys/class/sound");
+  if (!dir) {
+    return -1;
+  }
+  int found = -1;
+  struct dirent *entry;
+  while (found < 0 && (entry = readdir(dir))) {
+    if (strncmp(entry->d_name, "midiC", 5) != 0) {
+      continue;
+    }
+    // The device of a MIDI node is its sound card, on top of a USB interface
+    char link[PATH_MAX], target[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/class/sound/%s/device/device/..", entry->d_name);
+    if (realpath(link, target) && strcmp(target, hidraw_device) == 0) {
+      snprintf(path, size, "/dev/snd/%s", entry->d_name);
+      found = 0;
+    }
+  }
+  closedir(dir);
+  return found;
+}
+
+// Wait for a note on message for a given note. Returns 1 if it arrived, 0 on
+// timeout and -1 on error. Anything else (like the note off) is skipped.
+static int wait_note_on(uint8_t note, int timeout_ms) {
+  static uint8_t status = 0;
+  static uint8_t data[2];
+  static int data_count = 0;
+
+  int64_t deadline = now_us() + (int64_t)timeout_ms * 1000;
+  for (;;) {
+    int64_t left = deadline - now_us();
+    if (left <= 0) {
+      return 0;
+    }
+    struct pollfd pfd = { .fd = midi, .events = POLLIN };
+    int ready = poll(&pfd, 1, (left + 999) / 1000);
+    if (ready < 0 && errno != EINTR) {
+      return -1;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+
+    uint8_t bytes[64];
+    ssize_t length = read(midi, bytes, sizeof(bytes));
+    if (length < 0) {
+      return errno == EAGAIN ? 0 : -1;
+    }
+    bool matched = false;
+    for (ssize_t i = 0; i < length; i++) {
+      uint8_t byte = bytes[i];
+      if (byte >= 0xF8) { // Real time messages can show up anywhere
+        continue;
+      }
+      if (byte & 0x80) { // A new status, data bytes reuse it (running status)
+        status = byte;
+        data_count = 0;
+        continue;
+      }
+      data[data_count++] = byte;
+      if (data_count < 2) {
+        continue;
+      }
+      data_count = 0;
+      if ((status & 0xF0) == 0x90 && data[0] == note && data[1] > 0) {
+        matched = true;
+      }
+    }
+    if (matched) {
+      return 1;
+    }
+  }
+}
+
+/*
+ * Raw HID
+ */
+
+// Half the shortest PING round trip, as an estimate of the raw HID leg
+static int64_t hid_one_way_us(void) {
+  int64_t best = INT64_MAX;
+  for (uint8_t seq = 0; seq < PING_SAMPLES; seq++) {
+    uint8_t report[HIDRAW_REPORT_SIZE] = { REMOTE_PING, seq };
+    int64_t sent = now_us();
+    if (hidraw_send(device, report, sizeof(report)) < 0) {
+      return -1;
+    }
+    for (;;) {
+      int length = hidraw_recv(device, report, 100);
+      if (length < 0) {
+        return -1;
+      }
+      if (length == 0) {
+        break;
+      }
+      if (report[0] == REMOTE_PING && report[1] == seq) {
+        int64_t rtt = now_us() - sent;
+        best = rtt < best ? rtt : best;
+        break;
+      }
+    }
+  }
+  return best == INT64_MAX ? -1 : best / 2;
+}
+
+int main(int argc, char **argv) {
+  int count = 200;
+  const char *midi_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'm':
+        midi_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n count] [-m midi-device] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (count < 1) {
+    fprintf(stderr, "the count must be positive\n");
+    return 2;
+  }
+
+  char hidraw_path[64];
+  if (optind < argc) {
+    snprintf(hidraw_path, sizeof(hidraw_path), "%s", argv[optind]);
+  } else if (!hidraw_find(hidraw_path, sizeof(hidraw_path))) {
+    fprintf(stderr, "no raw HID device found\n");
+    return 1;
+  }
+  device = hidraw_open(hidraw_path);
+  if (device < 0) {
+    perror(hidraw_path);
+    return 1;
+  }
+
+  char found_midi[PATH_MAX];
+  if (!midi_path) {
+    if (find_midi(hidraw_path, found_midi, sizeof(found_midi)) < 0) {
+      fprintf(stderr, "no MIDI device found, use -m\n");
+      return 1;
+    }
+    midi_path = found_midi;
+  }
+  midi = open(midi_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (midi < 0) {
+    perror(midi_path);
+    return 1;
+  }
+
+  int64_t hid_us = hid_one_way_us();
+  if (hid_us < 0) {
+    fprintf(stderr, "no reply to PING, is the firmware up to date?\n");
+    return 1;
+  }
+
+  int64_t *round_trips = malloc(count * sizeof(int64_t));
+  int64_t *latencies = malloc(count * sizeof(int64_t));
+  int received = 0, lost = 0;
+  for (int i = 0; i < count; i++) {
+    uint8_t report[HIDRAW_REPORT_SIZE] = { REMOTE_MIDI_PROBE, PROBE_NOTE };
+    int64_t sent = now_us();
+    if (hidraw_send(device, report, sizeof(report)) < 0) {
+      perror("send");
+      return 1;
+    }
+    int ret = wait_note_on(PROBE_NOTE, NOTE_TIMEOUT_MS);
+    if (ret < 0) {
+      perror(midi_path);
+      return 1;
+    }
+    if (ret == 0) {
+      lost++;
+      continue;
+    }
+    round_trips[received] = now_us() - sent;
+    latencies[received] = round_trips[received] - hid_us;
+    received++;
+    // Spread the probes over different points of the USB frames
+    usleep(1000 + rand() % 1000);
+  }
+
+  printf("%d notes (%d lost), raw HID one way %.3f ms\n", received, lost, hid_us / 1000.0);
+  if (received > 0) {
+    print_summary("round trip", round_trips, received);
+    print_summary("MIDI to ALSA", latencies, received);
+  }
+
+  free(round_trips);
+  free(latencies);
+  close(midi);
+  close(device);
+  return received > 0 ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/*
+ * Simulate the mouse keys of the keymaps and plot the pointer trajectories
+ *
+ * Usage: mouse-sim [-i interval] [-t inertia] [-s svg-file]
+ *
+ *   -i interval  The time between reports in ms, like the USB polling
+ *                interval (1 by default)
+ *   -t inertia   MOUSE_KEYS_INERTIA_MS, in ms (40 by default)
+ *   -s svg-file  Also plot the distance travelled over time by every curve
+ *                and scenario to an SVG file
+ *
+ * Runs a few key press scenarios (holding a direction, holding a diagonal and
+ * tapping) through every acceleration curve of common/mouse_keys.c, built as
+ * is, and prints the pointer position after each report as CSV lines of
+ * curve,scenario,time,x,y.
+ */
+
+#include "mouse_keys.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char *curve_names[] = { "linear", "quadratic", "precise" };
+
+#define CURVE_COUNT (MOUSE_CURVE_PRECISE + 1)
+
+uint8_t mouse_sim_curve = MOUSE_CURVE_LINEAR;
+int32_t mouse_sim_inertia_ms = 40;
+
+// The time of the simulation, in ms
+static uint32_t now = 0;
+
+uint32_t timer_read32(void) {
+  return now;
+}
+
+uint32_t timer_elapsed32(uint32_t last) {
+  return now - last;
+}
+
+uint16_t timer_read(void) {
+  return now;
+}
+
+uint16_t timer_elapsed(uint16_t last) {
+  return (uint16_t)now - last;
+}
+
+uint16_t pointing_device_get_hires_scroll_resolution(void) {
+  return 1;
+}
+
+// Press or release a mouse key
+static void mouse_key(uint16_t keycode, bool pressed) {
+  keyrecord_t record = { .event = { .pressed = pressed, .time = now } };
+  mouse_keys_process(keycode, &record);
+}
+
+// The keys held at a given time of a scenario, as directions on each axis
+typedef struct {
+  const char *name;
+  uint32_t duration;
+  void (*keys)(uint32_t time, int *dx, int *dy);
+} scenario_t;
+
+static void hold_right(uint32_t time, int *dx, int *dy) {
+  *dx = time < 1500;
+  *dy = 0;
+}
+
+static void hold_diagonal(uint32_t time, int *dx, int *dy) {
+  *dx = *dy = time < 1500;
+}
+
+// Five short taps, as used to nudge the pointer onto a target
+static void tap_right(uint32_t time, int *dx, int *dy) {
+  *dx = time < 1000 && time % 200 < 60;
+  *dy = 0;
+}
+
+static const scenario_t scenarios[] = {
+  { "hold", 2000, hold_right },
+  { "diagonal", 2000, hold_diagonal },
+  { "taps", 1200, tap_right }
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct {
+  uint32_t time;
+  long x, y;
+} sample_t;
+
+// Run a scenario through a curve, one report every interval ms
+static size_t simulate(uint8_t curve, const scenario_t *scenario, uint16_t interval, sample_t *samples) {
+  mouse_sim_curve = curve;
+
+  // Let the pointer come to rest from the run before, then start a report
+  // interval after the last one
+  for (int i = 0; i < 1000; i++) {
+    now += 32;
+    pointing_device_task_user((report_mouse_t){ 0 });
+  }
+  uint32_t start = now + interval;
+
+  int held_x = 0, held_y = 0;
+  long x = 0, y = 0;
+  size_t count = 0;
+  for (uint32_t time = 0; time <= scenario->duration; time += interval) {
+    now = start + time;
+    int dx, dy;
+    scenario->keys(time, &dx, &dy);
+    if (dx != held_x) {
+      mouse_key(MS_RGHT, dx);
+      held_x = dx;
+    }
+    if (dy != held_y) {
+      mouse_key(MS_DOWN, dy);
+      held_y = dy;
+    }
+    report_mouse_t report = pointing_device_task_user((report_mouse_t){ 0 });
+    x += report.x;
+    y += report.y;
+    samples[count++] = (sample_t){ time, x, y };
+  }
+  return count;
+}
+
+static const char *colors[] = { "#1f77b4", "#d62728", "#2ca02c" };
+static const char *dashes[] = { "", "8,4", "2,3" };
+
+// Plot the distance travelled over time, one line per curve and scenario
+static int write_svg(const char *path, uint16_t interval) {
+  FILE *svg = fopen(path, "w");
+  if (!svg) {
+    perror(path);
+    return -1;
+  }
+
+  const int width = 800, height = 500, margin = 50;
+  const double max_time = 2000, max_distance = 2500;
+  fprintf(svg, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"sans-serif\" font-size=\"12\">\n", width, height);
+  fprintf(svg, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+  fprintf(svg, "<path d=\"M%d %d V%d H%d\" stroke=\"black\" fill=\"none\"/>\n", margin, margin, height - margin, width - margin);
+  fprintf(svg, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">time (ms, up to %.0f)</text>\n", width / 2, height - 15, max_time);
+  fprintf(svg, "<text x=\"15\" y=\"%d\" transform=\"rotate(-90 15 %d)\" text-anchor=\"middle\">distance (px, up to %.0f)</text>\n", height / 2, height / 2, max_distance);
+
+  sample_t *samples = malloc(sizeof(sample_t) * (max_time / interval + 2));
+  for (size_t c = 0; c < CURVE_COUNT; c++) {
+    for (size_t s = 0; s < SCENARIO_COUNT; s++) {
+      size_t count = simulate(c, &scenarios[s], interval, samples);
+      fprintf(svg, "<polyline fill=\"none\" stroke=\"%s\" stroke-dasharray=\"%s\" points=\"", colors[c], dashes[s]);
+      for (size_t i = 0; i < count; i++) {
+        double distance = hypot(samples[i].x, samples[i].y);
+        double px = margin + samples[i].time / max_time * (width - 2 * margin);
+        double py = height - margin - distance / max_distance * (height - 2 * margin);
+        fprintf(svg, "%.1f,%.1f ", px, py < margin ? margin : py);
+      }
+      fprintf(svg, "\"/>\n");
+    }
+  }
+  free(samples);
+
+  // Legend
+  for (size_t c = 0; c < CURVE_COUNT; c++) {
+    int y = margin + 20 * c;
+    fprintf(svg, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"%s\"/>\n", margin + 20, y, margin + 50, y, colors[c]);
+    fprintf(svg, "<text x=\"%d\" y=\"%d\">%s</text>\n", margin + 55, y + 4, curve_names[c]);
+  }
+  for (size_t s = 0; s < SCENARIO_COUNT; s++) {
+    int y = margin + 20 * (CURVE_COUNT + s);
+    fprintf(svg, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"black\" stroke-dasharray=\"%s\"/>\n", margin + 20, y, margin + 50, y, dashes[s]);
+    fprintf(svg, "<text x=\"%d\" y=\"%d\">%s</text>\n", margin + 55, y + 4, scenarios[s].name);
+  }
+
+  fprintf(svg, "</svg>\n");
+  fclose(svg);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint16_t interval = 1;
+  const char *svg_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:t:s:")) != -1) {
+    switch (opt) {
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 't':
+        mouse_sim_inertia_ms = atoi(optarg);
+        break;
+      case 's':
+        svg_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-i interval] [-t inertia] [-s svg-file]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (interval < 1 || mouse_sim_inertia_ms < 1) {
+    fprintf(stderr, "the interval and inertia must be positive\n");
+    return 2;
+  }
+
+  printf("curve,scenario,time,x,y\n");
+  sample_t *samples = malloc(sizeof(sample_t) * (2000 / interval + 2));
+  for (size_t c = 0; c < CURVE_COUNT; c++) {
+    for (size_t s = 0; s < SCENARIO_COUNT; s++) {
+      size_t count = simulate(c, &scenarios[s], interval, samples);
+      for (size_t i = 0; i < count; i++) {
+        printf("%s,%s,%u,%ld,%ld\n", curve_names[c], scenarios[s].name, samples[i].time, samples[i].x, samples[i].y);
+      }
+    }
+  }
+  free(samples);
+
+  if (svg_path && write_svg(svg_path, interval) < 0) {
+    return 1;
+  }
+  return 0;
+}
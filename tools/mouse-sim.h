@@ -0,0 +1,15 @@
+/*
+ * The configuration of common/mouse_keys.c in mouse-sim, included before it
+ * like the config.h of a keymap, with the curve and the easing time chosen at
+ * run time
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+extern uint8_t mouse_sim_curve;
+extern int32_t mouse_sim_inertia_ms;
+
+#define MOUSE_KEYS_CURVE mouse_sim_curve
+#define MOUSE_KEYS_INERTIA_MS mouse_sim_inertia_ms
@@ -0,0 +1,333 @@
+/*
+ * Measure the USB and host side latency of key presses with the TheKey
+ *
+ * Usage: probe-latency [-n presses] [-e event-device] [device]
+ *
+ *   -n presses      Stop after this many key presses (forever by default)
+ *   -e event-device The evdev device of the keyboard (found automatically by
+ *                   default, by looking for a keyboard reporting KEY_F24 next
+ *                   to the raw HID interface)
+ *   device          The hidraw device to use (found automatically by default)
+ *
+ * Puts the keyboard in probe mode, where it timestamps every key change right
+ * after the matrix scan and sends the timestamp over raw HID. The device clock
+ * is mapped to the host's CLOCK_MONOTONIC by exchanging PROBE_SYNC messages,
+ * keeping the sample with the shortest round trip. Every key press is then
+ * matched with its evdev event, and the difference between both times is the
+ * latency added by USB and the host input stack.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYNC_SAMPLES 32
+#define SYNC_PERIOD_US 5000000
+#define MAX_PENDING 64
+
+typedef struct {
+  uint8_t row, col;
+  bool pressed;
+  int64_t time_us; // in host time
+} probe_event_t;
+
+static int device = -1;
+static int input = -1;
+
+// Host time minus device time, and the uncertainty of that estimate
+static int64_t offset_us = 0;
+static int64_t offset_error_us = 0;
+static uint32_t last_device_time = 0;
+static int64_t device_wraps = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  (void)signal;
+  running = 0;
+}
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Extend a 32-bit device time (which wraps every ~71 minutes) to 64 bits
+static int64_t extend_device_time(uint32_t time) {
+  if (time < last_device_time && last_device_time - time > UINT32_MAX / 2) {
+    device_wraps++;
+  }
+  last_device_time = time;
+  return device_wraps * ((int64_t)UINT32_MAX + 1) + time;
+}
+
+static int send_message(uint8_t kind) {
+  uint8_t report[HIDRAW_REPORT_SIZE] = { kind };
+  return hidraw_send(device, report, sizeof(report));
+}
+
+/*
+ * Clock synchronization
+ */
+
+// Estimate the clock offset, keeping the sample with the shortest round trip
+static int sync_clocks(void) {
+  int64_t best_rtt = INT64_MAX;
+  for (uint32_t seq = 0; seq < SYNC_SAMPLES; seq++) {
+    uint8_t report[HIDRAW_REPORT_SIZE] = { REMOTE_PROBE_SYNC, seq };
+    int64_t sent = now_us();
+    if (hidraw_send(device, report, sizeof(report)) < 0) {
+      return -1;
+    }
+    for (;;) {
+      int length = hidraw_recv(device, report, 100);
+      if (length < 0) {
+        return -1;
+      }
+      if (length == 0) {
+        break;
+      }
+      if (length >= 12 && report[0] == REMOTE_PROBE_SYNC && report[1] == seq) {
+        int64_t received = now_us();
+        int64_t rtt = received - sent;
+        if (rtt < best_rtt) {
+          best_rtt = rtt;
+          offset_us = (sent + received) / 2 - extend_device_time(read_u32(&report[8]));
+          offset_error_us = rtt / 2;
+        }
+        break;
+      }
+    }
+  }
+  return best_rtt == INT64_MAX ? -1 : 0;
+}
+
+/*
+ * Input devices
+ */
+
+// Find the evdev device of the keyboard: one that can report KEY_F24 and
+// belongs to the same USB device as the raw HID interface (each interface has
+// its own HID device, so compare the USB devices above them)
+static int find_input(const char *hidraw_path, char *path, size_t size) {
+  char hidraw_link[PATH_MAX], hidraw_device[PATH_MAX];
+  const char *name = strrchr(hidraw_path, '/');
+  snprintf(hidraw_link, sizeof(hidraw_link), "/sys/class/hidraw/%s/device/../..", name ? name + 1 : hidraw_path);
+  if (!realpath(hidraw_link, hidraw_device)) {
+    return -1;
+  }
+
+  DIR *dir = opendir("/dev/input");
+  if (!dir) {
+    return -1;
+  }
+  int found = -1;
+  struct dirent *entry;
+  while (found < 0 && (entry = readdir(dir))) {
+    if (strncmp(entry->d_name, "event", 5) != 0) {
+      continue;
+    }
+    char link[PATH_MAX], target[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/class/input/%s/device/device/../..", entry->d_name);
+    if (!realpath(link, target) || strcmp(target, hidraw_device) != 0) {
+      continue;
+    }
+
+    snprintf(path, size, "/dev/input/%s", entry->d_name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    uint8_t keys[KEY_MAX / 8 + 1] = { 0 };
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) >= 0 && (keys[KEY_F24 / 8] & (1 << (KEY_F24 % 8)))) {
+      found = 0;
+    }
+    close(fd);
+  }
+  closedir(dir);
+  return found;
+}
+
+/*
+ * Statistics
+ */
+
+static int compare_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_summary(int64_t *latencies, int count) {
+  if (count == 0) {
+    return;
+  }
+  qsort(latencies, count, sizeof(int64_t), compare_i64);
+  printf("%d presses, latency ms: min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", count,
+         latencies[0] / 1000.0, latencies[(count - 1) / 2] / 1000.0,
+         latencies[(int)((count - 1) * 0.9)] / 1000.0, latencies[(int)((count - 1) * 0.99)] / 1000.0,
+         latencies[count - 1] / 1000.0);
+}
+
+int main(int argc, char **argv) {
+  int presses = 0;
+  const char *input_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:e:")) != -1) {
+    switch (opt) {
+      case 'n':
+        presses = atoi(optarg);
+        break;
+      case 'e':
+        input_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n presses] [-e event-device] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  char hidraw_path[64];
+  if (optind < argc) {
+    snprintf(hidraw_path, sizeof(hidraw_path), "%s", argv[optind]);
+  } else if (!hidraw_find(hidraw_path, sizeof(hidraw_path))) {
+    fprintf(stderr, "no raw HID device found\n");
+    return 1;
+  }
+  device = hidraw_open(hidraw_path);
+  if (device < 0) {
+    perror(hidraw_path);
+    return 1;
+  }
+
+  char found_input[PATH_MAX];
+  if (!input_path) {
+    if (find_input(hidraw_path, found_input, sizeof(found_input)) < 0) {
+      fprintf(stderr, "no input device found, use -e\n");
+      return 1;
+    }
+    input_path = found_input;
+  }
+  input = open(input_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (input < 0) {
+    perror(input_path);
+    return 1;
+  }
+
+  // Timestamp input events with the same clock used for the device
+  int clock = CLOCK_MONOTONIC;
+  if (ioctl(input, EVIOCSCLOCKID, &clock) < 0) {
+    perror("EVIOCSCLOCKID");
+    return 1;
+  }
+
+  if (send_message(REMOTE_PROBE_START) < 0 || sync_clocks() < 0) {
+    fprintf(stderr, "the keyboard does not answer, is it a TheKey with probe mode?\n");
+    return 1;
+  }
+  int64_t last_sync = now_us();
+  printf("probing %s and %s (clock sync ±%.3f ms), press the keys\n",
+         hidraw_path, input_path, offset_error_us / 1000.0);
+  fflush(stdout);
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  // Device key presses waiting for their input event, oldest first
+  probe_event_t pending[MAX_PENDING];
+  int pending_count = 0;
+
+  int64_t *latencies = NULL;
+  int count = 0, capacity = 0;
+
+  while (running && (presses == 0 || count < presses)) {
+    // Resynchronize from time to time to follow clock drift
+    if (pending_count == 0 && now_us() - last_sync > SYNC_PERIOD_US) {
+      if (sync_clocks() < 0) {
+        fprintf(stderr, "lost the keyboard\n");
+        break;
+      }
+      last_sync = now_us();
+    }
+
+    struct pollfd pfds[2] = {
+      { .fd = device, .events = POLLIN },
+      { .fd = input, .events = POLLIN },
+    };
+    if (poll(pfds, 2, 1000) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      uint8_t report[HIDRAW_REPORT_SIZE];
+      int length = read(device, report, sizeof(report));
+      if (length >= 2 && report[0] == REMOTE_PROBE_EVENTS) {
+        for (int i = 0; i < report[1] && 2 + 7 * i + 7 <= length; i++) {
+          const uint8_t *raw = &report[2 + 7 * i];
+          if (!raw[2] || pending_count == MAX_PENDING) {
+            continue; // Only presses are measured
+          }
+          pending[pending_count++] = (probe_event_t){
+            .row = raw[0], .col = raw[1], .pressed = true,
+            .time_us = extend_device_time(read_u32(&raw[3])) + offset_us,
+          };
+        }
+      }
+    }
+
+    if (pfds[1].revents & POLLIN) {
+      struct input_event ev;
+      while (read(input, &ev, sizeof(ev)) == sizeof(ev)) {
+        if (ev.type != EV_KEY || ev.value != 1 || (ev.code != KEY_F23 && ev.code != KEY_F24)) {
+          continue;
+        }
+        if (pending_count == 0) {
+          fprintf(stderr, "input event with no matching probe event\n");
+          continue;
+        }
+
+        // Match with the oldest pending press
+        probe_event_t press = pending[0];
+        memmove(pending, pending + 1, --pending_count * sizeof(probe_event_t));
+
+        int64_t time = (int64_t)ev.input_event_sec * 1000000 + ev.input_event_usec;
+        int64_t latency = time - press.time_us;
+        printf("%s: %.3f ms\n", ev.code == KEY_F23 ? "F23" : "F24", latency / 1000.0);
+        fflush(stdout);
+
+        if (count == capacity) {
+          capacity = capacity ? capacity * 2 : 64;
+          latencies = realloc(latencies, capacity * sizeof(int64_t));
+        }
+        latencies[count++] = latency;
+      }
+    }
+  }
+
+  send_message(REMOTE_PROBE_STOP);
+  print_summary(latencies, count);
+  printf("clock sync uncertainty: ±%.3f ms\n", offset_error_us / 1000.0);
+  free(latencies);
+  return 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * Stands in for QMK's progmem.h when the sources shared by the keyboards are
+ * built on the host, where everything is in RAM
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_ptr(address) (*(void *const *)(address))
@@ -0,0 +1,134 @@
+/*
+ * Stands in for QMK's quantum.h when the sources shared by the keyboards are
+ * built on the host: the parts of the QMK API they use, implemented by the
+ * tool building them
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "progmem.h"
+
+// Timers, in ms
+uint32_t timer_read32(void);
+uint32_t timer_elapsed32(uint32_t last);
+
+// The user EEPROM block
+void eeconfig_read_user_datablock(void *data, uint32_t offset, uint32_t size);
+void eeconfig_update_user_datablock(const void *data, uint32_t offset, uint32_t size);
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+uint16_t timer_read(void);
+uint16_t timer_elapsed(uint16_t last);
+
+// Key events
+typedef struct {
+  uint8_t col;
+  uint8_t row;
+} keypos_t;
+
+typedef struct {
+  keypos_t key;
+  bool pressed;
+  uint16_t time;
+} keyevent_t;
+
+typedef struct {
+  keyevent_t event;
+} keyrecord_t;
+
+// The keycodes used, with their values in QMK
+enum {
+  MS_UP = 0x00CD,
+  MS_DOWN = 0x00CE,
+  MS_LEFT = 0x00CF,
+  MS_RGHT = 0x00D0,
+  MS_WHLU = 0x00D9,
+  MS_WHLD = 0x00DA,
+};
+
+// Pointing devices
+typedef struct {
+  uint8_t buttons;
+  int8_t x, y, v, h;
+} report_mouse_t;
+
+typedef struct {
+  bool (*init)(void);
+  report_mouse_t (*get_report)(report_mouse_t mouse_report);
+  uint16_t (*get_cpi)(void);
+  void (*set_cpi)(uint16_t cpi);
+} pointing_device_driver_t;
+
+uint16_t pointing_device_get_hires_scroll_resolution(void);
+report_mouse_t pointing_device_task_user(report_mouse_t mouse_report);
+
+// Basic keycodes (HID usages) and modifiers, with their values in QMK
+enum {
+  KC_NO = 0x0000,
+  KC_PGUP = 0x004B,
+  KC_PGDN = 0x004E,
+  KC_RGHT = 0x004F,
+  KC_LEFT = 0x0050,
+  KC_DOWN = 0x0051,
+  KC_UP = 0x0052,
+};
+
+#define LCTL(kc) (0x0100 | (kc))
+
+#define KEYEQ(a, b) ((a).row == (b).row && (a).col == (b).col)
+
+void register_code16(uint16_t keycode);
+void unregister_code16(uint16_t keycode);
+
+// The layer a key was pressed on
+uint8_t read_source_layers_cache(keypos_t key);
+
+// Keyboard reports
+#define KEYBOARD_REPORT_KEYS 6
+
+#define KC_EXSEL 0x00A4
+#define KC_LEFT_SHIFT 0x00E1
+#define KC_RIGHT_ALT 0x00E6
+
+#define IS_MODIFIER_KEYCODE(code) ((code) >= 0x00E0 && (code) <= 0x00E7)
+#define MOD_BIT(code) (1 << ((code) & 0x07))
+
+void add_key(uint8_t key);
+void del_key(uint8_t key);
+void set_weak_mods(uint8_t mods);
+void send_keyboard_report(void);
+
+void tap_code(uint8_t code);
+void register_code(uint8_t code);
+void unregister_code(uint8_t code);
+void wait_ms(uint16_t ms);
+
+// The SEND_STRING encoding, as in QMK's send_string_keycodes.h
+#define SS_TAP_CODE 1
+#define SS_DOWN_CODE 2
+#define SS_UP_CODE 3
+#define SS_DELAY_CODE 4
+
+#define ADD_SLASH_X(y) STRINGIZE(\x##y)
+#define STRINGIZE(z) #z
+#define SS_TAP(keycode) "\1" ADD_SLASH_X(keycode)
+#define SS_DOWN(keycode) "\2" ADD_SLASH_X(keycode)
+#define SS_UP(keycode) "\3" ADD_SLASH_X(keycode)
+#define SS_LCTL(string) SS_DOWN(X_LCTL) string SS_UP(X_LCTL)
+#define SS_LSFT(string) SS_DOWN(X_LSFT) string SS_UP(X_LSFT)
+#define SS_LALT(string) SS_DOWN(X_LALT) string SS_UP(X_LALT)
+
+// The characters SEND_STRING types, and the ones needing Shift and AltGr (a
+// bit per character)
+extern const uint8_t ascii_to_keycode_lut[128];
+extern const uint8_t ascii_to_shift_lut[16];
+extern const uint8_t ascii_to_altgr_lut[16];
+
+#define PGM_LOADBIT(mem, pos) ((pgm_read_byte(&((mem)[(pos) / 8])) & (1 << ((pos) % 8))) != 0)
+#define PSTR(string) (string)
@@ -0,0 +1,10 @@
+/*
+ * Stands in for QMK's raw_hid.h when common/remote_hid.c is built on the host
+ * (see remote-dispatch-check)
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+void raw_hid_send(uint8_t *data, uint8_t length);
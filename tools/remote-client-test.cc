@@ -0,0 +1,300 @@
+/*
+ * Test the remote_client library against a virtual keyboard
+ *
+ * Usage: remote-client-test [-v]
+ *
+ *   -v  Print every report the virtual keyboard receives
+ *
+ * Creates a virtual USB device through /dev/uhid (usually requires root) with
+ * the raw HID interface of the keyboards, answering from a thread of its own:
+ * PING and VERSION are replied to, BOOT_TIMES never is, STACK_USAGE is
+ * rejected with an ERROR, and EVENTS_SUBSCRIBE is answered with a pushed
+ * EVENTS_REPORT. Finds it with discover(), then checks call() and request()
+ * replies, pipelined requests matched in order, timeouts, rejections, pushed
+ * reports, merged LED updates, and requests failing once the device is gone.
+ * Prints the number of checks, and exits with 1 if any of them failed.
+ */
+
+#include "remote_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Ids of no real keyboard, so that the test never talks to one
+constexpr uint16_t test_vendor_id = 0x1209;
+constexpr uint16_t test_product_id = 0x0001;
+static const char test_name[] = "qmk-playground remote-client-test";
+
+// QMK's raw HID report descriptor, as in fake-keyboard
+static const uint8_t raw_hid_descriptor[] = {
+  0x06, 0x60, 0xFF, 0x09, 0x61, 0xA1, 0x01,
+  0x09, 0x62, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x95, remote::report_size, 0x75, 0x08, 0x81, 0x02,
+  0x09, 0x63, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x95, remote::report_size, 0x75, 0x08, 0x91, 0x02,
+  0xC0,
+};
+
+// The virtual keyboard, run by its own thread
+class VirtualKeyboard {
+ public:
+  explicit VirtualKeyboard(bool verbose) : verbose_(verbose) {
+    fd_ = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (fd_ < 0) {
+      throw std::system_error(errno, std::generic_category(), "/dev/uhid");
+    }
+    struct uhid_event create = {};
+    create.type = UHID_CREATE2;
+    snprintf((char *)create.u.create2.name, sizeof(create.u.create2.name), "%s", test_name);
+    memcpy(create.u.create2.rd_data, raw_hid_descriptor, sizeof(raw_hid_descriptor));
+    create.u.create2.rd_size = sizeof(raw_hid_descriptor);
+    create.u.create2.bus = BUS_USB;
+    create.u.create2.vendor = test_vendor_id;
+    create.u.create2.product = test_product_id;
+    if (!write_event(create)) {
+      int error = errno;
+      close(fd_);
+      throw std::system_error(error, std::generic_category(), "UHID_CREATE2");
+    }
+    thread_ = std::thread([this] { run(); });
+  }
+
+  ~VirtualKeyboard() {
+    unplug();
+    close(fd_);
+  }
+
+  // Remove the device, failing whatever is still waiting on it
+  void unplug() {
+    if (thread_.joinable()) {
+      stop_ = true;
+      thread_.join();
+      struct uhid_event destroy = {};
+      destroy.type = UHID_DESTROY;
+      write_event(destroy);
+    }
+  }
+
+  // The reports received so far, emptied
+  std::vector<remote::Report> take_received() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::move(received_);
+  }
+
+ private:
+  bool write_event(const struct uhid_event &event) {
+    return write(fd_, &event, sizeof(event)) == sizeof(event);
+  }
+
+  void send(const remote::Report &report) {
+    struct uhid_event event = {};
+    event.type = UHID_INPUT2;
+    event.u.input2.size = remote::report_size;
+    memcpy(event.u.input2.data, report.data(), remote::report_size);
+    write_event(event);
+  }
+
+  void handle(remote::Report report) {
+    if (verbose_) {
+      printf("recv");
+      for (uint8_t byte : report) {
+        printf(" %02x", byte);
+      }
+      printf("\n");
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      received_.push_back(report);
+    }
+    switch (report[0]) {
+      case remote::PING:
+        send(report);
+        break;
+      case remote::VERSION:
+        if (report[1] == remote::protocol_version) {
+          uint32_t kinds = 1UL << remote::PING | 1UL << remote::VERSION;
+          memcpy(&report[2], &kinds, sizeof(kinds));
+          send(report);
+        } else {
+          send({ remote::ERROR, remote::VERSION, remote::REJECT_VERSION, remote::protocol_version });
+        }
+        break;
+      case remote::STACK_USAGE:
+        send({ remote::ERROR, remote::STACK_USAGE, remote::REJECT_TOO_SHORT, remote::protocol_version });
+        break;
+      case remote::EVENTS_SUBSCRIBE:
+        send({ remote::EVENTS_REPORT, 1, 0, 2 });
+        break;
+      default:
+        break;
+    }
+  }
+
+  void run() {
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    while (!stop_) {
+      if (poll(&pfd, 1, 10) <= 0) {
+        continue;
+      }
+      struct uhid_event event;
+      if (read(fd_, &event, sizeof(event)) <= 0 || event.type != UHID_OUTPUT) {
+        continue;
+      }
+      // Unnumbered reports may come prefixed by a zero report id
+      const uint8_t *data = event.u.output.data;
+      size_t size = event.u.output.size;
+      if (size == remote::report_size + 1) {
+        data++;
+        size--;
+      }
+      remote::Report report{};
+      memcpy(report.data(), data, std::min(size, remote::report_size));
+      handle(report);
+    }
+  }
+
+  int fd_ = -1;
+  bool verbose_;
+  std::atomic<bool> stop_{ false };
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<remote::Report> received_;
+};
+
+static int checks = 0;
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  checks++;
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// The hidraw device of the virtual keyboard, once the kernel made it
+static std::string find_device() {
+  for (int tries = 0; tries < 200; tries++) {
+    for (const remote::Device &device : remote::discover()) {
+      if (device.vendor_id == test_vendor_id && device.product_id == test_product_id && device.name == test_name) {
+        return device.path;
+      }
+    }
+    usleep(10000);
+  }
+  return "";
+}
+
+static remote::Report ping(uint8_t sequence) {
+  remote::Report report = remote::message(remote::PING);
+  report[1] = sequence;
+  return report;
+}
+
+static remote::Report set_leds(uint8_t first, uint8_t count) {
+  remote::Report report = remote::message(remote::RGB_SET_LEDS);
+  report[1] = first;
+  report[2] = count;
+  for (uint8_t i = 0; i < count; i++) {
+    report[3 + 3 * i] = first + i;
+  }
+  return report;
+}
+
+int main(int argc, char **argv) {
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "v")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  try {
+    VirtualKeyboard keyboard(verbose);
+    std::string path = find_device();
+    if (path.empty()) {
+      fprintf(stderr, "the virtual keyboard did not show up among the hidraw devices\n");
+      return 1;
+    }
+
+    remote::Options options;
+    options.window = 1;
+    options.timeout = std::chrono::milliseconds(200);
+    remote::Client client(path, options);
+
+    // A VERSION gives the version of the client, and is replied to
+    remote::Reply reply = client.call(remote::message(remote::VERSION));
+    check(reply.status == remote::Status::ok && reply.report[1] == remote::protocol_version, "VERSION replied to");
+
+    // Requests in flight are matched to their replies in order
+    std::vector<int> order;
+    for (uint8_t sequence = 0; sequence < 8; sequence++) {
+      client.request(ping(sequence), [&order, sequence](const remote::Reply &reply) {
+        order.push_back(reply.status == remote::Status::ok && reply.report[1] == sequence ? sequence : -1);
+      });
+    }
+    check(client.in_flight() == 1 && client.queued() == 7, "requests past the window queued");
+    check(client.drain(), "drained");
+    check(order == std::vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7 }), "replies in order");
+
+    // No reply, then an ERROR
+    reply = client.call(remote::message(remote::BOOT_TIMES));
+    check(reply.status == remote::Status::timeout && reply.round_trip >= options.timeout, "timeout");
+    reply = client.call(remote::message(remote::STACK_USAGE));
+    check(reply.status == remote::Status::rejected && reply.reject_reason == remote::REJECT_TOO_SHORT, "rejected");
+    check(client.stats().timeouts == 1 && client.stats().rejected == 1, "timeouts and rejections counted");
+
+    // Reports replying to nothing go to the report handler
+    int pushed = 0;
+    client.on_report([&pushed](const remote::Report &report) { pushed += report[0] == remote::EVENTS_REPORT; });
+    client.send(remote::message(remote::EVENTS_SUBSCRIBE));
+    client.call(ping(0));
+    check(pushed == 1, "pushed report handled");
+    keyboard.take_received();
+
+    // LED updates waiting behind a request are merged, without passing it
+    client.request(ping(1), nullptr);
+    client.request(ping(2), nullptr);
+    client.send(set_leds(0, 3));
+    client.send(set_leds(3, 3));
+    client.send(set_leds(6, 3));
+    client.send(set_leds(0, 2));
+    check(client.stats().coalesced == 2, "adjacent LED updates merged");
+    check(client.drain(), "drained");
+    client.call(ping(3)); // Nothing tells when the keyboard got the last one
+    std::vector<remote::Report> received = keyboard.take_received();
+    check(received.size() == 5 && received[0] == ping(1) && received[1] == ping(2), "requests first");
+    check(received.size() == 5 && received[2] == set_leds(0, 9) && received[3] == set_leds(0, 2), "merged LED updates");
+
+    // Everything waiting fails once the device is gone
+    remote::Status status = remote::Status::ok;
+    client.request(remote::message(remote::BOOT_TIMES), [&status](const remote::Reply &reply) { status = reply.status; });
+    keyboard.unplug();
+    while (client.poll(100)) {
+    }
+    check(status == remote::Status::closed, "closed");
+  } catch (const std::system_error &e) {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures > 0;
+}
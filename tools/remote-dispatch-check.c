@@ -0,0 +1,335 @@
+/*
+ * Check the checks of remote_dispatch on the host
+ *
+ * Usage: remote-dispatch-check [-v]
+ *
+ *   -v  Print every message sent and what came of it
+ *
+ * Builds common/remote_hid.c as it is, with a handler registered for every
+ * kind but one, and sends it every kind of message: valid ones (with counts at
+ * their maximum), short ones, ones with counts over what their payload holds,
+ * ones only the keyboard sends, kinds past the last one, and VERSION messages
+ * from hosts with the same, no or another protocol version. Checks for each
+ * that the handler is called with the message (in place, or in the queue for
+ * those replied to) or that it is rejected with the right ERROR, and prints
+ * the number of messages sent. Exits with 1 if any of them went wrong.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "progmem.h"
+#include "remote_hid.h"
+
+// What is expected of each kind, written out here rather than taken from the
+// dispatch table, so that a change to the table shows up
+typedef struct {
+  bool reply;
+  bool to_host;
+  uint8_t count_offset;
+  uint8_t count_max; // 0 if not counted
+} expected_t;
+
+#define COUNTED(view, count, max) { .count_offset = offsetof(view, count), .count_max = max }
+
+static const expected_t expected[REMOTE_KIND_COUNT] = {
+  [REMOTE_RGB_SET_COLOR] = COUNTED(remote_rgb_set_color_t, count, 12),
+  [REMOTE_RGB_LOAD_EFFECT] = COUNTED(remote_rgb_load_effect_t, count, 29),
+  [REMOTE_RGB_ANIM_GROUP] = COUNTED(remote_rgb_anim_group_t, count, 12),
+  [REMOTE_RGB_ANIM_KEYFRAMES] = COUNTED(remote_rgb_anim_keyframes_t, count, 4),
+  [REMOTE_RGB_SET_LEDS] = COUNTED(remote_rgb_set_leds_t, count, 9),
+  [REMOTE_EVENTS_REPORT] = { .to_host = true },
+  [REMOTE_PING] = { .reply = true },
+  [REMOTE_PROBE_SYNC] = { .reply = true },
+  [REMOTE_PROBE_EVENTS] = { .to_host = true },
+  [REMOTE_BOOT_TIMES] = { .reply = true },
+  [REMOTE_LEADER_DICT] = { .reply = true },
+  [REMOTE_STACK_USAGE] = { .reply = true },
+  [REMOTE_VERSION] = { .reply = true },
+  [REMOTE_ERROR] = { .to_host = true },
+};
+
+// The one kind without a handler, which must be ignored
+#define UNHANDLED_KIND REMOTE_MIDI_PROBE
+
+// What the handler and raw_hid_send saw since the last reset
+static int handled = 0;
+static remote_message_t *handled_message;
+static remote_message_t handled_copy;
+
+#define SENT_MAX 8
+static uint8_t sent[SENT_MAX][REMOTE_REPORT_SIZE];
+static int sent_count = 0;
+
+static void record(remote_message_t *message) {
+  handled++;
+  handled_message = message;
+  handled_copy = *message;
+}
+
+void raw_hid_send(uint8_t *data, uint8_t length) {
+  if (length != REMOTE_REPORT_SIZE) {
+    printf("raw_hid_send of %u bytes\n", length);
+  }
+  if (sent_count < SENT_MAX) {
+    memcpy(sent[sent_count], data, REMOTE_REPORT_SIZE);
+  }
+  sent_count++;
+}
+
+#define HANDLED(kind) [kind] = record,
+
+const remote_handler_t PROGMEM remote_handlers[REMOTE_KIND_COUNT] = {
+  HANDLED(REMOTE_RGB_START)
+  HANDLED(REMOTE_RGB_STOP)
+  HANDLED(REMOTE_RGB_SET_COLOR)
+  HANDLED(REMOTE_RGB_LOAD_EFFECT)
+  HANDLED(REMOTE_RGB_SELECT_EFFECT)
+  HANDLED(REMOTE_RGB_ANIM_GROUP)
+  HANDLED(REMOTE_RGB_ANIM_KEYFRAMES)
+  HANDLED(REMOTE_RGB_ANIM_PLAY)
+  HANDLED(REMOTE_RGB_ANIM_STOP)
+  HANDLED(REMOTE_EVENTS_SUBSCRIBE)
+  HANDLED(REMOTE_EVENTS_REPORT)
+  HANDLED(REMOTE_RGB_SET_LEDS)
+  HANDLED(REMOTE_PING)
+  HANDLED(REMOTE_PROBE_START)
+  HANDLED(REMOTE_PROBE_STOP)
+  HANDLED(REMOTE_PROBE_SYNC)
+  HANDLED(REMOTE_PROBE_EVENTS)
+  HANDLED(REMOTE_BOOT_TIMES)
+  HANDLED(REMOTE_LEADER_DICT)
+  HANDLED(REMOTE_STACK_USAGE)
+  HANDLED(REMOTE_ERROR)
+};
+
+static bool verbose = false;
+static int messages = 0;
+static int failures = 0;
+
+// A message of a kind, its payload filled with a pattern, and its count (if
+// any) set
+static void fill(uint8_t *data, uint8_t kind, int count) {
+  for (int i = 0; i < REMOTE_REPORT_SIZE; i++) {
+    data[i] = 0x40 + i;
+  }
+  data[0] = kind;
+  if (kind < REMOTE_KIND_COUNT && expected[kind].count_max) {
+    data[expected[kind].count_offset] = count;
+  }
+}
+
+// Send a message, and flush the replies like the end of the loop
+static void send(uint8_t *data, uint8_t length) {
+  handled = 0;
+  handled_message = NULL;
+  sent_count = 0;
+  messages++;
+  uint32_t received = remote_messages_received;
+  remote_dispatch(data, length);
+  remote_flush();
+  if (remote_messages_received != received + 1) {
+    printf("kind %u: not counted as received\n", data[0]);
+    failures++;
+  }
+}
+
+static void fail(const char *test, uint8_t kind, const char *what) {
+  printf("%s kind %u: %s\n", test, kind, what);
+  failures++;
+}
+
+// The message must have been rejected with a reason, and not handled
+static void check_rejected(const char *test, uint8_t kind, uint8_t reason) {
+  if (handled) {
+    fail(test, kind, "handled, not rejected");
+  }
+  if (sent_count != 1) {
+    fail(test, kind, "not one ERROR sent");
+    return;
+  }
+  const remote_message_t *error = (const remote_message_t *)sent[0];
+  if (error->kind != REMOTE_ERROR || error->error.rejected_kind != kind || error->error.reason != reason) {
+    fail(test, kind, "wrong ERROR");
+  } else if (error->error.version != REMOTE_PROTOCOL_VERSION) {
+    fail(test, kind, "ERROR without the protocol version");
+  }
+  if (verbose) {
+    printf("%s kind %u: ERROR %u\n", test, kind, error->error.reason);
+  }
+}
+
+// The message must have been ignored without a word
+static void check_ignored(const char *test, uint8_t kind) {
+  if (handled || sent_count) {
+    fail(test, kind, "not ignored");
+  } else if (verbose) {
+    printf("%s kind %u: ignored\n", test, kind);
+  }
+}
+
+// The handler must have been called once with the message: in place, or in
+// the queue and sent back for those replied to
+static void check_handled(const char *test, uint8_t kind, uint8_t *data) {
+  if (handled != 1) {
+    fail(test, kind, "not handled once");
+    return;
+  }
+  if (memcmp(&handled_copy, data, REMOTE_REPORT_SIZE) != 0) {
+    fail(test, kind, "handled another message");
+  }
+  if (expected[kind].reply) {
+    if (handled_message == (remote_message_t *)data) {
+      fail(test, kind, "handled in place, not in the queue");
+    }
+    if (sent_count != 1 || memcmp(sent[0], data, REMOTE_REPORT_SIZE) != 0) {
+      fail(test, kind, "not replied to");
+    }
+  } else {
+    if (handled_message != (remote_message_t *)data) {
+      fail(test, kind, "not handled in place");
+    }
+    if (sent_count) {
+      fail(test, kind, "replied to");
+    }
+  }
+  if (verbose) {
+    printf("%s kind %u: handled%s\n", test, kind, expected[kind].reply ? ", replied" : "");
+  }
+}
+
+// The VERSION reply, or the ERROR for another version
+static void check_version(const char *test, uint8_t host_version) {
+  uint8_t data[REMOTE_REPORT_SIZE] = { REMOTE_VERSION, host_version };
+  send(data, REMOTE_REPORT_SIZE);
+  if (host_version != 0 && host_version != REMOTE_PROTOCOL_VERSION) {
+    check_rejected(test, REMOTE_VERSION, REMOTE_ERROR_VERSION);
+    return;
+  }
+  uint32_t kinds = 0;
+  for (uint8_t kind = 0; kind < REMOTE_KIND_COUNT; kind++) {
+    kinds |= kind != UNHANDLED_KIND ? 1UL << kind : 0;
+  }
+  const remote_message_t *reply = (const remote_message_t *)sent[0];
+  if (handled || sent_count != 1 || reply->kind != REMOTE_VERSION) {
+    fail(test, REMOTE_VERSION, "not replied to");
+  } else if (reply->version.version != REMOTE_PROTOCOL_VERSION || reply->version.kinds != kinds
+             || reply->version.queue_size != REMOTE_QUEUE_SIZE) {
+    fail(test, REMOTE_VERSION, "wrong reply");
+  } else if (verbose) {
+    printf("%s kind %u: version %u, kinds %08x\n", test, REMOTE_VERSION, reply->version.version, (unsigned)reply->version.kinds);
+  }
+}
+
+// Every kind but VERSION, as a host would send it
+static void check_kind(uint8_t kind) {
+  uint8_t data[REMOTE_REPORT_SIZE];
+  const expected_t *expect = &expected[kind];
+
+  // Valid, with as many items as the payload holds
+  fill(data, kind, expect->count_max);
+  send(data, REMOTE_REPORT_SIZE);
+  if (expect->to_host) {
+    check_rejected("valid", kind, REMOTE_ERROR_TO_HOST);
+  } else if (kind == UNHANDLED_KIND) {
+    check_ignored("valid", kind);
+  } else {
+    check_handled("valid", kind, data);
+  }
+
+  // Short, from a single byte to one byte short
+  for (uint8_t length = 1; length < REMOTE_REPORT_SIZE; length += length < 30 ? 29 : 1) {
+    fill(data, kind, expect->count_max);
+    send(data, length);
+    if (expect->to_host) {
+      check_rejected("short", kind, REMOTE_ERROR_TO_HOST);
+    } else if (kind == UNHANDLED_KIND) {
+      check_ignored("short", kind);
+    } else {
+      check_rejected("short", kind, REMOTE_ERROR_TOO_SHORT);
+    }
+  }
+
+  // Over the count, by one and by all
+  if (expect->count_max) {
+    for (int count = expect->count_max + 1; count <= 0xFF; count += 0xFF - expect->count_max - 1) {
+      fill(data, kind, count);
+      send(data, REMOTE_REPORT_SIZE);
+      check_rejected("over-count", kind, REMOTE_ERROR_TOO_MANY);
+    }
+  }
+
+  // Nothing to take but the kind
+  fill(data, kind, 0);
+  memset(&data[1], 0, REMOTE_REPORT_SIZE - 1);
+  send(data, REMOTE_REPORT_SIZE);
+  if (expect->to_host) {
+    check_rejected("empty", kind, REMOTE_ERROR_TO_HOST);
+  } else if (kind == UNHANDLED_KIND) {
+    check_ignored("empty", kind);
+  } else {
+    check_handled("empty", kind, data);
+  }
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "v")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  // Hosts that check the version, and those that do not
+  check_version("version", REMOTE_PROTOCOL_VERSION);
+  check_version("version", 0);
+
+  for (uint8_t kind = 0; kind < REMOTE_KIND_COUNT; kind++) {
+    if (kind != REMOTE_VERSION) {
+      check_kind(kind);
+    }
+  }
+
+  // Kinds from later versions of the protocol
+  for (int kind = REMOTE_KIND_COUNT; kind <= 0xFF; kind++) {
+    uint8_t data[REMOTE_REPORT_SIZE];
+    fill(data, kind, 0);
+    send(data, REMOTE_REPORT_SIZE);
+    check_ignored("unknown", kind);
+  }
+
+  // A host with another version is rejected, whatever it sends, until it
+  // comes back with the right one
+  check_version("other version", REMOTE_PROTOCOL_VERSION + 1);
+  for (uint8_t kind = 0; kind < REMOTE_KIND_COUNT; kind++) {
+    if (kind == REMOTE_VERSION || kind == UNHANDLED_KIND || expected[kind].to_host) {
+      continue;
+    }
+    uint8_t data[REMOTE_REPORT_SIZE];
+    fill(data, kind, expected[kind].count_max);
+    send(data, REMOTE_REPORT_SIZE);
+    check_rejected("other version", kind, REMOTE_ERROR_VERSION);
+  }
+  check_version("other version", 0xFF);
+  check_version("version again", REMOTE_PROTOCOL_VERSION);
+  uint8_t ping[REMOTE_REPORT_SIZE];
+  fill(ping, REMOTE_PING, 0);
+  send(ping, REMOTE_REPORT_SIZE);
+  check_handled("version again", REMOTE_PING, ping);
+
+  printf("%d messages, %d wrong\n", messages, failures);
+  if (failures > 0) {
+    fprintf(stderr, "%d checks of remote_dispatch went wrong\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Print what each connected keyboard speaks of the raw HID protocol
+ *
+ * Usage: remote-info [-n count] [-w window] [device...]
+ *
+ *   -n count   The number of pings sent to each keyboard (100 by default,
+ *              0 to skip them)
+ *   -w window  The maximum number of requests in flight (the queue size
+ *              reported by the keyboard by default)
+ *   device     The hidraw devices to use (every keyboard found by default)
+ *
+ * Asks each keyboard for its protocol version and the message kinds it
+ * handles, then pipelines pings through the remote_client library and prints
+ * their round-trip times. All the keyboards are driven at once, from a single
+ * epoll loop.
+ */
+
+#include "remote_client.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+static const char *const kind_names[] = {
+  "rgb_start", "rgb_stop", "rgb_set_color", "rgb_load_effect", "rgb_select_effect",
+  "rgb_anim_group", "rgb_anim_keyframes", "rgb_anim_play", "rgb_anim_stop", "events_subscribe",
+  "events_report", "rgb_set_leds", "ping", "probe_start", "probe_stop",
+  "probe_sync", "probe_events", "boot_times", "midi_probe", "leader_dict",
+  "stack_usage", "version", "error",
+};
+
+struct Keyboard {
+  std::unique_ptr<remote::Client> client;
+  std::string name;
+  size_t window = 1; // Pings in flight at most
+  int pings_left = 0;
+  std::vector<long> round_trips; // In us
+  int lost = 0;
+  bool other_version = false; // Speaks another protocol version, not pinged
+  bool done = false;
+  std::string out; // Printed once done, so keyboards do not interleave
+};
+
+static void appendf(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string &out, const char *format, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  out += line;
+}
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void send_pings(Keyboard &keyboard) {
+  while (keyboard.pings_left > 0 && keyboard.client->in_flight() + keyboard.client->queued() < keyboard.window) {
+    keyboard.pings_left--;
+    keyboard.client->request(remote::message(remote::PING), [&keyboard](const remote::Reply &reply) {
+      if (reply.status == remote::Status::ok) {
+        keyboard.round_trips.push_back(reply.round_trip.count());
+      } else {
+        keyboard.lost++;
+      }
+    });
+  }
+}
+
+static void report_pings(Keyboard &keyboard) {
+  std::vector<long> rtt = keyboard.round_trips;
+  if (rtt.empty()) {
+    appendf(keyboard.out, "  pings:     all %d lost\n", keyboard.lost);
+    return;
+  }
+  std::sort(rtt.begin(), rtt.end());
+  appendf(keyboard.out, "  pings:     %zu replied, %d lost, round trip min %ld us, median %ld us, p99 %ld us, max %ld us\n",
+    rtt.size(), keyboard.lost, rtt.front(), rtt[rtt.size() / 2], rtt[rtt.size() * 99 / 100], rtt.back());
+  const remote::Stats &stats = keyboard.client->stats();
+  appendf(keyboard.out, "  reports:   %llu written, %llu replies, %llu pushed\n",
+    (unsigned long long)stats.written, (unsigned long long)stats.replies, (unsigned long long)stats.pushed);
+}
+
+int main(int argc, char **argv) {
+  int count = 100;
+  size_t window = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n count] [-w window] [device...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (count < 0) {
+    fprintf(stderr, "invalid count\n");
+    return 1;
+  }
+
+  std::vector<std::string> paths(argv + optind, argv + argc);
+  std::vector<std::string> names(paths.size());
+  if (paths.empty()) {
+    for (const remote::Device &device : remote::discover()) {
+      paths.push_back(device.path);
+      names.push_back(device.name);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "no keyboard found\n");
+    return 1;
+  }
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<Keyboard> keyboards(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    Keyboard &keyboard = keyboards[i];
+    keyboard.name = names[i];
+    try {
+      remote::Options options;
+      options.window = window ? window : options.window;
+      keyboard.client = std::make_unique<remote::Client>(paths[i], options);
+    } catch (const std::system_error &e) {
+      fprintf(stderr, "%s: %s\n", paths[i].c_str(), e.what());
+      return 1;
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &keyboard;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, keyboard.client->fd(), &event);
+
+    // The pings start once the keyboard says how many replies it can queue
+    keyboard.client->request(remote::message(remote::VERSION), [&keyboard, count, window](const remote::Reply &reply) {
+      std::string &out = keyboard.out;
+      appendf(out, "%s", keyboard.client->path().c_str());
+      if (!keyboard.name.empty()) {
+        appendf(out, " (%s)", keyboard.name.c_str());
+      }
+      appendf(out, "\n");
+      size_t queue_size = 1;
+      if (reply.status == remote::Status::ok) {
+        const uint8_t *data = reply.report.data();
+        uint32_t kinds = read_u32(&data[2]);
+        queue_size = data[6];
+        appendf(out, "  protocol:  %d, %zu replies queued\n  handles:  ", data[1], queue_size);
+        for (int kind = 0; kind < 32; kind++) {
+          if (kinds & 1UL << kind) {
+            if (kind < (int)(sizeof(kind_names) / sizeof(kind_names[0]))) {
+              appendf(out, " %s", kind_names[kind]);
+            } else {
+              appendf(out, " %d", kind);
+            }
+          }
+        }
+        appendf(out, "\n");
+      } else if (reply.status == remote::Status::rejected && reply.reject_reason == remote::REJECT_VERSION) {
+        appendf(out, "  protocol:  %d, not %d: update the keyboard or this tool\n", reply.report[3], remote::protocol_version);
+        keyboard.other_version = true;
+        return;
+      } else {
+        // Keyboards from before VERSION ignore it
+        appendf(out, "  protocol:  unknown (no reply to VERSION)\n");
+      }
+      keyboard.pings_left = count;
+      keyboard.window = window ? window : std::max<size_t>(queue_size, 1);
+      send_pings(keyboard);
+    });
+  }
+
+  // Run every client from a single loop, until all the pings are answered
+  size_t left = keyboards.size();
+  while (left > 0) {
+    struct epoll_event events[8];
+    int ready = epoll_wait(epoll_fd, events, 8, -1);
+    for (int i = 0; i < ready; i++) {
+      Keyboard &keyboard = *(Keyboard *)events[i].data.ptr;
+      if (keyboard.done) {
+        continue;
+      }
+      bool alive = keyboard.client->poll(0);
+      send_pings(keyboard);
+      bool finished = keyboard.other_version
+                      || (keyboard.pings_left == 0 && keyboard.client->in_flight() == 0 && keyboard.client->queued() == 0
+                          && keyboard.round_trips.size() + keyboard.lost == (size_t)count);
+      if (!alive || finished) {
+        if (!alive) {
+          fprintf(stderr, "%s: the device went away\n", keyboard.client->path().c_str());
+        } else {
+          if (count > 0 && !keyboard.other_version) {
+            report_pings(keyboard);
+          }
+          fputs(keyboard.out.c_str(), stdout);
+        }
+        keyboard.done = true;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, keyboard.client->fd(), NULL);
+      }
+    }
+    left = std::count_if(keyboards.begin(), keyboards.end(), [](const Keyboard &k) { return !k.done; });
+  }
+  close(epoll_fd);
+  return 0;
+}
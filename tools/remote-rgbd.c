@@ -0,0 +1,617 @@
+/*
+ * Share the keyboard LEDs between several local clients
+ *
+ * Usage: remote-rgbd [-s socket] [-f fps] [-r rows] [-c cols] [-l] [device]
+ *
+ *   -s socket  The Unix socket to listen on ($XDG_RUNTIME_DIR/remote-rgb.sock
+ *              by default)
+ *   -f fps     The maximum number of frames sent to the keyboard per second
+ *              (60 by default)
+ *   -r rows    The number of matrix rows (12 by default, like the Moonlander)
+ *   -c cols    The number of matrix columns (7 by default)
+ *   -l         Address LEDs by index instead of keys, the LED of row,col
+ *              being row * cols + col (e.g. -r 1 -c 9 -l for the 9 LEDs of
+ *              the Preonic's underglow)
+ *   device     The hidraw device to use (found automatically by default)
+ *
+ * The daemon owns the raw HID device. Each client connected to the socket owns
+ * a layer of RGBA colors covering the whole matrix, which lives as long as its
+ * connection. Layers are composited from the lowest to the highest priority
+ * using their alpha, and only the keys whose color changed are sent to the
+ * keyboard, grouping keys of the same color into as few SET_COLOR messages as
+ * possible. The messages the keyboard handles are asked with VERSION: LEDs
+ * go in runs of SET_LEDS with -l, or when the keyboard has no SET_COLOR.
+ *
+ * Remote RGB mode is turned on when the first client connects and off when
+ * the last one disconnects. If it is turned off from the keyboard, the daemon
+ * stops sending colors until it is turned back on. Keyboards without events
+ * (like the Preonic) cannot tell, so the whole frame is sent again every
+ * second instead: the colors come back at most a second after the mode does.
+ *
+ * Clients send one command per line:
+ *
+ *   priority <n>                    Set the priority of the client's layer
+ *   set <a> <r> <g> <b> <row,col>...  Set some keys of the layer
+ *   fill <a> <r> <g> <b>            Set the whole layer
+ *   clear                           Make the whole layer transparent
+ *
+ * Colors and alpha go from 0 to 255. Invalid commands are answered with an
+ * "error" line, and nothing is sent back otherwise. For instance:
+ *
+ *   $ socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/remote-rgb.sock
+ *   priority 10
+ *   set 255 255 0 0 1,1 1,2
+ */
+
+#define _GNU_SOURCE
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// The maximum number of keys in a single SET_COLOR message, and of LEDs in a
+// single SET_LEDS one
+#define SET_COLOR_MAX_KEYS 12
+#define SET_LEDS_MAX_LEDS 9
+
+// How long to wait for the VERSION reply, and how often to send the whole
+// frame again when the keyboard has no events
+#define VERSION_TIMEOUT_MS 1000
+#define REFRESH_PERIOD_US 1000000
+
+#define MAX_CLIENTS 32
+#define MAX_LINE 1024
+
+typedef struct {
+  int fd;
+  int priority;
+  uint8_t *layer; // rows * cols RGBA values
+  char line[MAX_LINE];
+  size_t length;
+} client_t;
+
+static int rows = 12, cols = 7;
+
+// Whether the frame goes out as SET_LEDS, and whether the keyboard pushes its
+// remote RGB mode changes
+static bool use_leds = false;
+static bool has_events = false;
+
+static client_t clients[MAX_CLIENTS];
+static int client_count = 0;
+
+// The colors last sent to the keyboard, and whether they are known to be there
+static uint8_t *sent;
+static bool sent_valid = false;
+
+// Whether the composited frame changed since it was last sent
+static bool dirty = true;
+
+// The remote RGB mode on the keyboard, as last reported by it
+static bool device_on = false;
+// Whether the daemon turned remote RGB mode on, and whether the user turned
+// it off from the keyboard while clients were connected
+static bool started = false;
+static bool paused = false;
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  (void)signal;
+  running = 0;
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Clients
+ */
+
+static void client_add(int fd) {
+  if (client_count == MAX_CLIENTS) {
+    close(fd);
+    return;
+  }
+  client_t *client = &clients[client_count++];
+  memset(client, 0, sizeof(*client));
+  client->fd = fd;
+  client->layer = calloc(rows * cols, 4);
+}
+
+static void client_remove(int i) {
+  close(clients[i].fd);
+  free(clients[i].layer);
+  clients[i] = clients[--client_count];
+  dirty = true;
+}
+
+// Parse a "row,col" pair, returning the index of the key or -1
+static int parse_key(const char *token) {
+  int row, col;
+  if (sscanf(token, "%d,%d", &row, &col) != 2 || row < 0 || row >= rows || col < 0 || col >= cols) {
+    return -1;
+  }
+  return row * cols + col;
+}
+
+// Parse "<a> <r> <g> <b>" into an RGBA color, returning the rest of the line
+static char *parse_color(char *args, uint8_t rgba[4]) {
+  unsigned a, r, g, b;
+  int consumed;
+  if (sscanf(args, "%u %u %u %u%n", &a, &r, &g, &b, &consumed) != 4 || a > 255 || r > 255 || g > 255 || b > 255) {
+    return NULL;
+  }
+  rgba[0] = r; rgba[1] = g; rgba[2] = b; rgba[3] = a;
+  return args + consumed;
+}
+
+static bool client_command(client_t *client, char *line) {
+  char *args = strchr(line, ' ');
+  if (args) {
+    *args++ = '\0';
+  } else {
+    args = line + strlen(line);
+  }
+
+  uint8_t rgba[4];
+  if (strcmp(line, "priority") == 0) {
+    char *end;
+    long priority = strtol(args, &end, 10);
+    if (end == args) {
+      return false;
+    }
+    client->priority = priority;
+  } else if (strcmp(line, "set") == 0) {
+    char *keys = parse_color(args, rgba);
+    if (!keys) {
+      return false;
+    }
+    for (char *token = strtok(keys, " \t"); token; token = strtok(NULL, " \t")) {
+      int index = parse_key(token);
+      if (index < 0) {
+        return false;
+      }
+      memcpy(&client->layer[4 * index], rgba, 4);
+    }
+  } else if (strcmp(line, "fill") == 0) {
+    if (!parse_color(args, rgba)) {
+      return false;
+    }
+    for (int index = 0; index < rows * cols; index++) {
+      memcpy(&client->layer[4 * index], rgba, 4);
+    }
+  } else if (strcmp(line, "clear") == 0) {
+    memset(client->layer, 0, rows * cols * 4);
+  } else if (line[0] != '\0') {
+    return false;
+  }
+
+  dirty = true;
+  return true;
+}
+
+// Read from a client, running every complete line. Returns false once the
+// client disconnects.
+static bool client_read(client_t *client) {
+  ssize_t n = read(client->fd, client->line + client->length, MAX_LINE - client->length);
+  if (n <= 0) {
+    return false;
+  }
+  client->length += n;
+
+  char *start = client->line;
+  char *newline;
+  while ((newline = memchr(start, '\n', client->length - (start - client->line)))) {
+    *newline = '\0';
+    if (newline > start && newline[-1] == '\r') {
+      newline[-1] = '\0';
+    }
+    if (!client_command(client, start)) {
+      (void)!write(client->fd, "error\n", 6);
+    }
+    start = newline + 1;
+  }
+
+  client->length -= start - client->line;
+  memmove(client->line, start, client->length);
+
+  // Drop clients sending lines that do not fit in the buffer
+  return client->length < MAX_LINE;
+}
+
+/*
+ * Compositing
+ */
+
+static int compare_priority(const void *a, const void *b) {
+  const client_t *x = *(const client_t *const *)a, *y = *(const client_t *const *)b;
+  return (x->priority > y->priority) - (x->priority < y->priority);
+}
+
+// Blend every layer, from the lowest to the highest priority, over black
+static void composite(uint8_t *frame) {
+  client_t *sorted[MAX_CLIENTS];
+  for (int i = 0; i < client_count; i++) {
+    sorted[i] = &clients[i];
+  }
+  qsort(sorted, client_count, sizeof(sorted[0]), compare_priority);
+
+  memset(frame, 0, rows * cols * 3);
+  for (int i = 0; i < client_count; i++) {
+    const uint8_t *layer = sorted[i]->layer;
+    for (int index = 0; index < rows * cols; index++) {
+      const uint8_t *src = &layer[4 * index];
+      uint8_t *dst = &frame[3 * index];
+      unsigned a = src[3];
+      for (int c = 0; c < 3; c++) {
+        dst[c] = (dst[c] * (255 - a) + src[c] * a + 127) / 255;
+      }
+    }
+  }
+}
+
+/*
+ * Keyboard
+ */
+
+static int send_message(int fd, uint8_t kind, const uint8_t *payload, size_t length) {
+  uint8_t report[HIDRAW_REPORT_SIZE] = { kind };
+  memcpy(&report[1], payload, length);
+  return hidraw_send(fd, report, sizeof(report));
+}
+
+// Send the LEDs that changed since the last frame, in runs of consecutive
+// LEDs. Returns the number of messages sent, or -1 on error.
+static int send_leds(int fd, const uint8_t *frame) {
+  int total = rows * cols;
+  int messages = 0;
+  for (int index = 0; index < total; index++) {
+    if (sent_valid && memcmp(&frame[3 * index], &sent[3 * index], 3) == 0) {
+      continue;
+    }
+    remote_message_t message = { .kind = REMOTE_RGB_SET_LEDS };
+    message.set_leds.first = index;
+    message.set_leds.count = total - index < SET_LEDS_MAX_LEDS ? total - index : SET_LEDS_MAX_LEDS;
+    memcpy(message.set_leds.colors, &frame[3 * index], 3 * message.set_leds.count);
+    if (hidraw_send(fd, message.data, sizeof(message.data)) < 0) {
+      return -1;
+    }
+    messages++;
+    index += message.set_leds.count - 1;
+  }
+
+  memcpy(sent, frame, total * 3);
+  sent_valid = true;
+  return messages;
+}
+
+// Send the keys that changed since the last frame, grouping keys by color.
+// Returns the number of messages sent, or -1 on error.
+static int send_frame(int fd, const uint8_t *frame) {
+  if (use_leds) {
+    return send_leds(fd, frame);
+  }
+
+  int total = rows * cols;
+  bool pending[total];
+  for (int index = 0; index < total; index++) {
+    pending[index] = !sent_valid || memcmp(&frame[3 * index], &sent[3 * index], 3) != 0;
+  }
+
+  int messages = 0;
+  for (int index = 0; index < total; index++) {
+    if (!pending[index]) {
+      continue;
+    }
+
+    // Collect every pending key with the same color, up to a message's worth
+    const uint8_t *color = &frame[3 * index];
+    uint8_t payload[HIDRAW_REPORT_SIZE - 1] = { color[0], color[1], color[2], 0 };
+    uint8_t count = 0;
+    for (int other = index; other < total && count < SET_COLOR_MAX_KEYS; other++) {
+      if (pending[other] && memcmp(&frame[3 * other], color, 3) == 0) {
+        pending[other] = false;
+        payload[7 + 2 * count] = other / cols;
+        payload[8 + 2 * count] = other % cols;
+        count++;
+      }
+    }
+    payload[3] = count;
+
+    // Revisit this color if it did not fit in a single message
+    index--;
+
+    if (send_message(fd, REMOTE_RGB_SET_COLOR, payload, sizeof(payload)) < 0) {
+      return -1;
+    }
+    messages++;
+  }
+
+  memcpy(sent, frame, total * 3);
+  sent_valid = true;
+  return messages;
+}
+
+// Handle a report pushed by the keyboard
+static void handle_report(const uint8_t *report, int length) {
+  if (length < 2 || report[0] != REMOTE_EVENTS_REPORT) {
+    return;
+  }
+  uint8_t count = report[1] & 0x7F;
+  for (uint8_t i = 0; i < count && 2 + 3 * i + 2 < length; i++) {
+    const uint8_t *event = &report[2 + 3 * i];
+    if (event[0] != REMOTE_EVENT_REMOTE_RGB) {
+      continue;
+    }
+    bool on = event[1];
+    if (on && !device_on) {
+      // The keyboard clears its colors when remote RGB mode starts
+      memset(sent, 0, rows * cols * 3);
+      sent_valid = true;
+      dirty = true;
+      paused = false;
+      started = client_count > 0;
+    } else if (!on && device_on && client_count > 0) {
+      // Turned off from the keyboard, wait until it is turned back on
+      paused = true;
+      started = false;
+    }
+    device_on = on;
+  }
+}
+
+// Bring the keyboard's remote RGB mode in line with the connected clients
+static int sync_mode(int fd) {
+  if (client_count > 0 && !device_on && !paused) {
+    if (send_message(fd, REMOTE_RGB_START, NULL, 0) < 0) {
+      return -1;
+    }
+    device_on = true;
+    started = true;
+    memset(sent, 0, rows * cols * 3);
+    sent_valid = true;
+    dirty = true;
+  } else if (client_count == 0) {
+    if (device_on && started && send_message(fd, REMOTE_RGB_STOP, NULL, 0) < 0) {
+      return -1;
+    }
+    if (started) {
+      device_on = false;
+    }
+    started = false;
+    paused = false;
+  }
+  return 0;
+}
+
+// Ask the keyboard for the kinds of messages it handles. Returns 0 if it does
+// not reply, and -1 on error (errno being EPROTO if it speaks another
+// protocol version).
+static int64_t query_kinds(int fd) {
+  remote_message_t message = { .version = { .kind = REMOTE_VERSION, .version = REMOTE_PROTOCOL_VERSION } };
+  if (hidraw_send(fd, message.data, sizeof(message.data)) < 0) {
+    return -1;
+  }
+  uint64_t deadline = now_us() + VERSION_TIMEOUT_MS * 1000;
+  for (uint64_t now = now_us(); now < deadline; now = now_us()) {
+    remote_message_t reply;
+    int length = hidraw_recv(fd, reply.data, (deadline - now + 999) / 1000);
+    if (length < 0) {
+      return -1;
+    }
+    if (length < 8) {
+      continue;
+    }
+    if (reply.kind == REMOTE_VERSION) {
+      return reply.version.kinds;
+    }
+    if (reply.kind == REMOTE_ERROR && reply.error.rejected_kind == REMOTE_VERSION) {
+      errno = EPROTO;
+      return -1;
+    }
+    handle_report(reply.data, length);
+  }
+  return 0;
+}
+
+/*
+ * Main loop
+ */
+
+static int listen_on(const char *path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    close(fd);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  char default_socket[256];
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  snprintf(default_socket, sizeof(default_socket), "%s/remote-rgb.sock", runtime_dir ? runtime_dir : "/tmp");
+
+  const char *socket_path = default_socket;
+  int fps = 60;
+  bool force_leds = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:f:r:c:l")) != -1) {
+    switch (opt) {
+      case 's':
+        socket_path = optarg;
+        break;
+      case 'f':
+        fps = atoi(optarg);
+        break;
+      case 'r':
+        rows = atoi(optarg);
+        break;
+      case 'c':
+        cols = atoi(optarg);
+        break;
+      case 'l':
+        force_leds = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s socket] [-f fps] [-r rows] [-c cols] [-l] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (fps <= 0 || rows <= 0 || cols <= 0 || rows > 255 || cols > 255) {
+    fprintf(stderr, "invalid fps or matrix size\n");
+    return 2;
+  }
+
+  int device = hidraw_open(optind < argc ? argv[optind] : NULL);
+  if (device < 0) {
+    perror("hidraw_open");
+    return 1;
+  }
+
+  sent = calloc(rows * cols, 3);
+  int64_t kinds = query_kinds(device);
+  if (kinds < 0) {
+    perror("VERSION");
+    return 1;
+  }
+  if (kinds == 0) {
+    // No reply: firmware from before VERSION, which all had SET_COLOR and events
+    kinds = 1UL << REMOTE_RGB_SET_COLOR | 1UL << REMOTE_EVENTS_SUBSCRIBE;
+  }
+  use_leds = force_leds || !(kinds & 1UL << REMOTE_RGB_SET_COLOR);
+  has_events = kinds & 1UL << REMOTE_EVENTS_SUBSCRIBE;
+  if (use_leds && (!(kinds & 1UL << REMOTE_RGB_SET_LEDS) || rows * cols > 256)) {
+    fprintf(stderr, "the keyboard cannot take %d LEDs by index\n", rows * cols);
+    return 1;
+  }
+
+  int server = listen_on(socket_path);
+  if (server < 0) {
+    perror(socket_path);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  // Learn about remote RGB mode changes made from the keyboard
+  if (has_events) {
+    uint8_t mask = 1 << REMOTE_EVENT_REMOTE_RGB;
+    send_message(device, REMOTE_EVENTS_SUBSCRIBE, &mask, 1);
+  }
+
+  uint8_t *frame = calloc(rows * cols, 3);
+  uint64_t frame_period = 1000000 / fps;
+  uint64_t next_frame = now_us();
+  uint64_t next_refresh = next_frame + REFRESH_PERIOD_US;
+
+  while (running) {
+    struct pollfd pfds[MAX_CLIENTS + 2];
+    pfds[0] = (struct pollfd){ .fd = device, .events = POLLIN };
+    pfds[1] = (struct pollfd){ .fd = server, .events = POLLIN };
+    for (int i = 0; i < client_count; i++) {
+      pfds[i + 2] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+    }
+    int watched = client_count;
+
+    // Wake up for the next frame only if there is something to send
+    int timeout = -1;
+    uint64_t wake = dirty ? next_frame : !has_events ? next_refresh : 0;
+    if (wake && device_on) {
+      uint64_t now = now_us();
+      timeout = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+    }
+
+    if (poll(pfds, watched + 2, timeout) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    if (pfds[0].revents & (POLLERR | POLLHUP)) {
+      fprintf(stderr, "keyboard disconnected\n");
+      break;
+    }
+    if (pfds[0].revents & POLLIN) {
+      uint8_t report[HIDRAW_REPORT_SIZE];
+      int length = read(device, report, sizeof(report));
+      if (length > 0) {
+        handle_report(report, length);
+      }
+    }
+
+    // Handle clients from the last one, since removing one moves the last
+    // client into its place
+    for (int i = watched - 1; i >= 0; i--) {
+      if (pfds[i + 2].revents && !client_read(&clients[i])) {
+        client_remove(i);
+      }
+    }
+
+    if (pfds[1].revents & POLLIN) {
+      int fd = accept4(server, NULL, NULL, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        client_add(fd);
+      }
+    }
+
+    if (sync_mode(device) < 0) {
+      perror("hidraw_send");
+      break;
+    }
+
+    // Without events, send the whole frame again once in a while, in case
+    // remote RGB mode was turned off and on from the keyboard
+    uint64_t now = now_us();
+    if (!has_events && device_on && now >= next_refresh) {
+      sent_valid = false;
+      dirty = true;
+      next_refresh = now + REFRESH_PERIOD_US;
+    }
+
+    // Send a new frame, at most once per frame period
+    if (dirty && device_on && now >= next_frame) {
+      composite(frame);
+      if (send_frame(device, frame) < 0) {
+        perror("hidraw_send");
+        break;
+      }
+      dirty = false;
+      next_frame = now + frame_period;
+    }
+  }
+
+  while (client_count > 0) {
+    client_remove(client_count - 1);
+  }
+  sync_mode(device);
+  unlink(socket_path);
+  return 0;
+}
@@ -0,0 +1,464 @@
+/*
+ * Asynchronous client for the raw HID protocol of the keyboards in this repo
+ */
+
+#include "remote_client.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+
+namespace remote {
+
+// Offsets into the messages, from the layouts in common/remote_hid.h
+constexpr size_t set_color_count = 4;
+constexpr size_t set_color_cells = 8;
+constexpr size_t set_color_max = 12;
+constexpr size_t set_leds_first = 1;
+constexpr size_t set_leds_count = 2;
+constexpr size_t set_leds_colors = 3;
+constexpr size_t set_leds_max = 9;
+constexpr size_t error_rejected_kind = 1;
+constexpr size_t error_reason = 2;
+constexpr size_t version_version = 1;
+
+bool has_reply(uint8_t kind) {
+  switch (kind) {
+    case PING:
+    case PROBE_SYNC:
+    case BOOT_TIMES:
+    case LEADER_DICT:
+    case STACK_USAGE:
+    case VERSION:
+      return true;
+    default:
+      return false;
+  }
+}
+
+Report message(uint8_t kind) {
+  Report report{};
+  report[0] = kind;
+  if (kind == VERSION) {
+    report[version_version] = protocol_version;
+  }
+  return report;
+}
+
+/*
+ * Discovery
+ */
+
+// The usages declared by a HID report descriptor: whether it has QMK's raw
+// HID usage, and whether it uses a vendor usage page at all
+static void descriptor_usages(const std::vector<uint8_t> &desc, bool &raw_usage, bool &vendor_page) {
+  uint32_t usage_page = 0;
+  size_t i = 0;
+  while (i < desc.size()) {
+    uint8_t prefix = desc[i++];
+
+    // Long items carry their own size and are never usages
+    if (prefix == 0xFE) {
+      if (i + 1 >= desc.size()) {
+        return;
+      }
+      i += 2 + desc[i];
+      continue;
+    }
+
+    size_t length = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+    if (i + length > desc.size()) {
+      return;
+    }
+    uint32_t value = 0;
+    for (size_t b = 0; b < length; b++) {
+      value |= (uint32_t)desc[i + b] << (8 * b);
+    }
+    i += length;
+
+    switch (prefix & 0xFC) {
+      case 0x04: // Usage page (global)
+        usage_page = value;
+        vendor_page |= usage_page >= 0xFF00;
+        break;
+      case 0x08: // Usage (local)
+        if (length == 4) {
+          raw_usage |= value == ((uint32_t)raw_usage_page << 16 | raw_usage_id);
+          vendor_page |= value >> 16 >= 0xFF00;
+        } else {
+          raw_usage |= usage_page == raw_usage_page && value == raw_usage_id;
+        }
+        break;
+    }
+  }
+}
+
+std::vector<Device> discover() {
+  std::vector<Device> devices;
+  DIR *dir = opendir("/sys/class/hidraw");
+  if (!dir) {
+    return devices;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+      continue;
+    }
+    std::string sys = std::string("/sys/class/hidraw/") + entry->d_name + "/device/";
+
+    std::ifstream desc_file(sys + "report_descriptor", std::ios::binary);
+    std::vector<uint8_t> desc((std::istreambuf_iterator<char>(desc_file)), std::istreambuf_iterator<char>());
+    bool raw_usage = false, vendor_page = false;
+    descriptor_usages(desc, raw_usage, vendor_page);
+
+    // HID_ID=<bus>:<vendor>:<product> and HID_NAME=<name>
+    Device device{ std::string("/dev/") + entry->d_name, 0, 0, "" };
+    std::ifstream uevent(sys + "uevent");
+    std::string line;
+    while (std::getline(uevent, line)) {
+      unsigned bus, vendor, product;
+      if (sscanf(line.c_str(), "HID_ID=%x:%x:%x", &bus, &vendor, &product) == 3) {
+        device.vendor_id = vendor;
+        device.product_id = product;
+      } else if (line.rfind("HID_NAME=", 0) == 0) {
+        device.name = line.substr(9);
+      }
+    }
+
+    bool moonlander = device.vendor_id == moonlander_vendor_id && device.product_id == moonlander_product_id;
+    if (raw_usage || (moonlander && vendor_page)) {
+      devices.push_back(device);
+    }
+  }
+  closedir(dir);
+
+  std::sort(devices.begin(), devices.end(), [](const Device &a, const Device &b) { return a.path < b.path; });
+  return devices;
+}
+
+/*
+ * Client
+ */
+
+// epoll data of the fds
+enum { EVENT_DEVICE, EVENT_TIMER };
+
+Client::Client(const std::string &path, Options options) : path_(path), options_(options) {
+  if (path_.empty()) {
+    std::vector<Device> devices = discover();
+    if (devices.empty()) {
+      throw std::system_error(ENODEV, std::generic_category(), "no keyboard found");
+    }
+    path_ = devices[0].path;
+  }
+  if (options_.window == 0) {
+    options_.window = 1;
+  }
+
+  device_fd_ = open(path_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  epoll_fd_ = device_fd_ < 0 ? -1 : epoll_create1(EPOLL_CLOEXEC);
+  timer_fd_ = epoll_fd_ < 0 ? -1 : timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    int error = errno;
+    close_device();
+    throw std::system_error(error, std::generic_category(), path_);
+  }
+
+  struct epoll_event device_event = {};
+  device_event.events = EPOLLIN;
+  device_event.data.u32 = EVENT_DEVICE;
+  struct epoll_event timer_event = {};
+  timer_event.events = EPOLLIN;
+  timer_event.data.u32 = EVENT_TIMER;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, device_fd_, &device_event);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &timer_event);
+}
+
+Client::~Client() {
+  close_device();
+}
+
+void Client::close_device() {
+  for (int *fd : { &device_fd_, &epoll_fd_, &timer_fd_ }) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+// Merge a message into the last queued one, if it has not been written yet
+// and the two take a single report. Only the last one is tried, so messages
+// are never reordered.
+bool Client::coalesce(const Report &report) {
+  if (!options_.coalesce || outgoing_.empty() || outgoing_.back().handler) {
+    return false;
+  }
+  Report &last = outgoing_.back().report;
+  if (last[0] != report[0]) {
+    return false;
+  }
+
+  switch (report[0]) {
+    // State changes: the last one wins
+    case RGB_SELECT_EFFECT:
+    case EVENTS_SUBSCRIBE:
+      last = report;
+      return true;
+
+    // Cells of the same color
+    case RGB_SET_COLOR: {
+      size_t count = last[set_color_count], more = report[set_color_count];
+      if (memcmp(&last[1], &report[1], 3) != 0 || count + more > set_color_max) {
+        return false;
+      }
+      memcpy(&last[set_color_cells + 2 * count], &report[set_color_cells], 2 * more);
+      last[set_color_count] = count + more;
+      return true;
+    }
+
+    // The same LEDs again, or the ones right after
+    case RGB_SET_LEDS: {
+      size_t first = last[set_leds_first], count = last[set_leds_count];
+      size_t new_first = report[set_leds_first], more = report[set_leds_count];
+      if (new_first == first && more == count) {
+        last = report;
+        return true;
+      }
+      if (new_first != first + count || count + more > set_leds_max) {
+        return false;
+      }
+      memcpy(&last[set_leds_colors + 3 * count], &report[set_leds_colors], 3 * more);
+      last[set_leds_count] = count + more;
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+void Client::send(const Report &report) {
+  if (has_reply(report[0])) {
+    request(report, nullptr);
+    return;
+  }
+  if (coalesce(report)) {
+    stats_.coalesced++;
+    return;
+  }
+  outgoing_.push_back({ report, nullptr });
+  write_some();
+}
+
+void Client::request(const Report &report, ReplyHandler handler) {
+  if (!has_reply(report[0])) {
+    throw std::invalid_argument("the keyboard does not reply to this kind of message");
+  }
+  // A request without a handler still takes its place in the window
+  outgoing_.push_back({ report, handler ? std::move(handler) : [](const Reply &) {} });
+  write_some();
+}
+
+Reply Client::call(const Report &report) {
+  bool done = false;
+  Reply reply{};
+  request(report, [&](const Reply &r) {
+    reply = r;
+    done = true;
+  });
+  while (!done && poll(-1)) {
+  }
+  if (!done) {
+    reply.status = Status::closed;
+  }
+  return reply;
+}
+
+// Write the queued messages in order, until the device would block or the
+// next one is a request with the window full
+void Client::write_some() {
+  while (device_fd_ >= 0 && !outgoing_.empty()) {
+    Outgoing &next = outgoing_.front();
+    if (next.handler && pending_.size() >= options_.window) {
+      break;
+    }
+
+    // The first byte is the report id, always 0 for the raw HID interface
+    uint8_t data[report_size + 1] = { 0 };
+    memcpy(&data[1], next.report.data(), report_size);
+    ssize_t written = write(device_fd_, data, sizeof(data));
+    if (written < 0 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    }
+    if (written < 0) {
+      close_device();
+      break;
+    }
+
+    stats_.written++;
+    if (next.handler) {
+      Clock::time_point now = Clock::now();
+      pending_.push_back({ next.report[0], std::move(next.handler), now, now + options_.timeout });
+      if (pending_.size() == 1) {
+        arm_timer();
+      }
+    }
+    outgoing_.pop_front();
+  }
+  update_interest();
+}
+
+// Wait for the device to take more only when a write would have blocked
+void Client::update_interest() {
+  if (device_fd_ < 0) {
+    return;
+  }
+  bool blocked = !outgoing_.empty() && (!outgoing_.front().handler || pending_.size() < options_.window);
+  if (blocked == want_write_) {
+    return;
+  }
+  want_write_ = blocked;
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  if (blocked) {
+    event.events |= EPOLLOUT;
+  }
+  event.data.u32 = EVENT_DEVICE;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, device_fd_, &event);
+}
+
+void Client::read_some() {
+  Report report;
+  for (;;) {
+    ssize_t length = read(device_fd_, report.data(), report_size);
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    if (length <= 0) {
+      close_device();
+      return;
+    }
+    std::fill(report.begin() + length, report.end(), 0);
+    handle_report(report);
+  }
+}
+
+// Replies come back in the order their requests were sent (the keyboard
+// handles one report at a time), so each goes to the oldest pending request
+// of its kind. ERROR replies go to the oldest of the kind they reject.
+void Client::handle_report(const Report &report) {
+  bool error = report[0] == ERROR;
+  uint8_t kind = error ? report[error_rejected_kind] : report[0];
+  auto match = std::find_if(pending_.begin(), pending_.end(), [&](const Pending &p) { return p.kind == kind; });
+  if (match == pending_.end() || (!error && !has_reply(kind))) {
+    stats_.pushed++;
+    if (report_handler_) {
+      report_handler_(report);
+    }
+    return;
+  }
+
+  Pending pending = std::move(*match);
+  bool rearm = match == pending_.begin();
+  pending_.erase(match);
+  if (rearm) {
+    arm_timer();
+  }
+
+  Reply reply{};
+  reply.status = error ? Status::rejected : Status::ok;
+  reply.report = report;
+  reply.reject_reason = error ? report[error_reason] : 0;
+  reply.round_trip = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - pending.sent);
+  (error ? stats_.rejected : stats_.replies)++;
+  pending.handler(reply);
+}
+
+// Fail the requests past their deadline
+void Client::expire() {
+  Clock::time_point now = Clock::now();
+  while (!pending_.empty() && pending_.front().deadline <= now) {
+    Pending pending = std::move(pending_.front());
+    pending_.pop_front();
+    stats_.timeouts++;
+    Reply reply{};
+    reply.status = Status::timeout;
+    reply.round_trip = std::chrono::duration_cast<std::chrono::microseconds>(now - pending.sent);
+    pending.handler(reply);
+  }
+  arm_timer();
+}
+
+// Requests are sent in order with the same timeout, so the oldest one has the
+// earliest deadline
+void Client::arm_timer() {
+  if (timer_fd_ < 0) {
+    return;
+  }
+  struct itimerspec spec = {};
+  if (!pending_.empty()) {
+    auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(pending_.front().deadline - Clock::now());
+    long long ns = std::max<long long>(left.count(), 1);
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+  }
+  timerfd_settime(timer_fd_, 0, &spec, nullptr);
+}
+
+bool Client::poll(int timeout_ms) {
+  if (device_fd_ >= 0) {
+    struct epoll_event events[2];
+    int ready = epoll_wait(epoll_fd_, events, 2, timeout_ms);
+    for (int i = 0; i < ready && device_fd_ >= 0; i++) {
+      if (events[i].data.u32 == EVENT_TIMER) {
+        uint64_t expirations;
+        if (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+          expire();
+        }
+      } else if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        read_some();
+      }
+    }
+    if (device_fd_ >= 0) {
+      write_some();
+      return true;
+    }
+  }
+
+  // Everything still waiting fails once the device is gone
+  if (device_fd_ < 0) {
+    outgoing_.clear();
+    while (!pending_.empty()) {
+      Pending pending = std::move(pending_.front());
+      pending_.pop_front();
+      Reply reply{};
+      reply.status = Status::closed;
+      pending.handler(reply);
+    }
+  }
+  return false;
+}
+
+bool Client::drain() {
+  while (!outgoing_.empty() || !pending_.empty()) {
+    if (!poll(-1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace remote
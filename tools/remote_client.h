@@ -0,0 +1,211 @@
+/*
+ * Asynchronous client for the raw HID protocol of the keyboards in this repo
+ *
+ * A Client drives one keyboard through its hidraw device, without blocking:
+ * - messages are queued and written as the device takes them, and the last
+ *   queued one absorbs the next when they can be merged (SET_LEDS of the same
+ *   or adjacent LEDs, SET_COLOR of the same color, state changes like
+ *   SELECT_EFFECT), so bursts of LED updates take fewer reports
+ * - requests (messages the keyboard replies to) are pipelined, up to a window
+ *   of replies in flight, and matched to their replies in order
+ * - reports pushed by the keyboard (events, probe events) go to a handler
+ *
+ * Everything happens in poll(), on the thread calling it. The client has its
+ * own epoll instance, whose fd can be added to another event loop.
+ */
+
+#pragma once
+
+#include "remote_hid.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace remote {
+
+constexpr size_t report_size = REMOTE_REPORT_SIZE;
+using Report = std::array<uint8_t, report_size>;
+
+constexpr uint8_t protocol_version = REMOTE_PROTOCOL_VERSION;
+
+// The kinds of common/remote_hid.h, without their prefix
+enum Kind : uint8_t {
+  RGB_START = REMOTE_RGB_START,
+  RGB_STOP = REMOTE_RGB_STOP,
+  RGB_SET_COLOR = REMOTE_RGB_SET_COLOR,
+  RGB_LOAD_EFFECT = REMOTE_RGB_LOAD_EFFECT,
+  RGB_SELECT_EFFECT = REMOTE_RGB_SELECT_EFFECT,
+  RGB_ANIM_GROUP = REMOTE_RGB_ANIM_GROUP,
+  RGB_ANIM_KEYFRAMES = REMOTE_RGB_ANIM_KEYFRAMES,
+  RGB_ANIM_PLAY = REMOTE_RGB_ANIM_PLAY,
+  RGB_ANIM_STOP = REMOTE_RGB_ANIM_STOP,
+  EVENTS_SUBSCRIBE = REMOTE_EVENTS_SUBSCRIBE,
+  EVENTS_REPORT = REMOTE_EVENTS_REPORT,
+  RGB_SET_LEDS = REMOTE_RGB_SET_LEDS,
+  PING = REMOTE_PING,
+  PROBE_START = REMOTE_PROBE_START,
+  PROBE_STOP = REMOTE_PROBE_STOP,
+  PROBE_SYNC = REMOTE_PROBE_SYNC,
+  PROBE_EVENTS = REMOTE_PROBE_EVENTS,
+  BOOT_TIMES = REMOTE_BOOT_TIMES,
+  MIDI_PROBE = REMOTE_MIDI_PROBE,
+  LEADER_DICT = REMOTE_LEADER_DICT,
+  STACK_USAGE = REMOTE_STACK_USAGE,
+  VERSION = REMOTE_VERSION,
+  ERROR = REMOTE_ERROR,
+};
+
+// Whether the keyboard replies to a kind of message
+bool has_reply(uint8_t kind);
+
+// Why the keyboard rejected a message (REMOTE_ERROR_REASON)
+enum RejectReason : uint8_t {
+  REJECT_TOO_SHORT = REMOTE_ERROR_TOO_SHORT,
+  REJECT_TOO_MANY = REMOTE_ERROR_TOO_MANY,
+  REJECT_TO_HOST = REMOTE_ERROR_TO_HOST,
+  REJECT_VERSION = REMOTE_ERROR_VERSION, // The keyboard speaks another protocol version
+};
+
+// A message of the given kind, the rest zeroed (a VERSION gives the version
+// of the client, the keyboard rejecting everything if it is not its own)
+Report message(uint8_t kind);
+
+/*
+ * Discovery
+ */
+
+struct Device {
+  std::string path;     // /dev/hidrawN
+  uint16_t vendor_id;
+  uint16_t product_id;
+  std::string name;
+};
+
+// The Moonlander's USB ids
+constexpr uint16_t moonlander_vendor_id = 0x3297;
+constexpr uint16_t moonlander_product_id = 0x1969;
+
+// QMK's raw HID usage page and usage id (RAW_USAGE_PAGE and RAW_USAGE_ID in
+// the Preonic and TheKey config.h)
+constexpr uint16_t raw_usage_page = 0xFF60;
+constexpr uint8_t raw_usage_id = 0x61;
+
+// Every hidraw device that is the raw HID interface of a keyboard: declaring
+// QMK's raw HID usage, or a vendor usage page on a Moonlander
+std::vector<Device> discover();
+
+/*
+ * Client
+ */
+
+enum class Status {
+  ok,
+  timeout,  // No reply in time
+  rejected, // The keyboard replied with an ERROR (see reject_reason)
+  closed,   // The device went away
+};
+
+struct Reply {
+  Status status;
+  Report report;         // The reply, or the ERROR report when rejected
+  uint8_t reject_reason; // REMOTE_ERROR_REASON when rejected
+  std::chrono::microseconds round_trip;
+};
+
+using ReplyHandler = std::function<void(const Reply &)>;
+using ReportHandler = std::function<void(const Report &)>;
+
+struct Options {
+  size_t window = 4;  // Replies in flight at once, at most the keyboard's queue
+  std::chrono::milliseconds timeout{ 1000 };
+  bool coalesce = true;
+};
+
+struct Stats {
+  uint64_t written = 0;    // Reports written to the device
+  uint64_t coalesced = 0;  // Messages merged into a queued one
+  uint64_t replies = 0;
+  uint64_t timeouts = 0;
+  uint64_t rejected = 0;
+  uint64_t pushed = 0;     // Reports not replying to anything
+};
+
+class Client {
+ public:
+  // Open a hidraw device, or the first keyboard found if path is empty.
+  // Throws std::system_error when it cannot.
+  explicit Client(const std::string &path = "", Options options = {});
+  ~Client();
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  // Queue a message the keyboard does not reply to
+  void send(const Report &report);
+
+  // Queue a request, calling handler from poll() once it is replied to, fails
+  // or times out. Throws std::invalid_argument if the kind has no reply.
+  void request(const Report &report, ReplyHandler handler);
+
+  // Send a request and wait for its reply, polling meanwhile
+  Reply call(const Report &report);
+
+  // Handle the reports that do not reply to a request
+  void on_report(ReportHandler handler) { report_handler_ = std::move(handler); }
+
+  // Write and read what the device allows, waiting up to timeout_ms (-1 for
+  // ever) for something to happen. Returns false once the device is gone.
+  bool poll(int timeout_ms);
+
+  // Poll until every queued message is written and every request replied to
+  bool drain();
+
+  // An epoll fd, readable when poll() has something to do
+  int fd() const { return epoll_fd_; }
+
+  const std::string &path() const { return path_; }
+  const Stats &stats() const { return stats_; }
+  size_t in_flight() const { return pending_.size(); }
+  size_t queued() const { return outgoing_.size(); }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Outgoing {
+    Report report;
+    ReplyHandler handler; // Empty for messages without a reply
+  };
+
+  struct Pending {
+    uint8_t kind;
+    ReplyHandler handler;
+    Clock::time_point sent;
+    Clock::time_point deadline;
+  };
+
+  bool coalesce(const Report &report);
+  void write_some();
+  void read_some();
+  void handle_report(const Report &report);
+  void expire();
+  void arm_timer();
+  void update_interest();
+  void close_device();
+
+  std::string path_;
+  Options options_;
+  int device_fd_ = -1;
+  int epoll_fd_ = -1;
+  int timer_fd_ = -1;
+  bool want_write_ = false;
+  std::deque<Outgoing> outgoing_;
+  std::deque<Pending> pending_;
+  ReportHandler report_handler_;
+  Stats stats_;
+};
+
+} // namespace remote
@@ -0,0 +1,330 @@
+/*
+ * Check the packed string output of the keymaps against SEND_STRING
+ *
+ * Usage: send-string-sim [-n] [-v]
+ *
+ *   -n  Model a host reading NKRO reports (new keys in usage order) instead
+ *       of 6KRO ones (new keys in slot order)
+ *   -v  Also print the packed reports of every string
+ *
+ * Plans the reports of a few strings (the leader sequences of the keymaps and
+ * some longer snippets) both as SEND_STRING does and with send_string_packed
+ * from common/packed_string.c, runs both through a model of the host, and
+ * checks that they type the same keys with the same modifiers. Prints the number of reports of each
+ * string both ways, and exits with 1 if any string types differently.
+ */
+
+#include "packed_string.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// The keys of the strings below, as in QMK's send_string_keycodes.h
+#define X_A     04
+#define X_E     08
+#define X_I     0c
+#define X_N     11
+#define X_O     12
+#define X_T     17
+#define X_U     18
+#define X_QUOT  34
+#define X_GRAVE 35
+#define X_F4    3d
+#define X_LCTL  e0
+#define X_LSFT  e1
+#define X_LALT  e2
+#define X_RALT  e6
+
+#define MAX_REPORTS 4096
+
+// The compose sequences of the keymaps (see "Leader mode")
+#define COMPOSE_KEY      SS_TAP(X_RALT)
+#define LOWER_ACUTE(kc)  SS_TAP(X_QUOT) SS_TAP(kc)
+#define UPPER_ACUTE(kc)  SS_TAP(X_QUOT) SS_LSFT(SS_TAP(kc))
+#define LOWER_UMLAUT(kc) SS_LSFT(SS_TAP(X_QUOT)) SS_TAP(kc)
+#define UPPER_UMLAUT(kc) SS_LSFT(SS_TAP(X_QUOT)) SS_LSFT(SS_TAP(kc))
+
+static const struct {
+  const char *name;
+  const char *string;
+} strings[] = {
+  { "acute a", COMPOSE_KEY LOWER_ACUTE(X_A) },
+  { "acute A", COMPOSE_KEY UPPER_ACUTE(X_A) },
+  { "umlaut a", COMPOSE_KEY LOWER_UMLAUT(X_A) },
+  { "umlaut A", COMPOSE_KEY UPPER_UMLAUT(X_A) },
+  { "ring A", COMPOSE_KEY SS_TAP(X_O) SS_LSFT(SS_TAP(X_A)) },
+  { "tilde N", COMPOSE_KEY SS_LSFT(SS_TAP(X_GRAVE)) SS_LSFT(SS_TAP(X_N)) },
+  { "ctrl shift t", SS_LCTL(SS_LSFT(SS_TAP(X_T))) },
+  { "alt f4", SS_LALT(SS_TAP(X_F4)) },
+  { "hello", "Hello, World!\n" },
+  { "doubles", "aabbccdd  !!" },
+  { "sentence", "The quick brown fox jumps over the lazy dog." },
+  { "snippet", "#include <stdio.h>\n\nint main(void) {\n  printf(\"hi\\n\");\n  return 0;\n}\n" },
+};
+
+#define STRING_COUNT (sizeof(strings) / sizeof(strings[0]))
+
+/*
+ * ASCII to usages (US layout, as in QMK's default lookup tables)
+ */
+
+const uint8_t ascii_to_keycode_lut[128] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x00-0x07
+  0x00, 0x2B, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x08-0x0F
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x10-0x17
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x18-0x1F
+  0x2C, 0x1E, 0x34, 0x20, 0x21, 0x22, 0x24, 0x34,  // 0x20-0x27
+  0x26, 0x27, 0x25, 0x2E, 0x36, 0x2D, 0x37, 0x38,  // 0x28-0x2F
+  0x27, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24,  // 0x30-0x37
+  0x25, 0x26, 0x33, 0x33, 0x36, 0x2E, 0x37, 0x38,  // 0x38-0x3F
+  0x1F, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,  // 0x40-0x47
+  0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12,  // 0x48-0x4F
+  0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A,  // 0x50-0x57
+  0x1B, 0x1C, 0x1D, 0x2F, 0x31, 0x30, 0x23, 0x2D,  // 0x58-0x5F
+  0x35, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,  // 0x60-0x67
+  0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12,  // 0x68-0x6F
+  0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A,  // 0x70-0x77
+  0x1B, 0x1C, 0x1D, 0x2F, 0x31, 0x30, 0x35, 0x00,  // 0x78-0x7F
+};
+
+const uint8_t ascii_to_shift_lut[16] = {
+  0x00, 0x00, 0x00, 0x00, 0x7E, 0x0F, 0x00, 0xD4,
+  0xFF, 0xFF, 0xFF, 0xC7, 0x00, 0x00, 0x00, 0x78
+};
+
+const uint8_t ascii_to_altgr_lut[16] = { 0 };
+
+/*
+ * Reports
+ */
+
+typedef struct {
+  uint8_t mods;
+  uint8_t keys[KEYBOARD_REPORT_KEYS]; // In slot order, 0 for empty slots
+} report_t;
+
+static report_t current;
+static report_t reports[MAX_REPORTS];
+static size_t report_count;
+
+void add_key(uint8_t key) {
+  for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+    if (current.keys[i] == key) {
+      return;
+    }
+  }
+  for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+    if (current.keys[i] == 0) {
+      current.keys[i] = key;
+      return;
+    }
+  }
+}
+
+void del_key(uint8_t key) {
+  for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+    if (current.keys[i] == key) {
+      current.keys[i] = 0;
+    }
+  }
+}
+
+void set_weak_mods(uint8_t mods) {
+  current.mods = mods;
+}
+
+void send_keyboard_report(void) {
+  if (report_count < MAX_REPORTS) {
+    reports[report_count++] = current;
+  }
+}
+
+static void reset_reports(void) {
+  memset(&current, 0, sizeof(current));
+  report_count = 0;
+}
+
+// The keys send_string_packed leaves to QMK, none of which the strings use
+void register_code(uint8_t code) {
+  add_key(code);
+  send_keyboard_report();
+}
+
+void unregister_code(uint8_t code) {
+  del_key(code);
+  send_keyboard_report();
+}
+
+void tap_code(uint8_t code) {
+  register_code(code);
+  unregister_code(code);
+}
+
+void wait_ms(uint16_t ms) {}
+
+/*
+ * SEND_STRING, one report per key or modifier change
+ */
+
+static void send_string(const char *string) {
+  char c;
+  while ((c = *string++)) {
+    if (c == SS_TAP_CODE || c == SS_DOWN_CODE || c == SS_UP_CODE) {
+      uint8_t key = *string++;
+      if (c != SS_UP_CODE) {
+        if (IS_MODIFIER_KEYCODE(key)) {
+          current.mods |= MOD_BIT(key);
+        } else {
+          add_key(key);
+        }
+        send_keyboard_report();
+      }
+      if (c != SS_DOWN_CODE) {
+        if (IS_MODIFIER_KEYCODE(key)) {
+          current.mods &= ~MOD_BIT(key);
+        } else {
+          del_key(key);
+        }
+        send_keyboard_report();
+      }
+      continue;
+    }
+    if ((uint8_t)c >= 128 || pgm_read_byte(&ascii_to_keycode_lut[(uint8_t)c]) == KC_NO) {
+      continue;
+    }
+    uint8_t usage = pgm_read_byte(&ascii_to_keycode_lut[(uint8_t)c]);
+    bool shifted = PGM_LOADBIT(ascii_to_shift_lut, (uint8_t)c);
+    if (shifted) {
+      current.mods |= MOD_BIT(KC_LEFT_SHIFT);
+      send_keyboard_report();
+    }
+    add_key(usage);
+    send_keyboard_report();
+    del_key(usage);
+    send_keyboard_report();
+    if (shifted) {
+      current.mods &= ~MOD_BIT(KC_LEFT_SHIFT);
+      send_keyboard_report();
+    }
+  }
+}
+
+/*
+ * Host model
+ */
+
+// What the host types: every key press with the modifiers down at the time,
+// and modifiers tapped on their own (mods 0xFF) as their usage
+typedef struct {
+  uint8_t usage;
+  uint8_t mods;
+} typed_t;
+
+static size_t host_type(bool nkro, typed_t *typed) {
+  report_t last = { 0 };
+  size_t count = 0;
+  uint8_t lone_mods = 0; // Modifiers pressed with no key pressed since
+
+  for (size_t r = 0; r < report_count; r++) {
+    const report_t *report = &reports[r];
+
+    // Modifiers first, as they come first in the report
+    uint8_t released = last.mods & ~report->mods;
+    for (int bit = 0; bit < 8; bit++) {
+      if (released & lone_mods & (1 << bit)) {
+        typed[count++] = (typed_t){ 0xE0 + bit, 0xFF };
+      }
+    }
+    lone_mods = (lone_mods & report->mods) | (report->mods & ~last.mods);
+
+    // Then the new keys, in slot or usage order
+    uint8_t pressed[KEYBOARD_REPORT_KEYS];
+    int pressed_count = 0;
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+      uint8_t key = report->keys[i];
+      if (key && !memchr(last.keys, key, KEYBOARD_REPORT_KEYS)) {
+        pressed[pressed_count++] = key;
+      }
+    }
+    if (nkro) {
+      for (int i = 1; i < pressed_count; i++) {
+        for (int j = i; j > 0 && pressed[j - 1] > pressed[j]; j--) {
+          uint8_t swap = pressed[j];
+          pressed[j] = pressed[j - 1];
+          pressed[j - 1] = swap;
+        }
+      }
+    }
+    for (int i = 0; i < pressed_count; i++) {
+      typed[count++] = (typed_t){ pressed[i], report->mods };
+    }
+    if (pressed_count > 0) {
+      lone_mods = 0;
+    }
+    last = *report;
+  }
+  return count;
+}
+
+static void print_report(const report_t *report) {
+  printf("    mods %02x keys", report->mods);
+  for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+    printf(" %02x", report->keys[i]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  bool nkro = false, verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "nv")) != -1) {
+    switch (opt) {
+      case 'n':
+        nkro = true;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n] [-v]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  static typed_t expected[MAX_REPORTS], typed[MAX_REPORTS];
+  size_t total_plain = 0, total_packed = 0;
+  int failures = 0;
+
+  printf("%-14s %8s %8s %7s\n", "string", "reports", "packed", "speedup");
+  for (size_t s = 0; s < STRING_COUNT; s++) {
+    reset_reports();
+    send_string(strings[s].string);
+    size_t plain = report_count;
+    size_t expected_count = host_type(nkro, expected);
+
+    reset_reports();
+    send_string_packed(strings[s].string);
+    size_t packed = report_count;
+    size_t typed_count = host_type(nkro, typed);
+
+    bool same = typed_count == expected_count && memcmp(typed, expected, typed_count * sizeof(typed_t)) == 0;
+    failures += !same;
+    total_plain += plain;
+    total_packed += packed;
+    printf("%-14s %8zu %8zu %6.2fx%s\n", strings[s].name, plain, packed, (double)plain / packed, same ? "" : "  MISMATCH");
+    if (verbose) {
+      for (size_t r = 0; r < report_count; r++) {
+        print_report(&reports[r]);
+      }
+    }
+  }
+  printf("%-14s %8zu %8zu %6.2fx\n", "total", total_plain, total_packed, (double)total_plain / total_packed);
+
+  if (failures > 0) {
+    fprintf(stderr, "%d strings typed differently\n", failures);
+    return 1;
+  }
+  return 0;
+}
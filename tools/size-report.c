@@ -0,0 +1,529 @@
+/*
+ * Report how much flash, RAM and stack a firmware uses
+ *
+ * Usage: size-report [-b budget] [-o report] firmware.elf [callgraph.ci...]
+ *        size-report -c previous-report report
+ *
+ *   -b budget   Fail if the firmware uses more than this file allows, as lines
+ *               like "flash 32256", "ram 2048" or "stack 512"
+ *   -o report   Save the report, to compare it with a later one
+ *   -c          Compare two reports, printing what changed
+ *
+ * Flash counts every section loaded from flash (code, constants and the initial
+ * values of variables), and RAM every variable, but not the stacks and heap the
+ * linker script reserves. Both are broken down by symbol.
+ *
+ * The worst case stack depth comes from the call graphs GCC writes with
+ * -fcallgraph-info=su (see SIZE_REPORT in the keymap rules.mk files): each
+ * function's own frame plus the deepest of its callees. Calls through
+ * pointers, recursion, frames of dynamic size and functions built without
+ * call graphs (like libc) cannot be followed, so the depth is a lower bound
+ * when there are any. They are counted in the summary.
+ */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TOP_COUNT 15
+#define PATH_MAX_DEPTH 64
+
+typedef struct {
+  char kind[8]; // "total", "flash", "ram" or "stack"
+  char *name;
+  long size;
+} entry_t;
+
+typedef struct {
+  entry_t *entries;
+  int count;
+  int capacity;
+} report_t;
+
+static void add_entry(report_t *report, const char *kind, const char *name, long size) {
+  if (report->count == report->capacity) {
+    report->capacity = report->capacity ? report->capacity * 2 : 256;
+    report->entries = realloc(report->entries, report->capacity * sizeof(entry_t));
+  }
+  entry_t *entry = &report->entries[report->count++];
+  snprintf(entry->kind, sizeof(entry->kind), "%s", kind);
+  entry->name = strdup(name);
+  entry->size = size;
+}
+
+static long find_entry(const report_t *report, const char *kind, const char *name) {
+  for (int i = 0; i < report->count; i++) {
+    if (strcmp(report->entries[i].kind, kind) == 0 && strcmp(report->entries[i].name, name) == 0) {
+      return report->entries[i].size;
+    }
+  }
+  return -1;
+}
+
+static int by_size(const void *a, const void *b) {
+  long x = ((const entry_t *)a)->size, y = ((const entry_t *)b)->size;
+  return (x < y) - (x > y);
+}
+
+static void *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *data = malloc(*size + 1);
+  if (fread(data, 1, *size, file) != *size) {
+    perror(path);
+    fclose(file);
+    free(data);
+    return NULL;
+  }
+  data[*size] = 0;
+  fclose(file);
+  return data;
+}
+
+/*
+ * Flash and RAM
+ */
+
+// Sections that are neither flash nor RAM, like the AVR EEPROM and fuses
+static bool ignored_section(const char *name) {
+  return strncmp(name, ".eeprom", 7) == 0 || strncmp(name, ".fuse", 5) == 0
+      || strncmp(name, ".lock", 5) == 0 || strncmp(name, ".signature", 10) == 0;
+}
+
+// Sections the linker script reserves for the stacks and heap
+static bool reserved_section(const char *name) {
+  return strstr(name, "stack") || strstr(name, "heap");
+}
+
+// Add the totals and symbols of a 32 bit ELF file (the AVR and ARM ones)
+static bool read_elf(const char *path, report_t *report, long *reserved) {
+  size_t size;
+  uint8_t *data = read_file(path, &size);
+  if (!data) {
+    return false;
+  }
+  Elf32_Ehdr *header = (Elf32_Ehdr *)data;
+  if (size < sizeof(*header) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+      || header->e_ident[EI_CLASS] != ELFCLASS32 || header->e_ident[EI_DATA] != ELFDATA2LSB
+      || header->e_shoff + (size_t)header->e_shnum * sizeof(Elf32_Shdr) > size) {
+    fprintf(stderr, "%s: not a 32 bit little endian ELF file\n", path);
+    return false;
+  }
+  Elf32_Shdr *sections = (Elf32_Shdr *)(data + header->e_shoff);
+  const char *section_names = (const char *)data + sections[header->e_shstrndx].sh_offset;
+
+  long flash = 0, ram = 0;
+  Elf32_Shdr *symtab = NULL;
+  for (int i = 0; i < header->e_shnum; i++) {
+    Elf32_Shdr *section = &sections[i];
+    const char *name = section_names + section->sh_name;
+    if (section->sh_type == SHT_SYMTAB) {
+      symtab = section;
+    }
+    if (!(section->sh_flags & SHF_ALLOC) || ignored_section(name)) {
+      continue;
+    }
+    if (reserved_section(name)) {
+      *reserved += section->sh_size;
+      continue;
+    }
+    if (section->sh_type != SHT_NOBITS) {
+      flash += section->sh_size;
+    }
+    if (section->sh_flags & SHF_WRITE) {
+      ram += section->sh_size;
+    }
+  }
+  add_entry(report, "total", "flash", flash);
+  add_entry(report, "total", "ram", ram);
+  if (!symtab) {
+    fprintf(stderr, "%s: no symbols, only printing the totals\n", path);
+    return true;
+  }
+
+  // Local symbols come after the FILE symbol of their source file, which tells
+  // apart the static variables with the same name
+  const char *names = (const char *)data + sections[symtab->sh_link].sh_offset;
+  Elf32_Sym *symbols = (Elf32_Sym *)(data + symtab->sh_offset);
+  const char *file = "?";
+  for (size_t i = 0; i < symtab->sh_size / sizeof(Elf32_Sym); i++) {
+    Elf32_Sym *symbol = &symbols[i];
+    int type = ELF32_ST_TYPE(symbol->st_info);
+    if (type == STT_FILE) {
+      file = names + symbol->st_name;
+      continue;
+    }
+    if ((type != STT_FUNC && type != STT_OBJECT) || symbol->st_size == 0
+        || symbol->st_shndx == SHN_UNDEF || symbol->st_shndx >= header->e_shnum) {
+      continue;
+    }
+    Elf32_Shdr *section = &sections[symbol->st_shndx];
+    const char *section_name = section_names + section->sh_name;
+    if (!(section->sh_flags & SHF_ALLOC) || ignored_section(section_name) || reserved_section(section_name)) {
+      continue;
+    }
+    char name[512];
+    if (ELF32_ST_BIND(symbol->st_info) == STB_LOCAL) {
+      snprintf(name, sizeof(name), "%s:%s", file, names + symbol->st_name);
+    } else {
+      snprintf(name, sizeof(name), "%s", names + symbol->st_name);
+    }
+    add_entry(report, section->sh_flags & SHF_WRITE ? "ram" : "flash", name, symbol->st_size);
+  }
+  free(data);
+  return true;
+}
+
+/*
+ * Stack
+ */
+
+typedef struct {
+  char *title;
+  long frame;      // -1 if unknown
+  bool dynamic;
+  int *callees;
+  int callee_count;
+  bool called;
+  int state;       // 0 not visited yet, 1 being visited, 2 done
+  long depth;      // Worst case depth from this function
+  int next;        // The callee on the worst case path, -1 if none
+} function_t;
+
+static function_t *functions = NULL;
+static int function_count = 0;
+static int indirect_calls = 0, recursive = 0, unknown = 0, dynamic = 0;
+
+static int find_function(const char *title) {
+  for (int i = 0; i < function_count; i++) {
+    if (strcmp(functions[i].title, title) == 0) {
+      return i;
+    }
+  }
+  functions = realloc(functions, (function_count + 1) * sizeof(function_t));
+  functions[function_count] = (function_t){ .title = strdup(title), .frame = -1, .next = -1 };
+  return function_count++;
+}
+
+// Copy the quoted value of a field of a VCG node or edge, like title: "main"
+static bool field(const char *block, const char *end, const char *name, char *value, size_t size) {
+  char key[32];
+  snprintf(key, sizeof(key), "%s: \"", name);
+  const char *start = strstr(block, key);
+  if (!start || start > end) {
+    return false;
+  }
+  start += strlen(key);
+  const char *stop = strchr(start, '"');
+  if (!stop || stop > end || (size_t)(stop - start) >= size) {
+    return false;
+  }
+  memcpy(value, start, stop - start);
+  value[stop - start] = 0;
+  return true;
+}
+
+// Add the nodes and edges of a call graph written by -fcallgraph-info
+static bool read_callgraph(const char *path) {
+  size_t size;
+  char *data = read_file(path, &size);
+  if (!data) {
+    return false;
+  }
+  // GCC writes every node and edge on a line of its own
+  char *saved;
+  for (char *line = strtok_r(data, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+    const char *end = line + strlen(line);
+    char title[512], label[1024], target[512];
+    if (strncmp(line, "node: {", 7) == 0 && field(line, end, "title", title, sizeof(title))) {
+      // The label ends with the frame size, like "func\nfile:1:1\n16 bytes (static)"
+      int index = find_function(title);
+      const char *frame;
+      if (field(line, end, "label", label, sizeof(label)) && (frame = strrchr(label, '\\'))
+          && strstr(frame, " bytes (")) {
+        functions[index].frame = atol(frame + 2);
+        functions[index].dynamic = strstr(frame, "(dynamic") != NULL;
+      }
+    } else if (strncmp(line, "edge: {", 7) == 0 && field(line, end, "sourcename", title, sizeof(title))
+               && field(line, end, "targetname", target, sizeof(target))) {
+      int source = find_function(title);
+      int callee = find_function(target);
+      function_t *function = &functions[source];
+      function->callees = realloc(function->callees, (function->callee_count + 1) * sizeof(int));
+      function->callees[function->callee_count++] = callee;
+      functions[callee].called = true;
+    }
+  }
+  free(data);
+  return true;
+}
+
+static long stack_depth(int index) {
+  function_t *function = &functions[index];
+  if (function->state == 2) {
+    return function->depth;
+  }
+  if (function->state == 1) {
+    recursive++;
+    return 0;
+  }
+  function->state = 1;
+  long deepest = 0;
+  for (int i = 0; i < function->callee_count; i++) {
+    int callee = function->callees[i];
+    if (strcmp(functions[callee].title, "__indirect_call") == 0) {
+      indirect_calls++;
+      continue;
+    }
+    long depth = stack_depth(callee);
+    if (functions[callee].state == 2 && (depth > deepest || function->next < 0)) {
+      deepest = depth;
+      function->next = callee;
+    }
+  }
+  function->depth = (function->frame > 0 ? function->frame : 0) + deepest;
+  function->state = 2;
+  return function->depth;
+}
+
+// Add the worst case depth from every function nothing calls (like main and
+// the interrupt handlers), and from all of them
+static int add_stack(report_t *report) {
+  int worst = -1;
+  for (int i = 0; i < function_count; i++) {
+    if (functions[i].frame < 0) {
+      unknown += functions[i].called && strcmp(functions[i].title, "__indirect_call") != 0;
+      continue;
+    }
+    dynamic += functions[i].dynamic;
+    if (functions[i].called) {
+      continue;
+    }
+    long depth = stack_depth(i);
+    add_entry(report, "stack", functions[i].title, depth);
+    if (worst < 0 || depth > functions[worst].depth) {
+      worst = i;
+    }
+  }
+  add_entry(report, "total", "stack", worst < 0 ? 0 : functions[worst].depth);
+  return worst;
+}
+
+/*
+ * Reports
+ */
+
+static bool save_report(const report_t *report, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  for (int i = 0; i < report->count; i++) {
+    const entry_t *entry = &report->entries[i];
+    fprintf(file, "%s %ld %s\n", entry->kind, entry->size, entry->name);
+  }
+  return fclose(file) == 0;
+}
+
+static bool load_report(report_t *report, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[1024], kind[8], name[512];
+  long size;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%7s %ld %511[^\n]", kind, &size, name) == 3) {
+      add_entry(report, kind, name, size);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// Print every entry that changed between two reports, the largest changes first
+static void compare(const report_t *previous, const report_t *current) {
+  report_t changes = { 0 };
+  for (int i = 0; i < current->count; i++) {
+    const entry_t *entry = &current->entries[i];
+    long before = find_entry(previous, entry->kind, entry->name);
+    if (before != entry->size) {
+      add_entry(&changes, entry->kind, entry->name, entry->size - (before < 0 ? 0 : before));
+    }
+  }
+  for (int i = 0; i < previous->count; i++) {
+    const entry_t *entry = &previous->entries[i];
+    if (find_entry(current, entry->kind, entry->name) < 0) {
+      add_entry(&changes, entry->kind, entry->name, -entry->size);
+    }
+  }
+  if (changes.count == 0) {
+    printf("no changes\n");
+    return;
+  }
+
+  for (int i = 0; i < changes.count; i++) {
+    changes.entries[i].size = labs(changes.entries[i].size);
+  }
+  qsort(changes.entries, changes.count, sizeof(entry_t), by_size);
+  for (int i = 0; i < changes.count; i++) {
+    const entry_t *entry = &changes.entries[i];
+    long before = find_entry(previous, entry->kind, entry->name);
+    long after = find_entry(current, entry->kind, entry->name);
+    long delta = (after < 0 ? 0 : after) - (before < 0 ? 0 : before);
+    printf("%-6s %+7ld  %s", entry->kind, delta, entry->name);
+    if (before < 0) {
+      printf(" (new)\n");
+    } else if (after < 0) {
+      printf(" (removed)\n");
+    } else {
+      printf(" (%ld -> %ld)\n", before, after);
+    }
+  }
+}
+
+static void print_top(const report_t *report, const char *kind, const char *title) {
+  report_t top = { 0 };
+  for (int i = 0; i < report->count; i++) {
+    if (strcmp(report->entries[i].kind, kind) == 0) {
+      add_entry(&top, kind, report->entries[i].name, report->entries[i].size);
+    }
+  }
+  qsort(top.entries, top.count, sizeof(entry_t), by_size);
+  printf("\n%s:\n", title);
+  for (int i = 0; i < top.count && i < TOP_COUNT; i++) {
+    printf("  %7ld  %s\n", top.entries[i].size, top.entries[i].name);
+  }
+}
+
+// Check a total against the budget, if any. Returns false if over it.
+static bool print_total(const report_t *report, const report_t *budget, const char *name) {
+  long used = find_entry(report, "total", name);
+  long limit = find_entry(budget, "budget", name);
+  printf("%-6s %7ld", name, used);
+  if (limit > 0) {
+    printf(" / %ld (%.1f%%)%s", limit, 100.0 * used / limit, used > limit ? "  OVER BUDGET" : "");
+  }
+  printf("\n");
+  return limit <= 0 || used <= limit;
+}
+
+int main(int argc, char **argv) {
+  const char *budget_path = NULL, *output = NULL;
+  bool compare_reports = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:o:c")) != -1) {
+    switch (opt) {
+      case 'b':
+        budget_path = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        compare_reports = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-b budget] [-o report] firmware.elf [callgraph.ci...]\n"
+                        "       %s -c previous-report report\n", argv[0], argv[0]);
+        return 2;
+    }
+  }
+
+  if (compare_reports) {
+    if (argc - optind != 2) {
+      fprintf(stderr, "-c takes two reports\n");
+      return 2;
+    }
+    report_t previous = { 0 }, current = { 0 };
+    if (!load_report(&previous, argv[optind]) || !load_report(&current, argv[optind + 1])) {
+      return 1;
+    }
+    compare(&previous, &current);
+    return 0;
+  }
+
+  if (optind == argc) {
+    fprintf(stderr, "no firmware given\n");
+    return 2;
+  }
+  report_t report = { 0 };
+  long reserved = 0;
+  if (!read_elf(argv[optind], &report, &reserved)) {
+    return 1;
+  }
+  for (int i = optind + 1; i < argc; i++) {
+    if (!read_callgraph(argv[i])) {
+      return 1;
+    }
+  }
+  int worst = add_stack(&report);
+
+  // The budget is read like a report, with "budget" as the kind of every line
+  report_t budget = { 0 };
+  if (budget_path) {
+    FILE *file = fopen(budget_path, "r");
+    if (!file) {
+      perror(budget_path);
+      return 1;
+    }
+    char line[256], name[16];
+    long limit;
+    while (fgets(line, sizeof(line), file)) {
+      if (line[0] != '#' && sscanf(line, "%15s %ld", name, &limit) == 2) {
+        add_entry(&budget, "budget", name, limit);
+      }
+    }
+    fclose(file);
+  }
+
+  bool within = print_total(&report, &budget, "flash");
+  within &= print_total(&report, &budget, "ram");
+  if (reserved > 0) {
+    printf("       (plus %ld reserved for the stacks and heap)\n", reserved);
+  }
+  if (function_count == 0) {
+    printf("stack  no call graphs given\n");
+    if (find_entry(&budget, "budget", "stack") > 0) {
+      within = false;
+    }
+  } else {
+    within &= print_total(&report, &budget, "stack");
+    printf("       deepest path:");
+    for (int i = worst, depth = 0; i >= 0 && depth < PATH_MAX_DEPTH; i = functions[i].next, depth++) {
+      printf(" %s%s", depth ? "> " : "", functions[i].title);
+      if (functions[i].frame >= 0) {
+        printf(" (%ld)", functions[i].frame);
+      }
+    }
+    printf("\n       not followed: %d indirect calls, %d recursive calls, %d dynamic frames, "
+           "%d functions without call graphs\n", indirect_calls, recursive, dynamic, unknown);
+  }
+
+  print_top(&report, "flash", "Largest in flash");
+  print_top(&report, "ram", "Largest in RAM");
+  print_top(&report, "stack", "Deepest stacks");
+
+  if (output && !save_report(&report, output)) {
+    return 1;
+  }
+  if (!within) {
+    fflush(stdout);
+    fprintf(stderr, "\nover budget (see %s)\n", budget_path);
+    return 1;
+  }
+  return 0;
+}
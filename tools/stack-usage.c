@@ -0,0 +1,132 @@
+/*
+ * Print how deep the stacks of a keyboard got since boot
+ *
+ * Usage: stack-usage [-r] [device]
+ *
+ *   -r      Start over once read: the keyboard paints its stacks again and
+ *           forgets which context used them the most
+ *   device  The hidraw device to use (found automatically by default)
+ *
+ * The keyboard paints its stacks at boot, and replies to a STACK_USAGE message
+ * with how much of each one lost the paint, the RAM left to the ChibiOS
+ * allocator, and which of its hooks took the process stack the deepest. This
+ * is measured while running, so unlike size-report it only covers what
+ * happened since boot, interrupts included. Run it after using the keyboard
+ * for a while, e.g. after a raw HID RGB session or a few leader sequences.
+ */
+
+#include "hidraw.h"
+#include "remote_hid.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLY_TIMEOUT_MS 1000
+
+static const char *contexts[] = {
+  "main loop", "raw_hid_receive", "RGB rendering", "leader_end_user"
+};
+
+#define CONTEXT_COUNT (sizeof(contexts) / sizeof(contexts[0]))
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint16_t read_u16(const uint8_t *data) {
+  return data[0] | data[1] << 8;
+}
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void print_stack(const char *name, uint16_t size, uint16_t used) {
+  printf("%-16s %6u of %6u bytes used (%5.1f%%), %6u free\n", name, used, size,
+         100.0 * used / size, size - used);
+}
+
+int main(int argc, char **argv) {
+  bool start_over = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r")) != -1) {
+    switch (opt) {
+      case 'r':
+        start_over = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-r] [device]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  char path[64];
+  if (optind < argc) {
+    snprintf(path, sizeof(path), "%s", argv[optind]);
+  } else if (!hidraw_find(path, sizeof(path))) {
+    fprintf(stderr, "no raw HID device found\n");
+    return 1;
+  }
+
+  int device = hidraw_open(path);
+  if (device < 0) {
+    perror(path);
+    return 1;
+  }
+
+  uint8_t request[HIDRAW_REPORT_SIZE] = { REMOTE_STACK_USAGE, start_over };
+  if (hidraw_send(device, request, sizeof(request)) < 0) {
+    perror("send");
+    return 1;
+  }
+
+  // Skip any event report pushed by the keyboard in the meantime
+  uint8_t reply[HIDRAW_REPORT_SIZE];
+  uint64_t deadline = now_us() + REPLY_TIMEOUT_MS * 1000;
+  for (;;) {
+    int64_t left_ms = ((int64_t)deadline - (int64_t)now_us()) / 1000;
+    int n = left_ms > 0 ? hidraw_recv(device, reply, left_ms) : 0;
+    if (n < 0) {
+      perror("recv");
+      return 1;
+    }
+    if (n == 0) {
+      fprintf(stderr, "no reply, is the firmware up to date?\n");
+      return 1;
+    }
+    if (reply[0] == REMOTE_STACK_USAGE) {
+      break;
+    }
+  }
+  close(device);
+
+  uint16_t process_size = read_u16(&reply[2]);
+  uint16_t main_size = read_u16(&reply[6]);
+  if (process_size == 0 || main_size == 0) {
+    fprintf(stderr, "the firmware cannot measure its stacks on this platform\n");
+    return 1;
+  }
+  print_stack("process stack", process_size, read_u16(&reply[4]));
+  print_stack("main stack", main_size, read_u16(&reply[8]));
+  printf("%-16s %6u bytes\n", "free RAM", read_u32(&reply[10]));
+
+  uint8_t deepest = reply[14];
+  printf("\nprocess stack by context:\n");
+  for (size_t i = 0; i < CONTEXT_COUNT; i++) {
+    uint16_t peak = read_u16(&reply[15 + 2 * i]);
+    if (peak == 0) {
+      printf("  %-16s %6s\n", contexts[i], "-");
+    } else {
+      printf("  %-16s %6u bytes%s\n", contexts[i], peak, i == deepest ? " (deepest)" : "");
+    }
+  }
+  if (start_over) {
+    printf("\nstarted over\n");
+  }
+  return 0;
+}
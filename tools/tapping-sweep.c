@@ -0,0 +1,749 @@
+/*
+ * Sweep the tap-hold and leader settings of the keymaps over recorded typing
+ *
+ * Usage: tapping-sweep [-t terms] [-f flavors] [-a assignments] [-l timeouts]
+ *                      [-H keys] [-d dictionary] [-j threads] corpus...
+ *
+ *   -t terms        TAPPING_TERM values, as a list or from:to:step ranges
+ *                   (150:350:25 by default)
+ *   -f flavors      Tap-hold flavors: default, permissive (PERMISSIVE_HOLD)
+ *                   and other (HOLD_ON_OTHER_KEY_PRESS), all by default
+ *   -a assignments  Home row mods, as the mods of A S D F (mirrored on
+ *                   SCLN L K J) with C, S, A, G or - for none, or the name of
+ *                   a board (moonlander,preonic by default)
+ *   -l timeouts     LEADER_TIMEOUT values (200:1000:100 by default)
+ *   -H keys         Other tap-hold keys, only ever meant as taps (the layer
+ *                   taps, SPC,ENT by default)
+ *   -d dictionary   The leader sequences, in the format of leader-dict (the
+ *                   ones compiled into the keymaps by default)
+ *   -j threads      Settings simulated at once (one per core by default)
+ *
+ * A corpus has an event per line, as its time in ms, the name of the key (the
+ * QMK keycodes without KC_, like A, SCLN, LSFT or LEAD) and down or up:
+ *
+ *   1250.4 LSFT down
+ *   1302.0 H down
+ *   1361.9 H up
+ *   1388.2 LSFT up
+ *
+ * It says what was meant to be typed, like a key logger on a regular keyboard
+ * would. Modifiers become holds of the home row key with that modifier on the
+ * other hand than the key they modify, and every other home row key press is
+ * meant as a tap. Each setting then runs the tap-hold decisions of QMK over
+ * the presses, reporting:
+ * - false holds: home row taps turned into modifiers (typing ctrl+s for s)
+ * - false taps: modifier holds turned into letters
+ * - the latency added to the keys typed, waiting for a decision
+ * - for each leader timeout (with LEADER_PER_KEY_TIMING, like the keymaps),
+ *   the sequences typed exactly, cut short by the timeout, or that took the
+ *   keys typed after them. Sequences are recognized as the longest one of the
+ *   dictionary typed after the leader key.
+ *
+ * Several corpora (e.g. from several people) are simply added up.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define MAX_KEYS 512
+#define MAX_SETTINGS 4096
+#define LEADER_KEYS 5 // Like the leader sequences of QMK
+#define LATENCY_BINS 2048
+#define CORPUS_GAP_MS 10000 // Between corpora, so they do not interact
+
+/*
+ * Keys
+ */
+
+static char key_names[MAX_KEYS][16];
+static int key_count = 0;
+
+// The id of a key name, ignoring case and KC_ or QK_ prefixes
+static int key_id(const char *name) {
+  if (strncasecmp(name, "KC_", 3) == 0 || strncasecmp(name, "QK_", 3) == 0) {
+    name += 3;
+  }
+  char upper[16];
+  size_t length = strlen(name);
+  if (length == 0 || length >= sizeof(upper)) {
+    return -1;
+  }
+  for (size_t i = 0; i <= length; i++) {
+    upper[i] = name[i] >= 'a' && name[i] <= 'z' ? name[i] - 'a' + 'A' : name[i];
+  }
+  for (int i = 0; i < key_count; i++) {
+    if (strcmp(key_names[i], upper) == 0) {
+      return i;
+    }
+  }
+  if (key_count == MAX_KEYS) {
+    return -1;
+  }
+  memcpy(key_names[key_count], upper, length + 1);
+  return key_count++;
+}
+
+enum { HAND_NONE = 0, HAND_LEFT, HAND_RIGHT };
+
+enum { MOD_NONE = 0, MOD_CTRL, MOD_SHIFT, MOD_ALT, MOD_GUI };
+
+static uint8_t key_hands[MAX_KEYS];
+static uint8_t key_mods[MAX_KEYS];   // The modifier a key is, if any
+static int lead_key;
+
+static const char *left_keys[] = {
+  "GRV", "1", "2", "3", "4", "5", "TAB", "Q", "W", "E", "R", "T",
+  "ESC", "CAPS", "A", "S", "D", "F", "G", "Z", "X", "C", "V", "B",
+};
+
+static const char *right_keys[] = {
+  "6", "7", "8", "9", "0", "MINS", "EQL", "BSPC", "Y", "U", "I", "O", "P", "LBRC", "RBRC",
+  "BSLS", "H", "J", "K", "L", "SCLN", "QUOT", "N", "M", "COMM", "DOT", "SLSH",
+};
+
+static const struct {
+  const char *name;
+  uint8_t mod;
+} modifier_keys[] = {
+  { "LCTL", MOD_CTRL }, { "RCTL", MOD_CTRL }, { "LSFT", MOD_SHIFT }, { "RSFT", MOD_SHIFT },
+  { "LALT", MOD_ALT },  { "RALT", MOD_ALT },  { "LGUI", MOD_GUI },   { "RGUI", MOD_GUI },
+};
+
+static void init_keys(void) {
+  for (size_t i = 0; i < sizeof(left_keys) / sizeof(left_keys[0]); i++) {
+    key_hands[key_id(left_keys[i])] = HAND_LEFT;
+  }
+  for (size_t i = 0; i < sizeof(right_keys) / sizeof(right_keys[0]); i++) {
+    key_hands[key_id(right_keys[i])] = HAND_RIGHT;
+  }
+  for (size_t i = 0; i < sizeof(modifier_keys) / sizeof(modifier_keys[0]); i++) {
+    key_mods[key_id(modifier_keys[i].name)] = modifier_keys[i].mod;
+  }
+  lead_key = key_id("LEAD");
+}
+
+/*
+ * Corpus
+ */
+
+typedef struct {
+  double press;
+  double release;
+  uint16_t key;
+} press_t;
+
+static press_t *presses = NULL;
+static size_t press_count = 0, press_capacity = 0;
+
+typedef struct {
+  double time;
+  uint16_t key;
+  bool down;
+} event_t;
+
+static int by_time(const void *a, const void *b) {
+  const event_t *x = a, *y = b;
+  return (x->time > y->time) - (x->time < y->time);
+}
+
+// Add the presses of a corpus, starting at `offset` ms. Returns the end time.
+static bool read_corpus(const char *path, double offset, double *end) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  event_t *events = NULL;
+  size_t count = 0, capacity = 0;
+  char line[256], name[32], state[8];
+  double time;
+  int number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    int key;
+    if (sscanf(line, "%lf %31s %7s", &time, name, state) != 3 || (key = key_id(name)) < 0
+        || (strcmp(state, "down") != 0 && strcmp(state, "up") != 0)) {
+      fprintf(stderr, "%s:%d: expected a time, a key and down or up\n", path, number);
+      fclose(file);
+      free(events);
+      return false;
+    }
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 4096;
+      events = realloc(events, capacity * sizeof(event_t));
+    }
+    events[count++] = (event_t){ .time = time, .key = key, .down = state[0] == 'd' };
+  }
+  fclose(file);
+
+  // Key loggers can write events a bit out of order
+  qsort(events, count, sizeof(event_t), by_time);
+  double first = count ? events[0].time : 0;
+  size_t open[MAX_KEYS];
+  bool is_open[MAX_KEYS] = { false };
+  for (size_t i = 0; i < count; i++) {
+    const event_t *event = &events[i];
+    double time = offset + event->time - first;
+    *end = time;
+    if (event->down) {
+      if (press_count == press_capacity) {
+        press_capacity = press_capacity ? press_capacity * 2 : 4096;
+        presses = realloc(presses, press_capacity * sizeof(press_t));
+      }
+      open[event->key] = press_count;
+      is_open[event->key] = true;
+      presses[press_count++] = (press_t){ .press = time, .release = -1, .key = event->key };
+    } else if (is_open[event->key]) {
+      presses[open[event->key]].release = time;
+      is_open[event->key] = false;
+    }
+  }
+  // Keys still down at the end are released with the last event
+  for (size_t i = 0; i < press_count; i++) {
+    if (presses[i].release < 0) {
+      presses[i].release = *end;
+    }
+  }
+  free(events);
+  return true;
+}
+
+/*
+ * Home row mods
+ */
+
+#define HOME_ROW_KEYS 4
+
+typedef struct {
+  char name[16];
+  uint8_t mods[HOME_ROW_KEYS]; // Of A S D F, mirrored on SCLN L K J
+} assignment_t;
+
+static const struct {
+  const char *board;
+  const char *mods;
+} board_assignments[] = {
+  { "moonlander", "CSAG" },
+  { "ergodox_ez", "CSAG" },
+  { "preonic", "GSAC" },
+};
+
+static const char *home_row_left[HOME_ROW_KEYS] = { "A", "S", "D", "F" };
+static const char *home_row_right[HOME_ROW_KEYS] = { "SCLN", "L", "K", "J" };
+
+static bool parse_assignment(const char *text, assignment_t *assignment) {
+  for (size_t i = 0; i < sizeof(board_assignments) / sizeof(board_assignments[0]); i++) {
+    if (strcmp(text, board_assignments[i].board) == 0) {
+      text = board_assignments[i].mods;
+    }
+  }
+  if (strlen(text) != HOME_ROW_KEYS) {
+    return false;
+  }
+  snprintf(assignment->name, sizeof(assignment->name), "%s", text);
+  for (int i = 0; i < HOME_ROW_KEYS; i++) {
+    const char *mod = strchr("-CSAG", text[i]);
+    if (!mod || !text[i]) {
+      return false;
+    }
+    assignment->mods[i] = mod - "-CSAG";
+  }
+  return true;
+}
+
+// A press as the keyboard sees it with some home row mods
+typedef struct {
+  double press;
+  double release;
+  bool tap_hold;
+  bool meant_hold;
+} physical_t;
+
+// The presses of the corpus on the home row key with the modifier they are
+// meant as, if any
+static physical_t *place_presses(const assignment_t *assignment, const bool *tap_taps) {
+  physical_t *physical = malloc(press_count * sizeof(physical_t));
+  int home_keys[2][HOME_ROW_KEYS];
+  bool tap_hold[MAX_KEYS] = { false };
+  double released[MAX_KEYS] = { 0 }; // When a key was last released
+  for (int i = 0; i < HOME_ROW_KEYS; i++) {
+    home_keys[0][i] = key_id(home_row_left[i]);
+    home_keys[1][i] = key_id(home_row_right[i]);
+    tap_hold[home_keys[0][i]] = tap_hold[home_keys[1][i]] = assignment->mods[i] != MOD_NONE;
+  }
+
+  for (size_t i = 0; i < press_count; i++) {
+    const press_t *press = &presses[i];
+    int key = press->key;
+    bool meant_hold = false;
+    uint8_t mod = key_mods[key];
+    if (mod != MOD_NONE) {
+      // The hand of the first key modified decides the other hand does it
+      uint8_t hand = HAND_NONE;
+      for (size_t j = i + 1; j < press_count && presses[j].press < press->release; j++) {
+        if (key_mods[presses[j].key] == MOD_NONE) {
+          hand = key_hands[presses[j].key];
+          break;
+        }
+      }
+      int sides[2] = { hand == HAND_LEFT ? 1 : 0, hand == HAND_LEFT ? 0 : 1 };
+      for (int side = 0; side < 2 && !meant_hold; side++) {
+        for (int k = 0; k < HOME_ROW_KEYS; k++) {
+          int home = home_keys[sides[side]][k];
+          if (assignment->mods[k] == mod && released[home] <= press->press) {
+            key = home;
+            meant_hold = true;
+            break;
+          }
+        }
+      }
+    }
+    released[key] = press->release;
+    physical[i] = (physical_t){
+      .press = press->press,
+      .release = press->release,
+      .tap_hold = tap_hold[key] || tap_taps[key],
+      .meant_hold = meant_hold,
+    };
+  }
+  return physical;
+}
+
+/*
+ * Tap-hold
+ */
+
+enum { FLAVOR_DEFAULT = 0, FLAVOR_PERMISSIVE, FLAVOR_OTHER, FLAVOR_COUNT };
+
+static const char *flavor_names[] = { "default", "permissive", "other" };
+
+typedef struct {
+  int assignment;
+  int flavor;
+  int term;
+  // Results
+  long tap_holds, meant_holds, false_holds, false_taps;
+  long typed;
+  double latency;
+  long latencies[LATENCY_BINS];
+} tap_hold_setting_t;
+
+// Decide like QMK whether a tap-hold key is held, and when
+static bool decide(const physical_t *physical, size_t count, size_t index, int flavor, int term,
+                   double *decision) {
+  const physical_t *key = &physical[index];
+  double expiry = key->press + term;
+  bool held = key->release - key->press >= term;
+  *decision = held ? expiry : key->release;
+  if (flavor == FLAVOR_DEFAULT) {
+    return held;
+  }
+  double end = held ? expiry : key->release;
+  double first_release = end;
+  for (size_t j = index + 1; j < count && physical[j].press < end; j++) {
+    if (flavor == FLAVOR_OTHER) {
+      *decision = physical[j].press;
+      return true;
+    }
+    if (physical[j].release < first_release) {
+      first_release = physical[j].release;
+    }
+  }
+  if (first_release < end) {
+    *decision = first_release;
+    return true;
+  }
+  return held;
+}
+
+static void run_tap_hold(tap_hold_setting_t *setting, const physical_t *physical) {
+  // Keys pressed before a decision wait for it
+  double pending = 0;
+  for (size_t i = 0; i < press_count; i++) {
+    const physical_t *key = &physical[i];
+    double typed_at = key->press;
+    if (key->tap_hold) {
+      double decision;
+      bool held = decide(physical, press_count, i, setting->flavor, setting->term, &decision);
+      setting->tap_holds++;
+      setting->meant_holds += key->meant_hold;
+      setting->false_holds += held && !key->meant_hold;
+      setting->false_taps += !held && key->meant_hold;
+      if (decision > pending) {
+        pending = decision;
+      }
+      if (held) {
+        continue;
+      }
+      typed_at = decision;
+    } else if (key_mods[presses[i].key] != MOD_NONE) {
+      continue;
+    }
+    if (pending > typed_at) {
+      typed_at = pending;
+    }
+    double latency = typed_at - key->press;
+    int bin = latency < LATENCY_BINS - 1 ? (int)latency : LATENCY_BINS - 1;
+    setting->typed++;
+    setting->latency += latency;
+    setting->latencies[bin]++;
+  }
+}
+
+static int percentile(const long *bins, long total, double fraction) {
+  long seen = 0;
+  for (int i = 0; i < LATENCY_BINS; i++) {
+    seen += bins[i];
+    if (seen >= total * fraction) {
+      return i;
+    }
+  }
+  return LATENCY_BINS - 1;
+}
+
+/*
+ * Leader
+ */
+
+typedef struct {
+  uint16_t keys[LEADER_KEYS];
+  int length;
+} sequence_t;
+
+static sequence_t *sequences = NULL;
+static int sequence_count = 0;
+
+// The sequences of process_leader_sequence in the keymaps
+static const char *default_sequences[] = {
+  "A", "E", "I", "O", "U", "N",
+  "LSFT A", "LSFT E", "LSFT I", "LSFT O", "LSFT U", "LSFT N",
+  "A E", "O E", "O A", "LSFT A E", "LSFT O E", "LSFT O A",
+  "M 1", "M 2", "M 3", "M 4", "M S",
+};
+
+static bool add_sequence(char *keys) {
+  sequence_t sequence = { .length = 0 };
+  for (char *name = strtok(keys, " "); name; name = strtok(NULL, " ")) {
+    int key = key_id(name);
+    if (key < 0 || sequence.length == LEADER_KEYS) {
+      return false;
+    }
+    sequence.keys[sequence.length++] = key;
+  }
+  if (sequence.length == 0) {
+    return false;
+  }
+  sequences = realloc(sequences, (sequence_count + 1) * sizeof(sequence_t));
+  sequences[sequence_count++] = sequence;
+  return true;
+}
+
+// Read the sequences of a leader-dict dictionary, ignoring their text
+static bool read_dictionary(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[1024];
+  int number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    char *tab = strchr(line, '\t');
+    if (!tab) {
+      fprintf(stderr, "%s:%d: expected keys, a tab and a text\n", path, number);
+      fclose(file);
+      return false;
+    }
+    *tab = 0;
+    if (!add_sequence(line)) {
+      fprintf(stderr, "%s:%d: expected 1 to %d keys\n", path, number, LEADER_KEYS);
+      fclose(file);
+      return false;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// The length of the longest sequence typed after a leader key, 0 if none
+static int meant_sequence(size_t lead) {
+  int longest = 0;
+  for (int i = 0; i < sequence_count; i++) {
+    const sequence_t *sequence = &sequences[i];
+    if (sequence->length <= longest || lead + sequence->length >= press_count) {
+      continue;
+    }
+    int k = 0;
+    while (k < sequence->length && presses[lead + 1 + k].key == sequence->keys[k]) {
+      k++;
+    }
+    if (k == sequence->length) {
+      longest = k;
+    }
+  }
+  return longest;
+}
+
+typedef struct {
+  int timeout;
+  // Results
+  long sequences, exact, cut, overran;
+} leader_setting_t;
+
+static int *meant_lengths = NULL; // Of each leader press, 0 if not a sequence
+
+static void run_leader(leader_setting_t *setting) {
+  for (size_t i = 0; i < press_count; i++) {
+    if (presses[i].key != lead_key || meant_lengths[i] == 0) {
+      continue;
+    }
+    // With LEADER_PER_KEY_TIMING, every key restarts the timeout
+    int taken = 0;
+    double last = presses[i].press;
+    for (size_t j = i + 1; j < press_count && taken < LEADER_KEYS; j++) {
+      if (presses[j].press - last > setting->timeout) {
+        break;
+      }
+      last = presses[j].press;
+      taken++;
+    }
+    setting->sequences++;
+    setting->exact += taken == meant_lengths[i];
+    setting->cut += taken < meant_lengths[i];
+    setting->overran += taken > meant_lengths[i];
+  }
+}
+
+/*
+ * Sweep
+ */
+
+static tap_hold_setting_t *tap_hold_settings;
+static leader_setting_t *leader_settings;
+static int tap_hold_count = 0, leader_count = 0;
+static physical_t **placements; // The presses with each assignment
+static atomic_int next_setting = 0;
+
+static void *worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    int index = atomic_fetch_add(&next_setting, 1);
+    if (index < tap_hold_count) {
+      tap_hold_setting_t *setting = &tap_hold_settings[index];
+      run_tap_hold(setting, placements[setting->assignment]);
+    } else if (index < tap_hold_count + leader_count) {
+      run_leader(&leader_settings[index - tap_hold_count]);
+    } else {
+      return NULL;
+    }
+  }
+}
+
+// Parse a list of values and from:to:step ranges
+static int parse_values(char *text, int *values, int capacity) {
+  int count = 0;
+  for (char *item = strtok(text, ","); item; item = strtok(NULL, ",")) {
+    int from, to, step;
+    int fields = sscanf(item, "%d:%d:%d", &from, &to, &step);
+    if (fields == 1) {
+      to = from;
+      step = 1;
+    } else if (fields != 3 || step <= 0) {
+      return -1;
+    }
+    for (int value = from; value <= to; value += step) {
+      if (count == capacity || value <= 0) {
+        return -1;
+      }
+      values[count++] = value;
+    }
+  }
+  return count;
+}
+
+static double percent(long part, long total) {
+  return total ? 100.0 * part / total : 0;
+}
+
+int main(int argc, char **argv) {
+  char default_terms[] = "150:350:25", default_timeouts[] = "200:1000:100";
+  char default_flavors[] = "default,permissive,other", default_assignments[] = "moonlander,preonic";
+  char default_taps[] = "SPC,ENT";
+  char *terms_text = default_terms, *timeouts_text = default_timeouts;
+  char *flavors_text = default_flavors, *assignments_text = default_assignments;
+  char *taps_text = default_taps;
+  const char *dictionary = NULL;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:f:a:l:H:d:j:")) != -1) {
+    switch (opt) {
+      case 't':
+        terms_text = optarg;
+        break;
+      case 'f':
+        flavors_text = optarg;
+        break;
+      case 'a':
+        assignments_text = optarg;
+        break;
+      case 'l':
+        timeouts_text = optarg;
+        break;
+      case 'H':
+        taps_text = optarg;
+        break;
+      case 'd':
+        dictionary = optarg;
+        break;
+      case 'j':
+        threads = strtol(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-t terms] [-f flavors] [-a assignments] [-l timeouts]\n"
+                        "       %*s [-H keys] [-d dictionary] [-j threads] corpus...\n",
+                argv[0], (int)strlen(argv[0]), "");
+        return 2;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, "no corpus given\n");
+    return 2;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  init_keys();
+
+  int terms[MAX_SETTINGS], timeouts[MAX_SETTINGS];
+  int term_count = parse_values(terms_text, terms, MAX_SETTINGS);
+  int timeout_count = parse_values(timeouts_text, timeouts, MAX_SETTINGS);
+  if (term_count <= 0 || timeout_count <= 0) {
+    fprintf(stderr, "bad list of terms or timeouts\n");
+    return 2;
+  }
+  int flavors[FLAVOR_COUNT], flavor_count = 0;
+  for (char *name = strtok(flavors_text, ","); name; name = strtok(NULL, ",")) {
+    int flavor = 0;
+    while (flavor < FLAVOR_COUNT && strcmp(name, flavor_names[flavor]) != 0) {
+      flavor++;
+    }
+    if (flavor == FLAVOR_COUNT || flavor_count == FLAVOR_COUNT) {
+      fprintf(stderr, "unknown flavor %s\n", name);
+      return 2;
+    }
+    flavors[flavor_count++] = flavor;
+  }
+  assignment_t assignments[16];
+  int assignment_count = 0;
+  for (char *name = strtok(assignments_text, ","); name; name = strtok(NULL, ",")) {
+    if (assignment_count == 16 || !parse_assignment(name, &assignments[assignment_count])) {
+      fprintf(stderr, "bad assignment %s\n", name);
+      return 2;
+    }
+    assignment_count++;
+  }
+  bool tap_taps[MAX_KEYS] = { false };
+  for (char *name = strtok(taps_text, ","); name; name = strtok(NULL, ",")) {
+    int key = key_id(name);
+    if (key < 0) {
+      fprintf(stderr, "bad key %s\n", name);
+      return 2;
+    }
+    tap_taps[key] = true;
+  }
+  if (dictionary) {
+    if (!read_dictionary(dictionary)) {
+      return 1;
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(default_sequences) / sizeof(default_sequences[0]); i++) {
+      char keys[32];
+      snprintf(keys, sizeof(keys), "%s", default_sequences[i]);
+      add_sequence(keys);
+    }
+  }
+
+  double offset = 0;
+  for (int i = optind; i < argc; i++) {
+    double end = offset;
+    if (!read_corpus(argv[i], offset, &end)) {
+      return 1;
+    }
+    offset = end + CORPUS_GAP_MS;
+  }
+
+  placements = malloc(assignment_count * sizeof(physical_t *));
+  for (int i = 0; i < assignment_count; i++) {
+    placements[i] = place_presses(&assignments[i], tap_taps);
+  }
+  meant_lengths = calloc(press_count, sizeof(int));
+  for (size_t i = 0; i < press_count; i++) {
+    if (presses[i].key == lead_key) {
+      meant_lengths[i] = meant_sequence(i);
+    }
+  }
+
+  tap_hold_settings = calloc((size_t)assignment_count * flavor_count * term_count, sizeof(tap_hold_setting_t));
+  for (int a = 0; a < assignment_count; a++) {
+    for (int f = 0; f < flavor_count; f++) {
+      for (int t = 0; t < term_count; t++) {
+        tap_hold_settings[tap_hold_count++] = (tap_hold_setting_t){
+          .assignment = a, .flavor = flavors[f], .term = terms[t]
+        };
+      }
+    }
+  }
+  leader_settings = calloc(timeout_count, sizeof(leader_setting_t));
+  for (int i = 0; i < timeout_count; i++) {
+    leader_settings[leader_count++] = (leader_setting_t){ .timeout = timeouts[i] };
+  }
+
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  for (long i = 0; i < threads; i++) {
+    pthread_create(&workers[i], NULL, worker, NULL);
+  }
+  for (long i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  printf("%zu key presses in %d corpora, %ld meant as home row mods, %ld leader sequences\n\n",
+         press_count, argc - optind, tap_hold_count ? tap_hold_settings[0].meant_holds : 0,
+         leader_count ? leader_settings[0].sequences : 0);
+
+  printf("%-10s %-10s %5s %12s %12s %12s %9s %9s\n", "mods", "flavor", "term", "false holds",
+         "false taps", "misfires", "latency", "p95");
+  for (int i = 0; i < tap_hold_count; i++) {
+    const tap_hold_setting_t *setting = &tap_hold_settings[i];
+    long meant_taps = setting->tap_holds - setting->meant_holds;
+    printf("%-10s %-10s %5d %11.2f%% %11.2f%% %11.2f%% %6.1f ms %6d ms\n",
+           assignments[setting->assignment].name, flavor_names[setting->flavor], setting->term,
+           percent(setting->false_holds, meant_taps), percent(setting->false_taps, setting->meant_holds),
+           percent(setting->false_holds + setting->false_taps, setting->tap_holds),
+           setting->typed ? setting->latency / setting->typed : 0,
+           percentile(setting->latencies, setting->typed, 0.95));
+  }
+
+  printf("\n%-8s %10s %10s %10s\n", "timeout", "exact", "cut", "overran");
+  for (int i = 0; i < leader_count; i++) {
+    const leader_setting_t *setting = &leader_settings[i];
+    printf("%5d ms %9.2f%% %9.2f%% %9.2f%%\n", setting->timeout,
+           percent(setting->exact, setting->sequences), percent(setting->cut, setting->sequences),
+           percent(setting->overran, setting->sequences));
+  }
+  return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Check that the persistent state of the keymaps survives a power loss at any
+ * point of a save
+ *
+ * Usage: user-store-sim [-n saves] [-s seq] [-v]
+ *
+ *   -n saves  The number of saves in a row (64 by default, enough to go round
+ *             the log a few times)
+ *   -s seq    The sequence number of the first save (1 by default, try 65530
+ *             to wrap it around)
+ *   -v        Print every power loss and the state brought back
+ *
+ * Runs the log of the persistent state (common/user_store.c, built as is) over
+ * an emulated EEPROM, erased to 0xFF (like the AVR EEPROM) and to 0x00 (like
+ * flash with the wear leveling of QMK). A save only writes the bytes that change, one at a time, so for every
+ * save it cuts the power before each of those writes, with the byte being
+ * written left as it was, erased to 0xFF or 0x00, or half written. It then
+ * reboots, checks that the state brought back is the one saved or the one
+ * before it (none before the first save), saves another state, reboots again
+ * and checks that this one comes back. Prints the number of power losses
+ * tried, and exits with 1 if any of them brought back another state.
+ */
+
+#include "user_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The EEPROM, and the writes left before the power goes (-1 for ever). The
+// write the power is lost in leaves its byte as given by torn.
+typedef enum {
+  TORN_OLD,    // Not written at all
+  TORN_ERASED, // Erased to 0xFF, but not programmed
+  TORN_ZEROED, // Cleared to 0x00, but not programmed
+  TORN_HALF,   // The high nibble written, not the low one
+  TORN_COUNT
+} torn_t;
+
+static const char *torn_names[] = { "old", "0xff", "0x00", "half" };
+
+static uint8_t eeprom[USER_STORE_SIZE];
+static long writes_left = -1;
+static torn_t torn = TORN_OLD;
+static long writes = 0; // Bytes written since the last reset of the counter
+
+// Like eeprom_update_block: only the bytes that change are written, in order
+void eeconfig_update_user_datablock(const void *data, uint32_t offset, uint32_t size) {
+  const uint8_t *bytes = data;
+  for (uint32_t i = 0; i < size; i++) {
+    uint8_t *cell = &eeprom[offset + i];
+    if (*cell == bytes[i] || writes_left == 0) {
+      continue;
+    }
+    writes++;
+    if (writes_left > 0 && --writes_left == 0) {
+      switch (torn) {
+        case TORN_OLD:
+          break;
+        case TORN_ERASED:
+          *cell = 0xFF;
+          break;
+        case TORN_ZEROED:
+          *cell = 0x00;
+          break;
+        default:
+          *cell = (bytes[i] & 0xF0) | (*cell & 0x0F);
+          break;
+      }
+      continue;
+    }
+    *cell = bytes[i];
+  }
+}
+
+void eeconfig_read_user_datablock(void *data, uint32_t offset, uint32_t size) {
+  memcpy(data, &eeprom[offset], size);
+}
+
+// Saves are made right away below, so time does not matter
+uint32_t timer_read32(void) {
+  return 0;
+}
+
+uint32_t timer_elapsed32(uint32_t last) {
+  return -last;
+}
+
+// The state of the keymap, as last brought back by user_store_restore
+static user_state_t applied;
+
+void user_store_collect(user_state_t *state) {
+  *state = applied;
+}
+
+void user_store_apply(const user_state_t *state) {
+  applied = *state;
+}
+
+// Boot: find the latest valid slot, returning whether there was one
+static bool reboot(user_state_t *state) {
+  memset(&applied, 0, sizeof(applied));
+  bool found = user_store_restore();
+  *state = applied;
+  return found;
+}
+
+// The state of the n-th save, different from the one before. The reserved
+// bytes stay zero, like in the firmware.
+static user_state_t state_of(int n) {
+  user_state_t state = { .values = { n % 4, n / 4 % 2, n * 3 % 11 } };
+  return state;
+}
+
+static void print_state(const char *label, bool valid, const user_state_t *state) {
+  if (valid) {
+    printf("%s", label);
+    for (int i = 0; i < USER_STATE_SIZE; i++) {
+      printf(" %u", state->values[i]);
+    }
+  } else {
+    printf("%s none", label);
+  }
+}
+
+// Cut every save of a run in every way, from an EEPROM erased to a value.
+// Returns the number of power losses that brought back a wrong state.
+static int run(uint8_t erased, int saves, uint16_t first_seq, bool verbose, long *losses) {
+  memset(eeprom, erased, sizeof(eeprom));
+  user_state_t previous;
+  bool has_previous = reboot(&previous);
+  if (has_previous) {
+    fprintf(stderr, "an EEPROM erased to 0x%02x has a valid slot\n", erased);
+    return 1;
+  }
+  user_store_seq = first_seq - 1;
+  int failures = 0;
+
+  for (int n = 0; n < saves; n++) {
+    user_state_t state = state_of(n);
+    uint8_t before[USER_STORE_SIZE];
+    memcpy(before, eeprom, sizeof(eeprom));
+    uint16_t seq = user_store_seq;
+    uint8_t slot = user_store_slot;
+
+    // The bytes the save writes
+    writes = 0;
+    user_store_save(&state);
+    long count = writes;
+
+    for (long cut = 1; cut <= count; cut++) {
+      for (torn_t mode = 0; mode < TORN_COUNT; mode++) {
+        memcpy(eeprom, before, sizeof(eeprom));
+        user_store_seq = seq;
+        user_store_slot = slot;
+        writes_left = cut;
+        torn = mode;
+        user_store_save(&state);
+        writes_left = -1;
+        (*losses)++;
+
+        user_state_t restored;
+        bool valid = reboot(&restored);
+        bool ok = (valid && memcmp(&restored, &state, sizeof(state)) == 0)
+                  || (valid == has_previous && (!valid || memcmp(&restored, &previous, sizeof(state)) == 0));
+
+        // The log must keep working after the reboot
+        user_state_t next = state_of(n + 1), again;
+        user_store_save(&next);
+        bool recovered = reboot(&again) && memcmp(&again, &next, sizeof(next)) == 0;
+
+        if (verbose || !ok || !recovered) {
+          printf("erased 0x%02x, save %d (seq %u), cut before write %ld of %ld, %s: ", erased, n, (uint16_t)(seq + 1), cut, count, torn_names[mode]);
+          print_state("restored", valid, &restored);
+          printf("%s%s\n", ok ? "" : "  WRONG STATE", recovered ? "" : "  NEXT SAVE LOST");
+        }
+        failures += !ok || !recovered;
+      }
+    }
+
+    // Then save for real, and carry on from a reboot
+    memcpy(eeprom, before, sizeof(eeprom));
+    user_store_seq = seq;
+    user_store_slot = slot;
+    user_store_save(&state);
+    has_previous = reboot(&previous);
+    if (!has_previous || memcmp(&previous, &state, sizeof(state)) != 0) {
+      printf("erased 0x%02x, save %d: not restored after a full save\n", erased, n);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  int saves = 64;
+  long first_seq = 1;
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+    switch (opt) {
+      case 'n':
+        saves = atoi(optarg);
+        break;
+      case 's':
+        first_seq = atol(optarg);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n saves] [-s seq] [-v]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (saves < 1 || first_seq < 0 || first_seq > 0xFFFF) {
+    fprintf(stderr, "the saves must be positive, and the sequence number 16 bits\n");
+    return 2;
+  }
+
+  long losses = 0;
+  int failures = run(0xFF, saves, first_seq, verbose, &losses);
+  failures += run(0x00, saves, first_seq, verbose, &losses);
+  printf("%d saves, %zu slots, %ld power losses, %d wrong\n", 2 * saves, USER_STORE_SLOTS, losses, failures);
+  if (failures > 0) {
+    fprintf(stderr, "%d power losses brought back a wrong state\n", failures);
+    return 1;
+  }
+  return 0;
+}